@@ -54,6 +54,57 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
   то контрольные суммы при передаче не будут вычисляться, и поле CRC16 будет 
   отсутствовать. При приеме поле CRC16 может отсутстовать, и оно будет 
   игнорироваться, если присутствует.
+
+  Для работы нескольких устройств на общей шине (например, RS-485) 
+  может быть включена адресация пакетов (см. binex_set_address). В этом случае
+  сразу после START передается байт адреса ADDR:
+  +--------------+-------+------+-------------------+--------+----------------+
+  |номер элемента|   0   |  1   | 2,3 (uint16, lsb) |  4..n  | n+1, n+2       |
+  +--------------+-------+------+-------------------+--------+----------------+
+  |  значение    | START | ADDR |    PACK_LEN       |  DATA  | CRC16          |
+  +--------------+-------+------+-------------------+--------+----------------+
+  Младшие 7 бит ADDR - адрес устройства, либо широковещательный адрес
+  BINEX_ADDRESS_BROADCAST. Старший бит (BINEX_ADDRESS_REPLY) установлен 
+  в пакетах, отправленных устройством, такие пакеты другими устройствами 
+  не принимаются. Пакеты с чужим адресом молча пропускаются. Байт ADDR 
+  экранируется и входит в расчет CRC16 так же, как и PACK_LEN.
+
+  Для зашумленных линий связи может быть включено помехоустойчивое 
+  кодирование кодом Рида-Соломона (см. binex_set_fec). В этом случае пакет
+  передается в виде двух кодовых слов:
+  +-------+---------------------------------+---------------------------------+
+  | START | [ADDR] PACK_LEN HDR_RS(2 байта) | DATA CRC16 RS(npar байт)        |
+  +-------+---------------------------------+---------------------------------+
+  Заголовок защищен 2 проверочными байтами (исправляется 1 ошибочный байт),
+  тело пакета вместе с CRC16 - npar проверочными байтами (исправляется 
+  npar/2 ошибочных байт). CRC16 вычисляется так же, как и без FEC, и 
+  проверяется уже после исправления ошибок. Экранирование применяется ко 
+  всем байтам после START, включая проверочные. Длина тела пакета вместе 
+  с CRC16 и проверочными байтами не должна превышать 255 байт, а при
+  приеме весь этот объем должен поместиться в буфер приемника.
+
+  Вместо START и экранирования может использоваться кадрирование COBS
+  (Consistent Overhead Byte Stuffing, см. binex_set_cobs):
+  +------+--------------------------------------+------+
+  | 0x00 | COBS([ADDR] DATA CRC16)              | 0x00 |
+  +------+--------------------------------------+------+
+  Кадр ограничен символами BINEX_COBS_DELIMITER, внутри кадра этот символ
+  не встречается. Каждый блок кадра начинается байтом кода N (1..255):
+  за ним следуют N-1 байт данных без нулей, а затем ноль, который
+  в линию не передается (кроме N = 255 и последнего блока кадра).
+  Поле PACK_LEN не передается - длина данных определяется по концу кадра,
+  CRC16 вычисляется так же, как и без COBS (в том числе по PACK_LEN).
+  Избыточность - 1 байт на каждые 254 байта кадра независимо от данных,
+  поэтому длина кадра определяется только длиной данных. Декодированный
+  кадр не длиннее закодированного, поэтому кадр может быть принят целиком
+  (например, по DMA) и декодирован на месте. COBS и FEC вместе
+  не используются.
+
+  Библиотека поддерживает несколько независимых каналов связи. Состояние
+  каждого канала хранится в структуре Binex_t, с которой работают функции
+  binex_rx_xxx/binex_tx_xxx. Функции binex_receiver, binex_transmit и т.д.
+  работают с экземпляром по умолчанию, вывод которого выполняется через
+  binex_tx_callback.
 ******************************************************************************/
 
 #ifndef __BINEX_LIB_H__
@@ -66,12 +117,45 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 //необходимо объявить define BINEX_CHECK_CRC
 #define BINEX_CHECK_CRC
 
+//Конфигурация проекта: в Bootloader-е поддержка FEC включается
+//опцией BOOTLOADER_USE_FEC. Утилиты хоста, собираемые без конфигурации
+//проекта, объявляют BINEX_NO_PROJECT_CONFIG и BINEX_USE_FEC при сборке
+#ifndef BINEX_NO_PROJECT_CONFIG
+#include "bootloader_project_config.h"
+#endif
+
+//Если нужна поддержка помехоустойчивого кодирования (FEC), то
+//необходимо объявить define BINEX_USE_FEC. Требует BINEX_CHECK_CRC.
+//Объявление должно быть одинаковым для всех модулей (от него зависит Binex_t)
+#if defined(BOOTLOADER_USE_FEC) && !defined(BINEX_USE_FEC)
+#define BINEX_USE_FEC
+#endif
+
+//Если нужна поддержка кадрирования COBS, то
+//необходимо объявить define BINEX_USE_COBS. Требует BINEX_CHECK_CRC.
+//В Bootloader-е включается опцией BOOTLOADER_USE_COBS
+#if defined(BOOTLOADER_USE_COBS) && !defined(BINEX_USE_COBS)
+#define BINEX_USE_COBS
+#endif
+
 //символ начала пакета
 #define BINEX_START_SYMBOL 0xF5
 
 //esc-символ
 #define BINEX_ESC_SYMBOL 0xF4
 
+//разделитель кадров COBS
+#define BINEX_COBS_DELIMITER 0x00
+
+//широковещательный адрес
+#define BINEX_ADDRESS_BROADCAST 0x7F
+
+//признак пакета, отправленного устройством
+#define BINEX_ADDRESS_REPLY 0x80
+
+//адресация отключена
+#define BINEX_ADDRESS_NONE 0xFF
+
 typedef enum
 {
   BINEX_PACK_NOT_RX = 0, //Пакет еще не принят
@@ -79,12 +163,156 @@ typedef enum
   BINEX_PACK_BROKEN = 2  //Пакет поврежден
 } BinexRxStatus_t;
 
+// Причина повреждения последнего пакета (BINEX_PACK_BROKEN)
+typedef enum
+{
+  BINEX_RX_ERR_NONE = 0,
+  BINEX_RX_ERR_FRAMING = 1, // START внутри пакета, недопустимая esc-последовательность
+  BINEX_RX_ERR_SIZE = 2,    // Пакет не помещается в буфер приемника
+  BINEX_RX_ERR_CRC = 3,     // Не совпала CRC16
+  BINEX_RX_ERR_FEC = 4      // Ошибки не исправляются кодом FEC
+} BinexRxError_t;
+
 typedef enum
 {
   BINEX_PACK_NOT_TX = 0, //Пакет еще не отправлен
   BINEX_PACK_TX = 1      //Пакет отправлен
 } BinexTxStatus_t;
 
+#ifdef BINEX_USE_FEC
+#include "rs-fec.h"
+#endif
+
+// Функция вывода символа в поток канала связи,
+// работает так же, как и binex_tx_callback
+typedef int (*BinexTxCallback_t)(void *arg, uint8_t c);
+
+// Состояние канала связи
+typedef struct
+{
+  // Приемник
+  uint8_t *receive_buffer;
+  size_t receive_buffer_size;
+  uint16_t rxpack_size;
+  uint16_t rxtmp;
+  uint8_t rxstate;
+  uint8_t flag_prev_rx_esc;
+  uint8_t rxpack_addr;
+  uint8_t rx_error;     // BinexRxError_t
+  uint8_t rx_corrected; // Исправлено байт FEC в последнем пакете
+
+  // Передатчик
+  uint8_t *txbuff;
+  uint16_t txpack_size;
+  uint16_t txtmp;
+  uint8_t txstate;
+  uint8_t flag_prev_tx_esc;
+#ifdef BINEX_CHECK_CRC
+  uint16_t tx_crc16;
+#endif
+
+  // Адресация
+  uint8_t address;
+  uint8_t flag_host;
+
+#ifdef BINEX_USE_FEC
+  uint8_t fec_npar;
+  uint8_t rx_hdr[5]; // [ADDR], PACK_LEN и 2 проверочных байта
+  uint8_t tx_hdr[5];
+  uint8_t tx_parity[RS_MAX_NPAR];
+#endif
+
+#ifdef BINEX_USE_COBS
+  uint8_t cobs;          // Кадрирование COBS
+  uint8_t rx_cobs_left;  // Осталось принять байт текущего блока
+  uint8_t rx_cobs_zero;  // Блок завершается нулем
+  uint16_t rx_cobs_tail; // Последние 2 принятых байта (CRC16)
+  uint8_t tx_cobs_code;  // Код текущего блока
+  uint16_t tx_cobs_end;  // Конец данных текущего блока
+#endif
+
+  BinexTxCallback_t tx_callback;
+  void *tx_arg;
+} Binex_t;
+
+/******************************************************************************
+  Функции для работы с произвольным каналом связи
+******************************************************************************/
+
+// Инициализация канала связи. tx_callback вызывается
+// с аргументом tx_arg для вывода каждого символа
+void binex_init(Binex_t *b, BinexTxCallback_t tx_callback, void *tx_arg);
+
+// Аналог binex_receiver_begin
+void binex_rx_begin(Binex_t *b, uint8_t *buff, size_t buff_size);
+
+// Аналог binex_receiver
+BinexRxStatus_t binex_rx(Binex_t *b, int16_t c);
+
+// Аналог binex_get_rxpack_len
+uint16_t binex_rx_len(Binex_t *b);
+
+// Аналог binex_get_rxpack_addr
+uint8_t binex_rx_addr(Binex_t *b);
+
+// Аналог binex_get_rx_error
+uint8_t binex_rx_error(Binex_t *b);
+
+// Аналог binex_get_rx_corrected
+uint8_t binex_rx_corrected(Binex_t *b);
+
+// Аналог binex_set_address, канал работает как устройство:
+// принимает пакеты со своим и широковещательным адресом,
+// отправляет пакеты с признаком BINEX_ADDRESS_REPLY
+void binex_address_set(Binex_t *b, uint8_t addr);
+
+// Канал работает как хост: пакеты отправляются устройству
+// с адресом addr (в том числе широковещательно), принимаются
+// ответы любых устройств, адрес ответившего - binex_rx_addr
+void binex_host_address_set(Binex_t *b, uint8_t addr);
+
+#ifdef BINEX_USE_FEC
+// Аналог binex_set_fec
+uint8_t binex_fec_set(Binex_t *b, uint8_t npar);
+
+// Аналог binex_get_fec
+uint8_t binex_fec_get(Binex_t *b);
+#endif
+
+#ifdef BINEX_USE_COBS
+// Аналог binex_set_cobs
+uint8_t binex_cobs_set(Binex_t *b, uint8_t enable);
+
+// Аналог binex_get_cobs
+uint8_t binex_cobs_get(Binex_t *b);
+
+// Декодирование на месте кадра COBS, принятого целиком (например,
+// по DMA до разделителя) - без посимвольного приемника binex_rx.
+// buf, len - кадр без разделителей BINEX_COBS_DELIMITER. Данные пакета
+// записываются в начало buf (адрес и CRC16 отбрасываются), длина -
+// binex_rx_len, адрес - binex_rx_addr. Адресация, как и у binex_rx,
+// задается binex_address_set/binex_host_address_set, режим COBS
+// канала (binex_cobs_set) не требуется, буфер приемника не используется.
+// Возвращает:
+//   BINEX_PACK_RX - пакет принят
+//   BINEX_PACK_BROKEN - ошибка кадра либо CRC16 (binex_rx_error)
+//   BINEX_PACK_NOT_RX - пустой кадр либо пакет адресован не нам
+// Bootloader принимает символы по одному (port_serial_getc) и
+// использует binex_rx, эта функция - для портов с приемом кадра
+// целиком (в buffer_exch) и утилит хоста
+BinexRxStatus_t binex_cobs_decode(Binex_t *b, uint8_t *buf, uint16_t len);
+#endif
+
+// Аналог binex_transmitter_init
+uint8_t binex_tx_init(Binex_t *b, void *buff, uint16_t size);
+
+// Аналог binex_transmit
+BinexTxStatus_t binex_tx(Binex_t *b);
+
+/******************************************************************************
+  Функции для работы с каналом связи по умолчанию
+******************************************************************************/
+
 
 //Буфер приемника, его размер равен BINEX_BUFFER_SIZE
 extern uint8_t binex_receive_buffer[];
@@ -105,8 +333,56 @@ BinexRxStatus_t binex_receiver(int16_t c);
 //Получить длину принятого пакета
 uint16_t binex_get_rxpack_len(void);
 
-// Инициализация процесса передачи буфера
-void binex_transmitter_init(void *buff, uint16_t size);
+// Включить адресацию пакетов и задать адрес устройства
+// (0x00..0x7E). Значение BINEX_ADDRESS_NONE отключает адресацию
+void binex_set_address(uint8_t addr);
+
+// Получить адрес принятого пакета: адрес устройства,
+// либо BINEX_ADDRESS_BROADCAST. Если адресация отключена,
+// то возвращается BINEX_ADDRESS_NONE
+uint8_t binex_get_rxpack_addr(void);
+
+// Получить причину повреждения последнего пакета, для
+// которого binex_receiver вернула BINEX_PACK_BROKEN (BinexRxError_t)
+uint8_t binex_get_rx_error(void);
+
+// Получить количество байт, исправленных кодом FEC
+// в последнем пакете (0 - FEC отключен либо ошибок не было)
+uint8_t binex_get_rx_corrected(void);
+
+#ifdef BINEX_USE_FEC
+// Включить помехоустойчивое кодирование пакетов.
+// npar - количество проверочных байт тела пакета,
+// четное число от 2 до RS_MAX_NPAR, 0 - FEC отключен
+// Возвращает:
+//   0 - OK
+//   1 - недопустимое значение npar, либо включен COBS
+uint8_t binex_set_fec(uint8_t npar);
+
+// Получить текущее количество проверочных байт (0 - FEC отключен)
+uint8_t binex_get_fec(void);
+#endif
+
+#ifdef BINEX_USE_COBS
+// Включить (enable = 1) либо выключить кадрирование COBS.
+// Действует с начала следующего пакета, приемник
+// должен быть переинициализирован (binex_receiver_begin)
+// Возвращает:
+//   0 - OK
+//   1 - включен FEC
+uint8_t binex_set_cobs(uint8_t enable);
+
+// Получить текущий режим кадрирования (1 - COBS)
+uint8_t binex_get_cobs(void);
+#endif
+
+// Инициализация процесса передачи буфера.
+// Возвращает:
+//   0 - OK
+//   1 - пакет не помещается в кодовое слово FEC
+//       (size + 2 + npar > 255), пакет не передается:
+//       binex_transmit сразу возвращает BINEX_PACK_TX
+uint8_t binex_transmitter_init(void *buff, uint16_t size);
 
 // Сам процесс передачи буфера. Эту функцию 
 // нужно вызывать до тех пор, пока она не вернет
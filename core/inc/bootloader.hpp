@@ -0,0 +1,712 @@
+#ifndef BOOTLOADER_HPP
+#define BOOTLOADER_HPP
+
+/*
+  Ядро Bootloader-а на C++17 для базового протокола: ACTIVATE, BEGIN,
+  SEND, WRITE, END, CHECK_CRC, APP_RUN, GET_INFO, без необязательных
+  функций BOOTLOADER_USE_xxx. Запросы, ответы и тайминги - как у ядра
+  на C (core/src/bootloader.c), сверка - make cpp-test в project/posix-sim.
+
+  Параметры шаблона Core:
+  - Config - конфигурация, constexpr члены класса. ProjectConfig берет
+    их из bootloader_config.h. Набор команд Config::commands задается
+    при компиляции, обработчики выключенных команд в образ не попадают,
+    ошибка конфигурации - static_assert
+  - Port - порт, класс со статическими функциями. CPort вызывает функции
+    bootloader_port.h, порт с inline функциями встраивается в ядро.
+    Функции порта на C встраиваются при сборке модуля ядра вместе с ними
+    (многофайловая компиляция IAR --mfc, gcc -flto)
+
+  Ядро собирается в одном модуле проекта вместо bootloader.c:
+    using BootCore = bootloader::Core<>;
+    BOOTLOADER_CORE_UNIT(BootCore)
+  Модуль определяет InitBootloader, ProcessBootloader и binex_tx_callback
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+extern "C" {
+#include "binex-lib.h"
+#include "bootloader.h"
+#include "bootloader_port.h"
+#include "crc16.h"
+#include "monocypher.h"
+#include "systick.h"
+#include "utils.h"
+}
+
+#include "bootloader_config.h"
+
+#if defined(BOOTLOADER_USE_JOURNAL) || defined(BOOTLOADER_USE_SPARSE) || defined(BOOTLOADER_USE_DELTA) || \
+    defined(BOOTLOADER_USE_SECTOR_CACHE) || defined(BOOTLOADER_USE_BROADCAST) || defined(BOOTLOADER_USE_FEC) || \
+    defined(BOOTLOADER_USE_COBS) || defined(BOOTLOADER_USE_ADDRESSING) || defined(BOOTLOADER_USE_STATS) ||      \
+    defined(BOOTLOADER_USE_TRACE) || defined(BOOTLOADER_USE_LINK_TEST) || defined(BOOTLOADER_USE_RELAY) ||      \
+    defined(BOOTLOADER_USE_USER_DATA)
+#error "bootloader.hpp supports the base protocol only, use core/src/bootloader.c with BOOTLOADER_USE_xxx"
+#endif
+
+namespace bootloader
+{
+
+/*
+  Команды (CMD_xxx в bootloader.c)
+*/
+namespace cmd
+{
+constexpr uint8_t Activate = 0x70;
+constexpr uint8_t Begin = 0x71;
+constexpr uint8_t Send = 0x72;
+constexpr uint8_t Write = 0x73;
+constexpr uint8_t End = 0x74;
+constexpr uint8_t CheckCrc = 0x75;
+constexpr uint8_t AppRun = 0x76;
+constexpr uint8_t GetInfo = 0x86;
+} // namespace cmd
+
+namespace status
+{
+constexpr uint8_t Ok = 0x00;
+constexpr uint8_t Error = 0x01;
+constexpr uint8_t WrongState = 0x02;
+constexpr uint8_t Event = 0xFF;
+} // namespace status
+
+// Бит команды в наборе Config::commands и в карте команд GET_INFO
+constexpr uint32_t commandBit(uint8_t c)
+{
+  return 1UL << (c - cmd::Activate);
+}
+
+// Без этих команд обновление невозможно
+constexpr uint32_t kRequiredCommands = commandBit(cmd::Activate) | commandBit(cmd::Begin) | commandBit(cmd::Send) |
+                                       commandBit(cmd::Write) | commandBit(cmd::End);
+
+constexpr uint32_t kAllCommands = kRequiredCommands | commandBit(cmd::CheckCrc) | commandBit(cmd::AppRun) |
+                                  commandBit(cmd::GetInfo);
+
+constexpr uint8_t kNonceSize = 24;
+
+#pragma pack(push, 1)
+template <uint8_t N>
+struct FwChunk
+{
+  uint32_t address;
+  uint8_t len;
+  uint8_t nonce[kNonceSize];
+  uint8_t ciphertext[N];
+  uint8_t tag[MAC_SIZE];
+};
+#pragma pack(pop)
+
+constexpr size_t constStrlen(const char *s)
+{
+  size_t n = 0;
+
+  while (s[n] != 0)
+    n++;
+  return n;
+}
+
+namespace keys
+{
+#include "private_keys.inc"
+} // namespace keys
+
+/*
+  Конфигурация проекта: bootloader_config.h
+*/
+struct ProjectConfig
+{
+  static constexpr uint32_t app_begin = BOOTLOADER_APP_BEGIN;
+  static constexpr uint32_t app_length = BOOTLOADER_APP_LENGTH;
+  static constexpr uint32_t sector_size = BOOTLOADER_FLASH_SECTOR_SIZE;
+  static constexpr uint8_t chunk_data_size = CHUNK_DATA_SIZE;
+  static constexpr uint16_t buffer_size = BUFFER_EXCH_SIZE;
+  static constexpr uint32_t uart_baud = BOOTLOADER_UART_BAUD;
+#ifdef BOOTLOADER_RX_FIFO_SIZE
+  static constexpr uint16_t rx_fifo_size = BOOTLOADER_RX_FIFO_SIZE;
+#else
+  static constexpr uint16_t rx_fifo_size = 0; // не сообщается в GET_INFO
+#endif
+  static constexpr uint32_t response_delay_ms = BOOTLOADER_RESPONSE_DELAY_MS;
+  static constexpr uint32_t timeout_ms = BOOTLOADER_TIMEOUT_MS;
+  static constexpr uint32_t erase_event_interval_ms = BOOTLOADER_ERASE_EVENT_INTERVAL_MS;
+  static constexpr uint32_t commands = kAllCommands;
+  static constexpr const char *device_id = BOOTLOADER_DEVICE_ID_STRING;
+  static constexpr const uint8_t *encryption_key = keys::EncryptionKey;
+  static constexpr const uint8_t *integrity_key = keys::IntegrityKey;
+};
+
+// Раскладка чанка совпадает с файлом обновления (FW_CHUNK_SIZE)
+static_assert(sizeof(FwChunk<CHUNK_DATA_SIZE>) == FW_CHUNK_SIZE, "fw chunk layout");
+
+/*
+  Порт - функции bootloader_port.h и время systick.h
+*/
+struct CPort
+{
+  static int16_t serialGetc() { return port_serial_getc(); }
+  static int16_t serialPutc(uint8_t c) { return port_serial_putc(c); }
+  static bool serialTransferCompleted() { return port_serial_transfer_completed() != 0; }
+  static bool sectorIsClear(uint32_t address) { return port_sector_isclear(address) != 0; }
+  static void sectorErase(uint32_t address) { port_sector_erase(address); }
+  static uint8_t writeChunk(uint8_t *data, uint32_t address, uint16_t len)
+  {
+    return port_write_chunk(data, address, len);
+  }
+  static void appRun()
+  {
+    port_deinit_all();
+    port_application_run();
+  }
+  static uint32_t millis() { return SYSTICK_GET_VALUE(); }
+};
+
+template <class Config = ProjectConfig, class Port = CPort>
+class Core
+{
+public:
+  static void init();
+  static void process();
+
+  // Вывод экземпляра binex по умолчанию (binex_tx_callback)
+  static int txCallback(uint8_t c) { return Port::serialPutc(c) == c; }
+
+private:
+  using Chunk = FwChunk<Config::chunk_data_size>;
+
+  static constexpr uint32_t kAppEnd = Config::app_begin + Config::app_length;
+  static constexpr size_t kDeviceIdLen = constStrlen(Config::device_id);
+
+  static_assert((Config::commands & kRequiredCommands) == kRequiredCommands, "ACTIVATE, BEGIN, SEND, WRITE and END are required");
+  static_assert((Config::commands & ~kAllCommands) == 0, "command is not supported by bootloader.hpp");
+  static_assert(Config::chunk_data_size != 0, "chunk_data_size is zero");
+  static_assert(sizeof(Chunk) == 4 + 1 + kNonceSize + Config::chunk_data_size + MAC_SIZE, "fw chunk layout");
+  static_assert(1 + sizeof(Chunk) <= Config::buffer_size, "chunk does not fit buffer_size");
+  static_assert((Config::sector_size % 4) == 0, "sector_size must be a multiple of 4");
+  static_assert(((Config::app_begin % Config::sector_size) == 0) && ((Config::app_length % Config::sector_size) == 0),
+                "application region is not sector aligned");
+  static_assert(Config::app_length > MAC_SIZE, "app_length is too small");
+  static_assert(kDeviceIdLen <= Config::chunk_data_size, "device_id does not fit identity chunk");
+
+  enum State : uint8_t
+  {
+    Main,
+    RxWait,
+    Begin,
+    FlashClear,
+    AppRun,
+    AppRun1,
+    AppRun2,
+    SendResp,
+    SendResp1
+  };
+
+  static constexpr bool has(uint8_t c) { return (Config::commands & commandBit(c)) != 0; }
+
+  static bool elapsed(uint32_t since, uint32_t ms) { return (Port::millis() - since) >= ms; }
+
+  // Ответ [command][status][данные в buffer_ + 2], len - длина ответа
+  static void respond(uint8_t command, uint8_t status, uint16_t len = 2)
+  {
+    buffer_[0] = command;
+    buffer_[1] = status;
+    binex_transmitter_init(buffer_, len);
+    state_ = SendResp;
+  }
+
+  static bool appMacCheck();
+  static bool decryptAndVerify(const Chunk *chunk);
+  static bool identityChunkValid();
+  static bool decryptChunk();
+  static bool writeData();
+  static uint16_t infoBuild();
+  static bool eraseEventPump();
+  static void eraseEvent(uint32_t block);
+  static void parseCommand();
+  static void checkCrc();
+  static void appRunCommand();
+
+  inline static uint8_t state_, state_prev_;
+  inline static bool activated_;
+  inline static bool firmware_valid_;
+  inline static bool begin_;
+  inline static uint32_t adr_counter_;
+  inline static uint32_t timer_;
+  inline static bool erase_error_;
+  inline static uint8_t erase_event_[10];
+  inline static bool erase_event_tx_;
+  inline static uint32_t erase_event_timer_;
+  inline static uint32_t boot_timer_;
+  inline static uint8_t buffer_[Config::buffer_size];
+  inline static uint8_t data_[Config::chunk_data_size];
+  inline static uint8_t data_len_;
+  inline static uint32_t data_address_;
+  inline static bool data_set_;
+};
+
+/******************************************************************************/
+
+/*
+  Проверка MAC прошивки в области приложения
+*/
+template <class Config, class Port>
+bool Core<Config, Port>::appMacCheck()
+{
+  const uint8_t *flash_begin = (const uint8_t *)Config::app_begin;
+  const uint8_t *flash_mac = (const uint8_t *)(kAppEnd - MAC_SIZE);
+  uint8_t calc_mac[MAC_SIZE];
+
+  crypto_poly1305(calc_mac, flash_begin, Config::app_length - MAC_SIZE, Config::integrity_key);
+  return crypto_verify16(calc_mac, flash_mac) == 0;
+}
+
+/*
+  Расшифровка чанка в data_, AAD - address (LE) и len
+*/
+template <class Config, class Port>
+bool Core<Config, Port>::decryptAndVerify(const Chunk *chunk)
+{
+  uint8_t aad[5];
+
+  UInt32ToBuff(aad, chunk->address);
+  aad[4] = chunk->len;
+
+  if (crypto_aead_unlock(data_, chunk->tag, Config::encryption_key, chunk->nonce, aad, sizeof(aad),
+                         chunk->ciphertext, Config::chunk_data_size) != 0)
+  {
+    crypto_wipe(data_, Config::chunk_data_size);
+    return false;
+  }
+  return true;
+}
+
+/*
+  Идентификационный чанк BEGIN: address - длина области приложения,
+  текст - Config::device_id, дополненный нулями
+*/
+template <class Config, class Port>
+bool Core<Config, Port>::identityChunkValid()
+{
+  const Chunk *chunk = (const Chunk *)(buffer_ + 1);
+
+  if ((chunk->len != Config::chunk_data_size) || (chunk->address != Config::app_length))
+    return false;
+
+  if (!decryptAndVerify(chunk))
+    return false;
+
+  for (size_t i = 0; i < Config::chunk_data_size; i++)
+  {
+    if (data_[i] != ((i < kDeviceIdLen) ? (uint8_t)Config::device_id[i] : 0))
+      return false;
+  }
+  return true;
+}
+
+template <class Config, class Port>
+bool Core<Config, Port>::decryptChunk()
+{
+  const Chunk *chunk = (const Chunk *)(buffer_ + 1);
+
+  data_set_ = false;
+  if ((chunk->len == 0) || (chunk->len > Config::chunk_data_size))
+    return false;
+
+  if (!decryptAndVerify(chunk))
+    return false;
+
+  data_len_ = chunk->len;
+  data_address_ = chunk->address;
+  if ((data_address_ < Config::app_begin) || ((data_address_ + data_len_) > kAppEnd))
+    return false;
+
+  data_set_ = true;
+  return true;
+}
+
+/*
+  Запись расшифрованного чанка, совпадающие с flash данные не пишутся
+*/
+template <class Config, class Port>
+bool Core<Config, Port>::writeData()
+{
+  if (memcmp((const uint8_t *)(uintptr_t)data_address_, data_, data_len_) == 0)
+    return true;
+
+  return Port::writeChunk(data_, data_address_, data_len_) == 0;
+}
+
+/*
+  Ответ GET_INFO (записи TLV, см. __info_build в bootloader.c)
+*/
+template <class Config, class Port>
+uint16_t Core<Config, Port>::infoBuild()
+{
+  uint8_t *p = buffer_;
+
+  *p++ = cmd::GetInfo;
+  *p++ = status::Ok;
+  *p++ = 1; // INFO_VERSION
+
+  *p++ = 0x01; // INFO_COMMANDS
+  *p++ = 4;
+  UInt32ToBuff(p, Config::commands);
+  p += 4;
+
+  *p++ = 0x02; // INFO_MAX_FRAME
+  *p++ = 2;
+  UInt16ToBuff(p, Config::buffer_size);
+  p += 2;
+
+  *p++ = 0x03; // INFO_CHUNK_SIZES
+  *p++ = 1;
+  *p++ = Config::chunk_data_size;
+
+  if constexpr (Config::rx_fifo_size != 0)
+  {
+    *p++ = 0x04; // INFO_RX_FIFO
+    *p++ = 2;
+    UInt16ToBuff(p, Config::rx_fifo_size);
+    p += 2;
+  }
+
+  *p++ = 0x05; // INFO_SECTOR_SIZE
+  *p++ = 4;
+  UInt32ToBuff(p, Config::sector_size);
+  p += 4;
+
+  *p++ = 0x06; // INFO_APP_REGION
+  *p++ = 8;
+  UInt32ToBuff(p, Config::app_begin);
+  UInt32ToBuff(p + 4, Config::app_length);
+  p += 8;
+
+  *p++ = 0x07; // INFO_RESP_DELAY
+  *p++ = 2;
+  UInt16ToBuff(p, Config::response_delay_ms);
+  p += 2;
+
+  *p++ = 0x08; // INFO_BAUD_RATES
+  *p++ = 4;
+  UInt32ToBuff(p, Config::uart_baud);
+  p += 4;
+
+  *p++ = 0x0A; // INFO_FEATURES
+  *p++ = 4;
+  UInt32ToBuff(p, 0);
+  p += 4;
+
+  *p++ = 0x0B; // INFO_FIRMWARE
+  *p++ = 1 + MAC_SIZE;
+  *p++ = firmware_valid_;
+  memcpy(p, (const uint8_t *)(kAppEnd - MAC_SIZE), MAC_SIZE);
+  p += MAC_SIZE;
+
+  constexpr uint8_t id_len = (kDeviceIdLen < 32) ? kDeviceIdLen : 32;
+  *p++ = 0x0C; // INFO_DEVICE_ID
+  *p++ = id_len;
+  memcpy(p, Config::device_id, id_len);
+  p += id_len;
+
+  return p - buffer_;
+}
+
+/*
+  Передача события о ходе очистки flash.
+  Возвращает true, пока событие передается
+*/
+template <class Config, class Port>
+bool Core<Config, Port>::eraseEventPump()
+{
+  if (erase_event_tx_ && (binex_transmit() == BINEX_PACK_TX))
+    erase_event_tx_ = false;
+
+  return erase_event_tx_ || !Port::serialTransferCompleted();
+}
+
+template <class Config, class Port>
+void Core<Config, Port>::eraseEvent(uint32_t block)
+{
+  if (erase_event_tx_ || !elapsed(erase_event_timer_, Config::erase_event_interval_ms))
+    return;
+
+  erase_event_timer_ = Port::millis();
+  erase_event_[0] = cmd::Begin;
+  erase_event_[1] = status::Event;
+  UInt32ToBuff(erase_event_ + 2, Config::app_length / Config::sector_size);
+  UInt32ToBuff(erase_event_ + 6, block);
+  binex_transmitter_init(erase_event_, sizeof(erase_event_));
+  erase_event_tx_ = true;
+  eraseEventPump();
+}
+
+template <class Config, class Port>
+void Core<Config, Port>::checkCrc()
+{
+  if (begin_)
+  {
+    respond(cmd::CheckCrc, status::WrongState);
+    return;
+  }
+
+  firmware_valid_ = appMacCheck();
+  respond(cmd::CheckCrc, firmware_valid_ ? status::Ok : status::Error);
+}
+
+template <class Config, class Port>
+void Core<Config, Port>::appRunCommand()
+{
+  if (begin_)
+  {
+    respond(cmd::AppRun, status::WrongState);
+    return;
+  }
+
+  if (!appMacCheck())
+  {
+    firmware_valid_ = false;
+    respond(cmd::AppRun, status::Error);
+    return;
+  }
+
+  // Приложение запускается после передачи ответа
+  respond(cmd::AppRun, status::Ok);
+  state_ = AppRun;
+}
+
+template <class Config, class Port>
+void Core<Config, Port>::parseCommand()
+{
+  uint16_t len = binex_get_rxpack_len();
+  uint8_t command = buffer_[0];
+
+  if (len == 0)
+  {
+    state_ = Main;
+    return;
+  }
+
+  // Команды, кроме ACTIVATE и GET_INFO, - только после активации
+  if (!activated_ && (command != cmd::Activate) && (command != cmd::GetInfo))
+  {
+    if ((command >= cmd::Activate) && (command <= cmd::AppRun) &&
+        ((command <= cmd::End) || has(command)))
+      state_ = Main;
+    return;
+  }
+
+  switch (command)
+  {
+  case cmd::Activate:
+  {
+    static const uint8_t activate_data[] = {'A', 'C', 'T', 'I', 'V', 'A', 'T', 'E'};
+
+    // [cmd][ACTIVATE] либо [cmd][ACTIVATE][режим кадрирования]
+    if (((len != 1 + sizeof(activate_data)) && (len != 2 + sizeof(activate_data))) ||
+        (memcmp(buffer_ + 1, activate_data, sizeof(activate_data)) != 0))
+    {
+      state_ = Main;
+      break;
+    }
+
+    activated_ = true;
+    buffer_[2] = 0; // кадрирование binex
+    respond(cmd::Activate, status::Ok, (len == 2 + sizeof(activate_data)) ? 3 : 2);
+  }
+  break;
+
+  case cmd::Begin:
+    if (len != 1 + sizeof(Chunk))
+    {
+      state_ = Main;
+      break;
+    }
+
+    if (!identityChunkValid())
+    {
+      respond(cmd::Begin, status::WrongState);
+      break;
+    }
+
+    state_ = Begin;
+    break;
+
+  case cmd::Send:
+    if (len != 1 + sizeof(Chunk))
+    {
+      state_ = Main;
+      break;
+    }
+
+    respond(cmd::Send, decryptChunk() ? status::Ok : status::Error);
+    break;
+
+  case cmd::Write:
+    if (!begin_ || !data_set_)
+    {
+      respond(cmd::Write, status::WrongState);
+      break;
+    }
+
+    respond(cmd::Write, writeData() ? status::Ok : status::Error);
+    break;
+
+  case cmd::End:
+    begin_ = false;
+    respond(cmd::End, status::Ok);
+    break;
+
+  case cmd::CheckCrc:
+    if constexpr (has(cmd::CheckCrc))
+      checkCrc();
+    break;
+
+  case cmd::AppRun:
+    if constexpr (has(cmd::AppRun))
+      appRunCommand();
+    break;
+
+  case cmd::GetInfo:
+    if constexpr (has(cmd::GetInfo))
+    {
+      binex_transmitter_init(buffer_, infoBuild());
+      state_ = SendResp;
+    }
+    break;
+  }
+}
+
+template <class Config, class Port>
+void Core<Config, Port>::init()
+{
+  Crc16Init();
+
+  state_ = Main;
+  state_prev_ = state_ + 1;
+  begin_ = false;
+  data_set_ = false;
+  activated_ = false;
+  firmware_valid_ = appMacCheck();
+  boot_timer_ = Port::millis();
+}
+
+template <class Config, class Port>
+void Core<Config, Port>::process()
+{
+  bool entry = false;
+
+  if (state_prev_ != state_)
+  {
+    state_prev_ = state_;
+    entry = true;
+  }
+
+  switch (state_)
+  {
+  case Main:
+    binex_receiver_begin(buffer_, Config::buffer_size);
+    state_ = RxWait;
+    break;
+
+  case RxWait:
+    if (binex_receiver(Port::serialGetc()) == BINEX_PACK_RX)
+      parseCommand();
+
+    // Без активации запускается проверенная прошивка по истечении таймаута
+    if (!activated_ && firmware_valid_ && elapsed(boot_timer_, Config::timeout_ms))
+      Port::appRun();
+    break;
+
+  case Begin:
+    firmware_valid_ = false;
+    adr_counter_ = Config::app_begin;
+    erase_error_ = false;
+    erase_event_timer_ = Port::millis();
+    state_ = FlashClear;
+    break;
+
+  case FlashClear:
+  {
+    // Событие о ходе очистки передается между секторами
+    bool event_busy = eraseEventPump();
+
+    if (erase_error_)
+    {
+      if (event_busy)
+        break;
+      UInt32ToBuff(buffer_ + 2, (adr_counter_ - Config::app_begin) / Config::sector_size);
+      respond(cmd::Begin, status::Error, 6);
+      break;
+    }
+
+    if (adr_counter_ >= kAppEnd)
+    {
+      if (event_busy)
+        break;
+      begin_ = true;
+      data_set_ = false;
+      respond(cmd::Begin, status::Ok);
+      break;
+    }
+
+    if (!Port::sectorIsClear(adr_counter_))
+    {
+      if (event_busy)
+        break;
+      Port::sectorErase(adr_counter_);
+      if (!Port::sectorIsClear(adr_counter_))
+      {
+        erase_error_ = true;
+        break;
+      }
+    }
+
+    adr_counter_ += Config::sector_size;
+    eraseEvent((adr_counter_ - Config::app_begin) / Config::sector_size);
+  }
+  break;
+
+  case SendResp:
+  case AppRun:
+    if (entry)
+      timer_ = Port::millis();
+    if (elapsed(timer_, Config::response_delay_ms))
+      state_ = (state_ == SendResp) ? SendResp1 : AppRun1;
+    break;
+
+  case SendResp1:
+    if (binex_transmit() == BINEX_PACK_TX)
+      state_ = Main;
+    break;
+
+  case AppRun1:
+    if (binex_transmit() == BINEX_PACK_TX)
+      state_ = AppRun2;
+    break;
+
+  case AppRun2:
+    if (entry)
+      timer_ = Port::millis();
+    if (elapsed(timer_, 300))
+      Port::appRun();
+    break;
+
+  default:
+    state_ = Main;
+    break;
+  }
+}
+
+} // namespace bootloader
+
+/*
+  Модуль ядра: функции bootloader.h и вывод binex для экземпляра CORE
+*/
+#define BOOTLOADER_CORE_UNIT(CORE)                                   \
+  extern "C" void InitBootloader(void) { CORE::init(); }             \
+  extern "C" void ProcessBootloader(void) { CORE::process(); }       \
+  extern "C" int binex_tx_callback(uint8_t c) { return CORE::txCallback(c); }
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef __BOOTLOADER_CONFIG_H__
+#define __BOOTLOADER_CONFIG_H__
+
+/*
+  Конфигурация ядра Bootloader-а в одном месте: параметры платы
+  (bootloader_hal_config.h) и проекта (bootloader_project_config.h),
+  значения по умолчанию, производные размеры и их проверка при компиляции.
+  Все размеры - константы времени компиляции, ошибка конфигурации
+  обнаруживается при сборке, а не на устройстве
+*/
+
+#include "bootloader_hal_config.h"
+#include "bootloader_project_config.h"
+
+/******************************************************************************/
+
+/*
+  Проверка при компиляции выражений, недоступных препроцессору (sizeof),
+  без зависимости от диалекта C: при ложном expr размер массива
+  отрицательный. name - уникальное имя проверки
+*/
+#define BOOTLOADER_STATIC_ASSERT(expr, name) \
+  typedef char bootloader_static_assert_##name[(expr) ? 1 : -1]
+
+/******************************************************************************/
+
+// Буфер обмена: принятый запрос и формируемый ответ
+#define BUFFER_EXCH_SIZE 256
+
+// Минимальный интервал между событиями о ходе очистки flash, мс.
+// Должен быть меньше тайм-аута ответа хоста: событие продлевает ожидание.
+// Событие передается между секторами, очистка на время передачи
+// приостанавливается
+#ifndef BOOTLOADER_ERASE_EVENT_INTERVAL_MS
+#define BOOTLOADER_ERASE_EVENT_INTERVAL_MS 50
+#endif
+
+// Размер данных в чанке. Может быть переопределен при сборке,
+// файл обновления при этом должен быть подготовлен с тем же размером
+#ifndef CHUNK_DATA_SIZE
+#define CHUNK_DATA_SIZE 128
+#endif
+
+#define MAC_SIZE 16
+
+// Размер struct fw_chunk_s: address, len, nonce, данные, tag
+#define FW_CHUNK_SIZE (4 + 1 + 24 + CHUNK_DATA_SIZE + MAC_SIZE)
+
+// Секторов flash в области приложения
+#define BOOTLOADER_APP_SECTORS (BOOTLOADER_APP_LENGTH / BOOTLOADER_FLASH_SECTOR_SIZE)
+
+/******************************************************************************/
+
+// Команда и чанк должны поместиться в буфер обмена
+#if (CHUNK_DATA_SIZE == 0) || (CHUNK_DATA_SIZE > 255) || ((1 + FW_CHUNK_SIZE) > BUFFER_EXCH_SIZE)
+#error "CHUNK_DATA_SIZE is too large"
+#endif
+
+// Область приложения очищается, записывается и отмечается в журнале
+// посекторно, запись во flash - словами
+#if (BOOTLOADER_FLASH_SECTOR_SIZE % 4) != 0
+#error "BOOTLOADER_FLASH_SECTOR_SIZE must be a multiple of 4"
+#endif
+
+#if (BOOTLOADER_APP_BEGIN % BOOTLOADER_FLASH_SECTOR_SIZE) || (BOOTLOADER_APP_LENGTH % BOOTLOADER_FLASH_SECTOR_SIZE)
+#error "Application region is not sector aligned"
+#endif
+
+// Раскладка flash: код Bootloader-а, сектор журнала, приложение.
+// Область кода задается и в файле линкера платы, здесь проверяется,
+// что перенос границы не отдает журналу или приложению часть кода
+#ifdef BOOTLOADER_CODE_LENGTH
+#if (BOOTLOADER_CODE_BEGIN + BOOTLOADER_CODE_LENGTH) > BOOTLOADER_APP_BEGIN
+#error "Bootloader code region overlaps the application region"
+#endif
+#endif
+
+#ifdef BOOTLOADER_USE_JOURNAL
+#if (BOOTLOADER_JOURNAL_BEGIN % BOOTLOADER_FLASH_SECTOR_SIZE) != 0
+#error "BOOTLOADER_JOURNAL_BEGIN is not sector aligned"
+#endif
+
+#if (BOOTLOADER_JOURNAL_BEGIN + BOOTLOADER_FLASH_SECTOR_SIZE) > BOOTLOADER_APP_BEGIN
+#error "Journal sector overlaps the application region"
+#endif
+
+#if defined(BOOTLOADER_CODE_LENGTH) && ((BOOTLOADER_CODE_BEGIN + BOOTLOADER_CODE_LENGTH) > BOOTLOADER_JOURNAL_BEGIN)
+#error "Bootloader code region overlaps the journal sector"
+#endif
+#endif
+
+// В конце области приложения - MAC прошивки
+#if BOOTLOADER_APP_LENGTH <= MAC_SIZE
+#error "BOOTLOADER_APP_LENGTH is too small"
+#endif
+
+#endif
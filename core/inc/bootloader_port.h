@@ -21,6 +21,24 @@ void port_application_run(void);
 */
 int port_boot_jumper_is_active(void);
 
+/*
+  Возвращает адрес устройства на общей шине (0x00..0x7E),
+  назначенный устройству при производстве
+  (используется для адресных запросов к устройству).
+  Если адрес не назначен - возвращает 0xFF,
+  тогда ядро выводит адрес из port_get_unique_id()
+*/
+uint8_t port_get_unit_address(void);
+
+// Размер уникального идентификатора МК, байт
+#define PORT_UNIQUE_ID_SIZE 12
+
+/*
+  Копирует в id уникальный идентификатор МК (PORT_UNIQUE_ID_SIZE байт),
+  записанный производителем МК
+*/
+void port_get_unique_id(uint8_t *id);
+
 /*
   Отправить символ в последовательный интерфейс связи
   Возвращает:
@@ -45,6 +63,31 @@ int port_serial_transfer_completed(void);
 */
 int16_t port_serial_getc(void);
 
+/*
+  Количество символов, потерянных приемником с момента запуска
+  (переполнение буфера приемника, аппаратное переполнение интерфейса).
+  Используется счетчиками статистики (BOOTLOADER_USE_STATS)
+*/
+uint32_t port_serial_rx_lost(void);
+
+/*
+  Счетчики ошибок приемника с момента запуска: аппаратное переполнение
+  (overrun), ошибка стопового бита (framing), шум на линии (noise).
+  Используются режимом проверки канала (BOOTLOADER_USE_LINK_TEST),
+  порт без таких флагов возвращает 0
+*/
+void port_serial_rx_errors(uint32_t *overrun, uint32_t *framing, uint32_t *noise);
+
+/*
+  Дополнительные последовательные каналы связи, используются
+  в режиме ретранслятора (BOOTLOADER_USE_RELAY) для связи
+  с нижестоящими устройствами.
+  ch - номер канала, 0..(BOOTLOADER_RELAY_CHANNELS - 1)
+  Работают так же, как port_serial_putc и port_serial_getc
+*/
+int16_t port_relay_putc(uint8_t ch, uint8_t c);
+int16_t port_relay_getc(uint8_t ch);
+
 /*
   Проверить, очищен ли данный сектор
 */
@@ -60,4 +103,14 @@ uint8_t port_sector_erase(uint32_t adr);
 */
 uint8_t port_write_chunk(uint8_t *chunk, uint32_t address, uint16_t len);
 
+/*
+  Записать слово во flash-память МК по произвольному адресу,
+  в том числе вне области приложения (служебные области, например журнал).
+  Адрес должен быть выровнен на 4 байта
+  Возвращает:
+    0 - OK
+    1 - ошибка записи
+*/
+uint8_t port_write_word(uint32_t address, uint32_t word);
+
 #endif
\ No newline at end of file
@@ -3,6 +3,18 @@
 
 #include <stdint.h>
 
+/*
+  CRC16 пакетов binex: полином 0x8005, отраженный, начальное значение 0xFFFF.
+  Реализация выбирается при сборке проекта одним из файлов:
+  - core/src/crc16.c - программная, по таблице 256 x uint16_t во flash
+    (строится при компиляции), используется на хосте и в симуляторе;
+  - hal/<mcu>/port/src/port_crc16.c - аппаратный блок CRC микроконтроллера.
+  Результаты реализаций совпадают побитно, в том числе при продолжении
+  расчета с промежуточного значения (start_crc).
+  Аппаратная реализация не реентерабельна: Crc16 вызывается только
+  из основного цикла
+*/
+
 void Crc16Init(void);
 uint16_t Crc16StartValue(void);
 uint16_t Crc16(uint8_t *pcBlock, uint16_t len, uint16_t start_crc);
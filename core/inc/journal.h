@@ -0,0 +1,60 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdint.h>
+
+/*
+  Журнал сессии обновления.
+  Хранится в отдельном секторе flash-памяти (BOOTLOADER_JOURNAL_BEGIN) и
+  переживает как разрыв связи, так и сброс питания.
+  Формат сектора журнала:
+    +--------+-----------+------------------------------------------+
+    | слово  |     0     | 1..4          | 5..(5 + N - 1)           |
+    +--------+-----------+---------------+--------------------------+
+    | данные |   MAGIC   | идентификатор | флаги записанных секторов |
+    +--------+-----------+---------------+--------------------------+
+  Идентификатор образа - это MAC (tag) идентификационного чанка файла
+  обновления. Под каждый сектор области приложения отводится одно слово:
+  0xFFFFFFFF - сектор не записан, 0x00000000 - сектор записан полностью.
+  Флаги только сбрасываются из 1 в 0, поэтому в течение сессии сектор
+  журнала стирается только один раз, при старте новой сессии.
+*/
+
+#define JOURNAL_ID_SIZE 16
+
+/*
+  Начать новую сессию: стереть журнал и записать идентификатор образа
+  Возвращает:
+    0 - OK
+    1 - ошибка записи журнала
+*/
+uint8_t JournalReset(const uint8_t *image_id);
+
+/*
+  Проверить, что журнал валиден и относится к образу image_id
+  Возвращает:
+    1 - журнал относится к данному образу
+    0 - журнал отсутствует, либо относится к другому образу
+*/
+uint8_t JournalIsMatch(const uint8_t *image_id);
+
+/*
+  Записан ли полностью сектор области приложения с адресом adr
+*/
+uint8_t JournalSectorIsDone(uint32_t adr);
+
+/*
+  Отметить сектор области приложения с адресом adr как записанный
+  Возвращает:
+    0 - OK
+    1 - ошибка записи журнала
+*/
+uint8_t JournalSectorSetDone(uint32_t adr);
+
+/*
+  Получить адрес первого не записанного сектора области приложения.
+  Если записаны все сектора, то возвращается адрес конца области приложения
+*/
+uint32_t JournalFirstIncomplete(void);
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef __RELAY_H__
+#define __RELAY_H__
+
+#include <stdint.h>
+#include "binex-lib.h"
+
+/*
+  Режим ретранслятора.
+  Позволяет обновлять устройства, доступные только через данное
+  устройство, по дополнительным последовательным каналам
+  (port_relay_xxx). Пакет, полученный от хоста, передается
+  в канал в фоне, пока Bootloader продолжает принимать следующие
+  пакеты хоста. Ответы нижестоящего устройства забираются хостом
+  по одному.
+  Ответы канала нумеруются. Принятый ответ хранится, пока хост не
+  подтвердит его номер в следующем опросе (либо до следующего пакета
+  в канал), поэтому потерянный ответ на опрос не теряет ответ
+  нижестоящего устройства: повторный опрос вернет его снова.
+*/
+
+// Размер буфера пакета канала
+#define RELAY_BUFFER_SIZE 256
+
+// Максимальный размер ответа нижестоящего устройства: вместе с
+// заголовком ответа RELAY_POLL (3 байта) он передается хосту одним
+// пакетом, с FEC - одним кодовым словом (тело, CRC16 и проверочные
+// байты не длиннее 255 байт, см. binex_transmitter_init).
+// Более длинный ответ не принимается, канал ждет до тайм-аута
+#ifdef BINEX_USE_FEC
+#define RELAY_REPLY_MAX_SIZE (255 - 2 - RS_MAX_NPAR - 3)
+#else
+#define RELAY_REPLY_MAX_SIZE (RELAY_BUFFER_SIZE - 3)
+#endif
+
+// Состояние канала (RelayPoll)
+#define RELAY_REPLY 0x00   // Принят ответ, он скопирован в буфер
+#define RELAY_BUSY 0x01    // Пакет передается, либо ответ еще не получен
+#define RELAY_TIMEOUT 0x02 // Ответа нет, канал свободен
+#define RELAY_ERROR 0x03   // Недопустимый номер канала или размер пакета
+
+void RelayInit(void);
+
+/*
+  Обработка всех каналов, вызывается в основном цикле
+*/
+void RelayProcess(void);
+
+/*
+  Начать передачу пакета в канал ch.
+  addr - адрес нижестоящего устройства на шине канала,
+  либо BINEX_ADDRESS_NONE
+  Предыдущий обмен по каналу, если он не завершен, прерывается,
+  неподтвержденный ответ отбрасывается
+  seq - номер последнего ответа канала: следующий ответ получит
+  другой номер, хост начинает подтверждения с этого значения
+  Возвращает:
+    RELAY_BUSY - пакет принят к передаче
+    RELAY_ERROR - недопустимый номер канала или размер пакета
+*/
+uint8_t RelaySend(uint8_t ch, uint8_t addr, const uint8_t *data, uint16_t len, uint8_t *seq);
+
+/*
+  Получить очередной ответ нижестоящего устройства канала ch.
+  ack - номер последнего ответа, принятого хостом: если хранимый
+  ответ имеет этот номер, он отбрасывается, и канал продолжает
+  ожидать следующие пакеты (например, события о ходе очистки
+  flash-памяти) до тайм-аута
+  out - буфер для ответа размером не менее RELAY_REPLY_MAX_SIZE
+  len - размер ответа
+  seq - номер ответа (RELAY_REPLY), иначе номер последнего ответа
+  Возвращает: RELAY_REPLY, RELAY_BUSY, RELAY_TIMEOUT, RELAY_ERROR
+*/
+uint8_t RelayPoll(uint8_t ch, uint8_t ack, uint8_t *out, uint16_t *len, uint8_t *seq);
+
+#endif
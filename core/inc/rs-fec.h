@@ -0,0 +1,35 @@
+#ifndef __RS_FEC_H__
+#define __RS_FEC_H__
+
+#include <stdint.h>
+
+/*
+  Код Рида-Соломона над GF(2^8), полином поля 0x11D, корни
+  порождающего полинома a^0..a^(npar-1). Код систематический:
+  кодовое слово - это данные, за которыми следуют npar проверочных байт.
+  Длина кодового слова не более 255 байт (укороченный код).
+  Исправляет до npar/2 ошибочных байт в кодовом слове.
+  Таблицы поля хранятся во flash, декодер использует только стек
+  (порядка 4 * RS_MAX_NPAR байт).
+*/
+
+#define RS_MAX_NPAR 16
+
+/*
+  Вычисление проверочных байт.
+  Перед первым вызовом parity должен быть заполнен нулями, далее функцию
+  можно вызывать последовательно для идущих друг за другом фрагментов данных
+*/
+void RsEncode(uint8_t *parity, uint8_t npar, const uint8_t *data, uint16_t len);
+
+/*
+  Проверка и исправление кодового слова на месте
+  codeword - данные и npar проверочных байт
+  len - полная длина кодового слова (не более 255)
+  Возвращает:
+    >=0 - количество исправленных байт
+    -1 - ошибки исправить невозможно
+*/
+int RsDecode(uint8_t *codeword, uint16_t len, uint8_t npar);
+
+#endif
@@ -32,6 +32,19 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "crc16.h"
 #endif
 
+#ifdef BINEX_USE_FEC
+#ifndef BINEX_CHECK_CRC
+#error "BINEX_USE_FEC requires BINEX_CHECK_CRC"
+#endif
+#include "rs-fec.h"
+#endif
+
+#ifdef BINEX_USE_COBS
+#ifndef BINEX_CHECK_CRC
+#error "BINEX_USE_COBS requires BINEX_CHECK_CRC"
+#endif
+#endif
+
 /******************************************************************************/
 
 #define BINEX_ESCAPE 0x00
@@ -41,33 +54,45 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 /******************************************************************************/
 
-static uint8_t *receive_buffer;
-static size_t receive_buffer_size;
-static uint16_t rxpack_size;
-static uint8_t rxstate;
-static uint8_t flag_prev_rx_esc;
+#ifdef BINEX_USE_FEC
+#define FEC_HDR_NPAR 2
+#endif
 
-static uint16_t txpack_size;
-static uint8_t *txbuff;
-static uint8_t txstate;
-static uint8_t flag_prev_tx_esc;
+#ifdef BINEX_USE_COBS
+// Максимальный код блока: 254 байта данных без завершающего нуля
+#define COBS_CODE_MAX 0xFF
 
-#ifdef BINEX_CHECK_CRC
-static uint16_t tx_crc16;
+// Состояния приемника и передатчика в режиме COBS
+#define COBS_RX_FRAME 10 // прием кадра
+#define COBS_RX_SKIP 11  // пропуск кадра до разделителя
+#define COBS_TX_CODE 10  // передача кода блока
+#define COBS_TX_DATA 11  // передача данных блока
+#define COBS_TX_END 12   // передача разделителя
 #endif
 
 /******************************************************************************/
 
-static uint8_t char_rx(uint8_t c)
+// Экземпляр по умолчанию, используется функциями
+// с одним экземпляром (binex_receiver, binex_transmit и т.д.)
+static int default_tx_callback(void *arg, uint8_t c);
+
+static Binex_t binex_default = {
+    .address = BINEX_ADDRESS_NONE,
+    .tx_callback = default_tx_callback,
+};
+
+/******************************************************************************/
+
+static uint8_t char_rx(Binex_t *b, uint8_t c)
 {
-  if (flag_prev_rx_esc)
+  if (b->flag_prev_rx_esc)
   {
     // Если предыдущий символ является esc-символом
     // Сбрасываем флаг, так как
     // оба сценария развития событий
     // предусматирвают сброс этого флага
 
-    flag_prev_rx_esc = 0;
+    b->flag_prev_rx_esc = 0;
 
     // Если пришла экранированная последовательность
     if ((c == BINEX_ESC_SYMBOL) || (c == BINEX_START_SYMBOL))
@@ -84,7 +109,7 @@ static uint8_t char_rx(uint8_t c)
   {
     // Если приняли esc-символ,
     // то устанавливаем соответствующий флаг
-    flag_prev_rx_esc = 1;
+    b->flag_prev_rx_esc = 1;
 
     // Просто выходим
     return BINEX_ESCAPE;
@@ -99,16 +124,16 @@ static uint8_t char_rx(uint8_t c)
   return BINEX_CHAR;
 }
 
-static int char_tx(uint8_t c)
+static int char_tx(Binex_t *b, uint8_t c)
 {
   // Если экранирование esc-символа
-  if (flag_prev_tx_esc)
+  if (b->flag_prev_tx_esc)
   {
-    if (binex_tx_callback(c))
+    if (b->tx_callback(b->tx_arg, c))
     {
       // На предыдущем шаге отправили esc-символ,
       // сейчас сам символ, поэтому возвращаем 1
-      flag_prev_tx_esc = 0;
+      b->flag_prev_tx_esc = 0;
       return 1;
     }
     return 0;
@@ -116,9 +141,9 @@ static int char_tx(uint8_t c)
 
   if ((c == BINEX_ESC_SYMBOL) || (c == BINEX_START_SYMBOL))
   {
-    if (binex_tx_callback(BINEX_ESC_SYMBOL))
+    if (b->tx_callback(b->tx_arg, BINEX_ESC_SYMBOL))
     {
-      flag_prev_tx_esc = 1;
+      b->flag_prev_tx_esc = 1;
     }
 
     // Либо ничего не отправили, либо отправили esc-символ,
@@ -126,51 +151,306 @@ static int char_tx(uint8_t c)
     return 0;
   }
 
-  if (binex_tx_callback(c))
+  if (b->tx_callback(b->tx_arg, c))
     return 1;
 
   return 0;
 }
 
+#ifdef BINEX_CHECK_CRC
+// Вычисление crc для поля адреса, поля длины пакета
+// и поля полезных данных принятого пакета (data)
+static uint16_t rx_crc(Binex_t *b, const uint8_t *data)
+{
+  uint16_t crc = Crc16StartValue();
+  if (b->rxpack_addr != BINEX_ADDRESS_NONE)
+    crc = Crc16(&b->rxpack_addr, 1, crc);
+  crc = Crc16((uint8_t *)((void *)(&b->rxpack_size)), 2, crc);
+  crc = Crc16((uint8_t *)data, b->rxpack_size, crc);
+  return crc;
+}
+#endif
+
+// Байт адреса, передаваемый в пакете
+static uint8_t tx_addr(Binex_t *b)
+{
+  if (b->flag_host)
+    return b->address;
+  return b->address | BINEX_ADDRESS_REPLY;
+}
+
+// Принимается ли пакет с данным байтом адреса:
+// устройство принимает пакеты со своим и широковещательным адресом,
+// хост - только ответы устройств
+static uint8_t rx_addr_match(Binex_t *b, uint8_t addr)
+{
+  if (b->flag_host)
+    return (addr & BINEX_ADDRESS_REPLY) != 0;
+  return (addr == b->address) || (addr == BINEX_ADDRESS_BROADCAST);
+}
+
+// Результат приема поврежденного пакета с запоминанием причины
+static BinexRxStatus_t rx_broken(Binex_t *b, uint8_t error)
+{
+  b->rx_error = error;
+  return BINEX_PACK_BROKEN;
+}
+
+#ifdef BINEX_USE_FEC
+// Размер заголовка пакета с FEC
+static uint8_t fec_hdr_size(Binex_t *b)
+{
+  if (b->address != BINEX_ADDRESS_NONE)
+    return 1 + 2 + FEC_HDR_NPAR;
+  return 2 + FEC_HDR_NPAR;
+}
+#endif
+
+#ifdef BINEX_USE_COBS
+// Размер кадра до кодирования: [ADDR] DATA CRC16
+static uint16_t cobs_tx_len(Binex_t *b)
+{
+  if (b->address != BINEX_ADDRESS_NONE)
+    return 1 + b->txpack_size + 2;
+  return b->txpack_size + 2;
+}
+
+// Байт кадра до кодирования
+static uint8_t cobs_tx_byte(Binex_t *b, uint16_t i)
+{
+  if (b->address != BINEX_ADDRESS_NONE)
+  {
+    if (i == 0)
+      return tx_addr(b);
+    i--;
+  }
+
+  if (i < b->txpack_size)
+    return b->txbuff[i];
+
+  return (uint8_t)(b->tx_crc16 >> (8 * (i - b->txpack_size)));
+}
+
+// Декодированный байт кадра: адрес, данные, CRC16.
+// Последние 2 байта кадра (CRC16) в буфер приемника
+// не записываются, поэтому буфер должен вмещать только данные
+static BinexRxStatus_t cobs_rx_byte(Binex_t *b, uint8_t c)
+{
+  uint16_t pos = b->rxpack_size++;
+
+  if (b->address != BINEX_ADDRESS_NONE)
+  {
+    if (pos == 0)
+    {
+      if (rx_addr_match(b, c))
+        b->rxpack_addr = c;
+      else
+        b->rxstate = COBS_RX_SKIP; // Пакет адресован не нам
+      return BINEX_PACK_NOT_RX;
+    }
+    pos--;
+  }
+
+  if (pos >= 2)
+  {
+    if (b->rxtmp >= b->receive_buffer_size)
+    {
+      b->rxstate = COBS_RX_SKIP;
+      return rx_broken(b, BINEX_RX_ERR_SIZE);
+    }
+    b->receive_buffer[b->rxtmp++] = (uint8_t)b->rx_cobs_tail;
+  }
+
+  b->rx_cobs_tail = (b->rx_cobs_tail >> 8) | ((uint16_t)c << 8);
+  return BINEX_PACK_NOT_RX;
+}
+
+// Конец кадра: проверка CRC16
+static BinexRxStatus_t cobs_rx_end(Binex_t *b)
+{
+  uint16_t hdr = (b->address != BINEX_ADDRESS_NONE) ? 1 : 0;
+
+  if ((b->rx_cobs_left != 0) || (b->rxpack_size < hdr + 2))
+    return rx_broken(b, BINEX_RX_ERR_FRAMING);
+
+  b->rxpack_size = b->rxtmp;
+
+  if (rx_crc(b, b->receive_buffer) == b->rx_cobs_tail)
+    return BINEX_PACK_RX;
+  return rx_broken(b, BINEX_RX_ERR_CRC);
+}
+
+static BinexRxStatus_t cobs_rx(Binex_t *b, uint8_t c)
+{
+  BinexRxStatus_t r;
+
+  if (c == BINEX_COBS_DELIMITER)
+  {
+    // Пустой кадр (разделитель перед пакетом)
+    // либо конец пропускаемого кадра
+    if (b->rxstate != COBS_RX_FRAME)
+    {
+      b->rxstate = 0;
+      return BINEX_PACK_NOT_RX;
+    }
+
+    b->rxstate = 0;
+    return cobs_rx_end(b);
+  }
+
+  switch (b->rxstate)
+  {
+  case 0:
+    /// Код первого блока кадра ///
+    b->rxpack_addr = BINEX_ADDRESS_NONE;
+    b->rx_corrected = 0;
+    b->rxpack_size = 0;
+    b->rxtmp = 0;
+    b->rx_cobs_left = 0;
+    b->rx_cobs_zero = 0;
+    b->rxstate = COBS_RX_FRAME;
+    // fallthrough
+  case COBS_RX_FRAME:
+    if (b->rx_cobs_left != 0)
+    {
+      b->rx_cobs_left--;
+      return cobs_rx_byte(b, c);
+    }
+
+    // Код следующего блока: предыдущий блок завершался нулем
+    if (b->rx_cobs_zero)
+    {
+      r = cobs_rx_byte(b, 0);
+      if (r != BINEX_PACK_NOT_RX)
+        return r;
+    }
+
+    b->rx_cobs_left = c - 1;
+    b->rx_cobs_zero = (c != COBS_CODE_MAX);
+    break;
+  }
+
+  return BINEX_PACK_NOT_RX;
+}
+#endif
+
 /******************************************************************************/
 
-void binex_receiver_begin(uint8_t *buff, size_t buff_size)
+void binex_init(Binex_t *b, BinexTxCallback_t tx_callback, void *tx_arg)
 {
-  receive_buffer = buff;
-  receive_buffer_size = buff_size;
-  rxstate = 0;
-  flag_prev_rx_esc = 0;
-  rxpack_size = 0;
+  b->receive_buffer = 0;
+  b->receive_buffer_size = 0;
+  b->rxpack_size = 0;
+  b->rxstate = 0;
+  b->flag_prev_rx_esc = 0;
+  b->rxpack_addr = BINEX_ADDRESS_NONE;
+  b->rx_error = BINEX_RX_ERR_NONE;
+  b->rx_corrected = 0;
+
+  b->txbuff = 0;
+  b->txpack_size = 0;
+  b->txstate = 0;
+  b->flag_prev_tx_esc = 0;
+
+  b->address = BINEX_ADDRESS_NONE;
+  b->flag_host = 0;
+
+#ifdef BINEX_USE_FEC
+  b->fec_npar = 0;
+#endif
+
+#ifdef BINEX_USE_COBS
+  b->cobs = 0;
+#endif
+
+  b->tx_callback = tx_callback;
+  b->tx_arg = tx_arg;
 }
 
-BinexRxStatus_t binex_receiver(int16_t c)
+void binex_rx_begin(Binex_t *b, uint8_t *buff, size_t buff_size)
+{
+  b->receive_buffer = buff;
+  b->receive_buffer_size = buff_size;
+  b->rxstate = 0;
+  b->flag_prev_rx_esc = 0;
+  b->rxpack_size = 0;
+}
+
+BinexRxStatus_t binex_rx(Binex_t *b, int16_t c)
 {
-  static uint16_t tmp;
   uint8_t r;
+#ifdef BINEX_USE_FEC
+  int corrected;
+#endif
 
   if (c < 0)
     return BINEX_PACK_NOT_RX;
 
-  switch (rxstate)
+#ifdef BINEX_USE_COBS
+  if (b->cobs)
+    return cobs_rx(b, (uint8_t)c);
+#endif
+
+  switch (b->rxstate)
   {
   case 0:
     // Начало приема пакета
     // Ожидается символ начала пакета
-    if (char_rx(c) == BINEX_START)
+    if (char_rx(b, c) == BINEX_START)
+    {
+      b->rxpack_addr = BINEX_ADDRESS_NONE;
+      b->rx_corrected = 0;
+
+#ifdef BINEX_USE_FEC
+      if (b->fec_npar != 0)
+      {
+        b->rxtmp = 0;
+        b->rxstate = 8;
+        break;
+      }
+#endif
+
+      if (b->address != BINEX_ADDRESS_NONE)
+        b->rxstate = 6;
+      else
+        b->rxstate = 1;
+    }
+    break;
+  //////////////////////////////////////
+  case 6:
+    /// Прием адреса пакета ///
+
+    r = char_rx(b, (uint8_t)c);
+    if (r == BINEX_CHAR)
+    {
+      if (rx_addr_match(b, (uint8_t)c))
+      {
+        b->rxpack_addr = (uint8_t)c;
+        b->rxstate = 1;
+      }
+      else
+      {
+        // Пакет адресован не нам, либо это ответ другого
+        // устройства. Пропускаем его до следующего START
+        b->rxstate = 0;
+      }
+    }
+    else if ((r == BINEX_START) || (r == BINEX_INVALID))
     {
-      rxstate = 1;
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
     }
     break;
   //////////////////////////////////////
   case 1:
     /// Прием 1го байта заголовка пакета ///
 
-    r = char_rx((uint8_t)c);
+    r = char_rx(b, (uint8_t)c);
     if (r == BINEX_CHAR)
     {
       // приняли символ
-      rxpack_size = ((uint8_t)c);
-      rxstate = 2;
+      b->rxpack_size = ((uint8_t)c);
+      b->rxstate = 2;
     }
     else if ((r == BINEX_START) || (r == BINEX_INVALID))
     {
@@ -178,77 +458,77 @@ BinexRxStatus_t binex_receiver(int16_t c)
       // либо некорректную esc-последовательность
       // переходим в состояние приема старта пакета
       // и возвращаем ошибку
-      rxstate = 0;
-      return BINEX_PACK_BROKEN;
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
     }
     break;
   //////////////////////////////////////
   case 2:
     /// Прием 2го байта заголовка пакета ///
 
-    r = char_rx((uint8_t)c);
+    r = char_rx(b, (uint8_t)c);
     if (r == BINEX_CHAR)
     {
-      rxpack_size |= (((uint8_t)c) << 8);
-      tmp = 0;
-      rxstate = 3;
+      b->rxpack_size |= (((uint8_t)c) << 8);
+      b->rxtmp = 0;
+      b->rxstate = 3;
 
-      if (rxpack_size > receive_buffer_size)
+      if (b->rxpack_size > b->receive_buffer_size)
       {
         // Пакет слишком большой.
         // Это могло произойти по 2м причинам:
         // 1. пакет действительно слишком большой
         // 2. возникла ошибка при приеме размера пакета
-        rxstate = 0;
-        return BINEX_PACK_BROKEN;
+        b->rxstate = 0;
+        return rx_broken(b, BINEX_RX_ERR_SIZE);
       }
-      else if (rxpack_size == 0) // Пустой пакет
+      else if (b->rxpack_size == 0) // Пустой пакет
       {
 #ifdef BINEX_CHECK_CRC
         // Состояние получения CRC16
-        rxstate = 4;
+        b->rxstate = 4;
 #else
         // Если crc не проверяем, то
         // возвращаемся в состояние приема
         // начала пакета, и возвращаем информацию о том,
         // что пакет был принят
-        rxstate = 0;
+        b->rxstate = 0;
         return BINEX_PACK_RX;
 #endif
       }
     }
     else if ((r == BINEX_START) || (r == BINEX_INVALID))
     {
-      rxstate = 0;
-      return BINEX_PACK_BROKEN;
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
     }
     break;
   //////////////////////////////////////
   case 3:
     /// Прием тела пакета ///
 
-    r = char_rx((uint8_t)c);
+    r = char_rx(b, (uint8_t)c);
 
     if (r == BINEX_CHAR)
     {
       // приняли символ
-      receive_buffer[tmp++] = (uint8_t)c;
-      if (tmp == rxpack_size) // приняли весь пакет
+      b->receive_buffer[b->rxtmp++] = (uint8_t)c;
+      if (b->rxtmp == b->rxpack_size) // приняли весь пакет
       {
 #ifdef BINEX_CHECK_CRC
         // Если crc проверяем
-        rxstate = 4; // прием и проверка CRC
+        b->rxstate = 4; // прием и проверка CRC
 #else
         // если crc не проверяем
-        rxstate = 0;
+        b->rxstate = 0;
         return BINEX_PACK_RX;
 #endif
       }
     }
     else if ((r == BINEX_START) || (r == BINEX_INVALID))
     {
-      rxstate = 0;
-      return BINEX_PACK_BROKEN;
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
     }
     break;
     //////////////////////////////////////
@@ -256,45 +536,120 @@ BinexRxStatus_t binex_receiver(int16_t c)
   case 4:
     /// Получение 1го байта crc ///
 
-    r = char_rx((uint8_t)c);
+    r = char_rx(b, (uint8_t)c);
 
     if (r == BINEX_CHAR)
     {
-      tmp = ((uint8_t)c);
-      rxstate = 5;
+      b->rxtmp = ((uint8_t)c);
+      b->rxstate = 5;
     }
     else if ((r == BINEX_START) || (r == BINEX_INVALID))
     {
-      rxstate = 0;
-      return BINEX_PACK_BROKEN;
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
     }
     break;
   //////////////////////////////////////
   case 5:
     /// Получение 2го байта crc ///
 
-    r = char_rx((uint8_t)c);
+    r = char_rx(b, (uint8_t)c);
 
     if (r == BINEX_CHAR)
     {
-      tmp |= ((uint8_t)c) << 8;
-      rxstate = 0;
+      b->rxtmp |= ((uint8_t)c) << 8;
+      b->rxstate = 0;
 
-      // Вычисление crc для поля длины пакета
-      // и поля полезных данных
-      uint16_t crc = Crc16StartValue();
-      crc = Crc16((uint8_t *)((void *)(&rxpack_size)), 2, crc);
-      crc = Crc16(receive_buffer, rxpack_size, crc);
+      if (rx_crc(b, b->receive_buffer) == b->rxtmp)
+        return BINEX_PACK_RX;
+      else
+        return rx_broken(b, BINEX_RX_ERR_CRC);
+    }
+    else if ((r == BINEX_START) || (r == BINEX_INVALID))
+    {
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
+    }
+    break;
+#endif
+    //////////////////////////////////////
+#ifdef BINEX_USE_FEC
+  case 8:
+    /// Прием заголовка пакета с FEC ///
 
-      if (crc == tmp)
+    r = char_rx(b, (uint8_t)c);
+
+    if (r == BINEX_CHAR)
+    {
+      uint8_t i = 0;
+
+      b->rx_hdr[b->rxtmp++] = (uint8_t)c;
+      if (b->rxtmp < fec_hdr_size(b))
+        break;
+
+      b->rxstate = 0;
+
+      corrected = RsDecode(b->rx_hdr, fec_hdr_size(b), FEC_HDR_NPAR);
+      if (corrected < 0)
+        return rx_broken(b, BINEX_RX_ERR_FEC);
+      b->rx_corrected = (uint8_t)corrected;
+
+      if (b->address != BINEX_ADDRESS_NONE)
+      {
+        if (!rx_addr_match(b, b->rx_hdr[0]))
+          break; // Пакет адресован не нам
+
+        b->rxpack_addr = b->rx_hdr[0];
+        i = 1;
+      }
+
+      b->rxpack_size = b->rx_hdr[i] | (b->rx_hdr[i + 1] << 8);
+      b->rxtmp = 0;
+
+      // Тело пакета вместе с CRC16 и проверочными
+      // байтами должно поместиться в буфер и в кодовое слово
+      if (((b->rxpack_size + 2 + b->fec_npar) > b->receive_buffer_size) ||
+          ((b->rxpack_size + 2 + b->fec_npar) > 255))
+        return rx_broken(b, BINEX_RX_ERR_SIZE);
+
+      b->rxstate = 9;
+    }
+    else if ((r == BINEX_START) || (r == BINEX_INVALID))
+    {
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
+    }
+    break;
+  //////////////////////////////////////
+  case 9:
+    /// Прием тела пакета с FEC ///
+
+    r = char_rx(b, (uint8_t)c);
+
+    if (r == BINEX_CHAR)
+    {
+      b->receive_buffer[b->rxtmp++] = (uint8_t)c;
+      if (b->rxtmp < (b->rxpack_size + 2 + b->fec_npar))
+        break;
+
+      b->rxstate = 0;
+
+      corrected = RsDecode(b->receive_buffer, b->rxtmp, b->fec_npar);
+      if (corrected < 0)
+        return rx_broken(b, BINEX_RX_ERR_FEC);
+      b->rx_corrected += (uint8_t)corrected;
+
+      b->rxtmp = b->receive_buffer[b->rxpack_size] | (b->receive_buffer[b->rxpack_size + 1] << 8);
+
+      if (rx_crc(b, b->receive_buffer) == b->rxtmp)
         return BINEX_PACK_RX;
       else
-        return BINEX_PACK_BROKEN;
+        return rx_broken(b, BINEX_RX_ERR_CRC);
     }
     else if ((r == BINEX_START) || (r == BINEX_INVALID))
     {
-      rxstate = 0;
-      return BINEX_PACK_BROKEN;
+      b->rxstate = 0;
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
     }
     break;
 #endif
@@ -303,49 +658,276 @@ BinexRxStatus_t binex_receiver(int16_t c)
   return BINEX_PACK_NOT_RX;
 }
 
-uint16_t binex_get_rxpack_len(void)
+uint16_t binex_rx_len(Binex_t *b)
 {
-  return rxpack_size;
+  return b->rxpack_size;
 }
 
-void binex_transmitter_init(void *buff, uint16_t size)
+void binex_address_set(Binex_t *b, uint8_t addr)
 {
-  txbuff = (uint8_t *)buff;
-  txpack_size = size;
-  txstate = 0;
-  flag_prev_tx_esc = 0;
-#ifdef BINEX_CHECK_CRC
-  tx_crc16 = Crc16StartValue();
-  tx_crc16 = Crc16((uint8_t *)((void *)(&txpack_size)), 2, tx_crc16);
-  tx_crc16 = Crc16(txbuff, size, tx_crc16);
+  b->address = addr;
+  b->flag_host = 0;
+}
+
+void binex_host_address_set(Binex_t *b, uint8_t addr)
+{
+  b->address = addr;
+  b->flag_host = 1;
+}
+
+uint8_t binex_rx_error(Binex_t *b)
+{
+  return b->rx_error;
+}
+
+uint8_t binex_rx_corrected(Binex_t *b)
+{
+  return b->rx_corrected;
+}
+
+uint8_t binex_rx_addr(Binex_t *b)
+{
+  if (b->rxpack_addr == BINEX_ADDRESS_NONE)
+    return BINEX_ADDRESS_NONE;
+  return b->rxpack_addr & (~BINEX_ADDRESS_REPLY);
+}
+
+#ifdef BINEX_USE_FEC
+uint8_t binex_fec_set(Binex_t *b, uint8_t npar)
+{
+  if ((npar & 0x01) || (npar > RS_MAX_NPAR))
+    return 1;
+
+#ifdef BINEX_USE_COBS
+  if (b->cobs && (npar != 0))
+    return 1;
 #endif
+
+  b->fec_npar = npar;
+  return 0;
 }
 
-BinexTxStatus_t binex_transmit(void)
+uint8_t binex_fec_get(Binex_t *b)
+{
+  return b->fec_npar;
+}
+#endif
+
+#ifdef BINEX_USE_COBS
+uint8_t binex_cobs_set(Binex_t *b, uint8_t enable)
+{
+#ifdef BINEX_USE_FEC
+  if (enable && (b->fec_npar != 0))
+    return 1;
+#endif
+
+  b->cobs = enable ? 1 : 0;
+  return 0;
+}
+
+uint8_t binex_cobs_get(Binex_t *b)
+{
+  return b->cobs;
+}
+
+BinexRxStatus_t binex_cobs_decode(Binex_t *b, uint8_t *buf, uint16_t len)
+{
+  uint16_t r = 0; // позиция чтения закодированного кадра
+  uint16_t w = 0; // позиция записи данных, всегда меньше r
+  uint8_t skip_addr = (b->address != BINEX_ADDRESS_NONE) ? 1 : 0;
+  uint8_t code, n;
+  uint16_t crc;
+
+  b->rxpack_addr = BINEX_ADDRESS_NONE;
+  b->rx_corrected = 0;
+  b->rxpack_size = 0;
+
+  if (len == 0)
+    return BINEX_PACK_NOT_RX;
+
+  while (r < len)
+  {
+    code = buf[r++];
+    if (code == BINEX_COBS_DELIMITER)
+      return rx_broken(b, BINEX_RX_ERR_FRAMING);
+
+    n = code - 1;
+
+    // Первый байт кадра - адрес, в буфер не записывается. Как и при
+    // посимвольном приеме, чужой пакет пропускается до проверки кадра
+    if (skip_addr && (n != 0) && (r < len))
+    {
+      if (buf[r] == BINEX_COBS_DELIMITER)
+        return rx_broken(b, BINEX_RX_ERR_FRAMING);
+      if (!rx_addr_match(b, buf[r]))
+        return BINEX_PACK_NOT_RX; // Пакет адресован не нам
+      b->rxpack_addr = buf[r++];
+      skip_addr = 0;
+      n--;
+    }
+
+    if (n > len - r)
+      return rx_broken(b, BINEX_RX_ERR_FRAMING); // Кадр оборван внутри блока
+
+    for (; n != 0; n--)
+    {
+      if (buf[r] == BINEX_COBS_DELIMITER)
+        return rx_broken(b, BINEX_RX_ERR_FRAMING);
+      buf[w++] = buf[r++];
+    }
+
+    // Ноль в конце блока, кроме блока максимальной длины и последнего
+    if ((code != COBS_CODE_MAX) && (r < len))
+    {
+      if (skip_addr)
+      {
+        if (!rx_addr_match(b, 0))
+          return BINEX_PACK_NOT_RX;
+        b->rxpack_addr = 0;
+        skip_addr = 0;
+      }
+      else
+        buf[w++] = 0;
+    }
+  }
+
+  if (skip_addr || (w < 2))
+    return rx_broken(b, BINEX_RX_ERR_FRAMING);
+
+  b->rxpack_size = w - 2;
+  crc = buf[w - 2] | ((uint16_t)buf[w - 1] << 8);
+
+  if (rx_crc(b, buf) == crc)
+    return BINEX_PACK_RX;
+  return rx_broken(b, BINEX_RX_ERR_CRC);
+}
+#endif
+
+uint8_t binex_tx_init(Binex_t *b, void *buff, uint16_t size)
 {
-  static uint16_t tmp;
+#ifdef BINEX_USE_FEC
+  // Тело пакета вместе с CRC16 и проверочными байтами -
+  // одно кодовое слово, не длиннее 255 байт
+#ifdef BINEX_USE_COBS
+  if ((b->fec_npar != 0) && !b->cobs && ((size + 2 + b->fec_npar) > 255))
+#else
+  if ((b->fec_npar != 0) && ((size + 2 + b->fec_npar) > 255))
+#endif
+  {
+    // Пакет не передается, binex_tx сразу возвращает BINEX_PACK_TX
+    b->txpack_size = 0;
+    b->txstate = 6;
+    return 1;
+  }
+#endif
+
+  b->txbuff = (uint8_t *)buff;
+  b->txpack_size = size;
+  b->txstate = 0;
+  b->flag_prev_tx_esc = 0;
+#ifdef BINEX_CHECK_CRC
+  b->tx_crc16 = Crc16StartValue();
+  if (b->address != BINEX_ADDRESS_NONE)
+  {
+    uint8_t addr = tx_addr(b);
+    b->tx_crc16 = Crc16(&addr, 1, b->tx_crc16);
+  }
+  b->tx_crc16 = Crc16((uint8_t *)((void *)(&b->txpack_size)), 2, b->tx_crc16);
+  b->tx_crc16 = Crc16(b->txbuff, size, b->tx_crc16);
+#endif
+
+#ifdef BINEX_USE_FEC
+#ifdef BINEX_USE_COBS
+  if ((b->fec_npar != 0) && !b->cobs)
+#else
+  if (b->fec_npar != 0)
+#endif
+  {
+    uint8_t i = 0;
+    uint8_t crc[2];
+
+    // Заголовок
+    if (b->address != BINEX_ADDRESS_NONE)
+      b->tx_hdr[i++] = tx_addr(b);
+
+    b->tx_hdr[i++] = (uint8_t)size;
+    b->tx_hdr[i++] = (uint8_t)(size >> 8);
+
+    for (uint8_t j = 0; j < FEC_HDR_NPAR; j++)
+      b->tx_hdr[i + j] = 0;
+    RsEncode(b->tx_hdr + i, FEC_HDR_NPAR, b->tx_hdr, i);
 
+    // Тело пакета вместе с CRC16
+    crc[0] = (uint8_t)b->tx_crc16;
+    crc[1] = (uint8_t)(b->tx_crc16 >> 8);
+
+    for (uint8_t j = 0; j < b->fec_npar; j++)
+      b->tx_parity[j] = 0;
+    RsEncode(b->tx_parity, b->fec_npar, b->txbuff, size);
+    RsEncode(b->tx_parity, b->fec_npar, crc, 2);
+  }
+#endif
+
+  return 0;
+}
+
+BinexTxStatus_t binex_tx(Binex_t *b)
+{
   for (;;)
   {
-    switch (txstate)
+    switch (b->txstate)
     {
     case 0:
       /// Начало процесса передачи ///
-      if (binex_tx_callback((uint8_t)BINEX_START_SYMBOL))
+#ifdef BINEX_USE_COBS
+      if (b->cobs)
+      {
+        if (b->tx_callback(b->tx_arg, BINEX_COBS_DELIMITER))
+        {
+          b->txtmp = 0;
+          b->txstate = COBS_TX_CODE;
+        }
+        else
+          return BINEX_PACK_NOT_TX;
+        break;
+      }
+#endif
+      if (b->tx_callback(b->tx_arg, (uint8_t)BINEX_START_SYMBOL))
       {
-        tmp = txpack_size;
-        txstate = 1;
+        b->txtmp = b->txpack_size;
+
+#ifdef BINEX_USE_FEC
+        if (b->fec_npar != 0)
+        {
+          b->txtmp = 0;
+          b->txstate = 8;
+          break;
+        }
+#endif
+
+        if (b->address != BINEX_ADDRESS_NONE)
+          b->txstate = 7;
+        else
+          b->txstate = 1;
       }
       else
         return BINEX_PACK_NOT_TX;
       break;
     /////////////////////////////////////////////
+    case 7:
+      /// Передача адреса пакета ///
+      if (char_tx(b, tx_addr(b)))
+        b->txstate = 1;
+      else
+        return BINEX_PACK_NOT_TX;
+      break;
+    /////////////////////////////////////////////
     case 1:
       /// Передача 1го байта длины пакета ///
-      if (char_tx((uint8_t)tmp))
+      if (char_tx(b, (uint8_t)b->txtmp))
       {
-        tmp >>= 8;
-        txstate = 2;
+        b->txtmp >>= 8;
+        b->txstate = 2;
       }
       else
         return BINEX_PACK_NOT_TX;
@@ -353,10 +935,10 @@ BinexTxStatus_t binex_transmit(void)
     /////////////////////////////////////////////
     case 2:
       /// Передача 2го байта длины пакета ///
-      if (char_tx((uint8_t)tmp))
+      if (char_tx(b, (uint8_t)b->txtmp))
       {
-        tmp = 0;
-        txstate = 3;
+        b->txtmp = 0;
+        b->txstate = 3;
       }
       else
         return BINEX_PACK_NOT_TX;
@@ -365,19 +947,19 @@ BinexTxStatus_t binex_transmit(void)
     case 3:
       /// Передача тела пакета ///
       // Если все передали
-      if (tmp >= txpack_size)
+      if (b->txtmp >= b->txpack_size)
       {
 #ifdef BINEX_CHECK_CRC
-        txstate = 4;
+        b->txstate = 4;
         break;
 #else
-        txstate = 6;
+        b->txstate = 6;
         return BINEX_PACK_TX;
 #endif
       }
 
-      if (char_tx(txbuff[tmp]))
-        tmp++;
+      if (char_tx(b, b->txbuff[b->txtmp]))
+        b->txtmp++;
       else
         return BINEX_PACK_NOT_TX;
       break;
@@ -385,10 +967,10 @@ BinexTxStatus_t binex_transmit(void)
 #ifdef BINEX_CHECK_CRC
     case 4:
       /// Передача 1го байта CRC ///
-      if (char_tx((uint8_t)tx_crc16))
+      if (char_tx(b, (uint8_t)b->tx_crc16))
       {
-        tx_crc16 >>= 8;
-        txstate = 5;
+        b->tx_crc16 >>= 8;
+        b->txstate = 5;
       }
       else
         return BINEX_PACK_NOT_TX;
@@ -396,14 +978,107 @@ BinexTxStatus_t binex_transmit(void)
     /////////////////////////////////////////////
     case 5:
       /// Передача 2го байта CRC ///
-      if (char_tx((uint8_t)tx_crc16))
+      if (char_tx(b, (uint8_t)b->tx_crc16))
       {
-        txstate = 6;
+#ifdef BINEX_USE_FEC
+        if (b->fec_npar != 0)
+        {
+          b->txtmp = 0;
+          b->txstate = 9;
+          break;
+        }
+#endif
+        b->txstate = 6;
         return BINEX_PACK_TX;
       }
       else
         return BINEX_PACK_NOT_TX;
       break;
+#endif
+    /////////////////////////////////////////////
+#ifdef BINEX_USE_FEC
+    case 8:
+      /// Передача заголовка пакета с FEC ///
+      if (b->txtmp >= fec_hdr_size(b))
+      {
+        b->txtmp = 0;
+        b->txstate = 3;
+        break;
+      }
+
+      if (char_tx(b, b->tx_hdr[b->txtmp]))
+        b->txtmp++;
+      else
+        return BINEX_PACK_NOT_TX;
+      break;
+    /////////////////////////////////////////////
+    case 9:
+      /// Передача проверочных байт тела пакета ///
+      if (b->txtmp >= b->fec_npar)
+      {
+        b->txstate = 6;
+        return BINEX_PACK_TX;
+      }
+
+      if (char_tx(b, b->tx_parity[b->txtmp]))
+        b->txtmp++;
+      else
+        return BINEX_PACK_NOT_TX;
+      break;
+#endif
+    /////////////////////////////////////////////
+#ifdef BINEX_USE_COBS
+    case COBS_TX_CODE:
+      /// Передача кода блока COBS ///
+      {
+        uint16_t len = cobs_tx_len(b);
+        uint16_t end = b->txtmp;
+
+        // Данные блока - до ближайшего нуля, не больше 254 байт
+        while ((end < len) && ((end - b->txtmp) < (COBS_CODE_MAX - 1)) &&
+               (cobs_tx_byte(b, end) != 0))
+          end++;
+
+        if (!b->tx_callback(b->tx_arg, (uint8_t)(end - b->txtmp + 1)))
+          return BINEX_PACK_NOT_TX;
+
+        b->tx_cobs_code = (uint8_t)(end - b->txtmp + 1);
+        b->tx_cobs_end = end;
+        b->txstate = COBS_TX_DATA;
+      }
+      break;
+    /////////////////////////////////////////////
+    case COBS_TX_DATA:
+      /// Передача данных блока COBS ///
+      if (b->txtmp < b->tx_cobs_end)
+      {
+        if (b->tx_callback(b->tx_arg, cobs_tx_byte(b, b->txtmp)))
+          b->txtmp++;
+        else
+          return BINEX_PACK_NOT_TX;
+        break;
+      }
+
+      if (b->txtmp >= cobs_tx_len(b))
+      {
+        b->txstate = COBS_TX_END;
+        break;
+      }
+
+      // Блок завершается нулем, который не передается
+      if (b->tx_cobs_code != COBS_CODE_MAX)
+        b->txtmp++;
+      b->txstate = COBS_TX_CODE;
+      break;
+    /////////////////////////////////////////////
+    case COBS_TX_END:
+      /// Передача разделителя кадра ///
+      if (b->tx_callback(b->tx_arg, BINEX_COBS_DELIMITER))
+      {
+        b->txstate = 6;
+        return BINEX_PACK_TX;
+      }
+      return BINEX_PACK_NOT_TX;
 #endif
     /////////////////////////////////////////////
     default:
@@ -411,3 +1086,80 @@ BinexTxStatus_t binex_transmit(void)
     }
   }
 }
+
+/******************************************************************************/
+
+static int default_tx_callback(void *arg, uint8_t c)
+{
+  (void)arg;
+  return binex_tx_callback(c);
+}
+
+void binex_receiver_begin(uint8_t *buff, size_t buff_size)
+{
+  binex_rx_begin(&binex_default, buff, buff_size);
+}
+
+BinexRxStatus_t binex_receiver(int16_t c)
+{
+  return binex_rx(&binex_default, c);
+}
+
+uint16_t binex_get_rxpack_len(void)
+{
+  return binex_rx_len(&binex_default);
+}
+
+void binex_set_address(uint8_t addr)
+{
+  binex_address_set(&binex_default, addr);
+}
+
+uint8_t binex_get_rx_error(void)
+{
+  return binex_rx_error(&binex_default);
+}
+
+uint8_t binex_get_rx_corrected(void)
+{
+  return binex_rx_corrected(&binex_default);
+}
+
+uint8_t binex_get_rxpack_addr(void)
+{
+  return binex_rx_addr(&binex_default);
+}
+
+#ifdef BINEX_USE_FEC
+uint8_t binex_set_fec(uint8_t npar)
+{
+  return binex_fec_set(&binex_default, npar);
+}
+
+uint8_t binex_get_fec(void)
+{
+  return binex_fec_get(&binex_default);
+}
+#endif
+
+#ifdef BINEX_USE_COBS
+uint8_t binex_set_cobs(uint8_t enable)
+{
+  return binex_cobs_set(&binex_default, enable);
+}
+
+uint8_t binex_get_cobs(void)
+{
+  return binex_cobs_get(&binex_default);
+}
+#endif
+
+uint8_t binex_transmitter_init(void *buff, uint16_t size)
+{
+  return binex_tx_init(&binex_default, buff, size);
+}
+
+BinexTxStatus_t binex_transmit(void)
+{
+  return binex_tx(&binex_default);
+}
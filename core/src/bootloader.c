@@ -4,10 +4,12 @@
 #include "binex-lib.h"
 #include "utils.h"
 #include "crc16.h"
+#include "journal.h"
+#include "rs-fec.h"
+#include "relay.h"
 #include "monocypher.h"
 #include "systick.h"
-#include "bootloader_hal_config.h"
-#include "bootloader_project_config.h"
+#include "bootloader_config.h"
 
 /******************************************************************************/
 
@@ -15,13 +17,6 @@
 
 /******************************************************************************/
 
-#define BUFFER_EXCH_SIZE 256
-
-#define CHUNK_DATA_SIZE 128
-#define MAC_SIZE 16
-
-/******************************************************************************/
-
 #define CMD_ACTIVATE 0x70
 #define CMD_BEGIN 0x71
 #define CMD_SEND 0x72
@@ -30,6 +25,23 @@
 #define CMD_CHECK_CRC 0x75
 #define CMD_APP_RUN 0x76
 #define CMD_ERASE_USER_DATA 0x78
+#define CMD_RESUME 0x79
+#define CMD_BCAST_BEGIN 0x7A
+#define CMD_BCAST_CHUNK 0x7B
+#define CMD_BCAST_END 0x7C
+#define CMD_BCAST_STATUS 0x7D
+#define CMD_BCAST_APP_RUN 0x7E
+#define CMD_DISCOVER 0x7F
+#define CMD_SET_FEC 0x80
+#define CMD_RELAY_SEND 0x81
+#define CMD_RELAY_POLL 0x82
+#define CMD_GET_STATS 0x83
+#define CMD_GET_TRACE 0x84
+#define CMD_LINK_TEST 0x85
+#define CMD_GET_INFO 0x86
+#define CMD_SEGMENT_MAP 0x87
+#define CMD_DELTA_BEGIN 0x88
+#define CMD_DELTA_CHUNK 0x89
 
 /******************************************************************************/
 
@@ -39,13 +51,9 @@ enum
   STATE_RX_WAIT,
   STATE_BEGIN,
   STATE_FLASH_CLEAR,
-  STATE_SEND_EVENT_FLASH_CLEAR,
-  STATE_SEND_EVENT_FLASH_CLEAR_1,
 
   STATE_USER_DATA_CLEAR_BEGIN,
   STATE_USER_DATA_CLEAR,
-  STATE_SEND_EVENT_USER_DATA_CLEAR,
-  STATE_SEND_EVENT_USER_DATA_CLEAR_1,
 
   STATE_APP_RUN,
   STATE_APP_RUN_1,
@@ -57,6 +65,109 @@ enum
   NUM_STATES
 };
 
+/* Состояние широковещательной сессии (ответ на CMD_BCAST_STATUS) */
+enum
+{
+  BCAST_IDLE = 0,     // Сессия не начата
+  BCAST_RECEIVE,      // Область приложения очищена, идет прием чанков
+  BCAST_ERASE_ERROR,  // Ошибка очистки области приложения или журнала
+  BCAST_END_VALID,    // Сессия завершена, MAC прошивки верный
+  BCAST_END_INVALID   // Сессия завершена, MAC прошивки неверный
+};
+
+#define BCAST_NUM_CHUNKS ((BOOTLOADER_APP_LENGTH + CHUNK_DATA_SIZE - 1) / CHUNK_DATA_SIZE)
+#define BCAST_BITMAP_SIZE ((BCAST_NUM_CHUNKS + 7) / 8)
+
+#ifdef BOOTLOADER_USE_SPARSE
+/*
+  Карта сегментов разреженного образа (CMD_SEGMENT_MAP). Чанки, целиком
+  состоящие из 0xFF, в файл обновления не входят: после очистки области
+  приложения эти участки и так читаются как 0xFF, поэтому MAC прошивки
+  по всей области сходится без их записи. Карта - зашифрованный чанк
+  с address = BOOTLOADER_APP_LENGTH (как у идентификационного) и len = 0,
+  открытый текст:
+    [0] количество сегментов N (1..SPARSE_MAX_SEGMENTS)
+    [1..] N x (адрес u32, длина u32) - участки с данными, по возрастанию
+  Чанки вне сегментов не принимаются, пропуски между сегментами
+  считаются записанными в журнале и в карте принятых чанков
+  широковещательной сессии
+*/
+#define SPARSE_MAX_SEGMENTS ((CHUNK_DATA_SIZE - 1) / 8)
+
+#if SPARSE_MAX_SEGMENTS == 0
+#error "BOOTLOADER_USE_SPARSE: CHUNK_DATA_SIZE is too small for a segment map"
+#endif
+#endif
+
+#ifdef BOOTLOADER_USE_DELTA
+/*
+  Разностное обновление (CMD_DELTA_BEGIN, CMD_DELTA_CHUNK): хост передает
+  поток операций, восстанавливающих новую прошивку из установленной.
+  Поток делится на чанки struct fw_chunk_s с address = DELTA_STREAM_BASE +
+  смещение в потоке. Формат потока:
+    [DELTA_VERSION][MAC базовой прошивки, 16 байт]
+    записи секторов: [номер сектора, varint][операции][DELTA_OP_END]
+  Операции, длина - varint:
+    DELTA_OP_COPY [длина][zigzag(источник - назначение), varint] - байты
+      установленной прошивки
+    DELTA_OP_ADD  [длина][байты] - новые данные
+    DELTA_OP_FILL [длина][байт] - повтор байта
+  Сектор собирается в ОЗУ целиком и только затем стирается и записывается,
+  поэтому источник копии может лежать в самом собираемом секторе. Копия из
+  уже перезаписанного сектора - ошибка потока: порядок секторов выбирает
+  хост (host/common/src/fw_delta.c). Сектора вне потока не меняются,
+  результат проверяется MAC прошивки (CHECK_CRC). Прерванное разностное
+  обновление продолжается только полным обновлением.
+  Поток не сжат: ADD несет только новые байты, а окну распаковщика
+  не хватило бы ОЗУ рядом с буфером сектора
+*/
+#define DELTA_STREAM_BASE 0x80000000UL
+#define DELTA_VERSION 1
+
+#define DELTA_OP_END 0x00
+#define DELTA_OP_COPY 0x01
+#define DELTA_OP_ADD 0x02
+#define DELTA_OP_FILL 0x03
+
+/* Разбор потока */
+enum
+{
+  DELTA_HEADER = 0, // Версия и MAC базовой прошивки
+  DELTA_SECTOR,     // Номер сектора
+  DELTA_OP,         // Код операции
+  DELTA_LEN,        // Длина операции
+  DELTA_ARG,        // Смещение источника COPY, байт FILL
+  DELTA_DATA,       // Данные ADD
+  DELTA_ERROR       // Ошибка, до следующего CMD_DELTA_BEGIN
+};
+
+#if (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH) > DELTA_STREAM_BASE
+#error "BOOTLOADER_USE_DELTA: application region overlaps DELTA_STREAM_BASE"
+#endif
+#endif
+
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+/*
+  Кэш записи: данные чанков (CMD_WRITE, CMD_BCAST_CHUNK) собираются
+  в копии сектора в ОЗУ в любом порядке и с любым выравниванием. Сектор
+  записывается во flash целиком, одним вызовом port_write_chunk с одной
+  проверкой, когда принят чанк, дописывающий последний байт сектора, когда
+  приходит чанк другого сектора, а также по CMD_END и CMD_BCAST_END. Если
+  сектор во flash уже не чистый (повтор чанка после записи сектора), он
+  перед записью стирается.
+  Ответ на CMD_WRITE:
+    0x00 на чанк, дописывающий сектор, - сектор записан во flash и проверен,
+      на остальные чанки - данные приняты в кэш;
+    0x01 - ошибка записи сектора в кэше. Данные остаются в кэше, и повтор
+      того же SEND/WRITE записывает сектор заново.
+  При последовательной передаче ошибка сектора приходит в ответ на его
+  последний чанк, так что хост повторяет чанк этого же сектора. Журнал
+  отмечает сектор записанным только после записи во flash
+*/
+#define CACHE_NONE 0xFFFFFFFFUL
+#define CACHE_WORDS (BOOTLOADER_FLASH_SECTOR_SIZE / 4)
+#endif
+
 #pragma pack(push, 1)
 
 struct fw_chunk_s
@@ -70,6 +181,218 @@ struct fw_chunk_s
 
 #pragma pack(pop)
 
+// Разбор запросов рассчитан на плотную упаковку чанка
+BOOTLOADER_STATIC_ASSERT(sizeof(struct fw_chunk_s) == FW_CHUNK_SIZE, fw_chunk_layout);
+
+// Время для счетчиков и трассировки, мкс
+#ifdef SYSTICK_GET_US
+#define TIME_US() SYSTICK_GET_US()
+#else
+#define TIME_US() (SYSTICK_GET_VALUE() * 1000UL)
+#endif
+
+// Наибольший ответ: с FEC тело пакета вместе с CRC16 и проверочными
+// байтами - одно кодовое слово до 255 байт (см. binex_transmitter_init)
+#ifdef BINEX_USE_FEC
+#define RESP_MAX_SIZE (255 - 2 - RS_MAX_NPAR)
+#else
+#define RESP_MAX_SIZE BUFFER_EXCH_SIZE
+#endif
+
+#ifdef BOOTLOADER_USE_RELAY
+// Ответ RELAY_POLL: заголовок и ответ нижестоящего устройства
+BOOTLOADER_STATIC_ASSERT((3 + RELAY_REPLY_MAX_SIZE) <= RESP_MAX_SIZE, relay_reply);
+#endif
+
+#ifdef BOOTLOADER_USE_STATS
+/*
+  Счетчики работы Bootloader-а с момента сброса (ответ на CMD_GET_STATS).
+  Все поля uint32_t, новые поля добавляются только в конец структуры,
+  при изменении смысла полей увеличивается STATS_VERSION.
+  Время - в мкс, если порт задает SYSTICK_GET_US(), иначе с точностью до мс
+*/
+#define STATS_VERSION 1
+
+struct stats_s
+{
+  uint32_t rx_bytes;         // Принято символов
+  uint32_t rx_frames;        // Принято пакетов
+  uint32_t rx_err_framing;   // Поврежденные пакеты: START внутри пакета, неверный ESC
+  uint32_t rx_err_size;      //   длина пакета больше буфера приемника
+  uint32_t rx_err_crc;       //   не совпала CRC16
+  uint32_t rx_err_fec;       //   ошибки не исправлены FEC
+  uint32_t rx_fec_corrected; // Исправлено байт кодом FEC
+  uint32_t rx_lost;          // Символов потеряно приемником (переполнение FIFO, USART)
+  uint32_t tx_bytes;         // Передано символов
+  uint32_t tx_frames;        // Передано пакетов (ответы и события)
+  uint32_t chunk_errors;     // Чанки, не прошедшие проверку AEAD
+  uint32_t identity_errors;  // Отвергнутые идентификационные чанки
+  uint32_t chunks_written;   // Записано чанков
+  uint32_t chunks_skipped;   // Чанки, уже записанные ранее (повтор WRITE)
+  uint32_t write_errors;     // Ошибки записи flash
+  uint32_t sectors_erased;   // Очищено секторов
+  uint32_t erase_errors;     // Ошибки очистки секторов
+  uint32_t mac_checks;       // Проверок MAC прошивки
+  uint32_t mac_errors;       //   из них неуспешных
+  uint32_t erase_time;       // Суммарное время очистки, мкс
+  uint32_t program_time;     // записи flash, мкс
+  uint32_t decrypt_time;     // расшифровки и проверки чанков, мкс
+  uint32_t mac_time;         // проверки MAC прошивки, мкс
+  uint32_t uptime_ms;        // Время с момента сброса, мс
+  uint32_t sectors_written;  // Записано секторов целиком (кэш записи, разностное обновление)
+};
+
+// Ответ: [cmd][status][версия][N][N x u32]
+BOOTLOADER_STATIC_ASSERT((4 + sizeof(struct stats_s)) <= BUFFER_EXCH_SIZE, stats_response);
+
+#define STATS_INC(f) (stats.f++)
+#define STATS_ADD(f, v) (stats.f += (v))
+#define STATS_TIME_BEGIN() uint32_t stats_t0 = TIME_US()
+#define STATS_TIME_END(f) (stats.f += TIME_US() - stats_t0)
+#else
+#define STATS_INC(f)
+#define STATS_ADD(f, v)
+#define STATS_TIME_BEGIN()
+#define STATS_TIME_END(f)
+#endif
+
+#ifdef BOOTLOADER_USE_TRACE
+/*
+  Кольцевой буфер событий (ответ на CMD_GET_TRACE). Записи нумеруются
+  с момента сброса, при заполнении буфера затираются самые старые.
+  Время записи - мкс (см. TIME_US), показывает порядок и интервалы
+  между событиями: например, переполнение приемника через два пакета
+  после долгой очистки сектора
+*/
+#ifndef BOOTLOADER_TRACE_SIZE
+#define BOOTLOADER_TRACE_SIZE 64
+#endif
+
+#if (BOOTLOADER_TRACE_SIZE & (BOOTLOADER_TRACE_SIZE - 1)) != 0
+#error "BOOTLOADER_TRACE_SIZE must be a power of two"
+#endif
+
+// Записей в одном ответе: 11 + 24 * 8 байт
+#define TRACE_PER_RESP 24
+
+enum
+{
+  TRACE_STATE = 1,     // arg - новое состояние автомата, value - предыдущее
+  TRACE_RX,            // arg - команда, value - длина пакета
+  TRACE_RX_BROKEN,     // arg - причина (BINEX_RX_ERR_xxx)
+  TRACE_RX_LOST,       // value - символов потеряно приемником с предыдущей записи
+  TRACE_TX,            // передан пакет: arg - команда, value - статус
+  TRACE_ERASE,         // начало очистки, value - номер сектора flash
+  TRACE_ERASE_END,     // arg - 0 сектор очищен, 1 ошибка
+  TRACE_WRITE,         // начало записи, arg 0 - чанка, 1 - сектора целиком,
+                       // value - его номер в области приложения
+  TRACE_WRITE_END,     // arg - 0 записано, 1 ошибка, 2 данные уже записаны
+  TRACE_CHUNK_ERROR,   // чанк не прошел проверку AEAD, arg - 1 идентификационный
+  TRACE_MAC,           // начало проверки MAC прошивки
+  TRACE_MAC_END        // arg - 0 MAC верный, 1 неверный
+};
+
+struct trace_s
+{
+  uint32_t time;
+  uint8_t event;
+  uint8_t arg;
+  uint16_t value;
+};
+
+// Запись передается как есть, 8 байт (kTraceEntrySize хоста)
+BOOTLOADER_STATIC_ASSERT(sizeof(struct trace_s) == 8, trace_entry_layout);
+BOOTLOADER_STATIC_ASSERT((11 + TRACE_PER_RESP * sizeof(struct trace_s)) <= RESP_MAX_SIZE, trace_response);
+
+#define TRACE(e, a, v) __trace((e), (a), (v))
+#else
+#define TRACE(e, a, v)
+#endif
+
+#ifdef BOOTLOADER_USE_LINK_TEST
+/*
+  Режим проверки канала (CMD_LINK_TEST): устройство принимает пакеты
+  заданного хостом размера и содержимого без ответа (SINK) либо отвечает
+  тем же содержимым (ECHO) и считает ошибки приема. По счетчикам хост
+  определяет полезную скорость и вероятность ошибки для выбора
+  скорости, размера чанка и FEC
+*/
+#define LINK_RESET 0x00  // Сброс счетчиков, начало измерения
+#define LINK_SINK 0x01   // Пакет без ответа
+#define LINK_ECHO 0x02   // Пакет с ответом тем же содержимым
+#define LINK_REPORT 0x03 // Чтение счетчиков
+
+// Содержимое пакета SINK, проверяется устройством
+#define LINK_PATTERN_ZERO 0x00  // 0x00
+#define LINK_PATTERN_ONES 0x01  // 0xFF
+#define LINK_PATTERN_COUNT 0x02 // (seq + i) & 0xFF
+#define LINK_PATTERN_PRBS 0x03  // xorshift32, начальное значение от seq
+#define LINK_PATTERN_ESC 0x04   // 0xF5, 0xF4, ... - каждый символ экранируется
+
+#define LINK_VERSION 1
+
+// Все поля uint32_t, новые добавляются только в конец
+struct link_stats_s
+{
+  uint32_t frames;         // Принято пакетов SINK
+  uint32_t bytes;          //   полезных байт в них
+  uint32_t seq_lost;       // Пропущено пакетов SINK по номерам
+  uint32_t pattern_errors; // Пакеты SINK с неверным содержимым при верной CRC
+  uint32_t echo_frames;    // Принято пакетов ECHO
+  uint32_t rx_err_framing; // Поврежденные пакеты, см. struct stats_s
+  uint32_t rx_err_size;
+  uint32_t rx_err_crc;
+  uint32_t rx_err_fec;
+  uint32_t rx_fec_corrected;
+  uint32_t rx_lost;        // Символов потеряно приемником
+  uint32_t usart_overrun;  // Флаги ошибок приемника
+  uint32_t usart_framing;
+  uint32_t usart_noise;
+  uint32_t first_us;       // Время приема первого и последнего пакета SINK
+  uint32_t last_us;        //   от сброса счетчиков, мкс
+  uint32_t elapsed_us;     // Время от сброса счетчиков
+};
+
+BOOTLOADER_STATIC_ASSERT((4 + sizeof(struct link_stats_s)) <= BUFFER_EXCH_SIZE, link_response);
+#endif
+
+/*
+  Описание Bootloader-а (ответ на CMD_GET_INFO): записи TLV
+  [тип][длина][значение], числа - little-endian. Хост пропускает
+  записи неизвестных типов, новые типы добавляются без смены INFO_VERSION
+*/
+#define INFO_VERSION 1
+
+#define INFO_COMMANDS 0x01     // Битовая карта команд 0x70..0x8F, бит i - команда 0x70 + i
+#define INFO_MAX_FRAME 0x02    // u16 максимальная длина пакета (BUFFER_EXCH_SIZE)
+#define INFO_CHUNK_SIZES 0x03  // u8[] поддерживаемые размеры данных чанка
+#define INFO_RX_FIFO 0x04      // u16 размер FIFO приемника - окно запросов хоста, байт
+#define INFO_SECTOR_SIZE 0x05  // u32 размер сектора flash
+#define INFO_APP_REGION 0x06   // u32 начало, u32 длина области приложения
+#define INFO_RESP_DELAY 0x07   // u16 задержка ответа, мс
+#define INFO_BAUD_RATES 0x08   // u32[] поддерживаемые скорости
+#define INFO_FEC 0x09          // u8 максимальное количество проверочных байт FEC
+#define INFO_FEATURES 0x0A     // u32 битовая карта возможностей (INFO_FEATURE_xxx)
+#define INFO_FIRMWARE 0x0B     // u8 прошивка прошла проверку, u8[16] MAC установленной прошивки
+#define INFO_DEVICE_ID 0x0C    // строка устройства (BOOTLOADER_DEVICE_ID_STRING)
+#define INFO_ADDRESS 0x0D      // u8 адрес устройства на шине
+
+#define INFO_FEATURE_JOURNAL (1UL << 0)    // RESUME
+#define INFO_FEATURE_BROADCAST (1UL << 1)  // BCAST_xxx
+#define INFO_FEATURE_ADDRESSING (1UL << 2) // адресация binex, DISCOVER
+#define INFO_FEATURE_RELAY (1UL << 3)      // RELAY_xxx
+#define INFO_FEATURE_USER_DATA (1UL << 4)  // ERASE_USER_DATA
+#define INFO_FEATURE_STATS (1UL << 5)      // GET_STATS
+#define INFO_FEATURE_TRACE (1UL << 6)      // GET_TRACE
+#define INFO_FEATURE_LINK_TEST (1UL << 7)  // LINK_TEST
+// (1UL << 8) - резерв, не используется
+#define INFO_FEATURE_DELTA (1UL << 9)       // разностные образы (DELTA_xxx)
+#define INFO_FEATURE_COBS (1UL << 10)       // кадрирование COBS (ACTIVATE)
+#define INFO_FEATURE_SPARSE (1UL << 11)     // разреженные образы (SEGMENT_MAP)
+
+// Режим кадрирования в запросе и ответе ACTIVATE
+#define FRAMING_COBS 0x01
+
 /******************************************************************************/
 
 static uint8_t state, _state;
@@ -77,7 +400,14 @@ static uint8_t flag_activated;
 static uint8_t flag_firmware_valid;
 static uint8_t flag_begin;
 static uint32_t adr_counter;
+static uint8_t flash_clear_cmd; // Команда, инициировавшая очистку области приложения
 static uint32_t timer;
+static uint32_t resp_delay; // Задержка перед отправкой ответа, мс
+
+static uint8_t erase_error;        // Ошибка очистки сектора adr_counter
+static uint8_t erase_event[10];    // Событие о ходе очистки
+static uint8_t erase_event_tx;     // Идет передача события
+static uint32_t erase_event_timer; // Время отправки последнего события
 
 #ifdef BOOTLOADER_TIMEOUT_MS
 static uint32_t boot_timer;
@@ -91,6 +421,84 @@ static uint8_t DataLen;        // Размер полезных данных в
 static uint32_t DataAddress;   // Смещение во flash, начиная с которого необходимо записать Data
 static uint8_t flag_DataIsSet; // Флаг наличия полезных данных в буфере Data
 
+#ifdef BOOTLOADER_USE_BROADCAST
+static uint8_t bcast_state;
+static uint16_t bcast_errors;                     // Количество отброшенных чанков
+static uint8_t bcast_bitmap[BCAST_BITMAP_SIZE]; // Карта принятых чанков
+#endif
+
+#ifdef BINEX_USE_FEC
+static uint8_t fec_pending; // Новый режим FEC, применяется после отправки ответа
+#endif
+
+#ifdef BINEX_USE_COBS
+static uint8_t cobs_pending; // Новый режим кадрирования, применяется после отправки ответа
+#endif
+
+#if defined(BOOTLOADER_USE_ADDRESSING) || defined(BOOTLOADER_USE_BROADCAST)
+static uint8_t unit_address; // Адрес устройства на шине
+#endif
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+static uint32_t rand_state; // Состояние ГПСЧ для случайной задержки ответа
+#endif
+
+#ifdef BOOTLOADER_USE_SPARSE
+static uint8_t sparse_count;                      // Сегментов в карте, 0 - образ без карты
+static uint32_t sparse_begin[SPARSE_MAX_SEGMENTS]; // Начало сегмента
+static uint32_t sparse_end[SPARSE_MAX_SEGMENTS];   // Адрес, следующий за сегментом
+#endif
+
+#ifdef BOOTLOADER_USE_DELTA
+static uint8_t delta_state;
+static uint8_t delta_error;  // Код ответа в состоянии DELTA_ERROR
+static uint8_t delta_op;     // Текущая операция
+static uint8_t delta_shift;  // Принято бит varint, 0 - начало значения
+static uint32_t delta_value; // Значение varint
+static uint16_t delta_len;   // Осталось байт операции, принято байт заголовка
+static uint16_t delta_pos;   // Собрано байт сектора
+static uint32_t delta_adr;   // Адрес собираемого сектора
+static uint32_t delta_offset; // Смещение следующего чанка в потоке
+static uint8_t delta_done[(BOOTLOADER_APP_SECTORS + 7) / 8]; // Перезаписанные сектора
+#endif
+
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+static uint32_t cache_adr;  // Сектор в кэше, CACHE_NONE - кэш пуст
+static uint8_t cache_dirty; // Кэш отличается от flash
+#ifdef BOOTLOADER_USE_JOURNAL
+static uint8_t cache_map[CACHE_WORDS / 8]; // Слова сектора, принятые целиком
+#endif
+#endif
+
+#if defined(BOOTLOADER_USE_DELTA) || defined(BOOTLOADER_USE_SECTOR_CACHE)
+// Сектор, собираемый в ОЗУ. Разностное обновление и кэш записи
+// работают в разных сессиях и используют один буфер
+static uint32_t sector_buf[BOOTLOADER_FLASH_SECTOR_SIZE / 4];
+#endif
+
+#ifdef BOOTLOADER_USE_JOURNAL
+static uint32_t journal_frontier; // Граница непрерывно записанных данных
+static uint32_t journal_mark_adr; // Следующий сектор, ожидающий отметки в журнале
+#endif
+
+#ifdef BOOTLOADER_USE_STATS
+static struct stats_s stats;
+#endif
+
+#ifdef BOOTLOADER_USE_LINK_TEST
+static struct link_stats_s link;
+static uint8_t link_active;       // Счетчики сброшены, идет измерение
+static uint16_t link_seq;         // Ожидаемый номер следующего пакета SINK
+static uint32_t link_t0;          // Время сброса счетчиков
+static uint32_t link_base[4];     // Счетчики порта при сбросе: потери, overrun, framing, noise
+#endif
+
+#ifdef BOOTLOADER_USE_TRACE
+static struct trace_s trace[BOOTLOADER_TRACE_SIZE];
+static uint32_t trace_count;   // Записей с момента сброса
+static uint32_t trace_rx_lost; // Значение port_serial_rx_lost() в последней записи
+#endif
+
 /* Строковая константа активации загрузчика */
 static const uint8_t activate_data[] = {'A', 'C', 'T', 'I', 'V', 'A', 'T', 'E'};
 
@@ -99,6 +507,19 @@ static const uint8_t expected_device_id[CHUNK_DATA_SIZE] = BOOTLOADER_DEVICE_ID_
 
 /******************************************************************************/
 
+#ifdef BOOTLOADER_USE_TRACE
+static void __trace(uint8_t event, uint8_t arg, uint16_t value)
+{
+  struct trace_s *t = &trace[trace_count & (BOOTLOADER_TRACE_SIZE - 1)];
+
+  t->time = TIME_US();
+  t->event = event;
+  t->arg = arg;
+  t->value = value;
+  trace_count++;
+}
+#endif
+
 /*
   Сравнение двух участков памяти
   Возвращает:
@@ -137,13 +558,24 @@ static uint8_t __app_poly1305_check(void)
 
   uint8_t calc_mac[MAC_SIZE];
 
+  STATS_INC(mac_checks);
+  STATS_TIME_BEGIN();
+  TRACE(TRACE_MAC, 0, 0);
+
   // 1. Считаем Poly1305 MAC по прошивке
   crypto_poly1305(calc_mac, flash_begin, firmware_size, IntegrityKey);
 
+  STATS_TIME_END(mac_time);
+
   // 2. Сравниваем с сохранённым
   if (crypto_verify16(calc_mac, flash_mac) != 0)
+  {
+    STATS_INC(mac_errors);
+    TRACE(TRACE_MAC_END, 1, 0);
     return 1; // MAC неверен
+  }
 
+  TRACE(TRACE_MAC_END, 0, 0);
   return 0; // OK
 }
 
@@ -164,6 +596,8 @@ static int __decrypt_and_verify_chunk(
   /* len */
   aad[4] = chunk->len;
 
+  STATS_TIME_BEGIN();
+
   /* Проверка и расшифровка, используется XChaCha20-Poly1305*/
   int ret = crypto_aead_unlock(
       plaintext,        // out: расшифрованные данные
@@ -174,6 +608,8 @@ static int __decrypt_and_verify_chunk(
       chunk->ciphertext,
       CHUNK_DATA_SIZE);
 
+  STATS_TIME_END(decrypt_time);
+
   /* crypto_aead_unlock():
      0  -> OK
     -1  -> MAC не совпал
@@ -217,12 +653,15 @@ static uint8_t __check_identity_chunk(void)
           chunk,
           Data) != 0)
   {
+    STATS_INC(identity_errors);
+    TRACE(TRACE_CHUNK_ERROR, 1, 0);
     return 1; // MAC / decrypt error
   }
 
   /* Сравнение идентификационной строки */
   if (__memcompare(Data, expected_device_id, CHUNK_DATA_SIZE) == 0)
   {
+    STATS_INC(identity_errors);
     return 1; // не тот девайс
   }
 
@@ -230,6 +669,99 @@ static uint8_t __check_identity_chunk(void)
   return 0;
 }
 
+#ifdef BOOTLOADER_USE_SPARSE
+/*
+  Участок adr..adr+len-1 целиком внутри одного сегмента карты.
+  Без карты принимается любой адрес
+*/
+static uint8_t __sparse_contains(uint32_t adr, uint32_t len)
+{
+  if (sparse_count == 0)
+    return 1;
+
+  for (uint8_t i = 0; i < sparse_count; i++)
+  {
+    if ((adr >= sparse_begin[i]) && ((adr + len) <= sparse_end[i]))
+      return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Пропуск участков без данных: возвращает adr, если он внутри сегмента,
+  иначе начало следующего сегмента либо конец области приложения
+*/
+static uint32_t __sparse_skip(uint32_t adr)
+{
+  if (sparse_count == 0)
+    return adr;
+
+  for (uint8_t i = 0; i < sparse_count; i++)
+  {
+    if (adr < sparse_end[i])
+      return (adr < sparse_begin[i]) ? sparse_begin[i] : adr;
+  }
+
+  return BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH;
+}
+
+/*
+  Прием карты сегментов из buffer_exch
+  Возвращает:
+    1 - неверная карта
+    0 - OK
+*/
+static uint8_t __sparse_map_load(void)
+{
+  const struct fw_chunk_s *chunk =
+      (const struct fw_chunk_s *)(buffer_exch + 1);
+  uint32_t prev = BOOTLOADER_APP_BEGIN;
+  uint8_t n;
+
+  sparse_count = 0;
+
+  if ((chunk->len != 0) || (chunk->address != BOOTLOADER_APP_LENGTH))
+    return 1;
+
+  // Карта расшифровывается в буфер Data, расшифрованный ранее чанк теряется
+  flag_DataIsSet = 0;
+
+  if (__decrypt_and_verify_chunk(EncryptionKey, chunk, Data) != 0)
+  {
+    STATS_INC(chunk_errors);
+    TRACE(TRACE_CHUNK_ERROR, 2, 0);
+    return 1;
+  }
+
+  n = Data[0];
+  if ((n == 0) || (n > SPARSE_MAX_SEGMENTS))
+    return 1;
+
+  for (uint8_t i = 0; i < n; i++)
+  {
+    uint32_t adr = GetUInt32(Data, 1 + 8 * i);
+    uint32_t len = GetUInt32(Data, 5 + 8 * i);
+
+    // Сегменты по возрастанию, без перекрытия, внутри области приложения
+    if ((adr < prev) ||
+        (adr >= (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH)) ||
+        (len == 0) ||
+        (len > (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH - adr)))
+    {
+      return 1;
+    }
+
+    sparse_begin[i] = adr;
+    sparse_end[i] = adr + len;
+    prev = adr + len;
+  }
+
+  sparse_count = n;
+  return 0;
+}
+#endif
+
 static uint8_t __decrypt_chunk(void)
 {
   flag_DataIsSet = 0;
@@ -247,6 +779,8 @@ static uint8_t __decrypt_chunk(void)
           chunk,
           Data) != 0)
   {
+    STATS_INC(chunk_errors);
+    TRACE(TRACE_CHUNK_ERROR, 0, 0);
     return 1; // MAC не сошёлся
   }
 
@@ -266,52 +800,1035 @@ static uint8_t __decrypt_chunk(void)
     return 1;
   }
 
+#ifdef BOOTLOADER_USE_SPARSE
+  /* Пропуски разреженного образа не записываются */
+  if (!__sparse_contains(DataAddress, DataLen))
+    return 1;
+#endif
+
   /* Если попали сюда, то все ОК */
   flag_DataIsSet = 1;
 
   return 0;
 }
 
-static void __app_run(void)
+#if defined(BOOTLOADER_USE_DELTA) || defined(BOOTLOADER_USE_SECTOR_CACHE)
+/*
+  Запись сектора adr целиком из sector_buf, сектор с данными
+  предварительно стирается
+  Возвращает:
+    0 - OK
+    1 - ошибка очистки или записи
+*/
+static uint8_t __sector_program(uint32_t adr)
 {
-  port_deinit_all();
-  port_application_run();
+  if (!port_sector_isclear(adr))
+  {
+    STATS_TIME_BEGIN();
+    TRACE(TRACE_ERASE, 0, adr / BOOTLOADER_FLASH_SECTOR_SIZE);
+    port_sector_erase(adr);
+    STATS_TIME_END(erase_time);
+    STATS_INC(sectors_erased);
+
+    if (!port_sector_isclear(adr))
+    {
+      STATS_INC(erase_errors);
+      TRACE(TRACE_ERASE_END, 1, adr / BOOTLOADER_FLASH_SECTOR_SIZE);
+      return 1;
+    }
+    TRACE(TRACE_ERASE_END, 0, adr / BOOTLOADER_FLASH_SECTOR_SIZE);
+  }
+
+  {
+    STATS_TIME_BEGIN();
+    TRACE(TRACE_WRITE, 1, (adr - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE);
+    uint8_t err = port_write_chunk((uint8_t *)sector_buf, adr, BOOTLOADER_FLASH_SECTOR_SIZE);
+    STATS_TIME_END(program_time);
+
+    if (err != 0)
+    {
+      STATS_INC(write_errors);
+      TRACE(TRACE_WRITE_END, 1, 0);
+      return 1;
+    }
+  }
+
+  STATS_INC(sectors_written);
+  TRACE(TRACE_WRITE_END, 0, 0);
+  return 0;
 }
+#endif
 
-static void __parsecmd(void)
+#ifdef BOOTLOADER_USE_DELTA
+static void __delta_begin(void)
 {
-  uint16_t len = binex_get_rxpack_len();
-  if (len == 0)
+  delta_state = DELTA_HEADER;
+  delta_error = 0x00;
+  delta_shift = 0;
+  delta_len = 0;
+  delta_offset = 0;
+  memset(delta_done, 0, sizeof(delta_done));
+}
+
+/*
+  Прием байта varint в delta_value
+  Возвращает:
+    0 - значение не закончено
+    1 - значение принято
+    2 - слишком длинное значение
+*/
+static uint8_t __delta_varint(uint8_t c)
+{
+  if (delta_shift == 0)
+    delta_value = 0;
+
+  delta_value |= (uint32_t)(c & 0x7F) << delta_shift;
+
+  if (c & 0x80)
   {
-    state = STATE_MAIN;
-    return;
+    delta_shift += 7;
+    return (delta_shift > 28) ? 2 : 0;
   }
 
-  switch (buffer_exch[0])
+  delta_shift = 0;
+  return 1;
+}
+
+/*
+  Источник копии adr..adr+len-1 внутри области приложения
+  и не затронут уже перезаписанными секторами
+*/
+static uint8_t __delta_source_valid(uint32_t adr, uint32_t len)
+{
+  uint32_t first, last;
+
+  if ((adr < BOOTLOADER_APP_BEGIN) ||
+      (adr >= (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH)) ||
+      (len > (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH - adr)))
   {
-  /////////////////////////////////////////
-  case CMD_ACTIVATE:
-    if (len != 9)
+    return 0;
+  }
+
+  first = (adr - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE;
+  last = (adr + len - 1 - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE;
+
+  for (uint32_t i = first; i <= last; i++)
+  {
+    if (delta_done[i >> 3] & (1 << (i & 0x07)))
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+  Запись собранного сектора. Сектор, совпадающий с flash, не перезаписывается
+  Возвращает:
+    0 - OK
+    1 - ошибка очистки или записи
+*/
+static uint8_t __delta_flush(void)
+{
+  uint32_t sector = (delta_adr - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE;
+
+  delta_done[sector >> 3] |= (1 << (sector & 0x07));
+
+  if (__memcompare((const uint8_t *)delta_adr, (const uint8_t *)sector_buf, BOOTLOADER_FLASH_SECTOR_SIZE))
+  {
+    STATS_INC(chunks_skipped);
+    return 0;
+  }
+
+  flag_firmware_valid = 0;
+  return __sector_program(delta_adr);
+}
+
+/*
+  Разбор очередного байта потока
+  Возвращает код ответа CMD_DELTA_CHUNK:
+    0x00 - OK
+    0x01 - ошибка потока, очистки или записи
+    0x03 - установленная прошивка не является базой потока
+*/
+static uint8_t __delta_byte(uint8_t c)
+{
+  uint8_t *sector = (uint8_t *)sector_buf;
+  uint8_t r;
+
+  switch (delta_state)
+  {
+  case DELTA_HEADER:
+    if (delta_len == 0)
     {
-      state = STATE_MAIN;
-      break;
+      if (c != DELTA_VERSION)
+        return 0x01;
+    }
+    else if (c != *(const uint8_t *)(BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH - MAC_SIZE + delta_len - 1))
+    {
+      return 0x03;
     }
 
-    // Проверяем сигнатуру
-    if (__check_activation_signature(buffer_exch + 1))
+    if (++delta_len == (1 + MAC_SIZE))
+      delta_state = DELTA_SECTOR;
+    return 0x00;
+
+  case DELTA_SECTOR:
+    r = __delta_varint(c);
+    if (r == 0)
+      return 0x00;
+
+    // Каждый сектор перезаписывается не более одного раза
+    if ((r != 1) || (delta_value >= BOOTLOADER_APP_SECTORS) ||
+        (delta_done[delta_value >> 3] & (1 << (delta_value & 0x07))))
     {
-      state = STATE_MAIN;
-      break;
+      return 0x01;
     }
 
-    // Если попали сюда, то все ОК
-    flag_activated = 1;
+    delta_adr = BOOTLOADER_APP_BEGIN + delta_value * BOOTLOADER_FLASH_SECTOR_SIZE;
+    delta_pos = 0;
+    delta_state = DELTA_OP;
+    return 0x00;
 
-    // Заполняем буфер ответа
-    buffer_exch[0] = CMD_ACTIVATE;
-    buffer_exch[1] = 0x00;
+  case DELTA_OP:
+    delta_op = c;
 
-    // Инициализируем передатчик
+    if (c == DELTA_OP_END)
+    {
+      // Сектор должен быть собран целиком
+      if (delta_pos != BOOTLOADER_FLASH_SECTOR_SIZE)
+        return 0x01;
+
+      delta_state = DELTA_SECTOR;
+      return __delta_flush();
+    }
+
+    if ((c != DELTA_OP_COPY) && (c != DELTA_OP_ADD) && (c != DELTA_OP_FILL))
+      return 0x01;
+
+    delta_state = DELTA_LEN;
+    return 0x00;
+
+  case DELTA_LEN:
+    r = __delta_varint(c);
+    if (r == 0)
+      return 0x00;
+
+    if ((r != 1) || (delta_value == 0) ||
+        (delta_value > (uint32_t)(BOOTLOADER_FLASH_SECTOR_SIZE - delta_pos)))
+    {
+      return 0x01;
+    }
+
+    delta_len = (uint16_t)delta_value;
+    delta_state = (delta_op == DELTA_OP_ADD) ? DELTA_DATA : DELTA_ARG;
+    return 0x00;
+
+  case DELTA_ARG:
+    if (delta_op == DELTA_OP_FILL)
+    {
+      memset(sector + delta_pos, c, delta_len);
+    }
+    else
+    {
+      uint32_t src;
+
+      r = __delta_varint(c);
+      if (r == 0)
+        return 0x00;
+      if (r != 1)
+        return 0x01;
+
+      // zigzag: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+      src = delta_adr + delta_pos + (uint32_t)((delta_value >> 1) ^ (0UL - (delta_value & 1)));
+
+      if (!__delta_source_valid(src, delta_len))
+        return 0x01;
+
+      memcpy(sector + delta_pos, (const uint8_t *)src, delta_len);
+    }
+
+    delta_pos += delta_len;
+    delta_state = DELTA_OP;
+    return 0x00;
+
+  case DELTA_DATA:
+    sector[delta_pos++] = c;
+    if (--delta_len == 0)
+      delta_state = DELTA_OP;
+    return 0x00;
+  }
+
+  return delta_error;
+}
+#endif
+
+#ifdef BOOTLOADER_USE_JOURNAL
+static void __journal_begin(uint32_t adr)
+{
+  journal_frontier = adr;
+  journal_mark_adr = adr;
+}
+
+/*
+  Новая сессия (BEGIN, DELTA_BEGIN, BCAST_BEGIN): журнал прежней сессии
+  заменяется журналом образа из идентификационного чанка в buffer_exch.
+  Если сектор журнала не удалось очистить или записать, сессия
+  не начинается: область приложения еще не тронута, а записанные
+  без журнала сектора RESUME потом не смог бы отличить от недописанных.
+  Возвращает 0 - OK, 1 - ошибка flash
+*/
+static uint8_t __journal_reset(void)
+{
+  if (JournalReset(((const struct fw_chunk_s *)(buffer_exch + 1))->tag) != 0)
+  {
+    STATS_INC(erase_errors);
+    return 1;
+  }
+
+  __journal_begin(BOOTLOADER_APP_BEGIN);
+  return 0;
+}
+
+/*
+  Учет успешно записанного чанка.
+  Сектор отмечается в журнале только тогда, когда он записан
+  непрерывно от своего начала до конца. Чанки, пришедшие не по порядку,
+  границу не сдвигают, такой сектор при возобновлении будет перезаписан
+*/
+static void __journal_chunk_written(uint32_t adr, uint32_t len)
+{
+  if ((adr <= journal_frontier) && ((adr + len) > journal_frontier))
+    journal_frontier = adr + len;
+
+#ifdef BOOTLOADER_USE_SPARSE
+  // Пропуски разреженного образа уже стерты
+  journal_frontier = __sparse_skip(journal_frontier);
+#endif
+
+  while ((journal_mark_adr + BOOTLOADER_FLASH_SECTOR_SIZE) <= journal_frontier)
+  {
+    JournalSectorSetDone(journal_mark_adr);
+    journal_mark_adr += BOOTLOADER_FLASH_SECTOR_SIZE;
+  }
+}
+#endif
+
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+static void __cache_drop(void)
+{
+  cache_adr = CACHE_NONE;
+  cache_dirty = 0;
+}
+
+#ifdef BOOTLOADER_USE_JOURNAL
+/*
+  Отметка в журнале данных записанного сектора: непрерывные
+  участки принятых слов учитываются как записанные чанки
+*/
+static void __cache_journal(void)
+{
+  uint16_t i = 0;
+
+  while (i < CACHE_WORDS)
+  {
+    uint16_t begin;
+
+    if (!(cache_map[i >> 3] & (1 << (i & 0x07))))
+    {
+      i++;
+      continue;
+    }
+
+    begin = i;
+    while ((i < CACHE_WORDS) && (cache_map[i >> 3] & (1 << (i & 0x07))))
+      i++;
+
+    __journal_chunk_written(cache_adr + begin * 4, (i - begin) * 4);
+  }
+
+  memset(cache_map, 0, sizeof(cache_map));
+}
+#endif
+
+/*
+  Запись сектора из кэша во flash
+  Возвращает:
+    0 - OK
+    1 - ошибка очистки или записи, данные остаются в кэше
+*/
+static uint8_t __cache_flush(void)
+{
+  if ((cache_adr == CACHE_NONE) || (cache_dirty == 0))
+    return 0;
+
+  if (!__memcompare((const uint8_t *)cache_adr, (const uint8_t *)sector_buf, BOOTLOADER_FLASH_SECTOR_SIZE))
+  {
+    if (__sector_program(cache_adr) != 0)
+      return 1;
+  }
+
+  cache_dirty = 0;
+
+#ifdef BOOTLOADER_USE_JOURNAL
+  __cache_journal();
+#endif
+
+  return 0;
+}
+
+/*
+  Прием данных в кэш, участок adr..adr+len целиком лежит в одном секторе
+  Возвращает:
+    0 - OK
+    1 - ошибка записи предыдущего сектора
+*/
+static uint8_t __cache_put(uint32_t adr, const uint8_t *data, uint16_t len)
+{
+  uint32_t sector = adr - ((adr - BOOTLOADER_APP_BEGIN) % BOOTLOADER_FLASH_SECTOR_SIZE);
+  uint8_t *buf = (uint8_t *)sector_buf;
+
+  if (sector != cache_adr)
+  {
+    if (__cache_flush() != 0)
+      return 1;
+
+    // Сектор мог быть частично записан раньше (RESUME, повтор чанка)
+    memcpy(buf, (const void *)sector, BOOTLOADER_FLASH_SECTOR_SIZE);
+    cache_adr = sector;
+#ifdef BOOTLOADER_USE_JOURNAL
+    memset(cache_map, 0, sizeof(cache_map));
+#endif
+  }
+
+  buf += adr - sector;
+
+  if (memcmp(buf, data, len) == 0)
+    STATS_INC(chunks_skipped);
+  else
+  {
+    memcpy(buf, data, len);
+    cache_dirty = 1;
+    STATS_INC(chunks_written);
+  }
+
+#ifdef BOOTLOADER_USE_JOURNAL
+  // Учитываются только слова, принятые целиком
+  for (uint16_t i = (adr - sector + 3) / 4; i < (adr - sector + len) / 4; i++)
+    cache_map[i >> 3] |= (1 << (i & 0x07));
+#endif
+
+  return 0;
+}
+
+/*
+  Запись расшифрованного чанка Data через кэш, чанк может
+  пересекать границу сектора
+  Возвращает:
+    0 - OK
+    1 - ошибка записи
+*/
+static uint8_t __write_data(void)
+{
+  uint32_t adr = DataAddress;
+  uint16_t pos = 0;
+
+  while (pos < DataLen)
+  {
+    uint32_t end = adr - ((adr - BOOTLOADER_APP_BEGIN) % BOOTLOADER_FLASH_SECTOR_SIZE) +
+                   BOOTLOADER_FLASH_SECTOR_SIZE;
+    uint16_t n = DataLen - pos;
+
+    if ((adr + n) > end)
+      n = end - adr;
+
+    if (__cache_put(adr, Data + pos, n) != 0)
+      return 1;
+
+    // Сектор дописан: записываем до ответа, чтобы ошибка
+    // пришла в ответе на чанк этого сектора
+    if (((adr + n) == end) && (__cache_flush() != 0))
+      return 1;
+
+    adr += n;
+    pos += n;
+  }
+
+  return 0;
+}
+#else
+/*
+  Запись расшифрованного чанка Data во flash-память
+  Возвращает:
+    0 - OK
+    1 - ошибка записи
+*/
+static uint8_t __write_data(void)
+{
+  if (!__memcompare((const uint8_t *)DataAddress, Data, DataLen))
+  {
+    // Если участки памяти не совпадают, то записываем.
+    // Иначе просто возвращаем ОК без повторной записи данных
+    STATS_TIME_BEGIN();
+    TRACE(TRACE_WRITE, 0, (DataAddress - BOOTLOADER_APP_BEGIN) / CHUNK_DATA_SIZE);
+    uint8_t err = port_write_chunk(Data, DataAddress, DataLen);
+    STATS_TIME_END(program_time);
+
+    if (err != 0)
+    {
+      STATS_INC(write_errors);
+      TRACE(TRACE_WRITE_END, 1, 0);
+      return 1;
+    }
+
+    STATS_INC(chunks_written);
+    TRACE(TRACE_WRITE_END, 0, 0);
+  }
+  else
+  {
+    STATS_INC(chunks_skipped);
+    TRACE(TRACE_WRITE_END, 2, 0);
+  }
+
+#ifdef BOOTLOADER_USE_JOURNAL
+  __journal_chunk_written(DataAddress, DataLen);
+#endif
+
+  return 0;
+}
+#endif
+
+#ifdef BOOTLOADER_USE_BROADCAST
+/*
+  Прием чанка широковещательной сессии.
+  Ответ на чанк не отправляется, результат учитывается
+  в карте принятых чанков, которую хост читает командой CMD_BCAST_STATUS
+*/
+static void __bcast_chunk(void)
+{
+  uint32_t offset;
+
+  if ((bcast_state != BCAST_RECEIVE) ||
+      (__decrypt_chunk() != 0) ||
+      (__write_data() != 0))
+  {
+    bcast_errors++;
+    return;
+  }
+
+  offset = DataAddress - BOOTLOADER_APP_BEGIN;
+
+  // Учитываются только чанки, выровненные на свой размер
+  if ((offset % CHUNK_DATA_SIZE) == 0)
+  {
+    offset /= CHUNK_DATA_SIZE;
+    bcast_bitmap[offset >> 3] |= (1 << (offset & 0x07));
+  }
+}
+#endif
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+/*
+  Допускается ли выполнение команды по широковещательному адресу.
+  Команды, требующие ответа на каждом шаге, выполняются только
+  по адресу устройства, иначе ответы устройств столкнутся на шине
+*/
+static uint8_t __cmd_allows_broadcast(uint8_t cmd)
+{
+  switch (cmd)
+  {
+  case CMD_ACTIVATE:
+  case CMD_DISCOVER:
+#ifdef BINEX_USE_FEC
+  case CMD_SET_FEC:
+#endif
+#ifdef BOOTLOADER_USE_BROADCAST
+  case CMD_BCAST_BEGIN:
+  case CMD_BCAST_CHUNK:
+  case CMD_BCAST_END:
+  case CMD_BCAST_APP_RUN:
+#ifdef BOOTLOADER_USE_SPARSE
+  case CMD_SEGMENT_MAP:
+#endif
+#endif
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Случайное число в диапазоне 0..max.
+  Начальное состояние - свертка UID МК, поэтому у устройств с одной
+  прошивкой последовательности разные даже при одновременном включении.
+  Дополнительно подмешивается время приема запроса в мкс:
+  расхождение тактовых генераторов делает его различным на разных устройствах
+*/
+static uint32_t __random(uint32_t max)
+{
+  rand_state = rand_state * 1103515245UL + 12345UL + TIME_US();
+  return (rand_state >> 16) % (max + 1);
+}
+#endif
+
+#if defined(BOOTLOADER_USE_ADDRESSING) || defined(BOOTLOADER_USE_BROADCAST)
+/*
+  Свертка уникального идентификатора МК (FNV-1a)
+*/
+static uint32_t __unique_id_hash(void)
+{
+  uint8_t id[PORT_UNIQUE_ID_SIZE];
+  uint32_t h = 2166136261UL;
+  uint8_t i;
+
+  port_get_unique_id(id);
+  for (i = 0; i < PORT_UNIQUE_ID_SIZE; i++)
+    h = (h ^ id[i]) * 16777619UL;
+
+  return h;
+}
+
+/*
+  Адрес устройства на шине. Если адрес не назначен при производстве
+  (см. port_get_unit_address), то он выводится из уникального
+  идентификатора МК в диапазон 0x00..0x7E.
+  Так устройства с одной и той же прошивкой получают разные адреса.
+  Свертки разных идентификаторов могут совпасть (для 10 устройств
+  на шине - примерно в 30% случаев), DISCOVER тогда находит один адрес
+  дважды, и таким устройствам адрес нужно назначить
+*/
+static uint8_t __unit_address(void)
+{
+  uint8_t addr = port_get_unit_address();
+
+  if (addr < BINEX_ADDRESS_BROADCAST)
+    return addr;
+
+  return (uint8_t)(__unique_id_hash() % BINEX_ADDRESS_BROADCAST);
+}
+#endif
+
+#ifdef BOOTLOADER_USE_STATS
+/*
+  Учет принятого символа и результата приема пакета
+*/
+static void __stats_rx(int16_t c, BinexRxStatus_t rx)
+{
+  if (c < 0)
+    return;
+
+  stats.rx_bytes++;
+
+  if (rx == BINEX_PACK_RX)
+  {
+    stats.rx_frames++;
+#ifdef BINEX_USE_FEC
+    stats.rx_fec_corrected += binex_get_rx_corrected();
+#endif
+  }
+  else if (rx == BINEX_PACK_BROKEN)
+  {
+    switch (binex_get_rx_error())
+    {
+    case BINEX_RX_ERR_SIZE:
+      stats.rx_err_size++;
+      break;
+    case BINEX_RX_ERR_CRC:
+      stats.rx_err_crc++;
+      break;
+    case BINEX_RX_ERR_FEC:
+      stats.rx_err_fec++;
+      break;
+    default:
+      stats.rx_err_framing++;
+      break;
+    }
+  }
+}
+#endif
+
+#ifdef BOOTLOADER_USE_LINK_TEST
+/*
+  Учет результата приема пакета в режиме проверки канала
+*/
+static void __link_rx(BinexRxStatus_t rx)
+{
+  if (!link_active)
+    return;
+
+  if (rx == BINEX_PACK_RX)
+  {
+#ifdef BINEX_USE_FEC
+    link.rx_fec_corrected += binex_get_rx_corrected();
+#endif
+  }
+  else if (rx == BINEX_PACK_BROKEN)
+  {
+    switch (binex_get_rx_error())
+    {
+    case BINEX_RX_ERR_SIZE:
+      link.rx_err_size++;
+      break;
+    case BINEX_RX_ERR_CRC:
+      link.rx_err_crc++;
+      break;
+    case BINEX_RX_ERR_FEC:
+      link.rx_err_fec++;
+      break;
+    default:
+      link.rx_err_framing++;
+      break;
+    }
+  }
+}
+
+/*
+  Проверка содержимого пакета SINK
+  Возвращает:
+    0 - содержимое совпадает с шаблоном либо шаблон неизвестен
+    1 - содержимое не совпадает
+*/
+static uint8_t __link_check_pattern(const uint8_t *p, uint16_t len, uint8_t pattern, uint16_t seq)
+{
+  uint32_t x = seq * 2654435761UL + 1;
+
+  for (uint16_t i = 0; i < len; i++)
+  {
+    uint8_t expected;
+
+    switch (pattern)
+    {
+    case LINK_PATTERN_ZERO:
+      expected = 0x00;
+      break;
+    case LINK_PATTERN_ONES:
+      expected = 0xFF;
+      break;
+    case LINK_PATTERN_COUNT:
+      expected = (uint8_t)(seq + i);
+      break;
+    case LINK_PATTERN_PRBS:
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      expected = (uint8_t)(x >> 24);
+      break;
+    case LINK_PATTERN_ESC:
+      expected = (i & 1) ? 0xF4 : 0xF5;
+      break;
+    default:
+      return 0;
+    }
+
+    if (p[i] != expected)
+      return 1;
+  }
+
+  return 0;
+}
+
+static void __link_reset(void)
+{
+  memset(&link, 0, sizeof(link));
+  link_active = 1;
+  link_seq = 0;
+  link_t0 = TIME_US();
+  link_base[0] = port_serial_rx_lost();
+  port_serial_rx_errors(&link_base[1], &link_base[2], &link_base[3]);
+}
+#endif
+
+/*
+  Добавить запись TLV в ответ CMD_GET_INFO
+  Возвращает указатель на следующую запись
+*/
+static uint8_t *__info_put(uint8_t *p, uint8_t type, const void *value, uint8_t len)
+{
+  p[0] = type;
+  p[1] = len;
+  memcpy(p + 2, value, len);
+  return p + 2 + len;
+}
+
+static uint8_t *__info_put_u32(uint8_t *p, uint8_t type, uint32_t value)
+{
+  p[0] = type;
+  p[1] = 4;
+  UInt32ToBuff(p + 2, value);
+  return p + 6;
+}
+
+static uint8_t *__info_put_u16(uint8_t *p, uint8_t type, uint16_t value)
+{
+  p[0] = type;
+  p[1] = 2;
+  UInt16ToBuff(p + 2, value);
+  return p + 4;
+}
+
+/*
+  Формирование ответа CMD_GET_INFO в buffer_exch
+  Возвращает длину ответа
+*/
+static uint16_t __info_build(void)
+{
+  static const uint8_t commands[] = {
+      CMD_ACTIVATE, CMD_BEGIN, CMD_SEND, CMD_WRITE, CMD_END, CMD_CHECK_CRC, CMD_APP_RUN,
+      CMD_GET_INFO,
+#ifdef BOOTLOADER_USE_USER_DATA
+      CMD_ERASE_USER_DATA,
+#endif
+#ifdef BOOTLOADER_USE_JOURNAL
+      CMD_RESUME,
+#endif
+#ifdef BOOTLOADER_USE_BROADCAST
+      CMD_BCAST_BEGIN, CMD_BCAST_CHUNK, CMD_BCAST_END, CMD_BCAST_STATUS, CMD_BCAST_APP_RUN,
+#endif
+#ifdef BOOTLOADER_USE_ADDRESSING
+      CMD_DISCOVER,
+#endif
+#ifdef BINEX_USE_FEC
+      CMD_SET_FEC,
+#endif
+#ifdef BOOTLOADER_USE_RELAY
+      CMD_RELAY_SEND, CMD_RELAY_POLL,
+#endif
+#ifdef BOOTLOADER_USE_STATS
+      CMD_GET_STATS,
+#endif
+#ifdef BOOTLOADER_USE_TRACE
+      CMD_GET_TRACE,
+#endif
+#ifdef BOOTLOADER_USE_LINK_TEST
+      CMD_LINK_TEST,
+#endif
+#ifdef BOOTLOADER_USE_SPARSE
+      CMD_SEGMENT_MAP,
+#endif
+#ifdef BOOTLOADER_USE_DELTA
+      CMD_DELTA_BEGIN, CMD_DELTA_CHUNK,
+#endif
+  };
+  const uint8_t chunk_size = CHUNK_DATA_SIZE;
+  uint8_t *p = buffer_exch + 3;
+  uint32_t features = 0;
+  uint8_t map[4] = {0};
+  uint8_t id_len = 0;
+
+  for (uint8_t i = 0; i < sizeof(commands); i++)
+    map[(commands[i] - 0x70) >> 3] |= 1 << ((commands[i] - 0x70) & 0x07);
+
+#ifdef BOOTLOADER_USE_JOURNAL
+  features |= INFO_FEATURE_JOURNAL;
+#endif
+#ifdef BOOTLOADER_USE_BROADCAST
+  features |= INFO_FEATURE_BROADCAST;
+#endif
+#ifdef BOOTLOADER_USE_ADDRESSING
+  features |= INFO_FEATURE_ADDRESSING;
+#endif
+#ifdef BOOTLOADER_USE_RELAY
+  features |= INFO_FEATURE_RELAY;
+#endif
+#ifdef BOOTLOADER_USE_USER_DATA
+  features |= INFO_FEATURE_USER_DATA;
+#endif
+#ifdef BOOTLOADER_USE_STATS
+  features |= INFO_FEATURE_STATS;
+#endif
+#ifdef BOOTLOADER_USE_TRACE
+  features |= INFO_FEATURE_TRACE;
+#endif
+#ifdef BOOTLOADER_USE_LINK_TEST
+  features |= INFO_FEATURE_LINK_TEST;
+#endif
+#ifdef BINEX_USE_COBS
+  features |= INFO_FEATURE_COBS;
+#endif
+#ifdef BOOTLOADER_USE_SPARSE
+  features |= INFO_FEATURE_SPARSE;
+#endif
+#ifdef BOOTLOADER_USE_DELTA
+  features |= INFO_FEATURE_DELTA;
+#endif
+
+  buffer_exch[0] = CMD_GET_INFO;
+  buffer_exch[1] = 0x00;
+  buffer_exch[2] = INFO_VERSION;
+
+  p = __info_put(p, INFO_COMMANDS, map, sizeof(map));
+  p = __info_put_u16(p, INFO_MAX_FRAME, BUFFER_EXCH_SIZE);
+  p = __info_put(p, INFO_CHUNK_SIZES, &chunk_size, 1);
+#ifdef BOOTLOADER_RX_FIFO_SIZE
+  p = __info_put_u16(p, INFO_RX_FIFO, BOOTLOADER_RX_FIFO_SIZE);
+#endif
+  p = __info_put_u32(p, INFO_SECTOR_SIZE, BOOTLOADER_FLASH_SECTOR_SIZE);
+
+  p[0] = INFO_APP_REGION;
+  p[1] = 8;
+  UInt32ToBuff(p + 2, BOOTLOADER_APP_BEGIN);
+  UInt32ToBuff(p + 6, BOOTLOADER_APP_LENGTH);
+  p += 10;
+
+  p = __info_put_u16(p, INFO_RESP_DELAY, BOOTLOADER_RESPONSE_DELAY_MS);
+  p = __info_put_u32(p, INFO_BAUD_RATES, BOOTLOADER_UART_BAUD);
+#ifdef BINEX_USE_FEC
+  {
+    const uint8_t npar = RS_MAX_NPAR;
+    p = __info_put(p, INFO_FEC, &npar, 1);
+  }
+#endif
+  p = __info_put_u32(p, INFO_FEATURES, features);
+
+  // MAC в конце области приложения однозначно определяет установленный образ
+  p[0] = INFO_FIRMWARE;
+  p[1] = 1 + MAC_SIZE;
+  p[2] = flag_firmware_valid;
+  memcpy(p + 3, (const uint8_t *)(BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH - MAC_SIZE), MAC_SIZE);
+  p += 3 + MAC_SIZE;
+
+  while ((id_len < 32) && (id_len < CHUNK_DATA_SIZE) && (expected_device_id[id_len] != 0))
+    id_len++;
+  p = __info_put(p, INFO_DEVICE_ID, expected_device_id, id_len);
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+  {
+    p = __info_put(p, INFO_ADDRESS, &unit_address, 1);
+  }
+#endif
+
+  return p - buffer_exch;
+}
+
+/*
+  Передача события о ходе очистки, вызывается на каждом шаге очистки.
+  Возвращает 1, пока событие не ушло в линию полностью: на время очистки
+  сектора прерывания запрещены и ядро останавливается на выборке из flash,
+  передатчик USART досылает только символы, уже находящиеся в его регистрах
+*/
+static uint8_t __erase_event_pump(void)
+{
+  if (erase_event_tx && (binex_transmit() == BINEX_PACK_TX))
+  {
+    erase_event_tx = 0;
+    STATS_INC(tx_frames);
+    TRACE(TRACE_TX, erase_event[0], erase_event[1]);
+  }
+
+  return erase_event_tx || !port_serial_transfer_completed();
+}
+
+/*
+  Событие о ходе очистки: block из total секторов очищено.
+  Отправляется не чаще BOOTLOADER_ERASE_EVENT_INTERVAL_MS и только если
+  предыдущее уже передано, иначе пропускается - следующее событие
+  несет текущее значение. Событие передается между секторами: следующий
+  сектор очищается после окончания передачи (около 1 мс на 115200)
+*/
+static void __erase_event(uint8_t cmd, uint32_t total, uint32_t block)
+{
+  if (erase_event_tx || ((SYSTICK_GET_VALUE() - erase_event_timer) < BOOTLOADER_ERASE_EVENT_INTERVAL_MS))
+    return;
+
+  erase_event_timer = SYSTICK_GET_VALUE();
+
+  erase_event[0] = cmd;
+  erase_event[1] = 0xFF;
+  UInt32ToBuff(erase_event + 2, total);
+  UInt32ToBuff(erase_event + 6, block);
+  binex_transmitter_init(erase_event, 10);
+  erase_event_tx = 1;
+
+  __erase_event_pump();
+}
+
+static void __app_run(void)
+{
+  port_deinit_all();
+  port_application_run();
+}
+
+static void __parsecmd(void)
+{
+  uint16_t len = binex_get_rxpack_len();
+  if (len == 0)
+  {
+    state = STATE_MAIN;
+    return;
+  }
+
+  resp_delay = BOOTLOADER_RESPONSE_DELAY_MS;
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+  uint8_t flag_broadcast = (binex_get_rxpack_addr() == BINEX_ADDRESS_BROADCAST);
+
+  if (flag_broadcast && !__cmd_allows_broadcast(buffer_exch[0]))
+  {
+    state = STATE_MAIN;
+    return;
+  }
+#endif
+
+  switch (buffer_exch[0])
+  {
+  /////////////////////////////////////////
+  case CMD_ACTIVATE:
+    /*
+      Запрос:
+        [0] CMD_ACTIVATE
+        [1..8] сигнатура
+        [9] необязательно, режим кадрирования (FRAMING_xxx)
+      Если режим кадрирования запрошен, то в ответе [2] - установленный
+      режим. Ответ отправляется еще в текущем режиме, новый режим
+      действует начиная со следующего пакета и до сброса устройства
+    */
+    if ((len != 9) && (len != 10))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    // Проверяем сигнатуру
+    if (__check_activation_signature(buffer_exch + 1))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    // Если попали сюда, то все ОК
+    flag_activated = 1;
+
+    // Заполняем буфер ответа
+    buffer_exch[0] = CMD_ACTIVATE;
+    buffer_exch[1] = 0x00;
+
+    if (len == 10)
+    {
+      buffer_exch[2] = 0;
+#ifdef BINEX_USE_COBS
+      // COBS и FEC вместе не используются
+      cobs_pending = (buffer_exch[9] & FRAMING_COBS) ? 1 : 0;
+#ifdef BINEX_USE_FEC
+      if (binex_get_fec() != 0)
+        cobs_pending = 0;
+#endif
+      if (cobs_pending)
+        buffer_exch[2] = FRAMING_COBS;
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+      // По широковещательному адресу режим переключается без ответа
+      if (flag_broadcast)
+      {
+        binex_set_cobs(cobs_pending);
+        cobs_pending = 0xFF;
+      }
+#endif
+#endif
+      binex_transmitter_init(buffer_exch, 3);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
+    // Инициализируем передатчик
     binex_transmitter_init(buffer_exch, 2);
     state = STATE_SEND_RESP;
     break;
@@ -327,7 +1844,255 @@ static void __parsecmd(void)
       Это является защитой от невнимательности и "кривых рук", 
       позволяющая не оставить пользователя с окирпиченным девайсом 
       в самый неподходящий момент времени.
+      Ответ [CMD_BEGIN][0x01] без номера сектора - не удалось обновить
+      журнал сессии, область приложения не тронута, запрос можно повторить.
+    */
+    if (flag_activated == 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    if (len != (1 + sizeof(struct fw_chunk_s)))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    if (__check_identity_chunk() != 0)
+    {
+      buffer_exch[0] = CMD_BEGIN;
+      buffer_exch[1] = 0x02;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
+#ifdef BOOTLOADER_USE_JOURNAL
+    // Новая сессия, старый журнал больше не нужен
+    if (__journal_reset() != 0)
+    {
+      // Прежняя сессия тоже не продолжается: ее журнал уже стерт
+      flag_begin = 0;
+      buffer_exch[0] = CMD_BEGIN;
+      buffer_exch[1] = 0x01;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+#endif
+
+#ifdef BOOTLOADER_USE_SPARSE
+    sparse_count = 0;
+#endif
+
+    flash_clear_cmd = CMD_BEGIN;
+    state = STATE_BEGIN;
+    break;
+    /////////////////////////////////////////
+#ifdef BOOTLOADER_USE_JOURNAL
+  case CMD_RESUME:
+    /*
+      Команда RESUME позволяет продолжить прерванную сессию обновления
+      (разрыв связи, сброс питания) без повторной очистки и записи
+      всей области приложения. Принимает тот же идентификационный чанк,
+      что и BEGIN. Если журнал относится к этому же образу, то стираются
+      только не записанные до конца сектора, а в ответе возвращается адрес,
+      начиная с которого хост должен продолжить передачу чанков.
+    */
+    if (flag_activated == 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    if (len != (1 + sizeof(struct fw_chunk_s)))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[0] = CMD_RESUME;
+
+    if (__check_identity_chunk() != 0)
+    {
+      buffer_exch[1] = 0x02;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
+    if (!JournalIsMatch(((const struct fw_chunk_s *)(buffer_exch + 1))->tag))
+    {
+      // Продолжать нечего, хосту необходимо начать с команды BEGIN
+      buffer_exch[1] = 0x03;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
+    __journal_begin(JournalFirstIncomplete());
+
+#ifdef BOOTLOADER_USE_SPARSE
+    sparse_count = 0;
+#endif
+
+    flash_clear_cmd = CMD_RESUME;
+    state = STATE_BEGIN;
+    break;
+#endif
+    /////////////////////////////////////////
+#ifdef BOOTLOADER_USE_SPARSE
+  case CMD_SEGMENT_MAP:
+  {
+    /*
+      Карта сегментов разреженного образа, отправляется после
+      BEGIN/RESUME/BCAST_BEGIN до первого чанка.
+      Запрос:
+        [0] CMD_SEGMENT_MAP
+        [1..] struct fw_chunk_s, address = BOOTLOADER_APP_LENGTH, len = 0
+      Ответ:
+        [0] CMD_SEGMENT_MAP
+        [1] 0x00 - OK, 0x01 - неверная карта, 0x02 - сессия не начата
+      В широковещательной сессии ответ не отправляется
+    */
+    uint8_t status = 0x00;
+
+    if (flag_activated == 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    if (len != (1 + sizeof(struct fw_chunk_s)))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    if (flag_begin == 0)
+      status = 0x02;
+    else if (__sparse_map_load() != 0)
+      status = 0x01;
+
+#ifdef BOOTLOADER_USE_JOURNAL
+    // Граница записанных данных переносится через пропуски
+    if (status == 0x00)
+      __journal_chunk_written(journal_frontier, 0);
+#endif
+
+#ifdef BOOTLOADER_USE_BROADCAST
+    if (flash_clear_cmd == CMD_BCAST_BEGIN)
+    {
+      if ((status == 0x00) && (bcast_state == BCAST_RECEIVE))
+      {
+        // Чанки пропусков считаются принятыми
+        for (uint16_t i = 0; i < BCAST_NUM_CHUNKS; i++)
+        {
+          uint32_t adr = BOOTLOADER_APP_BEGIN + (uint32_t)i * CHUNK_DATA_SIZE;
+          uint32_t size = BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH - adr;
+
+          if (size > CHUNK_DATA_SIZE)
+            size = CHUNK_DATA_SIZE;
+
+          if (!__sparse_contains(adr, size))
+            bcast_bitmap[i >> 3] |= (1 << (i & 0x07));
+        }
+      }
+
+      state = STATE_MAIN;
+      break;
+    }
+#endif
+
+    buffer_exch[0] = CMD_SEGMENT_MAP;
+    buffer_exch[1] = status;
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_SEND_RESP;
+  }
+  break;
+    /////////////////////////////////////////
+#endif
+#ifdef BOOTLOADER_USE_DELTA
+  case CMD_DELTA_BEGIN:
+    /*
+      Начало разностного обновления, заменяет BEGIN: область приложения
+      не очищается, сектора перезаписываются по мере приема потока.
+      Запрос:
+        [0] CMD_DELTA_BEGIN
+        [1..] идентификационный чанк
+      Ответ:
+        [0] CMD_DELTA_BEGIN
+        [1] 0x00 - OK, 0x01 - ошибка записи журнала (можно повторить),
+            0x02 - неверный идентификационный чанк,
+            0x03 - установленная прошивка повреждена, нужно полное обновление
+    */
+    if (flag_activated == 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    if (len != (1 + sizeof(struct fw_chunk_s)))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[0] = CMD_DELTA_BEGIN;
+
+    if (__check_identity_chunk() != 0)
+      buffer_exch[1] = 0x02;
+    else if (__app_poly1305_check() != 0)
+      buffer_exch[1] = 0x03;
+#ifdef BOOTLOADER_USE_JOURNAL
+    // Сектора меняются на месте, журнал прежней сессии больше не верен
+    else if (__journal_reset() != 0)
+    {
+      flag_begin = 0;
+      buffer_exch[1] = 0x01;
+    }
+#endif
+    else
+    {
+      __delta_begin();
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+      __cache_drop(); // Буфер сектора занят разностным обновлением
+#endif
+#ifdef BOOTLOADER_USE_BROADCAST
+      bcast_state = BCAST_IDLE;
+#endif
+
+      flag_begin = 1;
+      flag_DataIsSet = 0;
+      flash_clear_cmd = CMD_DELTA_BEGIN; // Сессию начала DELTA_BEGIN, очистки нет
+      buffer_exch[1] = 0x00;
+    }
+
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_SEND_RESP;
+    break;
+    /////////////////////////////////////////
+  case CMD_DELTA_CHUNK:
+  {
+    /*
+      Очередной чанк потока разностного обновления, чанки принимаются
+      строго по порядку.
+      Запрос:
+        [0] CMD_DELTA_CHUNK
+        [1..] struct fw_chunk_s, address = DELTA_STREAM_BASE + смещение в потоке
+      Ответ:
+        [0] CMD_DELTA_CHUNK
+        [1] 0x00 - OK, в том числе повтор уже принятого чанка
+            0x01 - ошибка расшифровки, потока, очистки или записи
+            0x02 - сессия не начата либо чанк не следующий по порядку
+            0x03 - установленная прошивка не является базой потока
     */
+    const struct fw_chunk_s *chunk =
+        (const struct fw_chunk_s *)(buffer_exch + 1);
+    uint32_t offset = chunk->address - DELTA_STREAM_BASE;
+    uint8_t status = 0x00;
+
     if (flag_activated == 0)
     {
       state = STATE_MAIN;
@@ -340,18 +2105,47 @@ static void __parsecmd(void)
       break;
     }
 
-    if (__check_identity_chunk() != 0)
+    if ((flag_begin == 0) || (flash_clear_cmd != CMD_DELTA_BEGIN))
+      status = 0x02;
+    else if ((chunk->address < DELTA_STREAM_BASE) ||
+             (chunk->len == 0) || (chunk->len > CHUNK_DATA_SIZE))
+      status = 0x01;
+    else if (offset > delta_offset)
+      status = 0x02; // Предыдущий чанк еще не принят
+    else if (chunk->len <= (delta_offset - offset))
+      status = 0x00; // Повтор: ответ на чанк был потерян
+    else if (offset != delta_offset)
+      status = 0x02;
+    else if (__decrypt_and_verify_chunk(EncryptionKey, chunk, Data) != 0)
     {
-      buffer_exch[0] = CMD_BEGIN;
-      buffer_exch[1] = 0x02;
-      binex_transmitter_init(buffer_exch, 2);
-      state = STATE_SEND_RESP;
-      break;
+      STATS_INC(chunk_errors);
+      TRACE(TRACE_CHUNK_ERROR, 0, 0);
+      status = 0x01;
+    }
+    else
+    {
+      flag_DataIsSet = 0;
+
+      for (uint8_t i = 0; (i < chunk->len) && (status == 0x00); i++)
+        status = __delta_byte(Data[i]);
+
+      if (status == 0x00)
+        delta_offset += chunk->len;
+      else if (delta_state != DELTA_ERROR)
+      {
+        delta_error = status;
+        delta_state = DELTA_ERROR;
+      }
     }
 
-    state = STATE_BEGIN;
-    break;
+    buffer_exch[0] = CMD_DELTA_CHUNK;
+    buffer_exch[1] = status;
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_SEND_RESP;
+  }
+  break;
     /////////////////////////////////////////
+#endif
 #ifdef BOOTLOADER_USE_USER_DATA
   case CMD_ERASE_USER_DATA:
     if (flag_activated == 0)
@@ -396,113 +2190,669 @@ static void __parsecmd(void)
       break;
     }
 
-    buffer_exch[0] = CMD_WRITE;
+    buffer_exch[0] = CMD_WRITE;
+
+    if (
+#ifdef BOOTLOADER_USE_DELTA
+        (flash_clear_cmd == CMD_DELTA_BEGIN) || // Сессия разностного обновления
+#endif
+        (flag_begin == 0) || (flag_DataIsSet == 0))
+    {
+      buffer_exch[1] = 0x02;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
+    if (__write_data() != 0)
+      buffer_exch[1] = 0x01; // ошибка записи
+    else
+      buffer_exch[1] = 0x00; // иначе ОК
+
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_SEND_RESP;
+    break;
+  /////////////////////////////////////////
+  case CMD_END:
+    if (flag_activated == 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[0] = CMD_END;
+
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+    // Последний сектор еще в кэше
+    if (__cache_flush() != 0)
+    {
+      buffer_exch[1] = 0x01;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+#endif
+
+    flag_begin = 0;
+    buffer_exch[1] = 0x00;
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_SEND_RESP;
+    break;
+  /////////////////////////////////////////
+  case CMD_CHECK_CRC:
+    if (flag_activated == 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[0] = CMD_CHECK_CRC;
+
+    if (flag_begin)
+    {
+      // В этом состоянии нельзя выполнять это действие,
+      // сначала надо до конца записать прошивку
+      buffer_exch[1] = 0x02;
+    }
+    else if (__app_poly1305_check() != 0)
+    {
+      flag_firmware_valid = 0;
+      buffer_exch[1] = 0x01; // ошибка расшифровки
+    }
+    else
+    {
+      flag_firmware_valid = 1;
+      buffer_exch[1] = 0x00; // иначе ОК
+    }
+
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_SEND_RESP;
+    break;
+  /////////////////////////////////////////
+  case CMD_APP_RUN:
+    if (flag_activated == 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[0] = CMD_APP_RUN;
+
+    if (flag_begin)
+    {
+      // В этом состоянии нельзя выполнять это действие,
+      // сначала надо до конца записать прошивку
+      buffer_exch[1] = 0x02;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+    else if (__app_poly1305_check() != 0) // Если основная прошивка отсутствует, либо повреждена
+    {
+      flag_firmware_valid = 0;
+      buffer_exch[1] = 0x01;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
+    // Отправляем ответ, после чего запускаем прошивку
+    buffer_exch[1] = 0x00;
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_APP_RUN;
+    break;
+    /////////////////////////////////////////
+#ifdef BOOTLOADER_USE_BROADCAST
+    /*
+      Широковещательная сессия обновления.
+      Все устройства на шине принимают один и тот же поток чанков
+      и НЕ отвечают на него, иначе ответы столкнутся на шине.
+      Каждое устройство ведет карту принятых чанков, хост опрашивает
+      устройства по одному командой CMD_BCAST_STATUS с адресом устройства
+      и досылает только недостающие чанки.
+    */
+  case CMD_BCAST_BEGIN:
+    /*
+      Заменяет собой ACTIVATE + BEGIN: успешная проверка
+      идентификационного чанка одновременно активирует Bootloader
+    */
+    if (len != (1 + sizeof(struct fw_chunk_s)))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    if (__check_identity_chunk() != 0)
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    flag_activated = 1;
+
+#ifdef BOOTLOADER_USE_JOURNAL
+    if (__journal_reset() != 0)
+    {
+      // Ответа нет, хост узнает об ошибке из CMD_BCAST_STATUS
+      flag_begin = 0;
+      bcast_state = BCAST_ERASE_ERROR;
+      state = STATE_MAIN;
+      break;
+    }
+#endif
+
+    memset(bcast_bitmap, 0, sizeof(bcast_bitmap));
+    bcast_errors = 0;
+    bcast_state = BCAST_IDLE;
+
+#ifdef BOOTLOADER_USE_SPARSE
+    sparse_count = 0;
+#endif
+
+    flash_clear_cmd = CMD_BCAST_BEGIN;
+    state = STATE_BEGIN;
+    break;
+  /////////////////////////////////////////
+  case CMD_BCAST_CHUNK:
+    if ((flag_activated != 0) &&
+        (flag_begin != 0) &&
+        (len == (1 + sizeof(struct fw_chunk_s))))
+    {
+      __bcast_chunk();
+    }
+
+    state = STATE_MAIN;
+    break;
+  /////////////////////////////////////////
+  case CMD_BCAST_END:
+    if ((flag_activated != 0) && (bcast_state == BCAST_RECEIVE))
+    {
+      flag_begin = 0;
+
+      if (
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+          (__cache_flush() != 0) ||
+#endif
+          (__app_poly1305_check() != 0))
+      {
+        flag_firmware_valid = 0;
+        bcast_state = BCAST_END_INVALID;
+      }
+      else
+      {
+        flag_firmware_valid = 1;
+        bcast_state = BCAST_END_VALID;
+      }
+    }
+
+    state = STATE_MAIN;
+    break;
+  /////////////////////////////////////////
+  case CMD_BCAST_STATUS:
+  {
+    /*
+      Запрос:
+        [0] CMD_BCAST_STATUS
+        [1] адрес устройства
+        [2..3] смещение в карте принятых чанков, байт
+      Ответ:
+        [0] CMD_BCAST_STATUS
+        [1] 0x00
+        [2] состояние сессии (BCAST_xxx)
+        [3..4] общее количество чанков
+        [5..6] количество отброшенных чанков
+        [7..8] смещение в карте принятых чанков, байт
+        [9..] фрагмент карты принятых чанков
+    */
+    uint16_t offset;
+    uint16_t size;
+
+    if ((len != 4) || (buffer_exch[1] != unit_address))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    offset = GetUInt16(buffer_exch, 2);
+    if (offset > BCAST_BITMAP_SIZE)
+      offset = BCAST_BITMAP_SIZE;
+
+    size = BCAST_BITMAP_SIZE - offset;
+    if (size > (RESP_MAX_SIZE - 9))
+      size = RESP_MAX_SIZE - 9;
+
+    buffer_exch[0] = CMD_BCAST_STATUS;
+    buffer_exch[1] = 0x00;
+    buffer_exch[2] = bcast_state;
+    UInt16ToBuff(buffer_exch + 3, BCAST_NUM_CHUNKS);
+    UInt16ToBuff(buffer_exch + 5, bcast_errors);
+    UInt16ToBuff(buffer_exch + 7, offset);
+    memcpy(buffer_exch + 9, bcast_bitmap + offset, size);
+
+    binex_transmitter_init(buffer_exch, 9 + size);
+    state = STATE_SEND_RESP;
+  }
+  break;
+  /////////////////////////////////////////
+  case CMD_BCAST_APP_RUN:
+    if ((flag_activated != 0) &&
+        (flag_begin == 0) &&
+        (flag_firmware_valid != 0))
+    {
+      __app_run();
+    }
+
+    state = STATE_MAIN;
+    break;
+#endif
+    /////////////////////////////////////////
+#ifdef BINEX_USE_FEC
+  case CMD_SET_FEC:
+    /*
+      Включение помехоустойчивого кодирования пакетов.
+      Запрос:
+        [0] CMD_SET_FEC
+        [1] количество проверочных байт (0 - FEC отключен)
+      Ответ отправляется еще в текущем режиме, новый режим
+      действует начиная со следующего пакета. Режим не сохраняется
+      и после сброса устройства FEC отключен.
+    */
+    if ((flag_activated == 0) || (len != 2))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[0] = CMD_SET_FEC;
+
+    if ((buffer_exch[1] & 0x01) || (buffer_exch[1] > RS_MAX_NPAR))
+    {
+      buffer_exch[1] = 0x01; // недопустимое значение
+    }
+#ifdef BINEX_USE_COBS
+    else if (binex_get_cobs() && (buffer_exch[1] != 0))
+    {
+      buffer_exch[1] = 0x01; // FEC не используется вместе с COBS
+    }
+#endif
+    else
+    {
+      fec_pending = buffer_exch[1];
+      buffer_exch[1] = 0x00;
+    }
+
+    binex_transmitter_init(buffer_exch, 2);
+    state = STATE_SEND_RESP;
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+    // По широковещательному адресу режим переключается без ответа
+    if (flag_broadcast && (fec_pending != 0xFF))
+    {
+      binex_set_fec(fec_pending);
+      fec_pending = 0xFF;
+    }
+#endif
+    break;
+    /////////////////////////////////////////
+#endif
+#ifdef BOOTLOADER_USE_RELAY
+  case CMD_RELAY_SEND:
+  {
+    /*
+      Передача пакета нижестоящему устройству.
+      Запрос:
+        [0] CMD_RELAY_SEND
+        [1] номер канала
+        [2] адрес устройства на шине канала, либо BINEX_ADDRESS_NONE
+        [3..] пакет для нижестоящего устройства
+      Ответ (сразу, не дожидаясь передачи пакета):
+        [0] CMD_RELAY_SEND
+        [1] 0x00 - пакет принят к передаче, 0x03 - ошибка
+        [2] номер последнего ответа канала (см. CMD_RELAY_POLL)
+    */
+    uint8_t seq;
+
+    if ((flag_activated == 0) || (len < 4))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[1] = RelaySend(buffer_exch[1], buffer_exch[2], buffer_exch + 3, len - 3, &seq);
+    if (buffer_exch[1] == RELAY_BUSY)
+      buffer_exch[1] = 0x00;
+
+    buffer_exch[0] = CMD_RELAY_SEND;
+    buffer_exch[2] = seq;
+    binex_transmitter_init(buffer_exch, 3);
+    state = STATE_SEND_RESP;
+  }
+  break;
+  /////////////////////////////////////////
+  case CMD_RELAY_POLL:
+  {
+    /*
+      Получение ответа нижестоящего устройства.
+      Запрос:
+        [0] CMD_RELAY_POLL
+        [1] номер канала
+        [2] номер последнего принятого хостом ответа канала
+            (после RELAY_SEND - номер из его ответа)
+      Ответ:
+        [0] CMD_RELAY_POLL
+        [1] состояние канала (RELAY_xxx)
+        [2] номер ответа
+        [3..] ответ нижестоящего устройства, если состояние RELAY_REPLY
+      Ответ хранится, пока хост не подтвердит его номер, поэтому
+      опрос можно повторять: потерянный ответ будет передан снова
+    */
+    uint16_t reply_len;
+    uint8_t seq;
+
+    if ((flag_activated == 0) || (len != 3))
+    {
+      state = STATE_MAIN;
+      break;
+    }
+
+    buffer_exch[1] = RelayPoll(buffer_exch[1], buffer_exch[2], buffer_exch + 3, &reply_len, &seq);
+    buffer_exch[0] = CMD_RELAY_POLL;
+    buffer_exch[2] = seq;
+    binex_transmitter_init(buffer_exch, 3 + reply_len);
+    state = STATE_SEND_RESP;
+  }
+  break;
+    /////////////////////////////////////////
+#endif
+#ifdef BOOTLOADER_USE_STATS
+  case CMD_GET_STATS:
+  {
+    /*
+      Чтение счетчиков работы Bootloader-а.
+      Запрос:
+        [0] CMD_GET_STATS
+      Ответ:
+        [0] CMD_GET_STATS
+        [1] 0x00
+        [2] версия набора счетчиков (STATS_VERSION)
+        [3] N - количество счетчиков
+        [4..] N счетчиков uint32_t в порядке полей struct stats_s
+      Счетчики не сбрасываются, хост вычисляет приращения
+    */
+    const uint32_t *p = (const uint32_t *)&stats;
+    uint8_t n = sizeof(stats) / sizeof(uint32_t);
 
-    if ((flag_begin == 0) || (flag_DataIsSet == 0))
+    if (flag_activated == 0)
     {
-      buffer_exch[1] = 0x02;
-      binex_transmitter_init(buffer_exch, 2);
-      state = STATE_SEND_RESP;
+      state = STATE_MAIN;
       break;
     }
 
-    if (__memcompare((const uint8_t *)DataAddress, Data, DataLen))
-    {
-      // Если участки памяти совпадают,
-      // то просто возвращаем ОК
-      // без повторной записи данных
-      buffer_exch[1] = 0x00; // ОК
-    }
-    else if (port_write_chunk(Data, DataAddress, DataLen) != 0)
-    {
-      buffer_exch[1] = 0x01; // ошибка записи
-    }
-    else
-    {
-      buffer_exch[1] = 0x00; // иначе ОК
-    }
+    stats.rx_lost = port_serial_rx_lost();
+    stats.uptime_ms = SYSTICK_GET_VALUE();
 
-    binex_transmitter_init(buffer_exch, 2);
+    buffer_exch[0] = CMD_GET_STATS;
+    buffer_exch[1] = 0x00;
+    buffer_exch[2] = STATS_VERSION;
+    buffer_exch[3] = n;
+    for (uint8_t i = 0; i < n; i++)
+      UInt32ToBuff(buffer_exch + 4 + 4 * i, p[i]);
+    binex_transmitter_init(buffer_exch, 4 + 4 * n);
     state = STATE_SEND_RESP;
-    break;
-  /////////////////////////////////////////
-  case CMD_END:
-    if (flag_activated == 0)
+  }
+  break;
+    /////////////////////////////////////////
+#endif
+#ifdef BOOTLOADER_USE_TRACE
+  case CMD_GET_TRACE:
+  {
+    /*
+      Чтение буфера событий.
+      Запрос:
+        [0] CMD_GET_TRACE
+        [1..4] номер первой запрашиваемой записи
+      Ответ:
+        [0] CMD_GET_TRACE
+        [1] 0x00
+        [2..5] номер первой переданной записи (больше запрошенного,
+               если запрошенные записи уже затерты)
+        [6..9] всего записей с момента сброса
+        [10] N - количество записей, до TRACE_PER_RESP
+        [11..] N записей по 8 байт:
+               [0..3] время, мкс
+               [4] событие (TRACE_xxx)
+               [5] arg
+               [6..7] value
+      Хост повторяет запрос со следующего номера, пока не прочитает
+      записи до номера, полученного в первом ответе
+    */
+    uint32_t first, n;
+
+    if ((flag_activated == 0) || (len != 5))
     {
       state = STATE_MAIN;
       break;
     }
 
-    flag_begin = 0;
-    buffer_exch[0] = CMD_END;
+    first = GetUInt32(buffer_exch, 1);
+    if ((trace_count > BOOTLOADER_TRACE_SIZE) && (first < trace_count - BOOTLOADER_TRACE_SIZE))
+      first = trace_count - BOOTLOADER_TRACE_SIZE;
+    if (first > trace_count)
+      first = trace_count;
+
+    n = trace_count - first;
+    if (n > TRACE_PER_RESP)
+      n = TRACE_PER_RESP;
+
+    buffer_exch[0] = CMD_GET_TRACE;
     buffer_exch[1] = 0x00;
-    binex_transmitter_init(buffer_exch, 2);
+    UInt32ToBuff(buffer_exch + 2, first);
+    UInt32ToBuff(buffer_exch + 6, trace_count);
+    buffer_exch[10] = n;
+    for (uint32_t i = 0; i < n; i++)
+    {
+      const struct trace_s *t = &trace[(first + i) & (BOOTLOADER_TRACE_SIZE - 1)];
+      uint8_t *p = buffer_exch + 11 + 8 * i;
+
+      UInt32ToBuff(p, t->time);
+      p[4] = t->event;
+      p[5] = t->arg;
+      UInt16ToBuff(p + 6, t->value);
+    }
+    binex_transmitter_init(buffer_exch, 11 + 8 * n);
     state = STATE_SEND_RESP;
-    break;
-  /////////////////////////////////////////
-  case CMD_CHECK_CRC:
-    if (flag_activated == 0)
+  }
+  break;
+    /////////////////////////////////////////
+#endif
+#ifdef BOOTLOADER_USE_LINK_TEST
+  case CMD_LINK_TEST:
+  {
+    /*
+      Проверка канала, только после активации.
+      Сброс счетчиков:
+        [0] CMD_LINK_TEST [1] LINK_RESET
+        Ответ: [0] CMD_LINK_TEST [1] 0x00
+      Пакет без ответа:
+        [0] CMD_LINK_TEST [1] LINK_SINK
+        [2..3] номер пакета, с 0 после сброса
+        [4] шаблон содержимого (LINK_PATTERN_xxx)
+        [5..] содержимое
+      Пакет с ответом:
+        [0] CMD_LINK_TEST [1] LINK_ECHO
+        [2] задержка ответа, мс
+        [3..] содержимое
+        Ответ: [0] CMD_LINK_TEST [1] 0x00 [2..] содержимое запроса
+      Чтение счетчиков:
+        [0] CMD_LINK_TEST [1] LINK_REPORT
+        Ответ: [0] CMD_LINK_TEST [1] 0x00
+               [2] версия набора счетчиков (LINK_VERSION)
+               [3] N - количество счетчиков
+               [4..] N счетчиков uint32_t в порядке полей struct link_stats_s
+    */
+    if ((flag_activated == 0) || (len < 2))
     {
       state = STATE_MAIN;
       break;
     }
 
-    buffer_exch[0] = CMD_CHECK_CRC;
-
-    if (flag_begin)
+    switch (buffer_exch[1])
     {
-      // В этом состоянии нельзя выполнять это действие,
-      // сначала надо до конца записать прошивку
-      buffer_exch[1] = 0x02;
-    }
-    else if (__app_poly1305_check() != 0)
+    case LINK_RESET:
+      __link_reset();
+      buffer_exch[1] = 0x00;
+      binex_transmitter_init(buffer_exch, 2);
+      state = STATE_SEND_RESP;
+      break;
+
+    case LINK_SINK:
     {
-      flag_firmware_valid = 0;
-      buffer_exch[1] = 0x01; // ошибка расшифровки
+      uint16_t seq;
+      uint32_t now = TIME_US() - link_t0;
+
+      state = STATE_MAIN;
+      if (!link_active || (len < 5))
+        break;
+
+      seq = GetUInt16(buffer_exch, 2);
+      link.seq_lost += (uint16_t)(seq - link_seq);
+      link_seq = seq + 1;
+
+      if (link.frames == 0)
+        link.first_us = now;
+      link.last_us = now;
+      link.frames++;
+      link.bytes += len - 5;
+
+      if (__link_check_pattern(buffer_exch + 5, len - 5, buffer_exch[4], seq))
+        link.pattern_errors++;
     }
-    else
+    break;
+
+    case LINK_ECHO:
+      if (len < 3)
+      {
+        state = STATE_MAIN;
+        break;
+      }
+
+      if (link_active)
+        link.echo_frames++;
+
+      resp_delay = buffer_exch[2];
+      buffer_exch[1] = 0x00;
+      memmove(buffer_exch + 2, buffer_exch + 3, len - 3);
+      binex_transmitter_init(buffer_exch, len - 1);
+      state = STATE_SEND_RESP;
+      break;
+
+    case LINK_REPORT:
     {
-      flag_firmware_valid = 1;
-      buffer_exch[1] = 0x00; // иначе ОК
-    }
+      const uint32_t *p = (const uint32_t *)&link;
+      uint8_t n = sizeof(link) / sizeof(uint32_t);
+      uint32_t overrun, framing, noise;
 
-    binex_transmitter_init(buffer_exch, 2);
-    state = STATE_SEND_RESP;
+      port_serial_rx_errors(&overrun, &framing, &noise);
+      link.rx_lost = port_serial_rx_lost() - link_base[0];
+      link.usart_overrun = overrun - link_base[1];
+      link.usart_framing = framing - link_base[2];
+      link.usart_noise = noise - link_base[3];
+      link.elapsed_us = TIME_US() - link_t0;
+
+      buffer_exch[1] = 0x00;
+      buffer_exch[2] = LINK_VERSION;
+      buffer_exch[3] = n;
+      for (uint8_t i = 0; i < n; i++)
+        UInt32ToBuff(buffer_exch + 4 + 4 * i, p[i]);
+      binex_transmitter_init(buffer_exch, 4 + 4 * n);
+      state = STATE_SEND_RESP;
+    }
     break;
-  /////////////////////////////////////////
-  case CMD_APP_RUN:
-    if (flag_activated == 0)
-    {
+
+    default:
       state = STATE_MAIN;
       break;
     }
+  }
+  break;
+    /////////////////////////////////////////
+#endif
+  case CMD_GET_INFO:
+  {
+    /*
+      Описание Bootloader-а для выбора режима обновления хостом.
+      Выполняется и до активации: не меняет состояние устройства.
+      Запрос:
+        [0] CMD_GET_INFO
+      Ответ:
+        [0] CMD_GET_INFO
+        [1] 0x00
+        [2] версия формата (INFO_VERSION)
+        [3..] записи TLV (INFO_xxx)
+    */
+    binex_transmitter_init(buffer_exch, __info_build());
+    state = STATE_SEND_RESP;
+  }
+  break;
+    /////////////////////////////////////////
+#ifdef BOOTLOADER_USE_ADDRESSING
+  case CMD_DISCOVER:
+  {
+    /*
+      Поиск устройств на шине. Отправляется по широковещательному адресу.
+      Запрос:
+        [0] CMD_DISCOVER
+        [1..2] окно ответа, мс
+        [3..18] необязательно: битовая карта уже найденных адресов
+      Ответ отправляет каждое устройство, которого нет в карте,
+      через случайное время в пределах окна:
+        [0] CMD_DISCOVER
+        [1] 0x00
+        [2] адрес устройства
+        [3] 1 - Bootloader активирован
+        [4] 1 - прошивка прошла проверку целостности
+      Хост повторяет запрос, дополняя карту найденными адресами,
+      пока устройства не перестанут отвечать. Столкнувшиеся ответы
+      отбрасываются по CRC и повторяются в следующем раунде.
+    */
+    uint8_t addr = unit_address;
+    uint16_t window;
 
-    buffer_exch[0] = CMD_APP_RUN;
-
-    if (flag_begin)
+    if ((len != 3) && (len != 19))
     {
-      // В этом состоянии нельзя выполнять это действие,
-      // сначала надо до конца записать прошивку
-      buffer_exch[1] = 0x02;
-      binex_transmitter_init(buffer_exch, 2);
-      state = STATE_SEND_RESP;
+      state = STATE_MAIN;
       break;
     }
-    else if (__app_poly1305_check() != 0) // Если основная прошивка отсутствует, либо повреждена
+
+    window = GetUInt16(buffer_exch, 1);
+
+    if ((len == 19) && (buffer_exch[3 + (addr >> 3)] & (1 << (addr & 0x07))))
     {
-      flag_firmware_valid = 0;
-      buffer_exch[1] = 0x01;
-      binex_transmitter_init(buffer_exch, 2);
-      state = STATE_SEND_RESP;
+      // Нас уже нашли
+      state = STATE_MAIN;
       break;
     }
 
-    // Отправляем ответ, после чего запускаем прошивку
+    buffer_exch[0] = CMD_DISCOVER;
     buffer_exch[1] = 0x00;
-    binex_transmitter_init(buffer_exch, 2);
-    state = STATE_APP_RUN;
-    break;
+    buffer_exch[2] = addr;
+    buffer_exch[3] = flag_activated;
+    buffer_exch[4] = flag_firmware_valid;
+    binex_transmitter_init(buffer_exch, 5);
+
+    resp_delay += __random(window);
+    state = STATE_SEND_RESP;
+  }
+    // Ответ на поиск отправляется в том числе и на широковещательный запрос
+    return;
+#endif
   }
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+  // На широковещательные запросы не отвечаем
+  if (flag_broadcast && (state == STATE_SEND_RESP))
+    state = STATE_MAIN;
+#endif
 }
 
 /******************************************************************************/
@@ -519,6 +2869,38 @@ void InitBootloader(void)
 
   flag_activated = 0;
 
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+  __cache_drop();
+#endif
+
+#ifdef BOOTLOADER_USE_BROADCAST
+  bcast_state = BCAST_IDLE;
+#endif
+
+  resp_delay = BOOTLOADER_RESPONSE_DELAY_MS;
+
+#ifdef BOOTLOADER_USE_RELAY
+  RelayInit();
+#endif
+
+#ifdef BINEX_USE_FEC
+  fec_pending = 0xFF;
+#endif
+
+#ifdef BINEX_USE_COBS
+  cobs_pending = 0xFF;
+  binex_set_cobs(0);
+#endif
+
+#if defined(BOOTLOADER_USE_ADDRESSING) || defined(BOOTLOADER_USE_BROADCAST)
+  unit_address = __unit_address();
+#endif
+
+#ifdef BOOTLOADER_USE_ADDRESSING
+  rand_state = __unique_id_hash();
+  binex_set_address(unit_address);
+#endif
+
 #if !defined(BOOTLOADER_DBG_MODE)
   // Если не ноль, то приложение не прошло
   // проверку целостности
@@ -544,10 +2926,34 @@ void ProcessBootloader(void)
   uint8_t entry = 0;
   if (_state != state)
   {
+#ifdef BOOTLOADER_USE_TRACE
+    // Переходы ожидания пакета сопровождают каждый запрос,
+    // границы пакетов отмечаются событиями TRACE_RX/TRACE_TX
+    if ((state != STATE_MAIN) && (state != STATE_RX_WAIT))
+      __trace(TRACE_STATE, state, _state);
+#endif
     _state = state;
     entry = 1;
   }
 
+#ifdef BOOTLOADER_USE_TRACE
+  {
+    uint32_t lost = port_serial_rx_lost() - trace_rx_lost;
+
+    if (lost != 0)
+    {
+      trace_rx_lost += lost;
+      __trace(TRACE_RX_LOST, 0, (lost > 0xFFFF) ? 0xFFFF : lost);
+    }
+  }
+#endif
+
+#ifdef BOOTLOADER_USE_RELAY
+  // Каналы ретранслятора обслуживаются
+  // независимо от состояния основного канала
+  RelayProcess();
+#endif
+
   switch (state)
   {
   /*********************************************/
@@ -557,8 +2963,28 @@ void ProcessBootloader(void)
     break;
   /*********************************************/
   case STATE_RX_WAIT:
-    if (binex_receiver(port_serial_getc()) == BINEX_PACK_RX)
+  {
+    int16_t c = port_serial_getc();
+    BinexRxStatus_t rx = binex_receiver(c);
+
+#ifdef BOOTLOADER_USE_STATS
+    __stats_rx(c, rx);
+#endif
+
+#ifdef BOOTLOADER_USE_LINK_TEST
+    __link_rx(rx);
+#endif
+
+#ifdef BOOTLOADER_USE_TRACE
+    if (rx == BINEX_PACK_RX)
+      __trace(TRACE_RX, buffer_exch[0], binex_get_rxpack_len());
+    else if (rx == BINEX_PACK_BROKEN)
+      __trace(TRACE_RX_BROKEN, binex_get_rx_error(), 0);
+#endif
+
+    if (rx == BINEX_PACK_RX)
       __parsecmd();
+  }
 
 #ifdef BOOTLOADER_TIMEOUT_MS                                              /* Если Bootloader активируется по тайм-ауту */
     if ((!flag_activated)                                                 // Если Bootloader не был активирован командой
@@ -581,82 +3007,164 @@ void ProcessBootloader(void)
   /*********************************************/
   case STATE_BEGIN:
   {
+#ifdef BOOTLOADER_USE_SECTOR_CACHE
+    // Данные прежней сессии, не записанные из кэша, отбрасываются
+    __cache_drop();
+#endif
     flag_firmware_valid = 0;
     adr_counter = BOOTLOADER_APP_BEGIN;
+    erase_error = 0;
+    erase_event_timer = SYSTICK_GET_VALUE();
     state = STATE_FLASH_CLEAR;
   }
   break;
   /*********************************************/
   case STATE_FLASH_CLEAR:
   {
+    // Событие о ходе очистки передается между секторами: во время очистки
+    // передатчик стоит, поэтому следующий сектор очищается только после
+    // окончания передачи события. Ответ на команду - тоже после нее
+    uint8_t event_busy = __erase_event_pump();
+
+    // Ошибка очистки сектора
+    if (erase_error)
+    {
+      if (event_busy)
+        break;
+
+      uint32_t block = (adr_counter - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE;
+      buffer_exch[0] = flash_clear_cmd;
+      buffer_exch[1] = 0x01;
+      UInt32ToBuff(buffer_exch + 2, block);
+      binex_transmitter_init(buffer_exch, 6);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
     // Если очистили всю область
     if (adr_counter >= (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH))
     {
+      if (event_busy)
+        break;
+
       flag_begin = 1;
       flag_DataIsSet = 0;
 
+#ifdef BOOTLOADER_USE_BROADCAST
+      if (flash_clear_cmd == CMD_BCAST_BEGIN)
+      {
+        // В широковещательной сессии не отвечаем
+        bcast_state = BCAST_RECEIVE;
+        state = STATE_MAIN;
+        break;
+      }
+#endif
+
       // Возвращаем OK
-      buffer_exch[0] = CMD_BEGIN;
+      buffer_exch[0] = flash_clear_cmd;
       buffer_exch[1] = 0x00;
+#ifdef BOOTLOADER_USE_JOURNAL
+      if (flash_clear_cmd == CMD_RESUME)
+      {
+        // Адрес, с которого хост должен продолжить передачу
+        UInt32ToBuff(buffer_exch + 2, journal_frontier);
+        binex_transmitter_init(buffer_exch, 6);
+        state = STATE_SEND_RESP;
+        break;
+      }
+#endif
       binex_transmitter_init(buffer_exch, 2);
       state = STATE_SEND_RESP;
       break;
     }
 
     // Если текущий сектор не очищен,
-    // то очищаем его
-    if (!port_sector_isclear(adr_counter))
+    // то очищаем его.
+    // Сектора, уже записанные в текущей сессии, не трогаем
+    if (
+#ifdef BOOTLOADER_USE_JOURNAL
+        !JournalSectorIsDone(adr_counter) &&
+#endif
+        !port_sector_isclear(adr_counter))
     {
+      if (event_busy)
+        break;
+
+      STATS_TIME_BEGIN();
+      TRACE(TRACE_ERASE, 0, adr_counter / BOOTLOADER_FLASH_SECTOR_SIZE);
       port_sector_erase(adr_counter);
+      STATS_TIME_END(erase_time);
+      STATS_INC(sectors_erased);
 
       // Если ошибка очистки сектора, то выходим с ошибкой
       if (!port_sector_isclear(adr_counter))
       {
-        uint32_t block = (adr_counter - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE;
-        buffer_exch[0] = CMD_BEGIN;
-        buffer_exch[1] = 0x01;
-        UInt32ToBuff(buffer_exch + 2, block);
-        binex_transmitter_init(buffer_exch, 6);
-        state = STATE_SEND_RESP;
+        STATS_INC(erase_errors);
+        TRACE(TRACE_ERASE_END, 1, adr_counter / BOOTLOADER_FLASH_SECTOR_SIZE);
+#ifdef BOOTLOADER_USE_BROADCAST
+        if (flash_clear_cmd == CMD_BCAST_BEGIN)
+        {
+          bcast_state = BCAST_ERASE_ERROR;
+          state = STATE_MAIN;
+          break;
+        }
+#endif
+        erase_error = 1;
         break;
       }
+
+      TRACE(TRACE_ERASE_END, 0, adr_counter / BOOTLOADER_FLASH_SECTOR_SIZE);
     }
 
     adr_counter += BOOTLOADER_FLASH_SECTOR_SIZE;
 
-    uint32_t block = (adr_counter - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE;
-    buffer_exch[0] = CMD_BEGIN;
-    buffer_exch[1] = 0xFF;
-    UInt32ToBuff(buffer_exch + 2, BOOTLOADER_APP_LENGTH / BOOTLOADER_FLASH_SECTOR_SIZE);
-    UInt32ToBuff(buffer_exch + 6, block);
-    binex_transmitter_init(buffer_exch, 10);
-    state = STATE_SEND_EVENT_FLASH_CLEAR;
+#ifdef BOOTLOADER_USE_BROADCAST
+    // Без событий о ходе очистки
+    if (flash_clear_cmd == CMD_BCAST_BEGIN)
+      break;
+#endif
+
+    __erase_event(flash_clear_cmd,
+                  BOOTLOADER_APP_LENGTH / BOOTLOADER_FLASH_SECTOR_SIZE,
+                  (adr_counter - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE);
   }
   break;
     /*********************************************/
-  case STATE_SEND_EVENT_FLASH_CLEAR:
-    if (binex_transmit() == BINEX_PACK_TX)
-      state = STATE_SEND_EVENT_FLASH_CLEAR_1;
-    break;
-  /*********************************************/
-  case STATE_SEND_EVENT_FLASH_CLEAR_1:
-    if (port_serial_transfer_completed())
-      state = STATE_FLASH_CLEAR;
-    break;
-    /*********************************************/
 #ifdef BOOTLOADER_USE_USER_DATA
   case STATE_USER_DATA_CLEAR_BEGIN:
   {
     adr_counter = USER_DATA_BEGIN;
+    erase_error = 0;
+    erase_event_timer = SYSTICK_GET_VALUE();
     state = STATE_USER_DATA_CLEAR;
   }
   break;
   /*********************************************/
   case STATE_USER_DATA_CLEAR:
   {
+    uint8_t event_busy = __erase_event_pump();
+
+    // Ошибка очистки сектора
+    if (erase_error)
+    {
+      if (event_busy)
+        break;
+
+      uint32_t block = (adr_counter - USER_DATA_BEGIN) / FLASH_SECTOR_SIZE;
+      buffer_exch[0] = CMD_ERASE_USER_DATA;
+      buffer_exch[1] = 0x01;
+      UInt32ToBuff(buffer_exch + 2, block);
+      binex_transmitter_init(buffer_exch, 6);
+      state = STATE_SEND_RESP;
+      break;
+    }
+
     // Если очистили всю область
     if (adr_counter >= (USER_DATA_BEGIN + USER_DATA_LENGHT))
     {
+      if (event_busy)
+        break;
+
       flag_begin = 1;
 
       // Возвращаем OK
@@ -671,42 +3179,34 @@ void ProcessBootloader(void)
     // то очищаем его
     if (!port_sector_isclear(adr_counter))
     {
+      if (event_busy)
+        break;
+
+      STATS_TIME_BEGIN();
+      TRACE(TRACE_ERASE, 0, adr_counter / BOOTLOADER_FLASH_SECTOR_SIZE);
       port_sector_erase(adr_counter);
+      STATS_TIME_END(erase_time);
+      STATS_INC(sectors_erased);
 
       // Если ошибка очистки сектора, то выходим с ошибкой
       if (!port_sector_isclear(adr_counter))
       {
-        uint32_t block = (adr_counter - USER_DATA_BEGIN) / FLASH_SECTOR_SIZE;
-        buffer_exch[0] = CMD_ERASE_USER_DATA;
-        buffer_exch[1] = 0x01;
-        UInt32ToBuff(buffer_exch + 2, block);
-        binex_transmitter_init(buffer_exch, 6);
-        state = STATE_SEND_RESP;
+        STATS_INC(erase_errors);
+        TRACE(TRACE_ERASE_END, 1, adr_counter / BOOTLOADER_FLASH_SECTOR_SIZE);
+        erase_error = 1;
         break;
       }
+
+      TRACE(TRACE_ERASE_END, 0, adr_counter / BOOTLOADER_FLASH_SECTOR_SIZE);
     }
 
     adr_counter += FLASH_SECTOR_SIZE;
 
-    uint32_t block = (adr_counter - USER_DATA_BEGIN) / FLASH_SECTOR_SIZE;
-    buffer_exch[0] = CMD_ERASE_USER_DATA;
-    buffer_exch[1] = 0xFF;
-    UInt32ToBuff(buffer_exch + 2, USER_DATA_LENGHT / FLASH_SECTOR_SIZE);
-    UInt32ToBuff(buffer_exch + 6, block);
-    binex_transmitter_init(buffer_exch, 10);
-    state = STATE_SEND_EVENT_USER_DATA_CLEAR;
+    __erase_event(CMD_ERASE_USER_DATA,
+                  USER_DATA_LENGHT / FLASH_SECTOR_SIZE,
+                  (adr_counter - USER_DATA_BEGIN) / FLASH_SECTOR_SIZE);
   }
   break;
-    /*********************************************/
-  case STATE_SEND_EVENT_USER_DATA_CLEAR:
-    if (binex_transmit() == BINEX_PACK_TX)
-      state = STATE_SEND_EVENT_USER_DATA_CLEAR_1;
-    break;
-  /*********************************************/
-  case STATE_SEND_EVENT_USER_DATA_CLEAR_1:
-    if (port_serial_transfer_completed())
-      state = STATE_USER_DATA_CLEAR;
-    break;
 #endif
   /*********************************************/
   case STATE_SEND_RESP:
@@ -715,7 +3215,7 @@ void ProcessBootloader(void)
       timer = SYSTICK_GET_VALUE();
     }
 
-    if ((SYSTICK_GET_VALUE() - timer) >= BOOTLOADER_RESPONSE_DELAY_MS)
+    if ((SYSTICK_GET_VALUE() - timer) >= resp_delay)
     {
       state = STATE_SEND_RESP_1;
     }
@@ -723,7 +3223,25 @@ void ProcessBootloader(void)
   /*********************************************/
   case STATE_SEND_RESP_1:
     if (binex_transmit() == BINEX_PACK_TX)
+    {
+      STATS_INC(tx_frames);
+      TRACE(TRACE_TX, buffer_exch[0], buffer_exch[1]);
+#ifdef BINEX_USE_FEC
+      if (fec_pending != 0xFF)
+      {
+        binex_set_fec(fec_pending);
+        fec_pending = 0xFF;
+      }
+#endif
+#ifdef BINEX_USE_COBS
+      if (cobs_pending != 0xFF)
+      {
+        binex_set_cobs(cobs_pending);
+        cobs_pending = 0xFF;
+      }
+#endif
       state = STATE_MAIN;
+    }
     break;
   /*********************************************/
   case STATE_APP_RUN:
@@ -741,6 +3259,8 @@ void ProcessBootloader(void)
   case STATE_APP_RUN_1:
     if (binex_transmit() == BINEX_PACK_TX)
     {
+      STATS_INC(tx_frames);
+      TRACE(TRACE_TX, buffer_exch[0], buffer_exch[1]);
       state = STATE_APP_RUN_2;
     }
     break;
@@ -769,7 +3289,10 @@ int binex_tx_callback(uint8_t c)
 {
   int16_t ret = port_serial_putc(c);
   if (ret == c)
+  {
+    STATS_INC(tx_bytes);
     return 1;
+  }
   return 0;
 }
 
@@ -0,0 +1,107 @@
+#include "journal.h"
+#include "bootloader_port.h"
+#include "bootloader_config.h"
+
+#ifdef BOOTLOADER_USE_JOURNAL
+
+/******************************************************************************/
+
+#define JOURNAL_MAGIC 0x314C4E4AUL // "JNL1"
+
+#define JOURNAL_SECTOR_DONE 0x00000000UL
+
+#define JOURNAL_MAGIC_ADR (BOOTLOADER_JOURNAL_BEGIN)
+#define JOURNAL_ID_ADR (BOOTLOADER_JOURNAL_BEGIN + 4)
+#define JOURNAL_FLAGS_ADR (JOURNAL_ID_ADR + JOURNAL_ID_SIZE)
+
+#if ((JOURNAL_FLAGS_ADR + BOOTLOADER_APP_SECTORS * 4) > (BOOTLOADER_JOURNAL_BEGIN + BOOTLOADER_FLASH_SECTOR_SIZE))
+#error "Journal does not fit into one flash sector"
+#endif
+
+/******************************************************************************/
+
+static uint32_t __read_word(uint32_t adr)
+{
+  return *(const volatile uint32_t *)adr;
+}
+
+static uint32_t __flag_adr(uint32_t adr)
+{
+  uint32_t sector = (adr - BOOTLOADER_APP_BEGIN) / BOOTLOADER_FLASH_SECTOR_SIZE;
+  return JOURNAL_FLAGS_ADR + sector * 4;
+}
+
+/******************************************************************************/
+
+uint8_t JournalReset(const uint8_t *image_id)
+{
+  if (!port_sector_isclear(BOOTLOADER_JOURNAL_BEGIN))
+  {
+    port_sector_erase(BOOTLOADER_JOURNAL_BEGIN);
+
+    if (!port_sector_isclear(BOOTLOADER_JOURNAL_BEGIN))
+      return 1;
+  }
+
+  // Сначала идентификатор, и только потом MAGIC,
+  // чтобы недописанный журнал не считался валидным
+  for (int i = 0; i < JOURNAL_ID_SIZE; i += 4)
+  {
+    uint32_t word = (uint32_t)image_id[i] |
+                    ((uint32_t)image_id[i + 1] << 8) |
+                    ((uint32_t)image_id[i + 2] << 16) |
+                    ((uint32_t)image_id[i + 3] << 24);
+
+    if (port_write_word(JOURNAL_ID_ADR + i, word) != 0)
+      return 1;
+  }
+
+  return port_write_word(JOURNAL_MAGIC_ADR, JOURNAL_MAGIC);
+}
+
+uint8_t JournalIsMatch(const uint8_t *image_id)
+{
+  const uint8_t *id = (const uint8_t *)JOURNAL_ID_ADR;
+
+  if (__read_word(JOURNAL_MAGIC_ADR) != JOURNAL_MAGIC)
+    return 0;
+
+  for (int i = 0; i < JOURNAL_ID_SIZE; i++)
+  {
+    if (id[i] != image_id[i])
+      return 0;
+  }
+
+  return 1;
+}
+
+uint8_t JournalSectorIsDone(uint32_t adr)
+{
+  if (__read_word(JOURNAL_MAGIC_ADR) != JOURNAL_MAGIC)
+    return 0;
+
+  return __read_word(__flag_adr(adr)) == JOURNAL_SECTOR_DONE;
+}
+
+uint8_t JournalSectorSetDone(uint32_t adr)
+{
+  if (JournalSectorIsDone(adr))
+    return 0;
+
+  return port_write_word(__flag_adr(adr), JOURNAL_SECTOR_DONE);
+}
+
+uint32_t JournalFirstIncomplete(void)
+{
+  uint32_t adr = BOOTLOADER_APP_BEGIN;
+
+  while ((adr < (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH)) &&
+         JournalSectorIsDone(adr))
+  {
+    adr += BOOTLOADER_FLASH_SECTOR_SIZE;
+  }
+
+  return adr;
+}
+
+#endif
@@ -0,0 +1,179 @@
+#include <string.h>
+#include "relay.h"
+#include "binex-lib.h"
+#include "bootloader_port.h"
+#include "systick.h"
+#include "bootloader_project_config.h"
+
+#ifdef BOOTLOADER_USE_RELAY
+
+/******************************************************************************/
+
+#ifndef BOOTLOADER_RELAY_TIMEOUT_MS
+#define BOOTLOADER_RELAY_TIMEOUT_MS 1000
+#endif
+
+enum
+{
+  RELAY_STATE_IDLE = 0,
+  RELAY_STATE_TX,
+  RELAY_STATE_RX_WAIT,
+  RELAY_STATE_REPLY,
+  RELAY_STATE_TIMEOUT
+};
+
+struct relay_channel_s
+{
+  Binex_t link;
+  uint8_t ch;
+  uint8_t state;
+  uint8_t reply_seq; // Номер последнего принятого ответа
+  uint16_t reply_len;
+  uint32_t timer;
+  uint8_t buffer[RELAY_BUFFER_SIZE];
+};
+
+/******************************************************************************/
+
+static struct relay_channel_s channels[BOOTLOADER_RELAY_CHANNELS];
+
+/******************************************************************************/
+
+static int __relay_tx_callback(void *arg, uint8_t c)
+{
+  struct relay_channel_s *channel = (struct relay_channel_s *)arg;
+
+  if (port_relay_putc(channel->ch, c) == c)
+    return 1;
+  return 0;
+}
+
+static void __rx_begin(struct relay_channel_s *channel)
+{
+  binex_rx_begin(&channel->link, channel->buffer, RELAY_REPLY_MAX_SIZE);
+  channel->timer = SYSTICK_GET_VALUE();
+  channel->state = RELAY_STATE_RX_WAIT;
+}
+
+static void __process_channel(struct relay_channel_s *channel)
+{
+  switch (channel->state)
+  {
+  case RELAY_STATE_TX:
+    if (binex_tx(&channel->link) == BINEX_PACK_TX)
+    {
+      // Весь пакет передан в буфер передатчика канала,
+      // буфер пакета можно использовать для приема ответа
+      __rx_begin(channel);
+    }
+    break;
+  /*********************************************/
+  case RELAY_STATE_RX_WAIT:
+    for (;;)
+    {
+      int16_t c = port_relay_getc(channel->ch);
+      if (c < 0)
+        break;
+
+      if (binex_rx(&channel->link, c) == BINEX_PACK_RX)
+      {
+        channel->reply_len = binex_rx_len(&channel->link);
+        channel->reply_seq++;
+        channel->state = RELAY_STATE_REPLY;
+        return;
+      }
+    }
+
+    if ((SYSTICK_GET_VALUE() - channel->timer) >= BOOTLOADER_RELAY_TIMEOUT_MS)
+      channel->state = RELAY_STATE_TIMEOUT;
+    break;
+  /*********************************************/
+  default:
+    // В состояниях IDLE, REPLY и TIMEOUT канал ждет хоста
+    break;
+  }
+}
+
+/******************************************************************************/
+
+void RelayInit(void)
+{
+  for (uint8_t i = 0; i < BOOTLOADER_RELAY_CHANNELS; i++)
+  {
+    binex_init(&channels[i].link, __relay_tx_callback, &channels[i]);
+    channels[i].ch = i;
+    channels[i].state = RELAY_STATE_IDLE;
+    channels[i].reply_seq = 0;
+  }
+}
+
+void RelayProcess(void)
+{
+  for (uint8_t i = 0; i < BOOTLOADER_RELAY_CHANNELS; i++)
+    __process_channel(&channels[i]);
+}
+
+uint8_t RelaySend(uint8_t ch, uint8_t addr, const uint8_t *data, uint16_t len, uint8_t *seq)
+{
+  struct relay_channel_s *channel;
+
+  *seq = 0;
+
+  if ((ch >= BOOTLOADER_RELAY_CHANNELS) || (len == 0) || (len > RELAY_BUFFER_SIZE))
+    return RELAY_ERROR;
+
+  channel = &channels[ch];
+  *seq = channel->reply_seq;
+
+  if (addr != BINEX_ADDRESS_NONE)
+    binex_host_address_set(&channel->link, addr);
+  else
+    binex_address_set(&channel->link, BINEX_ADDRESS_NONE);
+
+  memcpy(channel->buffer, data, len);
+  binex_tx_init(&channel->link, channel->buffer, len);
+  channel->state = RELAY_STATE_TX;
+
+  return RELAY_BUSY;
+}
+
+uint8_t RelayPoll(uint8_t ch, uint8_t ack, uint8_t *out, uint16_t *len, uint8_t *seq)
+{
+  struct relay_channel_s *channel;
+
+  *len = 0;
+  *seq = 0;
+
+  if (ch >= BOOTLOADER_RELAY_CHANNELS)
+    return RELAY_ERROR;
+
+  channel = &channels[ch];
+
+  if ((channel->state == RELAY_STATE_REPLY) && (channel->reply_seq == ack))
+  {
+    // Хост принял ответ, ждем следующие пакеты нижестоящего устройства
+    __rx_begin(channel);
+  }
+
+  *seq = channel->reply_seq;
+
+  switch (channel->state)
+  {
+  case RELAY_STATE_REPLY:
+    // Ответ хранится до подтверждения: если этот ответ хосту
+    // потеряется, повторный опрос вернет его снова
+    memcpy(out, channel->buffer, channel->reply_len);
+    *len = channel->reply_len;
+    return RELAY_REPLY;
+
+  case RELAY_STATE_TX:
+  case RELAY_STATE_RX_WAIT:
+    return RELAY_BUSY;
+
+  default:
+    channel->state = RELAY_STATE_IDLE;
+    return RELAY_TIMEOUT;
+  }
+}
+
+#endif
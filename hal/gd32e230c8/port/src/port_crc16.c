@@ -0,0 +1,47 @@
+#include "gd32e23x.h"
+#include "crc16.h"
+
+/*
+  Аппаратный расчет CRC16 блоком CRC (см. crc16.h).
+  Блок считает CRC в прямом порядке бит, алгоритм Crc16 - отраженный:
+  входные байты отражает блок (REV_I по байтам), результат - тоже (REV_O),
+  а промежуточное значение start_crc отражается при загрузке в IDATA.
+  Результат совпадает с программным расчетом core/src/crc16.c,
+  проверка - host/bench (make verify)
+*/
+
+#define CRC16_POLY 0x8005
+
+static uint16_t Reverse(uint16_t value)
+{
+  value = ((value & 0xAAAA) >> 1) | ((value & 0x5555) << 1);
+  value = ((value & 0xCCCC) >> 2) | ((value & 0x3333) << 2);
+  value = ((value & 0xF0F0) >> 4) | ((value & 0x0F0F) << 4);
+  value = (value >> 8) | (value << 8);
+
+  return value;
+}
+
+void Crc16Init(void)
+{
+  rcu_periph_clock_enable(RCU_CRC);
+
+  crc_deinit();
+  crc_polynomial_size_set(CRC_CTL_PS_16);
+  crc_polynomial_set(CRC16_POLY);
+  crc_input_data_reverse_config(CRC_INPUT_DATA_BYTE);
+  crc_reverse_output_data_enable();
+}
+
+uint16_t Crc16StartValue(void)
+{
+  return 0xFFFF;
+}
+
+uint16_t Crc16(uint8_t *pcBlock, uint16_t len, uint16_t start_crc)
+{
+  crc_init_data_register_write(Reverse(start_crc));
+  crc_data_register_reset();
+
+  return (uint16_t)crc_block_data_calculate(pcBlock, len, INPUT_FORMAT_BYTE);
+}
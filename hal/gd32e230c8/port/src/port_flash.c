@@ -15,6 +15,8 @@ uint8_t port_sector_isclear(uint32_t sector)
   return 1;
 }
 
+/* Прерывания запрещены, ядро стоит на выборке из flash до конца очистки:
+   символы в FIFO передатчика USART ждут следующего сектора */
 uint8_t port_sector_erase(uint32_t page_addr)
 {
   __disable_irq();
@@ -39,6 +41,7 @@ uint8_t port_write_chunk(uint8_t *chunk,
   uint32_t i = 0;
   uint32_t tail;
   uint32_t word;
+  uint32_t start = address; /* начало участка для верификации */
 
   for (;;)
   {
@@ -58,8 +61,11 @@ uint8_t port_write_chunk(uint8_t *chunk,
 
     if (tail >= 4)
     {
-      /* обычная word-запись */
-      word = *(uint32_t *)(void *)(chunk + i);
+      /* обычная word-запись; chunk может быть не выровнен
+         (данные в буфере обмена), а Cortex-M23 не допускает
+         невыровненного чтения слова - собираем по байтам */
+      word = chunk[i] | (chunk[i + 1] << 8) | (chunk[i + 2] << 16) |
+             ((uint32_t)chunk[i + 3] << 24);
       fmc_word_program(address, word);
 
       address += 4;
@@ -89,13 +95,35 @@ uint8_t port_write_chunk(uint8_t *chunk,
     __enable_irq();
   }
 
-  /* Верификация */
+  /* Верификация от начала участка: address после записи хвоста
+     округлен вверх до слова, и address - len указывал бы на
+     следующие байты при len, не кратном 4 */
   for (uint32_t j = 0; j < len; j++)
   {
-    if (*(uint8_t *)(address - len + j) != chunk[j])
+    if (*(uint8_t *)(start + j) != chunk[j])
       return 1;
   }
 
   return 0;
 }
 
+uint8_t port_write_word(uint32_t address, uint32_t word)
+{
+  if (address & 0x03)
+    return 1;
+
+  __disable_irq();
+  fmc_unlock();
+
+  fmc_word_program(address, word);
+
+  fmc_flag_clear(FMC_FLAG_END | FMC_FLAG_WPERR | FMC_FLAG_PGERR);
+  fmc_lock();
+  __enable_irq();
+
+  /* Верификация */
+  if ((*(__IO uint32_t *)(address)) != word)
+    return 1;
+
+  return 0;
+}
@@ -0,0 +1,14 @@
+#include <string.h>
+#include "gd32e23x.h"
+#include "bootloader_port.h"
+
+/*
+  Уникальный идентификатор МК GD32E23x - 96 бит,
+  записан производителем в системную область flash
+*/
+#define UNIQUE_ID_BEGIN 0x1FFFF7ACUL
+
+void port_get_unique_id(uint8_t *id)
+{
+  memcpy(id, (const void *)UNIQUE_ID_BEGIN, PORT_UNIQUE_ID_SIZE);
+}
@@ -0,0 +1,48 @@
+#ifndef __FLASH_SIM_H__
+#define __FLASH_SIM_H__
+
+#include <stdint.h>
+
+/*
+  Эмуляция flash-памяти МК.
+  Память отображается из файла по тому же адресу, что и у МК
+  (FLASH_SIM_BEGIN), поэтому ядро читает flash обычным указателем.
+  Содержимое файла сохраняется между запусками.
+  Семантика записи как у GD32: стирание сектора заполняет его 0xFF,
+  слово можно записать только в стертую ячейку, иначе ошибка
+  программирования и содержимое ячейки не меняется.
+  Вне операций записи память защищена от записи (аналог fmc_lock).
+*/
+
+#define FLASH_SIM_BEGIN 0x08000000UL
+#define FLASH_SIM_SIZE 0x10000UL
+
+struct flash_sim_stat_s
+{
+  uint32_t sector_erase;  // Количество стертых секторов
+  uint32_t word_program;  // Количество записанных слов
+  uint32_t program_error; // Попыток записи в нестертую ячейку
+};
+
+/*
+  Открыть (при необходимости создать) файл образа flash и отобразить его
+  path - путь к файлу, либо NULL - память не сохраняется, изначально стерта
+  erase_us, program_us - эмулируемое время стирания сектора и записи слова
+  Возвращает:
+    0 - OK
+    -1 - ошибка, причина выведена в stderr
+*/
+int FlashSimOpen(const char *path, uint32_t erase_us, uint32_t program_us);
+
+void FlashSimClose(void);
+
+/*
+  Функция ожидания для эмуляции времени операций с flash.
+  По умолчанию (NULL) используется nanosleep, симулятор с
+  виртуальным временем подставляет сюда продвижение своих часов
+*/
+void FlashSimSetDelayHook(void (*hook)(uint32_t us));
+
+const struct flash_sim_stat_s *FlashSimStat(void);
+
+#endif
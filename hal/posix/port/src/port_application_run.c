@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "bootloader_port.h"
+#include "bootloader_project_config.h"
+#include "flash_sim.h"
+
+/*
+  Приложения на хосте нет, поэтому запуск приложения
+  означает штатное завершение процесса симулятора
+*/
+void port_application_run(void)
+{
+  fprintf(stderr, "sim: application run (0x%08lX)\n", (unsigned long)BOOTLOADER_APP_BEGIN);
+
+  FlashSimClose();
+  exit(0);
+}
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bootloader_port.h"
+#include "bootloader_hal_config.h"
+#include "bootloader_project_config.h"
+#include "flash_sim.h"
+
+#define FLASH_ERASE_VALUE 0xFFFFFFFFU
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000
+#endif
+
+static uint8_t *flash;
+static uint32_t erase_delay_us;
+static uint32_t program_delay_us;
+static struct flash_sim_stat_s flash_stat;
+static void (*delay_hook)(uint32_t us);
+
+/******************************************************************************/
+
+static void __delay_us(uint32_t us)
+{
+  struct timespec ts;
+
+  if (us == 0)
+    return;
+
+  if (delay_hook != NULL)
+  {
+    delay_hook(us);
+    return;
+  }
+
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (long)(us % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+
+static uint8_t __in_flash(uint32_t adr, uint32_t len)
+{
+  return (adr >= FLASH_SIM_BEGIN) && ((adr + len) <= (FLASH_SIM_BEGIN + FLASH_SIM_SIZE));
+}
+
+static void __unlock(void)
+{
+  mprotect(flash, FLASH_SIM_SIZE, PROT_READ | PROT_WRITE);
+}
+
+static void __lock(void)
+{
+  mprotect(flash, FLASH_SIM_SIZE, PROT_READ);
+}
+
+/*
+  Аналог fmc_word_program: запись возможна только в стертое слово
+*/
+static uint8_t __word_program(uint32_t address, uint32_t word)
+{
+  uint32_t *p = (uint32_t *)(flash + (address - FLASH_SIM_BEGIN));
+
+  __delay_us(program_delay_us);
+
+  if (*p != FLASH_ERASE_VALUE)
+  {
+    flash_stat.program_error++;
+    return 1;
+  }
+
+  *p = word;
+  flash_stat.word_program++;
+  return 0;
+}
+
+/******************************************************************************/
+
+int FlashSimOpen(const char *path, uint32_t erase_us, uint32_t program_us)
+{
+  struct stat st;
+  int fd;
+  void *p;
+
+  erase_delay_us = erase_us;
+  program_delay_us = program_us;
+  memset(&flash_stat, 0, sizeof(flash_stat));
+
+  if (path == NULL)
+  {
+    p = mmap((void *)FLASH_SIM_BEGIN, FLASH_SIM_SIZE, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if ((p == MAP_FAILED) || (p != (void *)FLASH_SIM_BEGIN))
+    {
+      fprintf(stderr, "flash: can't map memory at 0x%08lX\n", FLASH_SIM_BEGIN);
+      if (p != MAP_FAILED)
+        munmap(p, FLASH_SIM_SIZE);
+      return -1;
+    }
+
+    flash = p;
+    memset(flash, 0xFF, FLASH_SIM_SIZE);
+    __lock();
+    return 0;
+  }
+
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd < 0)
+  {
+    fprintf(stderr, "flash: %s: %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (fstat(fd, &st) != 0)
+  {
+    fprintf(stderr, "flash: %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  if (st.st_size != (off_t)FLASH_SIM_SIZE)
+  {
+    // Новый образ: вся память стерта
+    static uint8_t erased[BOOTLOADER_FLASH_SECTOR_SIZE];
+
+    memset(erased, 0xFF, sizeof(erased));
+
+    if (ftruncate(fd, 0) != 0)
+    {
+      fprintf(stderr, "flash: %s: %s\n", path, strerror(errno));
+      close(fd);
+      return -1;
+    }
+
+    for (uint32_t i = 0; i < FLASH_SIM_SIZE; i += sizeof(erased))
+    {
+      if (write(fd, erased, sizeof(erased)) != (ssize_t)sizeof(erased))
+      {
+        fprintf(stderr, "flash: %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+      }
+    }
+  }
+
+  p = mmap((void *)FLASH_SIM_BEGIN, FLASH_SIM_SIZE, PROT_READ,
+           MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+  close(fd);
+
+  if ((p == MAP_FAILED) || (p != (void *)FLASH_SIM_BEGIN))
+  {
+    fprintf(stderr, "flash: can't map image at 0x%08lX\n", FLASH_SIM_BEGIN);
+    if (p != MAP_FAILED)
+      munmap(p, FLASH_SIM_SIZE);
+    return -1;
+  }
+
+  flash = p;
+  return 0;
+}
+
+void FlashSimClose(void)
+{
+  if (flash == NULL)
+    return;
+
+  msync(flash, FLASH_SIM_SIZE, MS_SYNC);
+  munmap(flash, FLASH_SIM_SIZE);
+  flash = NULL;
+}
+
+void FlashSimSetDelayHook(void (*hook)(uint32_t us))
+{
+  delay_hook = hook;
+}
+
+const struct flash_sim_stat_s *FlashSimStat(void)
+{
+  return &flash_stat;
+}
+
+/******************************************************************************/
+
+uint8_t port_sector_isclear(uint32_t sector)
+{
+  for (uint32_t i = sector; i < sector + BOOTLOADER_FLASH_SECTOR_SIZE; i += 4)
+  {
+    if ((*(volatile uint32_t *)(uintptr_t)(i)) != FLASH_ERASE_VALUE)
+      return 0;
+  }
+  return 1;
+}
+
+uint8_t port_sector_erase(uint32_t page_addr)
+{
+  page_addr &= ~(BOOTLOADER_FLASH_SECTOR_SIZE - 1);
+
+  if (!__in_flash(page_addr, BOOTLOADER_FLASH_SECTOR_SIZE))
+    return 1;
+
+  __delay_us(erase_delay_us);
+
+  __unlock();
+  memset(flash + (page_addr - FLASH_SIM_BEGIN), 0xFF, BOOTLOADER_FLASH_SECTOR_SIZE);
+  __lock();
+
+  flash_stat.sector_erase++;
+
+  return 0;
+}
+
+uint8_t port_write_chunk(uint8_t *chunk,
+                         uint32_t address,
+                         uint16_t len)
+{
+  uint32_t i = 0;
+  uint32_t tail;
+  uint32_t word;
+
+  /* проверка выхода за границы приложения */
+  if ((address & 0x03) ||
+      (address < BOOTLOADER_APP_BEGIN) ||
+      (address + len > (BOOTLOADER_APP_BEGIN + BOOTLOADER_APP_LENGTH)))
+    return 1;
+
+  __unlock();
+
+  while (i < len)
+  {
+    tail = len - i;
+    word = 0xFFFFFFFFU;
+
+    /* неполное слово в конце дополняется 0xFF */
+    memcpy(&word, chunk + i, (tail >= 4) ? 4 : tail);
+
+    __word_program(address + i, word);
+    i += (tail >= 4) ? 4 : tail;
+  }
+
+  __lock();
+
+  /* Верификация */
+  if (memcmp((const void *)(uintptr_t)address, chunk, len) != 0)
+    return 1;
+
+  return 0;
+}
+
+uint8_t port_write_word(uint32_t address, uint32_t word)
+{
+  if ((address & 0x03) || !__in_flash(address, 4))
+    return 1;
+
+  __unlock();
+  __word_program(address, word);
+  __lock();
+
+  /* Верификация */
+  if ((*(volatile uint32_t *)(uintptr_t)(address)) != word)
+    return 1;
+
+  return 0;
+}
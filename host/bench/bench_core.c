@@ -0,0 +1,797 @@
+/*
+  Микро-замеры примитивов ядра Bootloader-а на хосте:
+  binex (прием/передача), CRC16 (таблица и побитовый расчет),
+  расшифровка чанка, MAC области приложения, проверка очистки сектора,
+  кодер/декодер Рида-Соломона.
+
+  Каждый замер повторяется несколько раз, количество итераций в одном
+  повторе подбирается так, чтобы повтор длился не меньше BENCH_SAMPLE_MS.
+  Результат - медиана времени одной операции и разброс (MAD) в процентах.
+
+  Результаты можно сохранить (--save) и сравнить с сохраненными ранее
+  (--compare), при замедлении больше порога программа возвращает 1.
+  Режим --verify проверяет побитное совпадение Crc16 с побитовым расчетом
+  и с портом CRC платы (port_crc16.c) на модели регистров блока CRC, а также
+  совпадение декодирования кадра COBS на месте (binex_cobs_decode)
+  с посимвольным приемником binex_rx.
+  Режим --only NAME --iters N выполняет N итераций одного замера без
+  измерения времени, он используется для подсчета инструкций в эмуляторе
+  (цель model в Makefile).
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include "binex-lib.h"
+#include "crc16.h"
+#include "rs-fec.h"
+#include "monocypher.h"
+#include "bootloader_port.h"
+#include "flash_sim.h"
+#include "bootloader_project_config.h"
+
+/******************************************************************************/
+
+#define BENCH_SAMPLES 15
+#define BENCH_SAMPLE_MS 20
+
+#define BINEX_PAYLOAD_SIZE 256
+#define CRC_BLOCK_SIZE 256
+#define CHUNK_DATA_SIZE 128
+#define APP_MAC_SIZE (BOOTLOADER_APP_LENGTH - 16)
+#define RS_DATA_SIZE 223
+#define RS_NPAR 16
+
+#define MAX_RESULTS 32
+
+/******************************************************************************/
+
+struct bench_s
+{
+  const char *name;
+  uint32_t bytes; // Обрабатывается байт за одну операцию
+  void (*run)(uint32_t iters);
+};
+
+struct result_s
+{
+  char name[32];
+  double ns; // нс на операцию
+};
+
+/******************************************************************************/
+
+static uint8_t payload[BINEX_PAYLOAD_SIZE];
+static uint8_t frame[BINEX_PAYLOAD_SIZE * 2 + 16];
+static uint16_t frame_len;
+static uint8_t rx_buff[BINEX_PAYLOAD_SIZE + 16];
+
+// Кадр COBS без разделителей для замера декодирования на месте
+static uint8_t cobs_frame[BINEX_PAYLOAD_SIZE * 2 + 16];
+static uint16_t cobs_frame_len;
+static uint8_t cobs_work[BINEX_PAYLOAD_SIZE * 2 + 16];
+
+static Binex_t link_bench;
+
+static uint8_t key[32];
+static uint8_t nonce[24];
+static uint8_t aad[5];
+static uint8_t cipher[CHUNK_DATA_SIZE];
+static uint8_t plain[CHUNK_DATA_SIZE];
+static uint8_t mac[16];
+
+static uint8_t app[APP_MAC_SIZE];
+
+static uint8_t rs_codeword[RS_DATA_SIZE + RS_NPAR];
+static uint8_t rs_work[RS_DATA_SIZE + RS_NPAR];
+
+static volatile uint32_t sink;
+
+/******************************************************************************/
+
+// Экземпляр binex по умолчанию не используется
+int binex_tx_callback(uint8_t c)
+{
+  (void)c;
+  return 0;
+}
+
+static int __frame_tx_callback(void *arg, uint8_t c)
+{
+  (void)arg;
+
+  if (frame_len >= sizeof(frame))
+    return 0;
+
+  frame[frame_len++] = c;
+  return 1;
+}
+
+static int __null_tx_callback(void *arg, uint8_t c)
+{
+  (void)arg;
+  sink += c;
+  return 1;
+}
+
+static uint64_t __now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+  Побитовый расчет CRC16 (тот же полином, что и Crc16),
+  для сравнения с табличной реализацией
+*/
+static uint16_t __crc16_bitwise(const uint8_t *data, uint16_t len, uint16_t crc)
+{
+  while (len--)
+  {
+    crc ^= *data++;
+
+    for (int i = 0; i < 8; i++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+  }
+
+  return crc;
+}
+
+/*
+  Порт CRC платы (hal/gd32e230c8/port/src/port_crc16.c), собранный с моделью
+  регистров блока CRC (gd32e23x/crc_model.c). Имена функций порта заменены
+  при сборке (Makefile, PORT_CRC_FLAGS)
+*/
+void PortCrc16Init(void);
+uint16_t PortCrc16StartValue(void);
+uint16_t PortCrc16(uint8_t *pcBlock, uint16_t len, uint16_t start_crc);
+
+/*
+  Побитное совпадение Crc16 с побитовым расчетом и портом CRC платы:
+  блоки разной длины, в том числе с продолжением от промежуточного значения,
+  как при расчете CRC пакета binex (адрес, размер, данные).
+  Возвращает количество несовпадений
+*/
+static int __crc16_verify(void)
+{
+  static const uint8_t check[] = "123456789";
+  uint32_t x = 1;
+  int errors = 0;
+
+  PortCrc16Init();
+
+  if ((Crc16((uint8_t *)check, 9, Crc16StartValue()) != 0x4B37) ||
+      (PortCrc16((uint8_t *)check, 9, PortCrc16StartValue()) != 0x4B37))
+  {
+    fprintf(stderr, "crc16: check value mismatch\n");
+    errors++;
+  }
+
+  for (uint16_t len = 0; len <= sizeof(payload); len++)
+  {
+    uint16_t crc, bitwise, unit;
+    uint16_t split;
+
+    x = x * 1103515245UL + 12345UL;
+    split = (uint16_t)((x >> 16) % (len + 1));
+
+    crc = Crc16(payload, split, Crc16StartValue());
+    crc = Crc16(payload + split, len - split, crc);
+    bitwise = __crc16_bitwise(payload, len, 0xFFFF);
+    unit = PortCrc16(payload, split, PortCrc16StartValue());
+    unit = PortCrc16(payload + split, len - split, unit);
+
+    if ((crc != bitwise) || (crc != unit))
+    {
+      fprintf(stderr, "crc16: len %u split %u: table %04X bitwise %04X port %04X\n",
+              len, split, crc, bitwise, unit);
+      errors++;
+    }
+  }
+
+  return errors;
+}
+
+/*
+  Кодирование пакета в кадр COBS передатчиком binex
+*/
+static void __cobs_encode(Binex_t *b, const uint8_t *data, uint16_t len)
+{
+  frame_len = 0;
+  binex_tx_init(b, (void *)data, len);
+  while (binex_tx(b) != BINEX_PACK_TX)
+    ;
+}
+
+/*
+  Прием кадра frame (с разделителями) посимвольным приемником и
+  декодирование того же кадра на месте (без разделителей) должны давать
+  одинаковый результат: статус, причину ошибки, адрес и данные.
+  Возвращает 1 при несовпадении
+*/
+static int __cobs_compare(Binex_t *rx, const char *what, uint16_t len)
+{
+  static uint8_t work[sizeof(frame)];
+  BinexRxStatus_t sr = BINEX_PACK_NOT_RX, br;
+  uint16_t slen, blen;
+  uint8_t serr, saddr;
+
+  binex_rx_begin(rx, rx_buff, sizeof(rx_buff));
+  for (uint16_t i = 0; (i < frame_len) && (sr == BINEX_PACK_NOT_RX); i++)
+    sr = binex_rx(rx, frame[i]);
+  slen = binex_rx_len(rx);
+  serr = binex_rx_error(rx);
+  saddr = binex_rx_addr(rx);
+
+  memcpy(work, frame + 1, frame_len - 2);
+  br = binex_cobs_decode(rx, work, frame_len - 2);
+  blen = binex_rx_len(rx);
+
+  if ((sr != br) ||
+      ((sr == BINEX_PACK_BROKEN) && (serr != binex_rx_error(rx))) ||
+      ((sr == BINEX_PACK_RX) && ((slen != blen) || (saddr != binex_rx_addr(rx)) ||
+                                 memcmp(rx_buff, work, blen))))
+  {
+    fprintf(stderr, "cobs: %s len %u: binex_rx %d (err %u, len %u), decode %d (err %u, len %u)\n",
+            what, len, sr, serr, slen, br, binex_rx_error(rx), blen);
+    return 1;
+  }
+
+  return 0;
+}
+
+/*
+  Декодирование COBS на месте против посимвольного приема: пакеты 0..256
+  байт с адресом и без, данные с нулями и сериями без нулей (блоки
+  максимальной длины), адрес 0 (первый блок пустой), поврежденные кадры.
+  Возвращает количество несовпадений
+*/
+static int __cobs_verify(void)
+{
+  static uint8_t data[BINEX_PAYLOAD_SIZE];
+  Binex_t tx, rx;
+  uint32_t x = 7;
+  int errors = 0;
+
+  for (uint16_t len = 0; len <= sizeof(data); len++)
+  {
+    for (int mode = 0; mode < 6; mode++)
+    {
+      for (uint16_t i = 0; i < len; i++)
+      {
+        x = x * 1103515245UL + 12345UL;
+        if (mode & 1)
+          data[i] = (uint8_t)(x >> 16) | 1; // без нулей
+        else
+          data[i] = ((x >> 16) & 3) ? (uint8_t)(x >> 24) : 0;
+      }
+
+      binex_init(&tx, __frame_tx_callback, NULL);
+      binex_init(&rx, NULL, NULL);
+      binex_cobs_set(&tx, 1);
+      binex_cobs_set(&rx, 1);
+
+      // Без адреса, адрес 0 и 0x15, прием устройством
+      if (mode >= 2)
+      {
+        binex_host_address_set(&tx, (mode < 4) ? 0 : 0x15);
+        binex_address_set(&rx, (mode < 4) ? 0 : 0x15);
+      }
+
+      __cobs_encode(&tx, data, len);
+      errors += __cobs_compare(&rx, "clean", len);
+
+      // Чужой адрес
+      if (mode >= 2)
+      {
+        binex_address_set(&rx, 0x16);
+        errors += __cobs_compare(&rx, "foreign address", len);
+        binex_address_set(&rx, (mode < 4) ? 0 : 0x15);
+      }
+
+      // Искаженный байт внутри кадра: ошибка CRC либо кадра
+      x = x * 1103515245UL + 12345UL;
+      {
+        uint16_t pos = 1 + (uint16_t)((x >> 16) % (frame_len - 2));
+        uint8_t saved = frame[pos];
+
+        frame[pos] ^= (uint8_t)(x >> 8) | 1;
+        if (frame[pos] != BINEX_COBS_DELIMITER)
+          errors += __cobs_compare(&rx, "corrupted", len);
+        frame[pos] = saved;
+      }
+
+      // Кадр оборван
+      if (frame_len > 4)
+      {
+        frame[frame_len - 2] = BINEX_COBS_DELIMITER;
+        frame_len--;
+        errors += __cobs_compare(&rx, "truncated", len);
+      }
+    }
+  }
+
+  return errors;
+}
+
+/******************************************************************************/
+
+static void __setup(void)
+{
+  uint32_t x = 12345;
+
+  for (unsigned i = 0; i < sizeof(payload); i++)
+  {
+    x = x * 1103515245UL + 12345UL;
+    payload[i] = (uint8_t)(x >> 16);
+  }
+
+  for (unsigned i = 0; i < sizeof(app); i++)
+  {
+    x = x * 1103515245UL + 12345UL;
+    app[i] = (uint8_t)(x >> 16);
+  }
+
+  memset(key, 0x5A, sizeof(key));
+  memset(nonce, 0xA5, sizeof(nonce));
+
+  Crc16Init();
+
+  /* Кадр COBS пакета без разделителей для замера декодирования на месте */
+  {
+    Binex_t b;
+
+    binex_init(&b, __frame_tx_callback, NULL);
+    binex_cobs_set(&b, 1);
+    __cobs_encode(&b, payload, sizeof(payload));
+    cobs_frame_len = frame_len - 2;
+    memcpy(cobs_frame, frame + 1, cobs_frame_len);
+  }
+
+  /* Пакет binex для замера приемника */
+  frame_len = 0;
+  binex_init(&link_bench, __frame_tx_callback, NULL);
+  binex_tx_init(&link_bench, payload, sizeof(payload));
+  while (binex_tx(&link_bench) != BINEX_PACK_TX)
+    ;
+
+  /* Зашифрованный чанк */
+  aad[4] = CHUNK_DATA_SIZE;
+  crypto_aead_lock(cipher, mac, key, nonce, aad, sizeof(aad), payload, CHUNK_DATA_SIZE);
+
+  /* Кодовое слово Рида-Соломона */
+  memcpy(rs_codeword, payload, RS_DATA_SIZE);
+  memset(rs_codeword + RS_DATA_SIZE, 0, RS_NPAR);
+  RsEncode(rs_codeword + RS_DATA_SIZE, RS_NPAR, rs_codeword, RS_DATA_SIZE);
+
+  /* Стертая flash для проверки очистки сектора */
+  if (FlashSimOpen(NULL, 0, 0) != 0)
+    exit(1);
+}
+
+/******************************************************************************/
+
+static void bench_binex_rx(uint32_t iters)
+{
+  while (iters--)
+  {
+    binex_rx_begin(&link_bench, rx_buff, sizeof(rx_buff));
+
+    for (uint16_t i = 0; i < frame_len; i++)
+    {
+      if (binex_rx(&link_bench, frame[i]) == BINEX_PACK_RX)
+        sink += binex_rx_len(&link_bench);
+    }
+  }
+}
+
+/*
+  Прием того же пакета в кадре COBS: посимвольно и на месте.
+  Кадр копируется в рабочий буфер, как при приеме по DMA
+*/
+static void bench_cobs_rx(uint32_t iters)
+{
+  Binex_t b;
+
+  binex_init(&b, NULL, NULL);
+  binex_cobs_set(&b, 1);
+
+  while (iters--)
+  {
+    binex_rx_begin(&b, rx_buff, sizeof(rx_buff));
+
+    for (uint16_t i = 0; i < cobs_frame_len; i++)
+      binex_rx(&b, cobs_frame[i]);
+    if (binex_rx(&b, BINEX_COBS_DELIMITER) == BINEX_PACK_RX)
+      sink += binex_rx_len(&b);
+  }
+}
+
+static void bench_cobs_decode(uint32_t iters)
+{
+  Binex_t b;
+
+  binex_init(&b, NULL, NULL);
+
+  while (iters--)
+  {
+    memcpy(cobs_work, cobs_frame, cobs_frame_len);
+    if (binex_cobs_decode(&b, cobs_work, cobs_frame_len) == BINEX_PACK_RX)
+      sink += binex_rx_len(&b);
+  }
+}
+
+static void bench_binex_tx(uint32_t iters)
+{
+  Binex_t b;
+
+  binex_init(&b, __null_tx_callback, NULL);
+
+  while (iters--)
+  {
+    binex_tx_init(&b, payload, sizeof(payload));
+    while (binex_tx(&b) != BINEX_PACK_TX)
+      ;
+  }
+}
+
+static void bench_crc16_table(uint32_t iters)
+{
+  while (iters--)
+    sink += Crc16(payload, CRC_BLOCK_SIZE, Crc16StartValue());
+}
+
+static void bench_crc16_bitwise(uint32_t iters)
+{
+  while (iters--)
+    sink += __crc16_bitwise(payload, CRC_BLOCK_SIZE, 0xFFFF);
+}
+
+static void bench_aead_unlock(uint32_t iters)
+{
+  while (iters--)
+    sink += crypto_aead_unlock(plain, mac, key, nonce, aad, sizeof(aad), cipher, CHUNK_DATA_SIZE);
+}
+
+static void bench_poly1305_app(uint32_t iters)
+{
+  uint8_t tag[16];
+
+  while (iters--)
+  {
+    crypto_poly1305(tag, app, sizeof(app), key);
+    sink += tag[0];
+  }
+}
+
+static void bench_sector_isclear(uint32_t iters)
+{
+  while (iters--)
+    sink += port_sector_isclear(BOOTLOADER_APP_BEGIN);
+}
+
+static void bench_rs_encode(uint32_t iters)
+{
+  uint8_t parity[RS_NPAR];
+
+  while (iters--)
+  {
+    memset(parity, 0, sizeof(parity));
+    RsEncode(parity, RS_NPAR, payload, RS_DATA_SIZE);
+    sink += parity[0];
+  }
+}
+
+static void bench_rs_decode_clean(uint32_t iters)
+{
+  while (iters--)
+  {
+    memcpy(rs_work, rs_codeword, sizeof(rs_work));
+    sink += RsDecode(rs_work, sizeof(rs_work), RS_NPAR);
+  }
+}
+
+static void bench_rs_decode_8err(uint32_t iters)
+{
+  while (iters--)
+  {
+    memcpy(rs_work, rs_codeword, sizeof(rs_work));
+    for (int i = 0; i < RS_NPAR / 2; i++)
+      rs_work[i * 29] ^= 0x5A;
+    sink += RsDecode(rs_work, sizeof(rs_work), RS_NPAR);
+  }
+}
+
+static const struct bench_s benches[] =
+{
+  {"binex_rx_256", BINEX_PAYLOAD_SIZE, bench_binex_rx},
+  {"binex_tx_256", BINEX_PAYLOAD_SIZE, bench_binex_tx},
+  {"cobs_rx_256", BINEX_PAYLOAD_SIZE, bench_cobs_rx},
+  {"cobs_decode_256", BINEX_PAYLOAD_SIZE, bench_cobs_decode},
+  {"crc16_table_256", CRC_BLOCK_SIZE, bench_crc16_table},
+  {"crc16_bitwise_256", CRC_BLOCK_SIZE, bench_crc16_bitwise},
+  {"aead_unlock_128", CHUNK_DATA_SIZE, bench_aead_unlock},
+  {"poly1305_app", APP_MAC_SIZE, bench_poly1305_app},
+  {"sector_isclear_1k", 1024, bench_sector_isclear},
+  {"rs_encode_223_16", RS_DATA_SIZE, bench_rs_encode},
+  {"rs_decode_clean", RS_DATA_SIZE + RS_NPAR, bench_rs_decode_clean},
+  {"rs_decode_8err", RS_DATA_SIZE + RS_NPAR, bench_rs_decode_8err},
+};
+
+#define NUM_BENCHES (sizeof(benches) / sizeof(benches[0]))
+
+/******************************************************************************/
+
+static int __cmp_double(const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+  Замер одного примитива
+  ns - медиана времени операции, mad - медианное отклонение, %
+*/
+static void __measure(const struct bench_s *b, double *ns, double *mad)
+{
+  double samples[BENCH_SAMPLES];
+  double dev[BENCH_SAMPLES];
+  uint32_t iters = 1;
+
+  // Подбор количества итераций
+  for (;;)
+  {
+    uint64_t t0 = __now_ns();
+    b->run(iters);
+    uint64_t dt = __now_ns() - t0;
+
+    if ((dt >= BENCH_SAMPLE_MS * 1000000ULL) || (iters >= (1u << 30)))
+      break;
+
+    iters = (dt == 0) ? iters * 16 : (uint32_t)((double)iters * BENCH_SAMPLE_MS * 1.2e6 / dt) + 1;
+  }
+
+  for (int i = 0; i < BENCH_SAMPLES; i++)
+  {
+    uint64_t t0 = __now_ns();
+    b->run(iters);
+    samples[i] = (double)(__now_ns() - t0) / iters;
+  }
+
+  qsort(samples, BENCH_SAMPLES, sizeof(double), __cmp_double);
+  *ns = samples[BENCH_SAMPLES / 2];
+
+  for (int i = 0; i < BENCH_SAMPLES; i++)
+    dev[i] = (samples[i] > *ns) ? samples[i] - *ns : *ns - samples[i];
+
+  qsort(dev, BENCH_SAMPLES, sizeof(double), __cmp_double);
+  *mad = dev[BENCH_SAMPLES / 2] * 100.0 / *ns;
+}
+
+/******************************************************************************/
+
+static int __load(const char *path, struct result_s *res)
+{
+  FILE *f = fopen(path, "r");
+  char line[128];
+  int n = 0;
+
+  if (f == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+
+  while ((n < MAX_RESULTS) && fgets(line, sizeof(line), f))
+  {
+    if ((line[0] == '#') || (sscanf(line, "%31s %lf", res[n].name, &res[n].ns) != 2))
+      continue;
+    n++;
+  }
+
+  fclose(f);
+  return n;
+}
+
+static int __save(const char *path, const struct result_s *res, int n, const char *unit)
+{
+  FILE *f = fopen(path, "w");
+
+  if (f == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+
+  fprintf(f, "# name %s\n", unit);
+  for (int i = 0; i < n; i++)
+    fprintf(f, "%s %.3f\n", res[i].name, res[i].ns);
+
+  fclose(f);
+  return 0;
+}
+
+/*
+  Сравнение с базовыми значениями
+  Возвращает количество ухудшений больше threshold процентов
+*/
+static int __compare(const struct result_s *base, int nbase,
+                     const struct result_s *cur, int ncur, double threshold)
+{
+  int regressions = 0;
+
+  printf("\n%-20s %12s %12s %8s\n", "name", "baseline", "current", "delta");
+
+  for (int i = 0; i < ncur; i++)
+  {
+    for (int j = 0; j < nbase; j++)
+    {
+      if (strcmp(cur[i].name, base[j].name) != 0)
+        continue;
+
+      double delta = (cur[i].ns - base[j].ns) * 100.0 / base[j].ns;
+      int bad = delta > threshold;
+
+      printf("%-20s %12.1f %12.1f %+7.1f%%%s\n", cur[i].name,
+             base[j].ns, cur[i].ns, delta, bad ? "  REGRESSION" : "");
+      regressions += bad;
+    }
+  }
+
+  return regressions;
+}
+
+/******************************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --filter SUBSTR       run only benchmarks whose name contains SUBSTR\n"
+          "  --save FILE           save results (ns/op)\n"
+          "  --compare FILE        compare with saved results\n"
+          "  --threshold PCT       allowed slowdown for --compare/--diff (default: 10)\n"
+          "  --list                list benchmark names\n"
+          "  --only NAME --iters N run N iterations of one benchmark without timing\n"
+          "  --diff BASE CUR       compare two result files (e.g. instruction counts)\n"
+          "  --verify              check CRC16 against bitwise and CRC unit models,\n"
+          "                        COBS in-place decode against binex_rx\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *filter = NULL;
+  const char *save = NULL;
+  const char *compare = NULL;
+  const char *only = NULL;
+  const char *diff_base = NULL;
+  const char *diff_cur = NULL;
+  uint32_t iters = 0;
+  int verify = 0;
+  double threshold = 10.0;
+  static struct result_s res[MAX_RESULTS];
+  int n = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--filter") && (i + 1 < argc))
+      filter = argv[++i];
+    else if (!strcmp(argv[i], "--save") && (i + 1 < argc))
+      save = argv[++i];
+    else if (!strcmp(argv[i], "--compare") && (i + 1 < argc))
+      compare = argv[++i];
+    else if (!strcmp(argv[i], "--threshold") && (i + 1 < argc))
+      threshold = strtod(argv[++i], NULL);
+    else if (!strcmp(argv[i], "--only") && (i + 1 < argc))
+      only = argv[++i];
+    else if (!strcmp(argv[i], "--iters") && (i + 1 < argc))
+      iters = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--diff") && (i + 2 < argc))
+    {
+      diff_base = argv[++i];
+      diff_cur = argv[++i];
+    }
+    else if (!strcmp(argv[i], "--verify"))
+      verify = 1;
+    else if (!strcmp(argv[i], "--list"))
+    {
+      for (unsigned j = 0; j < NUM_BENCHES; j++)
+        printf("%s\n", benches[j].name);
+      return 0;
+    }
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (diff_base != NULL)
+  {
+    static struct result_s base[MAX_RESULTS];
+    int nbase = __load(diff_base, base);
+    int ncur = __load(diff_cur, res);
+
+    if ((nbase < 0) || (ncur < 0))
+      return 2;
+
+    return __compare(base, nbase, res, ncur, threshold) ? 1 : 0;
+  }
+
+  __setup();
+
+  if (verify)
+  {
+    int crc_errors = __crc16_verify();
+    int cobs_errors = __cobs_verify();
+
+    printf("crc16: %s\n", crc_errors ? "FAIL" : "OK");
+    printf("cobs: %s\n", cobs_errors ? "FAIL" : "OK");
+    return (crc_errors || cobs_errors) ? 1 : 0;
+  }
+
+  if (only != NULL)
+  {
+    for (unsigned j = 0; j < NUM_BENCHES; j++)
+    {
+      if (!strcmp(benches[j].name, only))
+      {
+        benches[j].run(iters);
+        return 0;
+      }
+    }
+
+    fprintf(stderr, "unknown benchmark: %s\n", only);
+    return 2;
+  }
+
+  // Замеры на одном ядре стабильнее
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(0, &cpus);
+  sched_setaffinity(0, sizeof(cpus), &cpus);
+
+  printf("%-20s %12s %10s %10s %8s\n", "name", "ns/op", "ns/byte", "MB/s", "mad");
+
+  for (unsigned j = 0; j < NUM_BENCHES; j++)
+  {
+    const struct bench_s *b = &benches[j];
+    double ns, mad;
+
+    if ((filter != NULL) && (strstr(b->name, filter) == NULL))
+      continue;
+
+    __measure(b, &ns, &mad);
+
+    printf("%-20s %12.1f %10.3f %10.1f %7.1f%%\n", b->name, ns,
+           ns / b->bytes, b->bytes * 1e3 / ns, mad);
+    fflush(stdout);
+
+    snprintf(res[n].name, sizeof(res[n].name), "%s", b->name);
+    res[n].ns = ns;
+    n++;
+  }
+
+  if ((save != NULL) && (__save(save, res, n, "ns/op") != 0))
+    return 2;
+
+  if (compare != NULL)
+  {
+    static struct result_s base[MAX_RESULTS];
+    int nbase = __load(compare, base);
+
+    if (nbase < 0)
+      return 2;
+
+    return __compare(base, nbase, res, n, threshold) ? 1 : 0;
+  }
+
+  return 0;
+}
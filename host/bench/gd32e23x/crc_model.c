@@ -0,0 +1,232 @@
+#include "gd32e23x.h"
+
+/*
+  Модель блока CRC GD32E23x для проверки hal/gd32e230c8/port/src/port_crc16.c
+  на хосте. Функции повторяют запись регистров в SPL (gd32e23x_crc.c),
+  а регистры ведут себя как в описании блока:
+
+  - расчет только при включенном тактировании (RCU_CRC), без него запись
+    регистров не действует
+  - IDATA - начальное значение, в DATA оно попадает только по сбросу
+    (CTL.RST), поэтому важен порядок записи IDATA и сброса
+  - размер полинома CTL.PS: 32, 16, 8 или 7 бит, расчет в прямом порядке
+    бит (старшим битом вперед) в младших битах DATA, полином - младшие
+    биты POLY
+  - CTL.REV_I - отражение входных данных по байтам, полусловам или словам
+  - CTL.REV_O - отражение результата по размеру полинома (для 16-битного
+    полинома - 16 бит), отражается только читаемое значение, не DATA
+*/
+
+static uint8_t clock_on;
+static uint32_t reg_data = 0xFFFFFFFFU;
+static uint32_t reg_fdata;
+static uint32_t reg_ctl;
+static uint32_t reg_idata = 0xFFFFFFFFU;
+static uint32_t reg_poly = 0x04C11DB7U;
+
+static uint32_t __reflect(uint32_t v, unsigned bits)
+{
+  uint32_t r = 0;
+
+  for (unsigned i = 0; i < bits; i++, v >>= 1)
+    r = (r << 1) | (v & 1);
+
+  return r;
+}
+
+static unsigned __poly_bits(void)
+{
+  switch (reg_ctl & CRC_CTL_PS)
+  {
+  case CRC_CTL_PS_16:
+    return 16;
+  case CRC_CTL_PS_8:
+    return 8;
+  case CRC_CTL_PS_7:
+    return 7;
+  default:
+    return 32;
+  }
+}
+
+static uint32_t __poly_mask(void)
+{
+  unsigned bits = __poly_bits();
+
+  return (bits == 32) ? 0xFFFFFFFFU : ((1UL << bits) - 1);
+}
+
+static void __ctl_write(uint32_t value)
+{
+  if (!clock_on)
+    return;
+
+  // Бит сброса не хранится: DATA загружается из IDATA
+  if (value & CRC_CTL_RST)
+    reg_data = reg_idata;
+  reg_ctl = value & ~CRC_CTL_RST;
+}
+
+/*
+  Запись в DATA: bits - разрядность записи (8, 16 или 32)
+*/
+static void __data_write(uint32_t value, unsigned bits)
+{
+  unsigned width = __poly_bits();
+  uint32_t mask = __poly_mask();
+  uint32_t crc = reg_data & mask;
+
+  if (!clock_on)
+    return;
+
+  switch (reg_ctl & CRC_CTL_REV_I)
+  {
+  case CRC_INPUT_DATA_BYTE:
+  {
+    uint32_t r = 0;
+
+    for (unsigned i = 0; i < bits; i += 8)
+      r |= __reflect((value >> i) & 0xFF, 8) << i;
+    value = r;
+  }
+  break;
+
+  case CRC_INPUT_DATA_HALFWORD:
+    if (bits >= 16)
+    {
+      uint32_t r = 0;
+
+      for (unsigned i = 0; i < bits; i += 16)
+        r |= __reflect((value >> i) & 0xFFFF, 16) << i;
+      value = r;
+    }
+    break;
+
+  case CRC_INPUT_DATA_WORD:
+    if (bits == 32)
+      value = __reflect(value, 32);
+    break;
+
+  default:
+    break;
+  }
+
+  for (int i = bits - 1; i >= 0; i--)
+  {
+    uint32_t feedback = ((crc >> (width - 1)) ^ (value >> i)) & 1;
+
+    crc = (crc << 1) & mask;
+    if (feedback)
+      crc ^= reg_poly & mask;
+  }
+
+  reg_data = (reg_data & ~mask) | crc;
+}
+
+static uint32_t __data_read(void)
+{
+  if (reg_ctl & CRC_CTL_REV_O)
+    return __reflect(reg_data & __poly_mask(), __poly_bits());
+
+  return reg_data;
+}
+
+/******************************************************************************/
+
+void rcu_periph_clock_enable(rcu_periph_enum periph)
+{
+  if (periph == RCU_CRC)
+    clock_on = 1;
+}
+
+void crc_deinit(void)
+{
+  if (!clock_on)
+    return;
+
+  reg_idata = 0xFFFFFFFFU;
+  reg_data = 0xFFFFFFFFU;
+  reg_fdata = 0;
+  reg_poly = 0x04C11DB7U;
+  __ctl_write(CRC_CTL_RST);
+}
+
+void crc_reverse_output_data_enable(void)
+{
+  __ctl_write(reg_ctl | CRC_CTL_REV_O);
+}
+
+void crc_reverse_output_data_disable(void)
+{
+  __ctl_write(reg_ctl & ~CRC_CTL_REV_O);
+}
+
+void crc_data_register_reset(void)
+{
+  __ctl_write(reg_ctl | CRC_CTL_RST);
+}
+
+uint32_t crc_data_register_read(void)
+{
+  return __data_read();
+}
+
+uint8_t crc_free_data_register_read(void)
+{
+  return (uint8_t)reg_fdata;
+}
+
+void crc_free_data_register_write(uint8_t free_data)
+{
+  if (clock_on)
+    reg_fdata = free_data;
+}
+
+void crc_init_data_register_write(uint32_t init_data)
+{
+  if (clock_on)
+    reg_idata = init_data;
+}
+
+void crc_input_data_reverse_config(uint32_t data_reverse)
+{
+  __ctl_write((reg_ctl & ~CRC_CTL_REV_I) | data_reverse);
+}
+
+void crc_polynomial_size_set(uint32_t poly_size)
+{
+  __ctl_write((reg_ctl & ~CRC_CTL_PS) | poly_size);
+}
+
+void crc_polynomial_set(uint32_t poly)
+{
+  if (clock_on)
+    reg_poly = poly;
+}
+
+uint32_t crc_single_data_calculate(uint32_t sdata, uint8_t data_format)
+{
+  if (data_format == INPUT_FORMAT_WORD)
+    __data_write(sdata, 32);
+  else if (data_format == INPUT_FORMAT_HALFWORD)
+    __data_write((uint16_t)sdata, 16);
+  else
+    __data_write((uint8_t)sdata, 8);
+
+  return __data_read();
+}
+
+uint32_t crc_block_data_calculate(void *array, uint32_t size, uint8_t data_format)
+{
+  for (uint32_t i = 0; i < size; i++)
+  {
+    if (data_format == INPUT_FORMAT_WORD)
+      __data_write(((uint32_t *)array)[i], 32);
+    else if (data_format == INPUT_FORMAT_HALFWORD)
+      __data_write(((uint16_t *)array)[i], 16);
+    else
+      __data_write(((uint8_t *)array)[i], 8);
+  }
+
+  return __data_read();
+}
@@ -0,0 +1,31 @@
+#ifndef GD32E23X_H
+#define GD32E23X_H
+
+/*
+  Заголовок GD32E23x для сборки hal/gd32e230c8/port/src/port_crc16.c на хосте.
+  Макросы битов - как в заголовке МК, константы и объявления функций блока
+  CRC - из неизмененного SPL (gd32e23x_crc.h). Функции CRC и тактирования
+  реализует модель регистров crc_model.c, к регистрам по адресам порт
+  не обращается
+*/
+
+#include <stdint.h>
+
+#define BIT(x)                 ((uint32_t)((uint32_t)0x01U << (x)))
+#define BITS(start, end)       ((0xFFFFFFFFUL << (start)) & (0xFFFFFFFFUL >> (31U - (uint32_t)(end))))
+#define REG32(addr)            (*(volatile uint32_t *)(uintptr_t)(addr))
+#define REG16(addr)            (*(volatile uint16_t *)(uintptr_t)(addr))
+#define REG8(addr)             (*(volatile uint8_t *)(uintptr_t)(addr))
+
+#define CRC_BASE               0x40023000U
+
+typedef enum
+{
+  RCU_CRC = (0x14U << 6) | 6U
+} rcu_periph_enum;
+
+void rcu_periph_clock_enable(rcu_periph_enum periph);
+
+#include "gd32e23x_crc.h"
+
+#endif
@@ -0,0 +1,1352 @@
+/*
+  Разбор записи линии связи (логический анализатор, симулятор) и анализ
+  эффективности обмена с Bootloader-ом.
+
+  Вход - символы обоих направлений с метками времени (см. README.md).
+  Из потока каждого направления восстанавливаются пакеты binex
+  (START, экранирование ESC, [ADDR], PACK_LEN, DATA, CRC16, проверочные
+  байты FEC) либо кадры COBS, затем команды Bootloader-а и ответы на них.
+  Кадрирование COBS включается ответом устройства на ACTIVATE: устройство
+  переходит на него после ответа, хост - после приема ответа.
+
+  Отчет:
+    - сырой поток и полезные данные по направлениям, доля экранирования
+      и служебных полей пакета, пакеты с ошибкой CRC, мусор вне пакетов
+    - куда ушло время линии: передача хоста и устройства, задержка ответа
+      по командам, стирание flash (между событиями о ходе очистки),
+      пауза хоста, ожидание ответа до тайм-аута, повторные передачи
+    - статистика по командам: запросы, повторы, ошибки, время ответа
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "binex-lib.h"
+#include "crc16.h"
+#include "rs-fec.h"
+
+/******************************************************************************/
+
+#define CMD_ACTIVATE 0x70
+#define CMD_BEGIN 0x71
+#define CMD_SEND 0x72
+#define CMD_WRITE 0x73
+#define CMD_END 0x74
+#define CMD_CHECK_CRC 0x75
+#define CMD_APP_RUN 0x76
+#define CMD_ERASE_USER_DATA 0x78
+#define CMD_RESUME 0x79
+#define CMD_BCAST_BEGIN 0x7A
+#define CMD_BCAST_CHUNK 0x7B
+#define CMD_BCAST_END 0x7C
+#define CMD_BCAST_STATUS 0x7D
+#define CMD_BCAST_APP_RUN 0x7E
+#define CMD_DISCOVER 0x7F
+#define CMD_SET_FEC 0x80
+#define CMD_RELAY_SEND 0x81
+#define CMD_RELAY_POLL 0x82
+
+#define STATUS_EVENT 0xFF
+
+#define FRAMING_COBS 0x01
+
+#define DIR_HOST 0 // хост -> устройство
+#define DIR_DEV 1  // устройство -> хост
+
+#define FRAME_MAX_SIZE 1024
+
+#define MAX_SWITCHES 64
+
+#define RETX_NONE 0
+#define RETX_DUP 1    // повтор корректного запроса, данные уже были в линии
+#define RETX_BROKEN 2 // повтор после запроса, поврежденного в линии
+
+/******************************************************************************/
+
+struct sym_s
+{
+  double t;    // начало передачи символа, с
+  uint32_t seq; // порядок в записи, для символов с одинаковым временем
+  uint8_t dir;
+  uint8_t c;
+};
+
+struct frame_s
+{
+  uint8_t dir;
+  uint8_t valid;
+  uint8_t addr;
+  uint8_t fec_npar;
+  uint8_t cobs;      // кадр COBS
+  uint8_t retx;      // повтор запроса: RETX_xxx
+  double t_start;    // начало символа START (разделителя COBS)
+  double t_end;      // конец последнего символа пакета
+  uint32_t raw;      // символов в линии, включая START и ESC (разделители)
+  uint32_t esc;      // символов ESC
+  uint32_t overhead; // START, ADDR, PACK_LEN, CRC16, проверочные байты,
+                     // для COBS - разделители и коды блоков
+  uint32_t corrected;
+  uint16_t len;
+  uint8_t *data;
+};
+
+struct dir_stat_s
+{
+  uint64_t raw;
+  uint64_t esc;
+  uint64_t overhead;
+  uint64_t payload;
+  uint64_t garbage; // символы вне пакетов и после конца пакета
+  uint32_t frames;
+  uint32_t broken;
+  uint32_t corrected;
+  double tx_time;
+};
+
+struct cmd_stat_s
+{
+  uint32_t requests;
+  uint32_t retx;
+  uint32_t responses;
+  uint32_t errors;
+  uint32_t events;
+  uint32_t no_reply;
+  double lat_sum, lat_min, lat_max;
+};
+
+enum
+{
+  CAT_HOST_TX = 0,
+  CAT_DEV_TX,
+  CAT_RETX_TX,
+  CAT_RESP_DELAY,
+  CAT_ERASE,
+  CAT_HOST_GAP,
+  CAT_TIMEOUT,
+  CAT_OTHER,
+  NUM_CATS
+};
+
+static const char *cat_name[NUM_CATS] =
+{
+  "host tx",
+  "device tx",
+  "retransmitted tx",
+  "device response delay",
+  "flash erase (progress events)",
+  "host gap",
+  "waiting for timeout",
+  "other idle",
+};
+
+/******************************************************************************/
+
+static struct sym_s *syms;
+static size_t num_syms, max_syms;
+
+static struct frame_s *frames;
+static size_t num_frames, max_frames;
+
+// Смена кадрирования: конец ответа устройства на ACTIVATE
+struct switch_s
+{
+  double t;
+  uint8_t cobs;
+};
+
+static struct switch_s switches[MAX_SWITCHES];
+static size_t num_switches;
+static uint8_t cobs_at_start; // кадрирование COBS с начала записи (--cobs)
+
+static struct dir_stat_s dir_stat[2];
+static struct cmd_stat_s cmd_stat[256];
+static double cat_time[NUM_CATS];
+static uint32_t cat_count[NUM_CATS];
+static double resp_delay[256]; // задержка ответа по командам
+
+static double byte_time;
+static uint32_t line_errors; // строки с ошибкой кадра UART в записи
+static uint32_t unmatched;   // ответы без запроса
+
+static const char *host_name;
+static const char *dev_name;
+
+/******************************************************************************/
+
+// Экземпляр binex по умолчанию не используется
+int binex_tx_callback(uint8_t c)
+{
+  (void)c;
+  return 0;
+}
+
+static const char *__cmd_name(uint8_t cmd)
+{
+  switch (cmd)
+  {
+  case CMD_ACTIVATE: return "ACTIVATE";
+  case CMD_BEGIN: return "BEGIN";
+  case CMD_SEND: return "SEND";
+  case CMD_WRITE: return "WRITE";
+  case CMD_END: return "END";
+  case CMD_CHECK_CRC: return "CHECK_CRC";
+  case CMD_APP_RUN: return "APP_RUN";
+  case CMD_ERASE_USER_DATA: return "ERASE_USER_DATA";
+  case CMD_RESUME: return "RESUME";
+  case CMD_BCAST_BEGIN: return "BCAST_BEGIN";
+  case CMD_BCAST_CHUNK: return "BCAST_CHUNK";
+  case CMD_BCAST_END: return "BCAST_END";
+  case CMD_BCAST_STATUS: return "BCAST_STATUS";
+  case CMD_BCAST_APP_RUN: return "BCAST_APP_RUN";
+  case CMD_DISCOVER: return "DISCOVER";
+  case CMD_SET_FEC: return "SET_FEC";
+  case CMD_RELAY_SEND: return "RELAY_SEND";
+  case CMD_RELAY_POLL: return "RELAY_POLL";
+  }
+  return NULL;
+}
+
+/*
+  Команды, на которые устройство не отвечает
+*/
+static int __cmd_no_reply(uint8_t cmd)
+{
+  return (cmd == CMD_BCAST_BEGIN) || (cmd == CMD_BCAST_CHUNK) ||
+         (cmd == CMD_BCAST_END) || (cmd == CMD_BCAST_APP_RUN);
+}
+
+/*
+  Команды опроса, одинаковые запросы подряд для них - не повтор
+*/
+static int __cmd_polling(uint8_t cmd)
+{
+  return (cmd == CMD_BCAST_STATUS) || (cmd == CMD_RELAY_POLL) || (cmd == CMD_DISCOVER);
+}
+
+/*
+  Чанк прошивки в запросе: cmd, address (4), len, nonce, ciphertext, tag
+*/
+static int __cmd_has_chunk(uint8_t cmd)
+{
+  return (cmd == CMD_SEND) || (cmd == CMD_BCAST_CHUNK);
+}
+
+/******************************************************************************
+  Чтение записи
+******************************************************************************/
+
+static void __sym_add(double t, uint8_t dir, uint8_t c)
+{
+  if (num_syms == max_syms)
+  {
+    max_syms = max_syms ? max_syms * 2 : 65536;
+    syms = realloc(syms, max_syms * sizeof(*syms));
+    if (!syms)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+
+  syms[num_syms].t = t;
+  syms[num_syms].seq = num_syms;
+  syms[num_syms].dir = dir;
+  syms[num_syms].c = c;
+  num_syms++;
+}
+
+static char *__trim(char *s)
+{
+  char *e;
+
+  while (isspace((unsigned char)*s) || (*s == '"'))
+    s++;
+
+  e = s + strlen(s);
+  while ((e > s) && (isspace((unsigned char)e[-1]) || (e[-1] == '"')))
+    *--e = 0;
+
+  return s;
+}
+
+/*
+  Направление по имени канала: H/D, >/<, либо имена --host/--dev
+*/
+static int __parse_dir(const char *s)
+{
+  if (host_name && !strcmp(s, host_name))
+    return DIR_HOST;
+  if (dev_name && !strcmp(s, dev_name))
+    return DIR_DEV;
+  if (!strcmp(s, "H") || !strcmp(s, "h") || !strcmp(s, ">"))
+    return DIR_HOST;
+  if (!strcmp(s, "D") || !strcmp(s, "d") || !strcmp(s, "<"))
+    return DIR_DEV;
+  return -1;
+}
+
+static int __split(char *line, char **fields, int max)
+{
+  int n = 0;
+  char *p = line;
+  int csv = (strchr(line, ',') != NULL);
+
+  while (*p && (n < max))
+  {
+    char *start = p;
+    int quoted = 0;
+
+    while (*p)
+    {
+      if (*p == '"')
+        quoted = !quoted;
+      else if (!quoted && (csv ? (*p == ',') : isspace((unsigned char)*p)))
+        break;
+      p++;
+    }
+
+    if (*p)
+      *p++ = 0;
+
+    if (!csv && (*start == 0))
+      continue;
+
+    fields[n++] = __trim(start);
+  }
+
+  return n;
+}
+
+/*
+  Формат записи:
+    - собственный: "время направление символ" (с, H/D, hex), см. README.md
+    - CSV с заголовком, например экспорт Saleae Logic 2 (Async Serial):
+      колонки time/start_time, name/channel/dir, data/value, type
+*/
+static int __load(const char *path)
+{
+  FILE *f = strcmp(path, "-") ? fopen(path, "r") : stdin;
+  char line[512];
+  int col_time = 0, col_dir = 1, col_data = 2, col_type = -1;
+  int header_seen = 0;
+  int csv = 0;
+  uint32_t lineno = 0;
+
+  if (!f)
+  {
+    perror(path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), f))
+  {
+    char *fields[16];
+    int n, dir;
+    char *end;
+    double t;
+    long v;
+
+    lineno++;
+
+    if ((line[0] == '#') || (line[0] == '\n') || (line[0] == '\r'))
+      continue;
+
+    n = __split(line, fields, 16);
+    if (n == 0)
+      continue;
+
+    // Заголовок CSV: первая строка, которая не начинается с числа
+    if (!header_seen && !isdigit((unsigned char)fields[0][0]) && (fields[0][0] != '-') && (fields[0][0] != '.'))
+    {
+      col_time = col_dir = col_data = -1;
+
+      for (int i = 0; i < n; i++)
+      {
+        char name[64];
+        size_t k;
+
+        for (k = 0; fields[i][k] && (k < sizeof(name) - 1); k++)
+          name[k] = tolower((unsigned char)fields[i][k]);
+        name[k] = 0;
+
+        if (!strncmp(name, "time", 4) || !strncmp(name, "start_time", 10))
+          col_time = i;
+        else if (!strcmp(name, "name") || !strcmp(name, "channel") || !strcmp(name, "dir"))
+          col_dir = i;
+        else if (!strcmp(name, "data") || !strcmp(name, "value"))
+          col_data = i;
+        else if (!strcmp(name, "type"))
+          col_type = i;
+      }
+
+      if ((col_time < 0) || (col_dir < 0) || (col_data < 0))
+      {
+        fprintf(stderr, "%s:%u: unknown header, need time, name/channel and data columns\n", path, lineno);
+        return -1;
+      }
+
+      header_seen = 1;
+      csv = 1;
+      continue;
+    }
+
+    header_seen = 1;
+
+    if ((n <= col_time) || (n <= col_dir) || (n <= col_data))
+    {
+      fprintf(stderr, "%s:%u: too few fields\n", path, lineno);
+      return -1;
+    }
+
+    // Ошибки кадра UART и т.п. в экспорте анализатора
+    if ((col_type >= 0) && (n > col_type) && strcmp(fields[col_type], "data"))
+    {
+      line_errors++;
+      continue;
+    }
+
+    t = strtod(fields[col_time], &end);
+    if (end == fields[col_time])
+    {
+      fprintf(stderr, "%s:%u: bad time '%s'\n", path, lineno, fields[col_time]);
+      return -1;
+    }
+
+    dir = __parse_dir(fields[col_dir]);
+    if (dir < 0)
+    {
+      fprintf(stderr, "%s:%u: unknown channel '%s', use --host/--dev\n", path, lineno, fields[col_dir]);
+      return -1;
+    }
+
+    // Собственный формат - hex, CSV - с префиксом 0x либо десятичное
+    v = strtol(fields[col_data], &end, csv ? 0 : 16);
+    if ((end == fields[col_data]) || (v < 0) || (v > 0xFF))
+    {
+      fprintf(stderr, "%s:%u: bad data '%s'\n", path, lineno, fields[col_data]);
+      return -1;
+    }
+
+    __sym_add(t, (uint8_t)dir, (uint8_t)v);
+  }
+
+  if (f != stdin)
+    fclose(f);
+
+  return 0;
+}
+
+static int __sym_cmp(const void *a, const void *b)
+{
+  const struct sym_s *x = a, *y = b;
+
+  if (x->t < y->t)
+    return -1;
+  if (x->t > y->t)
+    return 1;
+  return (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+static int __double_cmp(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*
+  Время передачи символа: минимальный интервал между соседними
+  символами одного направления (символы внутри пакета идут подряд)
+*/
+static double __estimate_byte_time(void)
+{
+  double *d = malloc(num_syms * sizeof(double));
+  double last[2] = {-1, -1};
+  size_t n = 0;
+  double r = 0;
+
+  for (size_t i = 0; i < num_syms; i++)
+  {
+    uint8_t dir = syms[i].dir;
+
+    if ((last[dir] >= 0) && (syms[i].t - last[dir] > 1e-9))
+      d[n++] = syms[i].t - last[dir];
+    last[dir] = syms[i].t;
+  }
+
+  if (n != 0)
+  {
+    // 1-й процентиль, чтобы один неточный интервал не испортил оценку
+    qsort(d, n, sizeof(double), __double_cmp);
+    r = d[n / 100];
+  }
+
+  free(d);
+  return r;
+}
+
+/******************************************************************************
+  Восстановление пакетов
+******************************************************************************/
+
+static struct frame_s *__frame_new(void)
+{
+  if (num_frames == max_frames)
+  {
+    max_frames = max_frames ? max_frames * 2 : 4096;
+    frames = realloc(frames, max_frames * sizeof(*frames));
+    if (!frames)
+    {
+      fprintf(stderr, "out of memory\n");
+      exit(1);
+    }
+  }
+
+  memset(&frames[num_frames], 0, sizeof(struct frame_s));
+  return &frames[num_frames++];
+}
+
+/*
+  Разбор пакета без FEC. Возвращает количество использованных байт
+  (после START, без экранирования), 0 - пакет не распознан
+*/
+static uint32_t __decode_plain(struct frame_s *fr, const uint8_t *u, uint32_t n, int addressed)
+{
+  uint32_t h = addressed ? 1 : 0;
+  uint32_t len;
+  uint16_t crc;
+
+  if (n < h + 4)
+    return 0;
+
+  len = u[h] | (u[h + 1] << 8);
+  if (n < h + 2 + len + 2)
+    return 0;
+
+  crc = Crc16((uint8_t *)u, h + 2 + len, Crc16StartValue());
+  if (crc != (u[h + 2 + len] | (u[h + 3 + len] << 8)))
+    return 0;
+
+  fr->addr = addressed ? u[0] : BINEX_ADDRESS_NONE;
+  fr->len = len;
+  fr->data = malloc(len + 1);
+  memcpy(fr->data, u + h + 2, len);
+  fr->fec_npar = 0;
+  fr->corrected = 0;
+  fr->overhead = 1 + h + 2 + 2;
+
+  return h + 2 + len + 2;
+}
+
+/*
+  Разбор пакета с FEC: заголовок [ADDR] PACK_LEN + 2 проверочных байта,
+  тело DATA CRC16 + npar проверочных байт
+*/
+static uint32_t __decode_fec(struct frame_s *fr, const uint8_t *u, uint32_t n, int addressed, uint8_t npar)
+{
+  uint8_t hdr[5];
+  uint8_t body[255];
+  uint8_t crc_buf[3];
+  uint32_t h = addressed ? 1 : 0;
+  uint32_t hs = h + 2 + 2;
+  uint32_t len, bs;
+  int corr_hdr, corr_body;
+  uint16_t crc;
+
+  if (n < hs)
+    return 0;
+
+  memcpy(hdr, u, hs);
+  corr_hdr = RsDecode(hdr, hs, 2);
+  if (corr_hdr < 0)
+    return 0;
+
+  len = hdr[h] | (hdr[h + 1] << 8);
+  bs = len + 2 + npar;
+  if ((bs > 255) || (n < hs + bs))
+    return 0;
+
+  memcpy(body, u + hs, bs);
+  corr_body = RsDecode(body, bs, npar);
+  if (corr_body < 0)
+    return 0;
+
+  memcpy(crc_buf, hdr, h + 2);
+  crc = Crc16(crc_buf, h + 2, Crc16StartValue());
+  crc = Crc16(body, len, crc);
+  if (crc != (body[len] | (body[len + 1] << 8)))
+    return 0;
+
+  fr->addr = addressed ? hdr[0] : BINEX_ADDRESS_NONE;
+  fr->len = len;
+  fr->data = malloc(len + 1);
+  memcpy(fr->data, body, len);
+  fr->fec_npar = npar;
+  fr->corrected = corr_hdr + corr_body;
+  fr->overhead = 1 + h + 2 + 2 + 2 + npar;
+
+  return hs + bs;
+}
+
+/*
+  Пакет распознается без знания режима канала: перебираются адресация
+  и количество проверочных байт FEC, первым пробуется режим предыдущего
+  корректного пакета этого направления
+*/
+static uint32_t __decode(struct frame_s *fr, const uint8_t *u, uint32_t n, uint8_t *mode_addr, uint8_t *mode_npar)
+{
+  uint8_t npar_try[1 + 1 + RS_MAX_NPAR / 2];
+  int num_npar = 0;
+
+  npar_try[num_npar++] = *mode_npar;
+  if (*mode_npar != 0)
+    npar_try[num_npar++] = 0;
+  for (uint8_t p = 2; p <= RS_MAX_NPAR; p += 2)
+    if (p != *mode_npar)
+      npar_try[num_npar++] = p;
+
+  for (int i = 0; i < num_npar; i++)
+  {
+    for (int a = 0; a < 2; a++)
+    {
+      int addressed = a ? !*mode_addr : *mode_addr;
+      uint32_t used;
+
+      if (npar_try[i] == 0)
+        used = __decode_plain(fr, u, n, addressed);
+      else
+        used = __decode_fec(fr, u, n, addressed, npar_try[i]);
+
+      if (used != 0)
+      {
+        *mode_addr = addressed;
+        *mode_npar = npar_try[i];
+        return used;
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+  Первый декодированный байт кадра COBS - адрес пакета
+  (код первого блока 1 - адрес 0)
+*/
+static uint8_t __cobs_first_byte(const uint8_t *u, uint32_t n)
+{
+  if ((n < 2) || (u[0] == 1))
+    return 0;
+  return u[1];
+}
+
+/*
+  Разбор кадра COBS (без разделителей) декодером ядра binex_cobs_decode:
+  адресация подбирается, как и для пакетов binex, первой пробуется
+  адресация предыдущего корректного пакета этого направления
+*/
+static uint32_t __decode_cobs(struct frame_s *fr, const uint8_t *u, uint32_t n, uint8_t *mode_addr)
+{
+  static uint8_t buf[FRAME_MAX_SIZE];
+  Binex_t b;
+
+  for (int a = 0; a < 2; a++)
+  {
+    int addressed = a ? !*mode_addr : *mode_addr;
+
+    binex_init(&b, NULL, NULL);
+    if (addressed)
+    {
+      // Запрос принимается как устройством с адресом запроса,
+      // ответ - как хостом
+      if (fr->dir == DIR_DEV)
+        binex_host_address_set(&b, 0);
+      else
+        binex_address_set(&b, __cobs_first_byte(u, n));
+    }
+
+    memcpy(buf, u, n);
+    if (binex_cobs_decode(&b, buf, n) != BINEX_PACK_RX)
+      continue;
+
+    fr->addr = addressed ? __cobs_first_byte(u, n) : BINEX_ADDRESS_NONE;
+    fr->len = binex_rx_len(&b);
+    fr->data = malloc(fr->len + 1);
+    memcpy(fr->data, buf, fr->len);
+    fr->fec_npar = 0;
+    fr->corrected = 0;
+    fr->overhead = fr->raw - fr->len;
+
+    *mode_addr = addressed;
+    return n;
+  }
+
+  return 0;
+}
+
+/*
+  Поврежденный пакет: время до последнего принятого символа
+*/
+static void __frame_broken(struct frame_s *fr, const double *ut, uint32_t n)
+{
+  struct dir_stat_s *ds = &dir_stat[fr->dir];
+
+  fr->valid = 0;
+  fr->t_end = (n ? ut[n - 1] : fr->t_start) + byte_time;
+  ds->broken++;
+  ds->tx_time += fr->t_end - fr->t_start;
+}
+
+static void __frame_finish(struct frame_s *fr, const uint8_t *u, const double *ut, uint32_t n,
+                           uint8_t *mode_addr, uint8_t *mode_npar)
+{
+  struct dir_stat_s *ds = &dir_stat[fr->dir];
+  uint32_t used = __decode(fr, u, n, mode_addr, mode_npar);
+
+  ds->frames++;
+
+  if (used == 0)
+  {
+    __frame_broken(fr, ut, n);
+    return;
+  }
+
+  fr->valid = 1;
+  fr->t_end = ut[used - 1] + byte_time;
+
+  // Лишние символы после конца пакета
+  ds->garbage += n - used;
+  fr->raw -= n - used;
+
+  ds->overhead += fr->overhead;
+  ds->payload += fr->len;
+  ds->corrected += fr->corrected;
+  ds->tx_time += fr->t_end - fr->t_start;
+}
+
+/*
+  Кадр COBS, t_delim - время завершающего разделителя
+  (< 0 - кадр оборван сменой кадрирования либо концом записи)
+*/
+static void __cobs_frame_finish(struct frame_s *fr, const uint8_t *u, const double *ut, uint32_t n,
+                                double t_delim, uint8_t *mode_addr)
+{
+  struct dir_stat_s *ds = &dir_stat[fr->dir];
+
+  // Только разделители - не кадр
+  if (n == 0)
+  {
+    ds->garbage += fr->raw;
+    num_frames--;
+    return;
+  }
+
+  ds->frames++;
+
+  if ((t_delim < 0) || (__decode_cobs(fr, u, n, mode_addr) == 0))
+  {
+    __frame_broken(fr, ut, n);
+    return;
+  }
+
+  fr->valid = 1;
+  fr->t_end = t_delim + byte_time;
+
+  ds->overhead += fr->overhead;
+  ds->payload += fr->len;
+  ds->tx_time += fr->t_end - fr->t_start;
+}
+
+/*
+  Ответ на ACTIVATE без FEC длиной 3 (с установленным режимом
+  кадрирования) в данных пакета binex после START: 7 байт либо 8 с адресом.
+  Пакет завершается сразу, следующие символы могут быть уже кадрами COBS
+*/
+static int __activate_reply(const uint8_t *u, uint32_t n)
+{
+  uint32_t h = n - 7;
+
+  if ((n != 7) && (n != 8))
+    return 0;
+
+  if ((u[h] != 3) || (u[h + 1] != 0) || (u[h + 2] != CMD_ACTIVATE) || (u[h + 3] != 0x00))
+    return 0;
+
+  return Crc16((uint8_t *)u, h + 5, Crc16StartValue()) == (u[h + 5] | (u[h + 6] << 8));
+}
+
+/*
+  Смена кадрирования после ответа устройства на ACTIVATE
+*/
+static void __framing_switch(struct frame_s *fr, uint8_t *cobs)
+{
+  uint8_t mode;
+
+  if (!fr->valid || (fr->len < 3) || (fr->data[0] != CMD_ACTIVATE) || (fr->data[1] != 0x00))
+    return;
+
+  mode = (fr->data[2] & FRAMING_COBS) ? 1 : 0;
+  if ((mode == *cobs) || (num_switches == MAX_SWITCHES))
+    return;
+
+  switches[num_switches].t = fr->t_end;
+  switches[num_switches].cobs = mode;
+  num_switches++;
+  *cobs = mode;
+}
+
+/*
+  Восстановление пакетов одного направления. Направление устройства
+  разбирается первым: его ответы на ACTIVATE задают моменты смены
+  кадрирования, по ним же разбирается направление хоста
+*/
+static void __decode_dir(uint8_t dir)
+{
+  static uint8_t u[FRAME_MAX_SIZE];
+  static double ut[FRAME_MAX_SIZE];
+  struct frame_s *fr = NULL;
+  uint32_t n = 0;
+  uint8_t esc = 0;
+  uint8_t mode_addr = 0, mode_npar = 0;
+  uint8_t cobs = cobs_at_start;
+  size_t sw = 0;
+
+  for (size_t i = 0; i < num_syms; i++)
+  {
+    uint8_t c = syms[i].c;
+
+    if (syms[i].dir != dir)
+      continue;
+
+    // Хост сменил кадрирование после ответа на ACTIVATE
+    while ((dir == DIR_HOST) && (sw < num_switches) && (switches[sw].t <= syms[i].t))
+    {
+      if (fr && cobs)
+        __cobs_frame_finish(fr, u, ut, n, -1, &mode_addr);
+      else if (fr)
+        __frame_finish(fr, u, ut, n, &mode_addr, &mode_npar);
+      fr = NULL;
+      esc = 0;
+      cobs = switches[sw++].cobs;
+    }
+
+    dir_stat[dir].raw++;
+
+    if (cobs)
+    {
+      if (c == BINEX_COBS_DELIMITER)
+      {
+        // Завершающий разделитель кадра, либо начальный
+        // разделитель следующего
+        if (fr && (n != 0))
+        {
+          fr->raw++;
+          __cobs_frame_finish(fr, u, ut, n, syms[i].t, &mode_addr);
+          __framing_switch(fr, &cobs);
+          fr = NULL;
+          continue;
+        }
+
+        if (!fr)
+        {
+          fr = __frame_new();
+          fr->dir = dir;
+          fr->cobs = 1;
+          fr->t_start = syms[i].t;
+          n = 0;
+        }
+        fr->raw++;
+        continue;
+      }
+
+      // Кадр без начального разделителя
+      if (!fr)
+      {
+        fr = __frame_new();
+        fr->dir = dir;
+        fr->cobs = 1;
+        fr->t_start = syms[i].t;
+        n = 0;
+      }
+
+      fr->raw++;
+      if (n < FRAME_MAX_SIZE)
+      {
+        ut[n] = syms[i].t;
+        u[n++] = c;
+      }
+      continue;
+    }
+
+    if ((c == BINEX_START_SYMBOL) && !esc)
+    {
+      if (fr)
+        __frame_finish(fr, u, ut, n, &mode_addr, &mode_npar);
+
+      fr = __frame_new();
+      fr->dir = dir;
+      fr->t_start = syms[i].t;
+      fr->raw = 1;
+      n = 0;
+      continue;
+    }
+
+    if (!fr)
+    {
+      dir_stat[dir].garbage++;
+      continue;
+    }
+
+    fr->raw++;
+
+    if (esc)
+    {
+      // ESC START, ESC ESC - символ данных, иначе
+      // последовательность некорректна, символ все равно
+      // сохраняется, пакет не пройдет проверку CRC
+      esc = 0;
+    }
+    else if (c == BINEX_ESC_SYMBOL)
+    {
+      esc = 1;
+      fr->esc++;
+      dir_stat[dir].esc++;
+      continue;
+    }
+
+    if (n < FRAME_MAX_SIZE)
+    {
+      ut[n] = syms[i].t;
+      u[n++] = c;
+    }
+
+    // Ответ устройства на ACTIVATE завершается сразу: после него
+    // устройство может перейти на COBS
+    if ((dir == DIR_DEV) && __activate_reply(u, n))
+    {
+      __frame_finish(fr, u, ut, n, &mode_addr, &mode_npar);
+      __framing_switch(fr, &cobs);
+      fr = NULL;
+    }
+  }
+
+  if (fr && cobs)
+    __cobs_frame_finish(fr, u, ut, n, -1, &mode_addr);
+  else if (fr)
+    __frame_finish(fr, u, ut, n, &mode_addr, &mode_npar);
+}
+
+static int __frame_cmp(const void *a, const void *b)
+{
+  const struct frame_s *x = a, *y = b;
+
+  if (x->t_start < y->t_start)
+    return -1;
+  if (x->t_start > y->t_start)
+    return 1;
+  return 0;
+}
+
+/******************************************************************************
+  Анализ обмена
+******************************************************************************/
+
+static void __cat_add(int cat, double t)
+{
+  if (t <= 0)
+    return;
+  cat_time[cat] += t;
+  cat_count[cat]++;
+}
+
+static void __analyze(void)
+{
+  struct frame_s *prev = NULL;
+  struct frame_s *req = NULL;     // последний запрос хоста
+  struct frame_s *last_req = NULL; // последний корректный запрос хоста
+  uint8_t req_answered = 0;
+  double req_lat_from = 0;
+
+  for (int i = 0; i < 256; i++)
+    cmd_stat[i].lat_min = 1e9;
+
+  for (size_t i = 0; i < num_frames; i++)
+  {
+    struct frame_s *fr = &frames[i];
+    uint8_t cmd = fr->valid && fr->len ? fr->data[0] : 0;
+
+    /* Пауза перед пакетом */
+    if (prev)
+    {
+      double gap = fr->t_start - prev->t_end;
+      uint8_t prev_cmd = prev->valid && prev->len ? prev->data[0] : 0;
+
+      if (prev->dir == DIR_HOST)
+      {
+        if (fr->dir == DIR_DEV)
+        {
+          if (fr->valid && (fr->len >= 2) && (fr->data[1] == STATUS_EVENT))
+            __cat_add(CAT_ERASE, gap);
+          else
+          {
+            __cat_add(CAT_RESP_DELAY, gap);
+            if (prev->valid && (gap > 0))
+              resp_delay[prev_cmd] += gap;
+          }
+        }
+        else if (!prev->valid || (!req_answered && !__cmd_no_reply(prev_cmd)))
+          __cat_add(CAT_TIMEOUT, gap);
+        else
+          __cat_add(CAT_HOST_GAP, gap);
+      }
+      else
+      {
+        uint8_t prev_event = prev->valid && (prev->len >= 2) && (prev->data[1] == STATUS_EVENT);
+
+        if (fr->dir == DIR_HOST)
+          __cat_add(CAT_HOST_GAP, gap);
+        else if (prev_event)
+          __cat_add(CAT_ERASE, gap);
+        else
+          __cat_add(CAT_OTHER, gap);
+      }
+    }
+
+    prev = fr;
+
+    /* Передача пакета */
+    if (fr->dir == DIR_HOST)
+    {
+      // Запрос, на который не было ответа
+      if (req && req->valid && !req_answered && !__cmd_no_reply(req->data[0]))
+        cmd_stat[req->data[0]].no_reply++;
+
+      if (fr->valid && fr->len)
+      {
+        // Повтор: тот же запрос, что и предыдущий, либо
+        // запрос после поврежденного в линии
+        if (req && !req->valid)
+          fr->retx = RETX_BROKEN;
+        else if (last_req && !__cmd_polling(cmd) && (last_req->len == fr->len) &&
+                 !memcmp(last_req->data, fr->data, fr->len))
+          fr->retx = RETX_DUP;
+
+        if (fr->retx != RETX_NONE)
+          cmd_stat[cmd].retx++;
+
+        cmd_stat[cmd].requests++;
+        last_req = fr;
+      }
+
+      __cat_add(fr->retx ? CAT_RETX_TX : CAT_HOST_TX, fr->t_end - fr->t_start);
+
+      req = fr;
+      req_answered = 0;
+      req_lat_from = fr->t_end;
+      continue;
+    }
+
+    __cat_add(CAT_DEV_TX, fr->t_end - fr->t_start);
+
+    if (!fr->valid || (fr->len < 2))
+      continue;
+
+    if (!req || !req->valid || (req->data[0] != cmd) || req_answered)
+    {
+      unmatched++;
+      continue;
+    }
+
+    if (fr->data[1] == STATUS_EVENT)
+    {
+      cmd_stat[cmd].events++;
+      continue;
+    }
+
+    // Время ответа: от конца запроса до начала ответа
+    {
+      struct cmd_stat_s *cs = &cmd_stat[cmd];
+      double lat = fr->t_start - req_lat_from;
+
+      cs->responses++;
+      if (fr->data[1] != 0x00)
+        cs->errors++;
+      cs->lat_sum += lat;
+      if (lat < cs->lat_min)
+        cs->lat_min = lat;
+      if (lat > cs->lat_max)
+        cs->lat_max = lat;
+    }
+
+    req_answered = 1;
+  }
+}
+
+/******************************************************************************
+  Отчет
+******************************************************************************/
+
+/*
+  Полезные данные прошивки: размер данных чанков без повторов
+  корректно переданных чанков
+*/
+static uint64_t __firmware_bytes(void)
+{
+  uint64_t n = 0;
+
+  for (size_t i = 0; i < num_frames; i++)
+  {
+    struct frame_s *fr = &frames[i];
+
+    if ((fr->dir != DIR_HOST) || !fr->valid || (fr->retx == RETX_DUP) || (fr->len < 6))
+      continue;
+    if (__cmd_has_chunk(fr->data[0]))
+      n += fr->data[5];
+  }
+
+  return n;
+}
+
+static void __print_frames(void)
+{
+  printf("%12s %3s %5s %5s %4s %-16s %6s %s\n",
+         "time_s", "dir", "raw", "len", "addr", "cmd", "status", "flags");
+
+  for (size_t i = 0; i < num_frames; i++)
+  {
+    struct frame_s *fr = &frames[i];
+    const char *name = NULL;
+    char cmd[20] = "-";
+    char status[8] = "-";
+    char addr[8] = "-";
+
+    if (fr->valid && fr->len)
+    {
+      name = __cmd_name(fr->data[0]);
+      if (name)
+        snprintf(cmd, sizeof(cmd), "%s", name);
+      else
+        snprintf(cmd, sizeof(cmd), "0x%02X", fr->data[0]);
+
+      if ((fr->dir == DIR_DEV) && (fr->len >= 2))
+        snprintf(status, sizeof(status), "0x%02X", fr->data[1]);
+    }
+
+    if (fr->valid && (fr->addr != BINEX_ADDRESS_NONE))
+      snprintf(addr, sizeof(addr), "%02X", fr->addr);
+
+    printf("%12.6f %3s %5u %5u %4s %-16s %6s%s%s%s%s",
+           fr->t_start, fr->dir == DIR_HOST ? ">" : "<", fr->raw,
+           fr->valid ? fr->len : 0, addr, cmd, status,
+           fr->valid ? "" : " BROKEN",
+           fr->retx ? " RETX" : "",
+           fr->fec_npar ? " FEC" : "",
+           fr->cobs ? " COBS" : "");
+    if (fr->fec_npar)
+      printf("(%u, corrected %u)", fr->fec_npar, fr->corrected);
+    printf("\n");
+  }
+
+  printf("\n");
+}
+
+static void __print_report(void)
+{
+  double t0 = syms[0].t;
+  double t1 = syms[num_syms - 1].t + byte_time;
+  double duration = t1 - t0;
+  double capacity = (byte_time > 0) ? duration / byte_time : 0; // символов за время записи
+  uint64_t fw = __firmware_bytes();
+  double cat_total = 0;
+
+  printf("capture: %zu symbols, %.3f s", num_syms, duration);
+  if (byte_time > 0)
+    printf(", symbol %.2f us (~%.0f baud)", byte_time * 1e6, 10.0 / byte_time);
+  if (line_errors)
+    printf(", %u line errors", line_errors);
+  printf("\n\n");
+
+  printf("%-10s %9s %7s %6s %7s %9s %9s %9s %8s %8s %8s\n",
+         "direction", "raw_B", "frames", "crc", "fec_fix", "payload_B",
+         "esc_B", "frame_B", "garbage", "raw_B/s", "line_use");
+
+  for (int d = 0; d < 2; d++)
+  {
+    struct dir_stat_s *ds = &dir_stat[d];
+
+    printf("%-10s %9llu %7u %6u %7u %9llu %9llu %9llu %8llu %8.0f %7.1f%%\n",
+           d == DIR_HOST ? "host>dev" : "dev>host",
+           (unsigned long long)ds->raw, ds->frames, ds->broken, ds->corrected,
+           (unsigned long long)ds->payload, (unsigned long long)ds->esc,
+           (unsigned long long)ds->overhead, (unsigned long long)ds->garbage,
+           ds->raw / duration, capacity > 0 ? 100.0 * ds->raw / capacity : 0);
+  }
+
+  printf("\n");
+  {
+    uint64_t raw = dir_stat[0].raw + dir_stat[1].raw;
+    uint64_t payload = dir_stat[0].payload + dir_stat[1].payload;
+    uint64_t esc = dir_stat[0].esc + dir_stat[1].esc;
+
+    printf("raw throughput:      %.0f B/s", raw / duration);
+    if (capacity > 0)
+      printf(" (%.1f%% of line)", 100.0 * raw / capacity);
+    printf("\n");
+    printf("frame payload:       %.0f B/s (%.1f%% of raw)\n",
+           payload / duration, raw ? 100.0 * payload / raw : 0);
+    printf("escape overhead:     %llu B (%.2f%% of raw)\n",
+           (unsigned long long)esc, raw ? 100.0 * esc / raw : 0);
+    printf("firmware goodput:    %llu B, %.0f B/s", (unsigned long long)fw, fw / duration);
+    if (capacity > 0)
+      printf(" (%.1f%% of line)", 100.0 * fw / capacity);
+    printf("\n");
+  }
+
+  {
+    uint32_t retx = 0;
+    for (int i = 0; i < 256; i++)
+      retx += cmd_stat[i].retx;
+
+    printf("retransmissions:     %u, %.3f s tx + %.3f s waiting for timeout\n",
+           retx, cat_time[CAT_RETX_TX], cat_time[CAT_TIMEOUT]);
+    if (unmatched)
+      printf("unmatched responses: %u\n", unmatched);
+  }
+
+  printf("\n%-32s %10s %7s %8s\n", "where the time goes", "time_s", "share", "count");
+  for (int c = 0; c < NUM_CATS; c++)
+    cat_total += cat_time[c];
+  for (int c = 0; c < NUM_CATS; c++)
+  {
+    if (cat_count[c] == 0)
+      continue;
+    printf("%-32s %10.3f %6.1f%% %8u\n", cat_name[c], cat_time[c],
+           100.0 * cat_time[c] / duration, cat_count[c]);
+    if (c == CAT_RESP_DELAY)
+    {
+      for (int i = 0; i < 256; i++)
+      {
+        const char *name = __cmd_name(i);
+        char buf[24];
+
+        if (resp_delay[i] <= 0)
+          continue;
+        if (!name)
+        {
+          snprintf(buf, sizeof(buf), "0x%02X", i);
+          name = buf;
+        }
+        printf("  %-30s %10.3f %6.1f%%\n", name, resp_delay[i], 100.0 * resp_delay[i] / duration);
+      }
+    }
+  }
+  printf("%-32s %10.3f %6.1f%%\n", "total", cat_total, 100.0 * cat_total / duration);
+
+  printf("\n%-16s %8s %6s %8s %7s %7s %9s %9s %9s %9s\n",
+         "command", "requests", "retx", "replies", "errors", "events",
+         "no_reply", "lat_min", "lat_avg", "lat_max");
+  for (int i = 0; i < 256; i++)
+  {
+    struct cmd_stat_s *cs = &cmd_stat[i];
+    const char *name = __cmd_name(i);
+    char buf[24];
+
+    if (cs->requests == 0)
+      continue;
+    if (!name)
+    {
+      snprintf(buf, sizeof(buf), "0x%02X", i);
+      name = buf;
+    }
+
+    printf("%-16s %8u %6u %8u %7u %7u %9u", name, cs->requests, cs->retx,
+           cs->responses, cs->errors, cs->events, cs->no_reply);
+    if (cs->responses)
+      printf(" %8.1fms %8.1fms %8.1fms\n", cs->lat_min * 1e3,
+             cs->lat_sum / cs->responses * 1e3, cs->lat_max * 1e3);
+    else
+      printf(" %9s %9s %9s\n", "-", "-", "-");
+  }
+}
+
+/******************************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [options] capture\n"
+          "  --baud N            line speed, default: estimated from the capture\n"
+          "  --host NAME         channel name of host->device in a CSV capture\n"
+          "  --dev NAME          channel name of device->host in a CSV capture\n"
+          "  --cobs              COBS framing from the start of the capture\n"
+          "                      (otherwise switched by the reply to ACTIVATE)\n"
+          "  --frames            list every decoded frame\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = NULL;
+  unsigned long baud = 0;
+  int list = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+      baud = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--host") && (i + 1 < argc))
+      host_name = argv[++i];
+    else if (!strcmp(argv[i], "--dev") && (i + 1 < argc))
+      dev_name = argv[++i];
+    else if (!strcmp(argv[i], "--cobs"))
+      cobs_at_start = 1;
+    else if (!strcmp(argv[i], "--frames"))
+      list = 1;
+    else if ((argv[i][0] != '-' || !strcmp(argv[i], "-")) && !path)
+      path = argv[i];
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!path)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  Crc16Init();
+
+  if (__load(path) != 0)
+    return 1;
+
+  if (num_syms == 0)
+  {
+    fprintf(stderr, "%s: no symbols\n", path);
+    return 1;
+  }
+
+  qsort(syms, num_syms, sizeof(*syms), __sym_cmp);
+
+  byte_time = baud ? 10.0 / baud : __estimate_byte_time();
+
+  __decode_dir(DIR_DEV);
+  __decode_dir(DIR_HOST);
+  qsort(frames, num_frames, sizeof(*frames), __frame_cmp);
+
+  __analyze();
+
+  if (list)
+    __print_frames();
+  __print_report();
+
+  for (size_t i = 0; i < num_frames; i++)
+    free(frames[i].data);
+  free(frames);
+  free(syms);
+
+  return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef __FW_DELTA_H__
+#define __FW_DELTA_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+  Поток разностного обновления (BOOTLOADER_USE_DELTA, формат описан
+  в core/src/bootloader.c). Поток делится на чанки с address =
+  PACK_DELTA_STREAM_BASE + смещение в потоке.
+
+  Поток не зависит от ключей устройства: MAC базовой прошивки в заголовке
+  и MAC новой прошивки в последних 16 байтах области не вычисляются здесь,
+  а подставляются при шифровании чанков по смещениям из PackDelta.
+  Поэтому MAC базовой прошивки не используется как источник копий, а
+  MAC новой прошивки всегда передается операцией ADD.
+*/
+
+// Должен совпадать с DELTA_STREAM_BASE Bootloader-а
+#define PACK_DELTA_STREAM_BASE 0x80000000UL
+
+#define PACK_DELTA_VERSION 1
+#define PACK_DELTA_BASE_MAC_OFFSET 1 // смещение MAC базовой прошивки в потоке
+
+/*
+  Сформировать поток разностного обновления
+  base, image - базовая и новая прошивки: полные образы области
+    приложения длиной app_length, содержимое последних 16 байт не важно
+  sector_size - размер сектора flash, app_length кратна ему
+  out - поток (malloc), out_size - его длина,
+  mac_offset - смещение MAC новой прошивки в потоке
+  Возвращает:
+    0 - OK
+    -1 - ошибка (нехватка памяти, неверные размеры)
+*/
+int PackDelta(uint8_t **out, size_t *out_size, size_t *mac_offset,
+              const uint8_t *base, const uint8_t *image,
+              uint32_t app_length, uint32_t sector_size);
+
+#endif
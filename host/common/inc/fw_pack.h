@@ -0,0 +1,92 @@
+#ifndef __FW_PACK_H__
+#define __FW_PACK_H__
+
+#include <stdint.h>
+
+/*
+  Подготовка файла обновления на стороне хоста.
+  Формат чанка совпадает со struct fw_chunk_s ядра Bootloader-а:
+    +---------+-----+-------+------------+-----+
+    | address | len | nonce | ciphertext | tag |
+    +---------+-----+-------+------------+-----+
+    |    4    |  1  |  24   |   128 *    | 16  |
+    +---------+-----+-------+------------+-----+
+  * - PACK_CHUNK_DATA_SIZE
+  Шифрование XChaCha20-Poly1305, AAD = address || len.
+  Идентификационный чанк: address = длина области приложения,
+  len = 128, открытый текст - строка идентификатора устройства,
+  дополненная нулями.
+  Карта сегментов разреженного образа: address = длина области
+  приложения, len = 0, открытый текст - [N][N x (адрес u32, длина u32)].
+*/
+
+// Должен совпадать с CHUNK_DATA_SIZE Bootloader-а
+#ifndef PACK_CHUNK_DATA_SIZE
+#define PACK_CHUNK_DATA_SIZE 128
+#endif
+#define PACK_MAC_SIZE 16
+#define PACK_NONCE_SIZE 24
+#define PACK_CHUNK_SIZE (4 + 1 + PACK_NONCE_SIZE + PACK_CHUNK_DATA_SIZE + PACK_MAC_SIZE)
+// Сегментов в карте разреженного образа (SPARSE_MAX_SEGMENTS Bootloader-а)
+#define PACK_MAX_SEGMENTS ((PACK_CHUNK_DATA_SIZE - 1) / 8)
+
+/*
+  Сформировать MAC прошивки: Poly1305 по образу области приложения
+  без последних 16 байт, результат записывается в последние 16 байт
+  image - образ области приложения длиной app_length
+*/
+void PackImageMac(uint8_t *image, uint32_t app_length, const uint8_t integrity_key[32]);
+
+/*
+  То же для образа короче области приложения, без изменения образа:
+  байты за концом образа (image_size) считаются равными 0xFF (стертая flash)
+  mac - MAC, который должен оказаться в последних 16 байтах области
+*/
+void PackImageMacPadded(uint8_t mac[PACK_MAC_SIZE],
+                        const uint8_t *image, uint32_t image_size,
+                        uint32_t app_length, const uint8_t integrity_key[32]);
+
+/*
+  Зашифровать чанк
+  out - буфер размером PACK_CHUNK_SIZE
+  data - len байт открытого текста (len <= PACK_CHUNK_DATA_SIZE),
+    недостающие байты чанка дополняются 0xFF
+*/
+void PackChunk(uint8_t *out,
+               const uint8_t key[32],
+               const uint8_t nonce[PACK_NONCE_SIZE],
+               uint32_t address,
+               const uint8_t *data,
+               uint8_t len);
+
+/*
+  Зашифровать идентификационный чанк
+*/
+void PackIdentityChunk(uint8_t *out,
+                       const uint8_t key[32],
+                       const uint8_t nonce[PACK_NONCE_SIZE],
+                       uint32_t app_length,
+                       const char *device_id);
+
+/*
+  Зашифровать карту сегментов разреженного образа
+  address, size - адреса и длины count сегментов с данными,
+    по возрастанию (count <= PACK_MAX_SEGMENTS)
+*/
+void PackSegmentMap(uint8_t *out,
+                    const uint8_t key[32],
+                    const uint8_t nonce[PACK_NONCE_SIZE],
+                    uint32_t app_length,
+                    const uint32_t *address,
+                    const uint32_t *size,
+                    uint8_t count);
+
+/*
+  Получить случайный nonce из /dev/urandom
+  Возвращает:
+    0 - OK
+    -1 - ошибка
+*/
+int PackRandomNonce(uint8_t nonce[PACK_NONCE_SIZE]);
+
+#endif
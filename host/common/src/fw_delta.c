@@ -0,0 +1,349 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fw_delta.h"
+
+/*
+  Сектора собираются по одному: копии ищутся по хеш-цепочкам 4-байтных
+  последовательностей базовой прошивки, с приоритетом продолжения
+  предыдущей копии с тем же смещением (сдвинутый код). Источник копии -
+  только сектора, еще не перезаписанные к этому моменту, и сам собираемый
+  сектор. Поток строится для двух порядков записи секторов: по
+  возрастанию адресов (код сдвигается к началу области) и по убыванию
+  (код сдвигается к концу), выбирается более короткий.
+*/
+
+#define MAC_SIZE 16
+
+#define OP_END 0x00
+#define OP_COPY 0x01
+#define OP_ADD 0x02
+#define OP_FILL 0x03
+
+#define MIN_MATCH 4
+#define HASH_BITS 14
+#define MAX_CHAIN 64
+
+struct stream
+{
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+  size_t mac_offset;
+  int error;
+};
+
+struct delta
+{
+  const uint8_t *base;
+  const uint8_t *image;
+  uint32_t length;
+  uint32_t sector_size;
+  uint32_t mac;          // начало MAC в области приложения
+  const uint8_t *done;   // перезаписанные сектора
+  uint32_t cur;          // собираемый сектор
+  int32_t *head;
+  int32_t *prev;
+};
+
+/******************************************************************************/
+
+static void put(struct stream *s, const uint8_t *data, size_t len)
+{
+  if (s->error)
+    return;
+
+  if (s->len + len > s->cap)
+  {
+    size_t cap = s->cap ? s->cap * 2 : 4096;
+    uint8_t *p;
+
+    while (cap < s->len + len)
+      cap *= 2;
+
+    p = realloc(s->data, cap);
+    if (!p)
+    {
+      s->error = 1;
+      return;
+    }
+    s->data = p;
+    s->cap = cap;
+  }
+
+  memcpy(s->data + s->len, data, len);
+  s->len += len;
+}
+
+static void put_byte(struct stream *s, uint8_t b)
+{
+  put(s, &b, 1);
+}
+
+static void put_varint(struct stream *s, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    put_byte(s, (uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  put_byte(s, (uint8_t)v);
+}
+
+static uint32_t varint_size(uint32_t v)
+{
+  uint32_t n = 1;
+
+  while (v >= 0x80)
+  {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static uint32_t hash4(const uint8_t *p)
+{
+  uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+/******************************************************************************/
+
+/*
+  Длина совпадения image[dst..] с base[src..], не больше limit
+*/
+static uint32_t match_len(const struct delta *d, uint32_t src, uint32_t dst, uint32_t limit)
+{
+  uint32_t n = 0;
+
+  while (n < limit)
+  {
+    uint32_t a = src + n;
+    uint32_t sector = a / d->sector_size;
+
+    if ((a >= d->mac) || ((sector != d->cur) && d->done[sector]))
+      break;
+    if (d->base[a] != d->image[dst + n])
+      break;
+    n++;
+  }
+
+  return n;
+}
+
+static void put_literal(const struct delta *d, struct stream *s, uint32_t from, uint32_t to)
+{
+  if (from == to)
+    return;
+
+  put_byte(s, OP_ADD);
+  put_varint(s, to - from);
+
+  // MAC новой прошивки всегда попадает в данные ADD
+  if ((d->mac >= from) && (d->mac < to))
+    s->mac_offset = s->len + (d->mac - from);
+
+  put(s, d->image + from, to - from);
+}
+
+static void put_sector(const struct delta *d, struct stream *s)
+{
+  uint32_t begin = d->cur * d->sector_size;
+  uint32_t end = begin + d->sector_size;
+  uint32_t limit_end = (end < d->mac) ? end : d->mac;
+  uint32_t lit = begin;
+  uint32_t p = begin;
+  int32_t last = 0;
+
+  put_varint(s, d->cur);
+
+  while (p < limit_end)
+  {
+    uint32_t limit = limit_end - p;
+    uint32_t best = 0, best_src = 0, run = 1;
+    int32_t copy_gain = 0, fill_gain = 0;
+
+    // Продолжение предыдущего смещения, затем поиск по хешу
+    if (((int64_t)p + last >= 0) && ((int64_t)p + last < d->mac))
+    {
+      best = match_len(d, p + last, p, limit);
+      best_src = p + last;
+    }
+
+    if ((limit >= MIN_MATCH) && (p + MIN_MATCH <= d->length))
+    {
+      int32_t cand = d->head[hash4(d->image + p)];
+
+      for (int steps = 0; (cand >= 0) && (steps < MAX_CHAIN) && (best < limit); steps++)
+      {
+        uint32_t n = match_len(d, (uint32_t)cand, p, limit);
+
+        if (n > best)
+        {
+          best = n;
+          best_src = (uint32_t)cand;
+        }
+        cand = d->prev[cand];
+      }
+    }
+
+    while ((run < limit) && (d->image[p + run] == d->image[p]))
+      run++;
+
+    if (best >= MIN_MATCH)
+      copy_gain = (int32_t)best - (int32_t)(1 + varint_size(best) +
+                                           varint_size(zigzag((int32_t)(best_src - p))));
+    if (run >= MIN_MATCH)
+      fill_gain = (int32_t)run - (int32_t)(2 + varint_size(run));
+
+    if ((copy_gain <= 0) && (fill_gain <= 0))
+    {
+      p++;
+      continue;
+    }
+
+    put_literal(d, s, lit, p);
+
+    if (copy_gain >= fill_gain)
+    {
+      put_byte(s, OP_COPY);
+      put_varint(s, best);
+      put_varint(s, zigzag((int32_t)(best_src - p)));
+      last = (int32_t)(best_src - p);
+      p += best;
+    }
+    else
+    {
+      put_byte(s, OP_FILL);
+      put_varint(s, run);
+      put_byte(s, d->image[p]);
+      p += run;
+    }
+
+    lit = p;
+  }
+
+  put_literal(d, s, lit, end);
+  put_byte(s, OP_END);
+}
+
+/*
+  Поток для заданного порядка записи секторов
+*/
+static void put_stream(struct delta *d, struct stream *s, const uint8_t *changed, int descending)
+{
+  uint32_t sectors = d->length / d->sector_size;
+  uint8_t *done = calloc(sectors, 1);
+  uint8_t header[1 + MAC_SIZE];
+
+  if (!done)
+  {
+    s->error = 1;
+    return;
+  }
+
+  memset(header, 0, sizeof(header));
+  header[0] = PACK_DELTA_VERSION;
+  put(s, header, sizeof(header));
+
+  d->done = done;
+  for (uint32_t i = 0; i < sectors; i++)
+  {
+    uint32_t k = descending ? sectors - 1 - i : i;
+
+    if (!changed[k])
+      continue;
+
+    d->cur = k;
+    put_sector(d, s);
+    done[k] = 1;
+  }
+
+  d->done = NULL;
+  free(done);
+}
+
+int PackDelta(uint8_t **out, size_t *out_size, size_t *mac_offset,
+              const uint8_t *base, const uint8_t *image,
+              uint32_t app_length, uint32_t sector_size)
+{
+  struct delta d;
+  struct stream up, down;
+  uint32_t sectors;
+  uint8_t *changed;
+
+  if ((sector_size == 0) || (app_length % sector_size) || (app_length <= MAC_SIZE))
+    return -1;
+
+  sectors = app_length / sector_size;
+
+  memset(&d, 0, sizeof(d));
+  memset(&up, 0, sizeof(up));
+  memset(&down, 0, sizeof(down));
+
+  d.base = base;
+  d.image = image;
+  d.length = app_length;
+  d.sector_size = sector_size;
+  d.mac = app_length - MAC_SIZE;
+  d.head = malloc(sizeof(int32_t) << HASH_BITS);
+  d.prev = malloc(sizeof(int32_t) * app_length);
+  changed = malloc(sectors);
+
+  if (!d.head || !d.prev || !changed)
+  {
+    free(d.head);
+    free(d.prev);
+    free(changed);
+    return -1;
+  }
+
+  // Хеш-цепочки базовой прошивки без MAC, в голове - старшие адреса
+  for (uint32_t i = 0; i < (1u << HASH_BITS); i++)
+    d.head[i] = -1;
+  for (uint32_t i = 0; i + MIN_MATCH <= d.mac; i++)
+  {
+    uint32_t h = hash4(base + i);
+
+    d.prev[i] = d.head[h];
+    d.head[h] = (int32_t)i;
+  }
+
+  // Последний сектор содержит MAC и меняется всегда
+  for (uint32_t k = 0; k < sectors; k++)
+    changed[k] = (k == sectors - 1) ||
+                 (memcmp(base + k * sector_size, image + k * sector_size, sector_size) != 0);
+
+  put_stream(&d, &up, changed, 0);
+  put_stream(&d, &down, changed, 1);
+
+  free(d.head);
+  free(d.prev);
+  free(changed);
+
+  if (up.error || down.error)
+  {
+    free(up.data);
+    free(down.data);
+    return -1;
+  }
+
+  if (down.len < up.len)
+  {
+    struct stream t = up;
+    up = down;
+    down = t;
+  }
+
+  free(down.data);
+  *out = up.data;
+  *out_size = up.len;
+  *mac_offset = up.mac_offset;
+  return 0;
+}
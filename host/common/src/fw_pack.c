@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <string.h>
+#include "fw_pack.h"
+#include "monocypher.h"
+
+/******************************************************************************/
+
+void PackImageMac(uint8_t *image, uint32_t app_length, const uint8_t integrity_key[32])
+{
+  crypto_poly1305(image + app_length - PACK_MAC_SIZE,
+                  image, app_length - PACK_MAC_SIZE,
+                  integrity_key);
+}
+
+void PackImageMacPadded(uint8_t mac[PACK_MAC_SIZE],
+                        const uint8_t *image, uint32_t image_size,
+                        uint32_t app_length, const uint8_t integrity_key[32])
+{
+  crypto_poly1305_ctx ctx;
+  uint8_t pad[64];
+  uint32_t size = app_length - PACK_MAC_SIZE;
+  uint32_t n = (image_size < size) ? image_size : size;
+
+  crypto_poly1305_init(&ctx, integrity_key);
+  crypto_poly1305_update(&ctx, image, n);
+
+  memset(pad, 0xFF, sizeof(pad));
+  while (n < size)
+  {
+    uint32_t k = (size - n < sizeof(pad)) ? (size - n) : sizeof(pad);
+
+    crypto_poly1305_update(&ctx, pad, k);
+    n += k;
+  }
+
+  crypto_poly1305_final(&ctx, mac);
+}
+
+/*
+  Запись struct fw_chunk_s: поле len входит в AAD и не обязано
+  совпадать с длиной открытого текста (карта сегментов)
+*/
+static void pack_record(uint8_t *out,
+                        const uint8_t key[32],
+                        const uint8_t nonce[PACK_NONCE_SIZE],
+                        uint32_t address,
+                        uint8_t len,
+                        const uint8_t plaintext[PACK_CHUNK_DATA_SIZE])
+{
+  uint8_t *ciphertext = out + 5 + PACK_NONCE_SIZE;
+  uint8_t *tag = ciphertext + PACK_CHUNK_DATA_SIZE;
+
+  /* AAD = address || len */
+  out[0] = (uint8_t)(address >> 0);
+  out[1] = (uint8_t)(address >> 8);
+  out[2] = (uint8_t)(address >> 16);
+  out[3] = (uint8_t)(address >> 24);
+  out[4] = len;
+
+  memcpy(out + 5, nonce, PACK_NONCE_SIZE);
+
+  crypto_aead_lock(ciphertext, tag, key, nonce,
+                   out, 5,
+                   plaintext, PACK_CHUNK_DATA_SIZE);
+}
+
+void PackChunk(uint8_t *out,
+               const uint8_t key[32],
+               const uint8_t nonce[PACK_NONCE_SIZE],
+               uint32_t address,
+               const uint8_t *data,
+               uint8_t len)
+{
+  uint8_t plaintext[PACK_CHUNK_DATA_SIZE];
+
+  memset(plaintext, 0xFF, sizeof(plaintext));
+  memcpy(plaintext, data, len);
+
+  pack_record(out, key, nonce, address, len, plaintext);
+
+  crypto_wipe(plaintext, sizeof(plaintext));
+}
+
+void PackIdentityChunk(uint8_t *out,
+                       const uint8_t key[32],
+                       const uint8_t nonce[PACK_NONCE_SIZE],
+                       uint32_t app_length,
+                       const char *device_id)
+{
+  uint8_t id[PACK_CHUNK_DATA_SIZE];
+  size_t len = strlen(device_id);
+
+  if (len > sizeof(id))
+    len = sizeof(id);
+
+  memset(id, 0, sizeof(id));
+  memcpy(id, device_id, len);
+
+  PackChunk(out, key, nonce, app_length, id, PACK_CHUNK_DATA_SIZE);
+}
+
+void PackSegmentMap(uint8_t *out,
+                    const uint8_t key[32],
+                    const uint8_t nonce[PACK_NONCE_SIZE],
+                    uint32_t app_length,
+                    const uint32_t *address,
+                    const uint32_t *size,
+                    uint8_t count)
+{
+  uint8_t map[PACK_CHUNK_DATA_SIZE];
+  uint8_t *p = map + 1;
+
+  memset(map, 0xFF, sizeof(map));
+  map[0] = count;
+
+  for (uint8_t i = 0; i < count; i++)
+  {
+    for (int k = 0; k < 4; k++)
+    {
+      p[k] = (uint8_t)(address[i] >> (8 * k));
+      p[4 + k] = (uint8_t)(size[i] >> (8 * k));
+    }
+    p += 8;
+  }
+
+  pack_record(out, key, nonce, app_length, 0, map);
+}
+
+int PackRandomNonce(uint8_t nonce[PACK_NONCE_SIZE])
+{
+  FILE *f = fopen("/dev/urandom", "rb");
+  size_t n;
+
+  if (f == NULL)
+    return -1;
+
+  n = fread(nonce, 1, PACK_NONCE_SIZE, f);
+  fclose(f);
+
+  return (n == PACK_NONCE_SIZE) ? 0 : -1;
+}
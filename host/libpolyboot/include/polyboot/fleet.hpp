@@ -0,0 +1,110 @@
+#ifndef POLYBOOT_FLEET_HPP
+#define POLYBOOT_FLEET_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "polyboot/package.hpp"
+#include "polyboot/session.hpp"
+#include "polyboot/transport.hpp"
+
+namespace polyboot
+{
+
+struct FleetOptions
+{
+  SessionOptions session;
+
+  // Попыток сессии на одно устройство. Неудачная сессия (исчерпаны
+  // повторы шага, ошибка порта) перезапускается через паузу, удваивающуюся
+  // с каждой попыткой, и продолжается с журнала устройства (RESUME)
+  unsigned max_attempts = 3;
+  std::chrono::milliseconds restart_delay{500};
+  std::chrono::milliseconds restart_delay_max{10000};
+};
+
+/*
+  Состояние устройства для отображения/экспорта. Счетчики статистики
+  относятся к текущей попытке, retries и timeouts - суммарные за все попытки
+*/
+struct DeviceStatus
+{
+  std::string name;
+  SessionState state = SessionState::Idle;
+  bool waiting = false;    // ждет перезапуска
+  unsigned attempt = 0;
+  size_t chunks_done = 0;
+  size_t chunks_total = 0;
+  uint64_t payload_done = 0;
+  uint64_t bytes_tx = 0;
+  uint64_t bytes_rx = 0;
+  uint32_t retries = 0;
+  uint32_t timeouts = 0;
+  double rate = 0;         // полезных байт/с за последний интервал sample()
+  double elapsed = 0;      // с, от первого запуска
+  std::string error;
+};
+
+/*
+  Параллельное обновление нескольких устройств одним циклом epoll.
+  Все сессии передают запросы из одного PreparedImage. Порт открывается
+  функцией opener при каждой попытке, поэтому отключенный и вновь
+  подключенный адаптер продолжает обновление.
+*/
+class Fleet
+{
+public:
+  using Opener = std::function<std::unique_ptr<Transport>()>;
+
+  Fleet(std::shared_ptr<const PreparedImage> image, const FleetOptions &options = FleetOptions());
+  ~Fleet();
+
+  Fleet(const Fleet &) = delete;
+  Fleet &operator=(const Fleet &) = delete;
+
+  void add(const std::string &name, Opener opener);
+
+  // Один проход цикла: ожидание событий не дольше max_wait,
+  // обработка готовых портов, тайм-аутов и перезапусков
+  void poll(Clock::duration max_wait);
+
+  // Обновить скорость устройств (за время от предыдущего вызова)
+  void sample(Clock::time_point now);
+
+  bool finished() const;
+  size_t size() const { return devices_.size(); }
+  const DeviceStatus &status(size_t i) const;
+  size_t succeeded() const;
+
+  /*
+    Цикл до завершения всех устройств, on_tick вызывается каждые
+    tick после sample() и один раз в конце.
+    Возвращает количество устройств, обновить которые не удалось
+  */
+  size_t run(const std::function<void(Fleet &)> &on_tick,
+             std::chrono::milliseconds tick = std::chrono::milliseconds(1000));
+
+private:
+  struct Device;
+
+  void launch(Device &d, Clock::time_point now);
+  void finish(Device &d, Clock::time_point now);
+  void watch(Device &d);
+  void unwatch(Device &d);
+  void update(Device &d, Clock::time_point now);
+
+  std::shared_ptr<const PreparedImage> image_;
+  FleetOptions opt_;
+  int epfd_ = -1;
+  std::vector<std::unique_ptr<Device>> devices_;
+  Clock::time_point last_sample_;
+};
+
+} // namespace polyboot
+
+#endif
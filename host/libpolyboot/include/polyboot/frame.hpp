@@ -0,0 +1,81 @@
+#ifndef POLYBOOT_FRAME_HPP
+#define POLYBOOT_FRAME_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include "binex-lib.h"
+}
+
+#include "polyboot/protocol.hpp"
+
+namespace polyboot
+{
+
+/*
+  Режим канала binex: адрес устройства, количество проверочных байт FEC
+  и кадрирование COBS вместо START и экранирования (вместе с FEC
+  не используется)
+*/
+struct LinkMode
+{
+  uint8_t address = kAddressNone;
+  uint8_t fec = 0;
+  bool cobs = false;
+};
+
+/*
+  Дописать в out пакет binex с данными payload (START, экранирование, CRC16,
+  FEC либо кадр COBS). Кодирование выполняется кодом ядра (binex-lib), поэтому формат в линии
+  совпадает с форматом устройства по построению.
+*/
+void EncodeFrame(std::vector<uint8_t> &out, const uint8_t *payload, size_t len, const LinkMode &mode);
+
+/*
+  Прием пакетов binex от устройства (хост принимает ответы любых устройств)
+*/
+class FrameDecoder
+{
+public:
+  explicit FrameDecoder(size_t max_payload = 512);
+
+  FrameDecoder(const FrameDecoder &) = delete;
+  FrameDecoder &operator=(const FrameDecoder &) = delete;
+
+  void setMode(const LinkMode &mode);
+  void reset();
+
+  // Обработать принятые символы, для каждого пакета вызывается
+  // on_frame(const uint8_t *data, size_t len)
+  template <class F>
+  void feed(const uint8_t *p, size_t n, F &&on_frame)
+  {
+    for (size_t i = 0; i < n; i++)
+    {
+      switch (binex_rx(&b_, p[i]))
+      {
+      case BINEX_PACK_RX:
+        on_frame(buf_.data(), (size_t)binex_rx_len(&b_));
+        break;
+      case BINEX_PACK_BROKEN:
+        broken_++;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+  uint32_t broken() const { return broken_; }
+
+private:
+  Binex_t b_;
+  std::vector<uint8_t> buf_;
+  uint32_t broken_ = 0;
+};
+
+} // namespace polyboot
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef POLYBOOT_INFO_HPP
+#define POLYBOOT_INFO_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "polyboot/protocol.hpp"
+
+namespace polyboot
+{
+
+/*
+  Описание Bootloader-а из ответа GET_INFO. Поля, отсутствующие
+  в ответе устройства, остаются нулевыми (пустыми)
+*/
+struct DeviceInfo
+{
+  uint8_t version = 0;             // 0 - не прочитано
+  uint32_t commands = 0;           // бит i - поддерживается команда 0x70 + i
+  uint16_t max_frame = 0;          // BUFFER_EXCH_SIZE
+  std::vector<uint8_t> chunk_sizes;
+  uint16_t rx_fifo = 0;            // окно запросов, байт
+  uint32_t sector_size = 0;
+  uint32_t app_begin = 0;
+  uint32_t app_length = 0;
+  uint16_t resp_delay_ms = 0;
+  std::vector<uint32_t> baud_rates;
+  uint8_t fec_max = 0;             // 0 - FEC не поддерживается
+  uint32_t features = 0;           // info::FeatureXxx
+  bool firmware_valid = false;
+  std::array<uint8_t, 16> firmware_mac{}; // отпечаток установленной прошивки
+  std::string device_id;
+  int address = -1;                // -1 - адресация отключена
+
+  bool supports(uint8_t c) const
+  {
+    return (c >= 0x70) && (c < 0x90) && (commands & (1u << (c - 0x70)));
+  }
+  bool has(uint32_t feature) const { return (features & feature) != 0; }
+};
+
+/*
+  Разобрать ответ GET_INFO целиком ([cmd][status][версия][TLV...]).
+  Записи неизвестных типов пропускаются.
+  Возвращает false - ответ поврежден
+*/
+bool ParseDeviceInfo(const uint8_t *data, size_t len, DeviceInfo *info);
+
+// Текстовое описание для вывода утилитами, по строке на поле
+std::string FormatDeviceInfo(const DeviceInfo &info);
+
+} // namespace polyboot
+
+#endif
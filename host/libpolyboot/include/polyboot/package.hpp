@@ -0,0 +1,125 @@
+#ifndef POLYBOOT_PACKAGE_HPP
+#define POLYBOOT_PACKAGE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "polyboot/frame.hpp"
+
+namespace polyboot
+{
+
+/*
+  Файл обновления: последовательность записей struct fw_chunk_s
+  (address u32 LSB, len, nonce[24], ciphertext[N], tag[16]), первая
+  запись - идентификационный чанк (address = длина области приложения).
+  Размер ciphertext N равен полю len идентификационного чанка
+  (CHUNK_DATA_SIZE Bootloader-а). В разреженном образе вторая запись -
+  карта сегментов (address как у идентификационного чанка, len = 0),
+  чанков, целиком состоящих из 0xFF, в файле нет. В разностном образе
+  вместо чанков прошивки - чанки потока восстановления новой прошивки
+  из установленной (address от kDeltaStreamBase).
+*/
+class Package
+{
+public:
+  // Ошибки формата - std::runtime_error
+  static Package Load(const std::string &path);
+  static Package FromRecords(std::vector<uint8_t> data);
+
+  size_t recordSize() const { return rec_; }
+  size_t numChunks() const { return data_.size() / rec_ - 1 - (sparse_ ? 1 : 0); }
+  bool sparse() const { return sparse_; }
+  bool delta() const;
+
+  const uint8_t *identity() const { return data_.data(); }
+  // Карта сегментов, nullptr - образ не разреженный
+  const uint8_t *segmentMap() const { return sparse_ ? data_.data() + rec_ : nullptr; }
+  const uint8_t *chunk(size_t i) const { return data_.data() + (i + 1 + (sparse_ ? 1 : 0)) * rec_; }
+
+  uint32_t chunkAddress(size_t i) const;
+  uint8_t chunkLen(size_t i) const { return chunk(i)[4]; }
+
+private:
+  std::vector<uint8_t> data_;
+  size_t rec_ = 0;
+  bool sparse_ = false;
+};
+
+/*
+  Образ, заранее упакованный в пакеты binex для заданного режима канала:
+  запросы BEGIN/RESUME, SEGMENT_MAP, SEND для каждого чанка, WRITE, END,
+  CHECK_CRC и APP_RUN (разностного образа - DELTA_BEGIN вместо BEGIN и
+  DELTA_CHUNK вместо SEND/WRITE) лежат в одном буфере, сессии передают их в линию прямо из него
+  без копирования. Один образ используется всеми сессиями с тем же режимом.
+*/
+class PreparedImage
+{
+public:
+  struct Frame
+  {
+    const uint8_t *data;
+    uint32_t size;
+  };
+
+  PreparedImage(const Package &package, const LinkMode &mode);
+
+  PreparedImage(const PreparedImage &) = delete;
+  PreparedImage &operator=(const PreparedImage &) = delete;
+
+  const LinkMode &mode() const { return mode_; }
+  size_t numChunks() const { return chunks_.size(); }
+  // Размер данных чанка (CHUNK_DATA_SIZE, для которого подготовлен пакет)
+  uint8_t chunkSize() const { return chunk_size_; }
+
+  Frame begin() const { return frame(begin_); }
+  Frame resume() const { return frame(resume_); }
+  // Разреженный образ: карта сегментов отправляется после BEGIN/RESUME
+  bool sparse() const { return sparse_; }
+  Frame segmentMap() const { return frame(segment_map_); }
+  // Разностный образ: begin() - DELTA_BEGIN, send(i) - DELTA_CHUNK
+  bool delta() const { return delta_; }
+  Frame send(size_t i) const { return frame(chunks_[i].frame); }
+  Frame write() const { return frame(write_); }
+  Frame end() const { return frame(end_); }
+  Frame checkCrc() const { return frame(check_crc_); }
+  Frame appRun() const { return frame(app_run_); }
+
+  // Адрес flash, следующий за данными чанка i, и размер данных чанка
+  uint32_t chunkEnd(size_t i) const { return chunks_[i].end; }
+  uint8_t chunkLen(size_t i) const { return chunks_[i].len; }
+  // Полезных данных прошивки во всех чанках
+  uint64_t payloadBytes() const { return payload_; }
+
+private:
+  struct Span
+  {
+    uint32_t offset, size;
+  };
+
+  struct Chunk
+  {
+    Span frame;
+    uint32_t end;
+    uint8_t len;
+  };
+
+  Span add(const uint8_t *payload, size_t len);
+  Frame frame(const Span &s) const { return {wire_.data() + s.offset, s.size}; }
+
+  LinkMode mode_;
+  uint8_t chunk_size_;
+  std::vector<uint8_t> wire_;
+  std::vector<Chunk> chunks_;
+  Span begin_, resume_, segment_map_{}, write_, end_, check_crc_, app_run_;
+  bool sparse_ = false;
+  bool delta_ = false;
+  uint64_t payload_ = 0;
+};
+
+} // namespace polyboot
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef POLYBOOT_PROTOCOL_HPP
+#define POLYBOOT_PROTOCOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace polyboot
+{
+
+/*
+  Команды Bootloader-а (core/src/bootloader.c).
+  Запрос: [cmd][данные], ответ: [cmd][status][данные]
+*/
+namespace cmd
+{
+constexpr uint8_t Activate = 0x70;
+constexpr uint8_t Begin = 0x71;
+constexpr uint8_t Send = 0x72;
+constexpr uint8_t Write = 0x73;
+constexpr uint8_t End = 0x74;
+constexpr uint8_t CheckCrc = 0x75;
+constexpr uint8_t AppRun = 0x76;
+constexpr uint8_t EraseUserData = 0x78;
+constexpr uint8_t Resume = 0x79;
+constexpr uint8_t SetFec = 0x80;
+constexpr uint8_t RelaySend = 0x81;
+constexpr uint8_t RelayPoll = 0x82;
+constexpr uint8_t GetStats = 0x83;
+constexpr uint8_t GetTrace = 0x84;
+constexpr uint8_t LinkTest = 0x85;
+constexpr uint8_t GetInfo = 0x86;
+constexpr uint8_t SegmentMap = 0x87;
+constexpr uint8_t DeltaBegin = 0x88;
+constexpr uint8_t DeltaChunk = 0x89;
+} // namespace cmd
+
+namespace status
+{
+constexpr uint8_t Ok = 0x00;
+constexpr uint8_t Error = 0x01;       // ошибка расшифровки/записи/проверки
+constexpr uint8_t WrongState = 0x02;  // неверный идентификационный чанк либо порядок команд
+constexpr uint8_t NoJournal = 0x03;   // RESUME: журнал не относится к этому образу
+constexpr uint8_t WrongBase = 0x03;   // DELTA_xxx: установленная прошивка не подходит
+constexpr uint8_t Event = 0xFF;       // событие о ходе очистки flash
+} // namespace status
+
+/*
+  Состояние канала ретранслятора в ответе RELAY_POLL:
+  [cmd][состояние][номер ответа][ответ нижестоящего устройства]
+*/
+namespace relay
+{
+constexpr uint8_t Reply = 0x00;
+constexpr uint8_t Busy = 0x01;
+constexpr uint8_t Timeout = 0x02;
+constexpr uint8_t Error = 0x03;
+} // namespace relay
+
+/*
+  Счетчики ответа GET_STATS: [cmd][status][версия][N][N x uint32_t].
+  Имена в порядке полей struct stats_s версии kStatsVersion,
+  счетчики сверх известных выводятся по номеру
+*/
+constexpr uint8_t kStatsVersion = 1;
+constexpr const char *kStatsNames[] = {
+    "rx_bytes", "rx_frames", "rx_err_framing", "rx_err_size", "rx_err_crc",
+    "rx_err_fec", "rx_fec_corrected", "rx_lost", "tx_bytes", "tx_frames",
+    "chunk_errors", "identity_errors", "chunks_written", "chunks_skipped",
+    "write_errors", "sectors_erased", "erase_errors", "mac_checks", "mac_errors",
+    "erase_us", "program_us", "decrypt_us", "mac_us", "uptime_ms", "sectors_written"};
+
+/*
+  Записи ответа GET_TRACE: [cmd][status][первая u32][всего u32][N][N x 8 байт],
+  запись - [время, мкс u32][событие][arg][value u16]. Имена событий
+  индексируются кодом события, состояний - номером состояния автомата
+  ProcessBootloader
+*/
+constexpr size_t kTraceEntrySize = 8;
+constexpr const char *kTraceEventNames[] = {
+    "?", "state", "rx", "rx-broken", "rx-lost", "tx", "erase", "erase-end",
+    "write", "write-end", "chunk-error", "mac", "mac-end"};
+constexpr const char *kTraceStateNames[] = {
+    "main", "rx-wait", "begin", "flash-clear", "user-data-begin", "user-data-clear",
+    "app-run", "app-run-1", "app-run-2", "send-resp", "send-resp-1"};
+
+/*
+  Режим проверки канала LINK_TEST: подкоманды, шаблоны содержимого
+  пакетов SINK и счетчики ответа REPORT (struct link_stats_s)
+*/
+namespace link
+{
+constexpr uint8_t Reset = 0x00;
+constexpr uint8_t Sink = 0x01;
+constexpr uint8_t Echo = 0x02;
+constexpr uint8_t Report = 0x03;
+
+constexpr uint8_t PatternZero = 0x00;
+constexpr uint8_t PatternOnes = 0x01;
+constexpr uint8_t PatternCount = 0x02;
+constexpr uint8_t PatternPrbs = 0x03;
+constexpr uint8_t PatternEsc = 0x04;
+
+constexpr uint8_t kVersion = 1;
+constexpr const char *kNames[] = {
+    "frames", "bytes", "seq_lost", "pattern_errors", "echo_frames", "rx_err_framing",
+    "rx_err_size", "rx_err_crc", "rx_err_fec", "rx_fec_corrected", "rx_lost",
+    "usart_overrun", "usart_framing", "usart_noise", "first_us", "last_us", "elapsed_us"};
+} // namespace link
+
+/*
+  Ответ GET_INFO: [cmd][status][версия][записи TLV [тип][длина][значение]]
+*/
+namespace info
+{
+constexpr uint8_t Commands = 0x01;
+constexpr uint8_t MaxFrame = 0x02;
+constexpr uint8_t ChunkSizes = 0x03;
+constexpr uint8_t RxFifo = 0x04;
+constexpr uint8_t SectorSize = 0x05;
+constexpr uint8_t AppRegion = 0x06;
+constexpr uint8_t RespDelay = 0x07;
+constexpr uint8_t BaudRates = 0x08;
+constexpr uint8_t Fec = 0x09;
+constexpr uint8_t Features = 0x0A;
+constexpr uint8_t Firmware = 0x0B;
+constexpr uint8_t DeviceId = 0x0C;
+constexpr uint8_t Address = 0x0D;
+
+constexpr uint32_t FeatureJournal = 1u << 0;
+constexpr uint32_t FeatureBroadcast = 1u << 1;
+constexpr uint32_t FeatureAddressing = 1u << 2;
+constexpr uint32_t FeatureRelay = 1u << 3;
+constexpr uint32_t FeatureUserData = 1u << 4;
+constexpr uint32_t FeatureStats = 1u << 5;
+constexpr uint32_t FeatureTrace = 1u << 6;
+constexpr uint32_t FeatureLinkTest = 1u << 7;
+// бит 8 - резерв
+constexpr uint32_t FeatureDelta = 1u << 9;
+constexpr uint32_t FeatureCobs = 1u << 10;
+constexpr uint32_t FeatureSparse = 1u << 11;
+
+constexpr const char *kFeatureNames[] = {
+    "journal", "broadcast", "addressing", "relay", "user-data",
+    "stats", "trace", "link-test", "bit8", "delta", "cobs",
+    "sparse"};
+} // namespace info
+
+// Сигнатура команды ACTIVATE
+constexpr char kActivateSignature[] = "ACTIVATE";
+
+// Режим кадрирования в запросе и ответе ACTIVATE
+constexpr uint8_t kFramingCobs = 0x01;
+
+// Адрес первого чанка потока разностного обновления
+constexpr uint32_t kDeltaStreamBase = 0x80000000u;
+
+// Адресация binex отключена
+constexpr uint8_t kAddressNone = 0xFF;
+
+} // namespace polyboot
+
+#endif
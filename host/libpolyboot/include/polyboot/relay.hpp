@@ -0,0 +1,113 @@
+#ifndef POLYBOOT_RELAY_HPP
+#define POLYBOOT_RELAY_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "polyboot/frame.hpp"
+#include "polyboot/protocol.hpp"
+#include "polyboot/transport.hpp"
+
+namespace polyboot
+{
+
+struct RelayOptions
+{
+  // Канал ретранслятора и адрес устройства на шине канала
+  uint8_t channel = 0;
+  uint8_t address = kAddressNone;
+
+  // Адрес самого ретранслятора на шине хоста
+  uint8_t gateway_address = kAddressNone;
+
+  // Тайм-аут ответа ретранслятора и количество повторов запроса
+  std::chrono::milliseconds timeout{300};
+  unsigned max_retries = 10;
+};
+
+/*
+  Канал к устройству, доступному только через ретранслятор
+  (Bootloader с BOOTLOADER_USE_RELAY). Сессия работает с ним как с
+  обычным каналом: пакеты binex, записанные сессией, разбираются,
+  и каждый передается ретранслятору командой RELAY_SEND, затем канал
+  ретранслятора опрашивается RELAY_POLL до ответа устройства. Ответ
+  снова упаковывается в binex и читается сессией. Перед первым пакетом
+  ретранслятор активируется (ACTIVATE).
+
+  Обмен с ретранслятором - по одному запросу, ответы на RELAY_POLL
+  подтверждаются номером, поэтому потерянный ответ ретранслятора
+  повторяется без потери ответа устройства. Пакеты к устройству тоже
+  передаются по одному: сессии нужно окно 1 и тайм-аут, больший
+  нескольких обменов с ретранслятором. Пакет, записанный сессией до
+  ответа на предыдущий (повтор), прерывает предыдущий обмен.
+
+  Пакеты сессии - без адреса, FEC и COBS: адрес устройства на шине
+  канала задается в RelayOptions, кадрирование канала - обычное binex.
+  Ретранслятор не отвечает после всех повторов либо отвергает пакет -
+  read() и write() возвращают -1, причина - error()
+*/
+class RelayTransport : public Transport
+{
+public:
+  RelayTransport(Transport &gateway, const RelayOptions &options = RelayOptions());
+
+  RelayTransport(const RelayTransport &) = delete;
+  RelayTransport &operator=(const RelayTransport &) = delete;
+
+  int fd() const override { return gateway_.fd(); }
+  ssize_t read(uint8_t *buf, size_t size) override;
+  ssize_t write(const uint8_t *buf, size_t size) override;
+
+  bool wantsWrite() const override { return tx_pos_ < tx_.size(); }
+  void onWritable(std::chrono::steady_clock::time_point now) override;
+  std::chrono::steady_clock::time_point deadline() const override;
+  void onTimer(std::chrono::steady_clock::time_point now) override;
+
+  const std::string &error() const { return error_; }
+
+  // Запросов к ретранслятору и повторов
+  uint32_t requests() const { return requests_; }
+  uint32_t retries() const { return retries_; }
+
+private:
+  void pump(std::chrono::steady_clock::time_point now);
+  void request(const uint8_t *payload, size_t len, std::chrono::steady_clock::time_point now);
+  void flush();
+  void onReply(const uint8_t *data, size_t len, std::chrono::steady_clock::time_point now);
+  void fail(const std::string &reason);
+
+  Transport &gateway_;
+  RelayOptions opt_;
+  LinkMode gateway_mode_;
+
+  FrameDecoder gateway_rx_; // ответы ретранслятора
+  FrameDecoder session_rx_; // пакеты сессии для устройства
+
+  std::deque<std::vector<uint8_t>> queue_; // пакеты, еще не переданные ретранслятору
+  std::vector<uint8_t> out_;               // ответы устройства в binex для сессии
+  size_t out_pos_ = 0;
+
+  std::vector<uint8_t> tx_; // запрос ретранслятору
+  size_t tx_pos_ = 0;
+  uint8_t tx_cmd_ = 0;
+  bool awaiting_ = false;
+  unsigned attempts_ = 0;
+  std::chrono::steady_clock::time_point sent_;
+
+  bool activated_ = false;
+  bool polling_ = false; // ответ устройства еще ожидается
+  uint8_t ack_ = 0;      // номер последнего полученного ответа канала
+
+  uint32_t requests_ = 0;
+  uint32_t retries_ = 0;
+  bool failed_ = false;
+  std::string error_;
+};
+
+} // namespace polyboot
+
+#endif
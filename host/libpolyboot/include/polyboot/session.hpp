@@ -0,0 +1,251 @@
+#ifndef POLYBOOT_SESSION_HPP
+#define POLYBOOT_SESSION_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "polyboot/frame.hpp"
+#include "polyboot/info.hpp"
+#include "polyboot/package.hpp"
+#include "polyboot/transport.hpp"
+
+namespace polyboot
+{
+
+using Clock = std::chrono::steady_clock;
+
+/*
+  Адрес устройства и FEC задаются режимом PreparedImage, при mode().fec != 0
+  FEC включается командой SET_FEC сразу после ACTIVATE. При mode().cobs
+  кадрирование COBS запрашивается в самой команде ACTIVATE, устройство,
+  не подтвердившее этот режим, не обновляется
+*/
+struct SessionOptions
+{
+  // Окно: запросов в линии без ответа и их суммарный размер в символах.
+  // Запрос отправляется без ожидания ответа на предыдущий, только если
+  // он поместится в FIFO приемника устройства вместе с неотвеченными.
+  // Конвейером передаются только SEND/WRITE, остальные команды - по одной
+  unsigned window = 2;
+  size_t window_bytes = 128;
+
+  // Тайм-аут ответа, отсчитывается от окончания передачи запроса
+  // либо от последнего события устройства (ход очистки flash)
+  std::chrono::milliseconds timeout{300};
+
+  // Пауза перед повтором удваивается с каждой неудачной попыткой
+  // одного шага, ответы, пришедшие во время паузы, отбрасываются
+  std::chrono::milliseconds backoff_min{20};
+  std::chrono::milliseconds backoff_max{1000};
+  unsigned max_retries = 10;
+
+  // Продолжить прерванную сессию (RESUME), при отсутствии
+  // журнала устройства выполняется обычный BEGIN
+  bool resume = false;
+
+  // Запустить приложение после проверки прошивки
+  bool run_app = true;
+
+  // Прочитать описание устройства (GET_INFO) после активации:
+  // окно window_bytes берется из размера FIFO приемника устройства,
+  // пакет с неподдерживаемым размером чанка и разреженный образ для
+  // устройства без SEGMENT_MAP отвергаются до очистки flash.
+  // Устройство без GET_INFO не отвечает, шаг пропускается
+  bool read_info = false;
+
+  // Прочитать счетчики устройства (GET_STATS) перед запуском
+  // приложения. Устройство без BOOTLOADER_USE_STATS не отвечает,
+  // тогда шаг пропускается после двух попыток
+  bool read_stats = false;
+
+  // Прочитать буфер событий устройства (GET_TRACE) перед
+  // запуском приложения, пропускается так же, как GET_STATS
+  bool read_trace = false;
+};
+
+enum class SessionState
+{
+  Idle,
+  Activate,
+  SetFec,
+  Info,
+  Begin,
+  Transfer,
+  End,
+  CheckCrc,
+  Stats,
+  Trace,
+  AppRun,
+  Done,
+  Failed
+};
+
+const char *SessionStateName(SessionState s);
+
+struct SessionStats
+{
+  uint64_t bytes_tx = 0;
+  uint64_t bytes_rx = 0;
+  uint32_t frames_tx = 0;
+  uint32_t frames_rx = 0;
+  uint32_t broken_rx = 0;  // поврежденные пакеты от устройства
+  uint32_t stale_rx = 0;   // ответы вне очереди запросов (опоздавшие)
+  uint32_t retries = 0;
+  uint32_t timeouts = 0;
+  uint32_t errors = 0;     // ответы с ошибкой
+  uint32_t events = 0;     // события о ходе очистки flash
+  size_t chunks_done = 0;  // записанных чанков (WRITE/DELTA_CHUNK OK)
+  size_t chunks_resumed = 0; // из них пропущено по ответу RESUME
+  size_t chunks_total = 0;
+  uint64_t payload_done = 0;
+  Clock::time_point started;
+  Clock::time_point finished;
+};
+
+/*
+  Счетчики устройства из ответа GET_STATS (protocol.hpp, kStatsNames)
+*/
+struct DeviceStats
+{
+  uint8_t version = 0;          // 0 - не прочитаны
+  std::vector<uint32_t> values;
+};
+
+/*
+  Запись буфера событий устройства (GET_TRACE, protocol.hpp)
+*/
+struct TraceEntry
+{
+  uint32_t seq;   // номер записи с момента сброса устройства
+  uint32_t time;  // мкс, часы устройства
+  uint8_t event;
+  uint8_t arg;
+  uint16_t value;
+};
+
+struct DeviceTrace
+{
+  uint32_t total = 0;             // записей на устройстве на момент чтения
+  std::vector<TraceEntry> entries; // пропуски номеров - затертые записи
+};
+
+/*
+  Сессия обновления одного устройства. Не блокируется и не владеет
+  циклом событий: приложение вызывает onReadable/onWritable по готовности
+  transport.fd() и onTimer по наступлении deadline(). Для одной сессии
+  есть готовый цикл RunSession.
+*/
+class Session
+{
+public:
+  Session(Transport &transport, std::shared_ptr<const PreparedImage> image,
+          const SessionOptions &options = SessionOptions());
+
+  Session(const Session &) = delete;
+  Session &operator=(const Session &) = delete;
+
+  void start(Clock::time_point now);
+
+  void onReadable(Clock::time_point now);
+  void onWritable(Clock::time_point now);
+  void onTimer(Clock::time_point now);
+
+  // Есть данные для передачи (нужно ждать готовности fd к записи)
+  bool wantsWrite() const;
+  // Время ближайшего тайм-аута, Clock::time_point::max() - нет
+  Clock::time_point deadline() const;
+
+  bool finished() const { return (state_ == SessionState::Done) || (state_ == SessionState::Failed); }
+  SessionState state() const { return state_; }
+  const SessionStats &stats() const { return stats_; }
+  const std::string &error() const { return error_; }
+  const DeviceInfo &deviceInfo() const { return device_info_; }
+  const DeviceStats &deviceStats() const { return device_stats_; }
+  const DeviceTrace &deviceTrace() const { return device_trace_; }
+  // Разностное обновление отвергнуто: установленная прошивка не
+  // является базой пакета (нужен полный пакет)
+  bool baseMismatch() const { return base_mismatch_; }
+  Transport &transport() { return transport_; }
+
+  // Вызывается при смене состояния, записи чанка и повторе
+  std::function<void(Session &)> on_progress;
+
+private:
+  struct Step
+  {
+    uint8_t cmd;
+    PreparedImage::Frame frame;
+    size_t chunk; // номер чанка для SEND/WRITE/DELTA_CHUNK
+  };
+
+  struct InFlight
+  {
+    size_t step;
+    uint32_t size;
+    Clock::time_point sent;
+  };
+
+  void buildSteps();
+  void fill(Clock::time_point now);
+  void transmit(Clock::time_point now);
+  void onFrame(const uint8_t *data, size_t len, Clock::time_point now);
+  void onSuccess(size_t step, const uint8_t *data, size_t len, Clock::time_point now);
+  void retry(size_t step, Clock::time_point now);
+  void fail(const std::string &reason, Clock::time_point now);
+  void setState(SessionState s);
+  bool pipelined(size_t step) const;
+  bool optional(size_t step) const;
+  PreparedImage::Frame encodeGetTrace(uint32_t seq);
+
+  Transport &transport_;
+  std::shared_ptr<const PreparedImage> image_;
+  SessionOptions opt_;
+  LinkMode plain_;
+
+  std::vector<uint8_t> small_; // ACTIVATE и SET_FEC в обоих режимах, GET_INFO, GET_STATS
+  PreparedImage::Frame activate_{}, activate_cobs_{}, set_fec_{}, set_fec_fec_{}, get_info_{}, get_stats_{};
+  size_t begin_step_ = 0;
+  size_t resume_step_ = 0; // первый шаг чанков после SEGMENT_MAP при RESUME
+
+  std::vector<Step> steps_;
+  std::vector<unsigned> attempts_;
+  size_t next_ = 0;
+
+  const uint8_t *tx_ptr_ = nullptr;
+  size_t tx_left_ = 0;
+  size_t tx_step_ = 0;
+  uint32_t tx_size_ = 0;
+  bool tx_discard_ = false; // передача, начатая до повтора
+
+  std::deque<InFlight> inflight_;
+  size_t inflight_bytes_ = 0;
+  Clock::time_point timer_;
+  Clock::time_point backoff_until_;
+  bool backoff_ = false;
+  bool base_mismatch_ = false;
+
+  FrameDecoder decoder_;
+  SessionState state_ = SessionState::Idle;
+  SessionStats stats_;
+  DeviceInfo device_info_;
+  DeviceStats device_stats_;
+  DeviceTrace device_trace_;
+  std::vector<uint8_t> trace_req_; // GET_TRACE с номером следующей записи
+  std::string error_;
+};
+
+/*
+  Выполнить одну сессию в собственном цикле poll().
+  Возвращает 0 - обновление выполнено, 1 - ошибка (Session::error)
+*/
+int RunSession(Session &session);
+
+} // namespace polyboot
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef POLYBOOT_TRANSPORT_HPP
+#define POLYBOOT_TRANSPORT_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+namespace polyboot
+{
+
+/*
+  Неблокирующий посимвольный канал связи с устройством.
+  Готовность к чтению/записи определяет цикл событий по fd()
+*/
+class Transport
+{
+public:
+  virtual ~Transport() = default;
+
+  virtual int fd() const = 0;
+
+  // Количество прочитанных/записанных байт,
+  // 0 - нет данных (места в буфере), -1 - ошибка канала
+  virtual ssize_t read(uint8_t *buf, size_t size) = 0;
+  virtual ssize_t write(const uint8_t *buf, size_t size) = 0;
+
+  // Транспорт с собственным обменом с устройством (RelayTransport):
+  // накопленные данные для передачи, время ближайшего тайм-аута и его
+  // обработка. Сессия учитывает их в своих wantsWrite, onWritable,
+  // deadline и onTimer, простому каналу они не нужны
+  virtual bool wantsWrite() const { return false; }
+  virtual void onWritable(std::chrono::steady_clock::time_point now) {}
+  virtual std::chrono::steady_clock::time_point deadline() const
+  {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  virtual void onTimer(std::chrono::steady_clock::time_point now) {}
+};
+
+/*
+  Готовый дескриптор: socketpair, pty симулятора и т.п.
+  Дескриптор переводится в неблокирующий режим
+*/
+class FdTransport : public Transport
+{
+public:
+  explicit FdTransport(int fd, bool own = false);
+  ~FdTransport() override;
+
+  FdTransport(const FdTransport &) = delete;
+  FdTransport &operator=(const FdTransport &) = delete;
+
+  int fd() const override { return fd_; }
+  ssize_t read(uint8_t *buf, size_t size) override;
+  ssize_t write(const uint8_t *buf, size_t size) override;
+
+protected:
+  FdTransport() = default;
+
+  int fd_ = -1;
+  bool own_ = false;
+};
+
+/*
+  Последовательный порт (USB-RS485 адаптер, pty): 8N1, без управления
+  потоком. Ошибка открытия или настройки - std::runtime_error
+*/
+class SerialTransport : public FdTransport
+{
+public:
+  SerialTransport(const std::string &path, unsigned baud);
+
+  // При VMIN = VTIME = 0 терминал возвращает 0 при отсутствии данных,
+  // а не конец потока, отключение адаптера - ошибка EIO
+  ssize_t read(uint8_t *buf, size_t size) override;
+};
+
+} // namespace polyboot
+
+#endif
@@ -0,0 +1,329 @@
+#include "polyboot/fleet.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace polyboot
+{
+
+struct Fleet::Device
+{
+  DeviceStatus st;
+  Opener opener;
+  std::unique_ptr<Transport> transport;
+  std::unique_ptr<Session> session; // удаляется раньше transport
+
+  bool waiting = true;              // ждет запуска или перезапуска
+  Clock::time_point restart_at = Clock::time_point::min();
+  Clock::time_point first_start;
+  Clock::time_point end;
+
+  int fd = -1;                      // зарегистрирован в epoll
+  uint32_t events = 0;
+
+  // Сумма по завершенным попыткам
+  uint32_t retries_prev = 0;
+  uint32_t timeouts_prev = 0;
+  uint64_t payload_prev = 0;
+
+  // Чанки, пропущенные по RESUME, в скорость не входят
+  uint64_t payload_base = 0;
+  uint64_t sample_payload = 0;
+};
+
+Fleet::Fleet(std::shared_ptr<const PreparedImage> image, const FleetOptions &options)
+    : image_(std::move(image)), opt_(options)
+{
+  if (!image_)
+    throw std::invalid_argument("fleet: no image");
+  if (opt_.max_attempts == 0)
+    opt_.max_attempts = 1;
+
+  epfd_ = epoll_create1(EPOLL_CLOEXEC);
+  if (epfd_ < 0)
+    throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+
+  last_sample_ = Clock::now();
+}
+
+Fleet::~Fleet()
+{
+  for (auto &d : devices_)
+  {
+    d->session.reset();
+    d->transport.reset();
+  }
+  close(epfd_);
+}
+
+void Fleet::add(const std::string &name, Opener opener)
+{
+  std::unique_ptr<Device> d(new Device);
+
+  d->st.name = name;
+  d->st.chunks_total = image_->numChunks();
+  d->opener = std::move(opener);
+  devices_.push_back(std::move(d));
+}
+
+const DeviceStatus &Fleet::status(size_t i) const
+{
+  return devices_.at(i)->st;
+}
+
+bool Fleet::finished() const
+{
+  for (auto &d : devices_)
+    if (d->waiting || d->session)
+      return false;
+  return true;
+}
+
+size_t Fleet::succeeded() const
+{
+  size_t n = 0;
+  for (auto &d : devices_)
+    n += (d->st.state == SessionState::Done);
+  return n;
+}
+
+/******************************************************************************/
+
+void Fleet::watch(Device &d)
+{
+  struct epoll_event ev;
+  int fd = d.transport->fd();
+
+  ev.events = EPOLLIN | (d.session->wantsWrite() ? (uint32_t)EPOLLOUT : 0u);
+  ev.data.ptr = &d;
+
+  if (d.fd != fd)
+  {
+    unwatch(d);
+    if (epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev) != 0)
+      throw std::runtime_error(std::string("epoll_ctl: ") + strerror(errno));
+    d.fd = fd;
+  }
+  else if (ev.events != d.events)
+    epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev);
+
+  d.events = ev.events;
+}
+
+void Fleet::unwatch(Device &d)
+{
+  if (d.fd < 0)
+    return;
+
+  epoll_ctl(epfd_, EPOLL_CTL_DEL, d.fd, NULL);
+  d.fd = -1;
+  d.events = 0;
+}
+
+void Fleet::launch(Device &d, Clock::time_point now)
+{
+  SessionOptions so = opt_.session;
+
+  d.waiting = false;
+  if (d.st.attempt++ == 0)
+    d.first_start = now;
+
+  // Повторная попытка продолжает запись с журнала устройства
+  if (d.st.attempt > 1)
+    so.resume = true;
+
+  try
+  {
+    d.transport = d.opener();
+    d.session.reset(new Session(*d.transport, image_, so));
+    d.payload_base = 0;
+    d.session->start(now);
+    watch(d);
+  }
+  catch (const std::exception &e)
+  {
+    d.st.error = e.what();
+    finish(d, now);
+  }
+}
+
+void Fleet::finish(Device &d, Clock::time_point now)
+{
+  bool done = false;
+
+  unwatch(d);
+
+  if (d.session)
+  {
+    const SessionStats &s = d.session->stats();
+
+    update(d, now);
+    d.retries_prev += s.retries;
+    d.timeouts_prev += s.timeouts;
+    d.payload_prev = d.st.payload_done;
+
+    done = (d.session->state() == SessionState::Done);
+    if (!done)
+      d.st.error = d.session->error();
+  }
+
+  d.session.reset();
+  d.transport.reset();
+
+  if (done)
+  {
+    d.st.state = SessionState::Done;
+    d.st.error.clear();
+    d.end = now;
+  }
+  else if (d.st.attempt < opt_.max_attempts)
+  {
+    auto delay = opt_.restart_delay * (1u << std::min(d.st.attempt - 1, 16u));
+
+    d.waiting = true;
+    d.restart_at = now + std::min(delay, opt_.restart_delay_max);
+    d.st.state = SessionState::Idle;
+  }
+  else
+  {
+    d.st.state = SessionState::Failed;
+    d.end = now;
+  }
+
+  d.st.waiting = d.waiting;
+}
+
+void Fleet::update(Device &d, Clock::time_point now)
+{
+  const SessionStats &s = d.session->stats();
+  SessionState state = d.session->state();
+
+  // До начала передачи чанков payload_done растет
+  // только за счет пропущенных по RESUME
+  if ((state <= SessionState::Begin) || (s.payload_done < d.payload_base))
+    d.payload_base = s.payload_done;
+
+  d.st.state = state;
+  d.st.waiting = false;
+  d.st.chunks_done = s.chunks_done;
+  d.st.bytes_tx = s.bytes_tx;
+  d.st.bytes_rx = s.bytes_rx;
+  d.st.retries = d.retries_prev + s.retries;
+  d.st.timeouts = d.timeouts_prev + s.timeouts;
+  d.st.payload_done = d.payload_prev + (s.payload_done - d.payload_base);
+}
+
+/******************************************************************************/
+
+void Fleet::poll(Clock::duration max_wait)
+{
+  struct epoll_event evs[64];
+  Clock::time_point now = Clock::now();
+  Clock::time_point wake = now + std::max(max_wait, Clock::duration::zero());
+  int timeout, n;
+
+  for (auto &d : devices_)
+  {
+    if (d->session)
+      wake = std::min(wake, d->session->deadline());
+    else if (d->waiting)
+      wake = std::min(wake, d->restart_at);
+  }
+
+  if (wake <= now)
+    timeout = 0;
+  else
+    timeout = (int)std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count() + 1;
+
+  n = epoll_wait(epfd_, evs, sizeof(evs) / sizeof(evs[0]), timeout);
+  if ((n < 0) && (errno != EINTR))
+    throw std::runtime_error(std::string("epoll_wait: ") + strerror(errno));
+
+  now = Clock::now();
+
+  for (int i = 0; i < n; i++)
+  {
+    Device &d = *static_cast<Device *>(evs[i].data.ptr);
+
+    if (!d.session || d.session->finished())
+      continue;
+    if (evs[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+      d.session->onReadable(now);
+    if ((evs[i].events & EPOLLOUT) && !d.session->finished())
+      d.session->onWritable(now);
+  }
+
+  for (auto &dp : devices_)
+  {
+    Device &d = *dp;
+
+    if (d.session)
+    {
+      d.session->onTimer(now);
+      if (d.session->finished())
+        finish(d, now);
+      else
+      {
+        update(d, now);
+        watch(d);
+      }
+    }
+    else if (d.waiting && (now >= d.restart_at))
+      launch(d, now);
+  }
+}
+
+void Fleet::sample(Clock::time_point now)
+{
+  double dt = std::chrono::duration<double>(now - last_sample_).count();
+
+  for (auto &d : devices_)
+  {
+    if (dt > 0)
+      d->st.rate = (d->st.payload_done - d->sample_payload) / dt;
+    d->sample_payload = d->st.payload_done;
+
+    if (d->st.attempt)
+    {
+      Clock::time_point end = (d->session || d->waiting) ? now : d->end;
+      d->st.elapsed = std::chrono::duration<double>(end - d->first_start).count();
+    }
+  }
+
+  last_sample_ = now;
+}
+
+size_t Fleet::run(const std::function<void(Fleet &)> &on_tick, std::chrono::milliseconds tick)
+{
+  Clock::time_point next = Clock::now() + tick;
+
+  sample(Clock::now());
+
+  while (!finished())
+  {
+    poll(next - Clock::now());
+
+    Clock::time_point now = Clock::now();
+    if (now >= next)
+    {
+      sample(now);
+      if (on_tick)
+        on_tick(*this);
+      next += tick;
+      if (next < now)
+        next = now + tick;
+    }
+  }
+
+  sample(Clock::now());
+  if (on_tick)
+    on_tick(*this);
+
+  return devices_.size() - succeeded();
+}
+
+} // namespace polyboot
@@ -0,0 +1,83 @@
+#include "polyboot/frame.hpp"
+
+extern "C" {
+#include "crc16.h"
+}
+
+/*
+  Экземпляр binex по умолчанию на хосте не используется,
+  приложение может определить свою функцию
+*/
+extern "C" __attribute__((weak)) int binex_tx_callback(uint8_t c)
+{
+  (void)c;
+  return 0;
+}
+
+namespace polyboot
+{
+
+namespace
+{
+
+struct CrcInit
+{
+  CrcInit() { Crc16Init(); }
+};
+
+void crc_init()
+{
+  static CrcInit init;
+  (void)init;
+}
+
+int append_callback(void *arg, uint8_t c)
+{
+  static_cast<std::vector<uint8_t> *>(arg)->push_back(c);
+  return 1;
+}
+
+void apply_mode(Binex_t *b, const LinkMode &mode)
+{
+  if (mode.address != kAddressNone)
+    binex_host_address_set(b, mode.address);
+  binex_fec_set(b, mode.fec);
+  binex_cobs_set(b, mode.cobs);
+}
+
+} // namespace
+
+void EncodeFrame(std::vector<uint8_t> &out, const uint8_t *payload, size_t len, const LinkMode &mode)
+{
+  Binex_t b;
+
+  crc_init();
+  binex_init(&b, append_callback, &out);
+  apply_mode(&b, mode);
+
+  binex_tx_init(&b, const_cast<uint8_t *>(payload), (uint16_t)len);
+  while (binex_tx(&b) != BINEX_PACK_TX)
+    ;
+}
+
+FrameDecoder::FrameDecoder(size_t max_payload)
+    : buf_(max_payload)
+{
+  crc_init();
+  binex_init(&b_, nullptr, nullptr);
+  reset();
+}
+
+void FrameDecoder::setMode(const LinkMode &mode)
+{
+  binex_init(&b_, nullptr, nullptr);
+  apply_mode(&b_, mode);
+  reset();
+}
+
+void FrameDecoder::reset()
+{
+  binex_rx_begin(&b_, buf_.data(), buf_.size());
+}
+
+} // namespace polyboot
@@ -0,0 +1,191 @@
+#include "polyboot/info.hpp"
+
+#include <cstdio>
+
+namespace polyboot
+{
+
+namespace
+{
+
+uint16_t load_u16(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+uint32_t load_u32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+} // namespace
+
+bool ParseDeviceInfo(const uint8_t *data, size_t len, DeviceInfo *info)
+{
+  DeviceInfo r;
+  size_t pos = 3;
+
+  if ((len < 3) || (data[0] != cmd::GetInfo) || (data[1] != status::Ok) || (data[2] == 0))
+    return false;
+
+  r.version = data[2];
+
+  while (pos < len)
+  {
+    uint8_t type, n;
+    const uint8_t *v;
+
+    if (pos + 2 > len)
+      return false;
+    type = data[pos];
+    n = data[pos + 1];
+    v = data + pos + 2;
+    if (pos + 2 + n > len)
+      return false;
+    pos += 2 + n;
+
+    switch (type)
+    {
+    case info::Commands:
+      for (size_t i = 0; (i < n) && (i < 4); i++)
+        r.commands |= (uint32_t)v[i] << (8 * i);
+      break;
+    case info::MaxFrame:
+      if (n >= 2)
+        r.max_frame = load_u16(v);
+      break;
+    case info::ChunkSizes:
+      r.chunk_sizes.assign(v, v + n);
+      break;
+    case info::RxFifo:
+      if (n >= 2)
+        r.rx_fifo = load_u16(v);
+      break;
+    case info::SectorSize:
+      if (n >= 4)
+        r.sector_size = load_u32(v);
+      break;
+    case info::AppRegion:
+      if (n >= 8)
+      {
+        r.app_begin = load_u32(v);
+        r.app_length = load_u32(v + 4);
+      }
+      break;
+    case info::RespDelay:
+      if (n >= 2)
+        r.resp_delay_ms = load_u16(v);
+      break;
+    case info::BaudRates:
+      for (size_t i = 0; i + 4 <= n; i += 4)
+        r.baud_rates.push_back(load_u32(v + i));
+      break;
+    case info::Fec:
+      if (n >= 1)
+        r.fec_max = v[0];
+      break;
+    case info::Features:
+      if (n >= 4)
+        r.features = load_u32(v);
+      break;
+    case info::Firmware:
+      if (n >= 1 + r.firmware_mac.size())
+      {
+        r.firmware_valid = v[0] != 0;
+        std::copy(v + 1, v + 1 + r.firmware_mac.size(), r.firmware_mac.begin());
+      }
+      break;
+    case info::DeviceId:
+      r.device_id.assign((const char *)v, n);
+      break;
+    case info::Address:
+      if (n >= 1)
+        r.address = v[0];
+      break;
+    }
+  }
+
+  *info = r;
+  return true;
+}
+
+std::string FormatDeviceInfo(const DeviceInfo &info)
+{
+  std::string s;
+  char buf[128];
+
+  if (info.version == 0)
+    return "device info: not available\n";
+
+  snprintf(buf, sizeof(buf), "device info (version %u):\n", info.version);
+  s += buf;
+  snprintf(buf, sizeof(buf), "  device id       %s\n", info.device_id.c_str());
+  s += buf;
+  if (info.address >= 0)
+  {
+    snprintf(buf, sizeof(buf), "  address         0x%02X\n", info.address);
+    s += buf;
+  }
+
+  s += "  commands       ";
+  for (unsigned c = 0x70; c < 0x90; c++)
+  {
+    if (info.supports(c))
+    {
+      snprintf(buf, sizeof(buf), " %02X", c);
+      s += buf;
+    }
+  }
+  s += "\n";
+
+  s += "  features       ";
+  for (size_t i = 0; i < sizeof(info::kFeatureNames) / sizeof(info::kFeatureNames[0]); i++)
+  {
+    if (info.features & (1u << i))
+    {
+      s += " ";
+      s += info::kFeatureNames[i];
+    }
+  }
+  s += "\n";
+
+  snprintf(buf, sizeof(buf), "  max frame       %u B\n  rx fifo         %u B\n",
+           info.max_frame, info.rx_fifo);
+  s += buf;
+
+  s += "  chunk sizes    ";
+  for (uint8_t c : info.chunk_sizes)
+  {
+    snprintf(buf, sizeof(buf), " %u", c);
+    s += buf;
+  }
+  s += "\n";
+
+  snprintf(buf, sizeof(buf), "  app region      0x%08X, %u B, sector %u B\n",
+           info.app_begin, info.app_length, info.sector_size);
+  s += buf;
+  snprintf(buf, sizeof(buf), "  response delay  %u ms\n  fec             up to %u parity bytes\n",
+           info.resp_delay_ms, info.fec_max);
+  s += buf;
+
+  s += "  baud rates     ";
+  for (uint32_t b : info.baud_rates)
+  {
+    snprintf(buf, sizeof(buf), " %u", b);
+    s += buf;
+  }
+  s += "\n";
+
+  s += "  firmware        ";
+  s += info.firmware_valid ? "valid, mac " : "invalid, mac ";
+  for (uint8_t b : info.firmware_mac)
+  {
+    snprintf(buf, sizeof(buf), "%02x", b);
+    s += buf;
+  }
+  s += "\n";
+
+  return s;
+}
+
+} // namespace polyboot
@@ -0,0 +1,132 @@
+#include "polyboot/package.hpp"
+#include "polyboot/protocol.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+
+namespace polyboot
+{
+
+namespace
+{
+
+constexpr size_t kChunkHeader = 4 + 1 + 24; // address, len, nonce
+constexpr size_t kChunkTag = 16;
+
+uint32_t load_u32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+} // namespace
+
+Package Package::Load(const std::string &path)
+{
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  FILE *f = fopen(path.c_str(), "rb");
+
+  if (!f)
+    throw std::runtime_error(path + ": cannot open");
+
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+
+  fclose(f);
+  return FromRecords(std::move(data));
+}
+
+Package Package::FromRecords(std::vector<uint8_t> data)
+{
+  Package p;
+
+  if (data.size() < kChunkHeader)
+    throw std::runtime_error("package: too short");
+
+  p.rec_ = kChunkHeader + data[4] + kChunkTag;
+
+  if ((data[4] == 0) || (data.size() % p.rec_) || (data.size() / p.rec_ < 2))
+    throw std::runtime_error("package: size is not a multiple of the chunk record");
+
+  p.data_ = std::move(data);
+
+  // Карта сегментов: адрес идентификационного чанка, len = 0
+  p.sparse_ = (p.data_.size() / p.rec_ >= 3) && (p.data_[p.rec_ + 4] == 0) &&
+              (load_u32(p.data_.data() + p.rec_) == load_u32(p.data_.data()));
+
+  for (size_t i = 0; i < p.numChunks(); i++)
+  {
+    if ((p.chunkLen(i) == 0) || (p.chunkLen(i) > p.rec_ - kChunkHeader - kChunkTag))
+      throw std::runtime_error("package: bad chunk length");
+  }
+
+  return p;
+}
+
+bool Package::delta() const
+{
+  return (numChunks() != 0) && (chunkAddress(0) >= kDeltaStreamBase);
+}
+
+uint32_t Package::chunkAddress(size_t i) const
+{
+  return load_u32(chunk(i));
+}
+
+/******************************************************************************/
+
+PreparedImage::PreparedImage(const Package &package, const LinkMode &mode)
+    : mode_(mode), chunk_size_(package.identity()[4])
+{
+  std::vector<uint8_t> req(1 + package.recordSize());
+  static const uint8_t single[][1] = {{cmd::Write}, {cmd::End}, {cmd::CheckCrc}, {cmd::AppRun}};
+
+  // Оценка размера: экранирование добавляет в среднем < 1% символов
+  wire_.reserve((package.numChunks() + 2) * (req.size() + 16 + mode.fec) * 102 / 100);
+
+  delta_ = package.delta();
+
+  std::copy(package.identity(), package.identity() + package.recordSize(), req.begin() + 1);
+  req[0] = delta_ ? cmd::DeltaBegin : cmd::Begin;
+  begin_ = add(req.data(), req.size());
+  req[0] = cmd::Resume;
+  resume_ = add(req.data(), req.size());
+
+  if (package.sparse())
+  {
+    std::copy(package.segmentMap(), package.segmentMap() + package.recordSize(), req.begin() + 1);
+    req[0] = cmd::SegmentMap;
+    segment_map_ = add(req.data(), req.size());
+    sparse_ = true;
+  }
+
+  chunks_.resize(package.numChunks());
+  req[0] = delta_ ? cmd::DeltaChunk : cmd::Send;
+  for (size_t i = 0; i < package.numChunks(); i++)
+  {
+    std::copy(package.chunk(i), package.chunk(i) + package.recordSize(), req.begin() + 1);
+    chunks_[i].frame = add(req.data(), req.size());
+    chunks_[i].end = package.chunkAddress(i) + package.chunkLen(i);
+    chunks_[i].len = package.chunkLen(i);
+    payload_ += package.chunkLen(i);
+  }
+
+  write_ = add(single[0], 1);
+  end_ = add(single[1], 1);
+  check_crc_ = add(single[2], 1);
+  app_run_ = add(single[3], 1);
+}
+
+PreparedImage::Span PreparedImage::add(const uint8_t *payload, size_t len)
+{
+  Span s;
+
+  s.offset = (uint32_t)wire_.size();
+  EncodeFrame(wire_, payload, len, mode_);
+  s.size = (uint32_t)(wire_.size() - s.offset);
+
+  return s;
+}
+
+} // namespace polyboot
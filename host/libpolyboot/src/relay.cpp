@@ -0,0 +1,256 @@
+#include "polyboot/relay.hpp"
+
+#include <cstdio>
+#include <cstring>
+
+namespace polyboot
+{
+
+using Clock = std::chrono::steady_clock;
+
+RelayTransport::RelayTransport(Transport &gateway, const RelayOptions &options)
+    : gateway_(gateway), opt_(options)
+{
+  gateway_mode_.address = opt_.gateway_address;
+  gateway_rx_.setMode(gateway_mode_);
+}
+
+/*
+  Следующий запрос к ретранслятору, если предыдущий завершен
+*/
+void RelayTransport::pump(Clock::time_point now)
+{
+  if (failed_ || awaiting_)
+    return;
+
+  if (!activated_)
+  {
+    uint8_t req[sizeof(kActivateSignature)];
+
+    req[0] = cmd::Activate;
+    memcpy(req + 1, kActivateSignature, sizeof(kActivateSignature) - 1);
+    request(req, sizeof(req), now);
+    return;
+  }
+
+  if (!queue_.empty())
+  {
+    // Новый пакет сессии прерывает опрос ответа на предыдущий
+    const std::vector<uint8_t> &p = queue_.front();
+    std::vector<uint8_t> req(3 + p.size());
+
+    req[0] = cmd::RelaySend;
+    req[1] = opt_.channel;
+    req[2] = opt_.address;
+    memcpy(req.data() + 3, p.data(), p.size());
+    request(req.data(), req.size(), now);
+    return;
+  }
+
+  if (polling_)
+  {
+    const uint8_t req[3] = {cmd::RelayPoll, opt_.channel, ack_};
+    request(req, sizeof(req), now);
+  }
+}
+
+void RelayTransport::request(const uint8_t *payload, size_t len, Clock::time_point now)
+{
+  tx_.clear();
+  tx_pos_ = 0;
+  EncodeFrame(tx_, payload, len, gateway_mode_);
+
+  tx_cmd_ = payload[0];
+  awaiting_ = true;
+  attempts_ = 0;
+  sent_ = now;
+  requests_++;
+
+  flush();
+}
+
+void RelayTransport::flush()
+{
+  while (!failed_ && (tx_pos_ < tx_.size()))
+  {
+    ssize_t n = gateway_.write(tx_.data() + tx_pos_, tx_.size() - tx_pos_);
+
+    if (n < 0)
+    {
+      fail("relay: gateway write error");
+      return;
+    }
+    if (n == 0)
+      return;
+
+    tx_pos_ += n;
+  }
+}
+
+void RelayTransport::onReply(const uint8_t *data, size_t len, Clock::time_point now)
+{
+  char buf[64];
+
+  // Опоздавший ответ на уже повторенный либо замененный запрос
+  if (!awaiting_ || (len < 2) || (data[0] != tx_cmd_))
+    return;
+
+  awaiting_ = false;
+
+  switch (tx_cmd_)
+  {
+  case cmd::Activate:
+    if (data[1] != status::Ok)
+    {
+      fail("relay: gateway rejected ACTIVATE");
+      return;
+    }
+    activated_ = true;
+    break;
+
+  case cmd::RelaySend:
+    if ((data[1] != status::Ok) || (len < 3))
+    {
+      snprintf(buf, sizeof(buf), "relay: gateway rejected a packet for channel %u", opt_.channel);
+      fail(buf);
+      return;
+    }
+
+    // Ответы канала до этого пакета отброшены ретранслятором,
+    // подтверждения начинаются с номера последнего из них
+    queue_.pop_front();
+    ack_ = data[2];
+    polling_ = true;
+    break;
+
+  case cmd::RelayPoll:
+    if (len < 3)
+      break;
+
+    switch (data[1])
+    {
+    case relay::Reply:
+      ack_ = data[2];
+      EncodeFrame(out_, data + 3, len - 3, LinkMode());
+
+      // После события о ходе очистки flash ответ устройства еще впереди
+      polling_ = (len >= 5) && (data[4] == status::Event);
+      break;
+
+    case relay::Busy:
+      break;
+
+    case relay::Timeout:
+      // Устройство не ответило, сессия повторит запрос сама
+      polling_ = false;
+      break;
+
+    default:
+      snprintf(buf, sizeof(buf), "relay: gateway has no channel %u", opt_.channel);
+      fail(buf);
+      return;
+    }
+    break;
+  }
+
+  pump(now);
+}
+
+ssize_t RelayTransport::read(uint8_t *buf, size_t size)
+{
+  Clock::time_point now = Clock::now();
+  uint8_t rx[512];
+  size_t n;
+
+  if (failed_)
+    return -1;
+
+  for (;;)
+  {
+    ssize_t r = gateway_.read(rx, sizeof(rx));
+
+    if (r < 0)
+    {
+      fail("relay: gateway disconnected");
+      return -1;
+    }
+    if (r == 0)
+      break;
+
+    gateway_rx_.feed(rx, r, [&](const uint8_t *data, size_t len) { onReply(data, len, now); });
+    if (failed_)
+      return -1;
+  }
+
+  n = out_.size() - out_pos_;
+  if (n == 0)
+    return 0;
+  if (n > size)
+    n = size;
+
+  memcpy(buf, out_.data() + out_pos_, n);
+  out_pos_ += n;
+  if (out_pos_ == out_.size())
+  {
+    out_.clear();
+    out_pos_ = 0;
+  }
+  return n;
+}
+
+ssize_t RelayTransport::write(const uint8_t *buf, size_t size)
+{
+  if (failed_)
+    return -1;
+
+  session_rx_.feed(buf, size, [&](const uint8_t *data, size_t len) {
+    queue_.emplace_back(data, data + len);
+  });
+
+  pump(Clock::now());
+  return failed_ ? -1 : (ssize_t)size;
+}
+
+void RelayTransport::onWritable(Clock::time_point)
+{
+  flush();
+}
+
+Clock::time_point RelayTransport::deadline() const
+{
+  if (failed_ || !awaiting_)
+    return Clock::time_point::max();
+  return sent_ + opt_.timeout;
+}
+
+void RelayTransport::onTimer(Clock::time_point now)
+{
+  if (failed_ || !awaiting_ || (now - sent_ < opt_.timeout))
+    return;
+
+  if (++attempts_ > opt_.max_retries)
+  {
+    fail("relay: no reply from gateway");
+    return;
+  }
+
+  // Повтор того же запроса: RELAY_POLL с тем же номером подтверждения
+  // не теряет ответ устройства, повтор RELAY_SEND равносилен повтору
+  // пакета сессией
+  retries_++;
+  gateway_rx_.reset();
+  tx_pos_ = 0;
+  sent_ = now;
+  flush();
+}
+
+void RelayTransport::fail(const std::string &reason)
+{
+  if (failed_)
+    return;
+
+  failed_ = true;
+  error_ = reason;
+}
+
+} // namespace polyboot
@@ -0,0 +1,720 @@
+#include "polyboot/session.hpp"
+#include "polyboot/protocol.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+
+namespace polyboot
+{
+
+namespace
+{
+
+uint32_t load_u32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+SessionState state_for(uint8_t c)
+{
+  switch (c)
+  {
+  case cmd::Activate: return SessionState::Activate;
+  case cmd::SetFec: return SessionState::SetFec;
+  case cmd::GetInfo: return SessionState::Info;
+  case cmd::Begin:
+  case cmd::Resume:
+  case cmd::DeltaBegin:
+  case cmd::SegmentMap: return SessionState::Begin;
+  case cmd::End: return SessionState::End;
+  case cmd::CheckCrc: return SessionState::CheckCrc;
+  case cmd::GetStats: return SessionState::Stats;
+  case cmd::GetTrace: return SessionState::Trace;
+  case cmd::AppRun: return SessionState::AppRun;
+  }
+  return SessionState::Transfer;
+}
+
+} // namespace
+
+const char *SessionStateName(SessionState s)
+{
+  switch (s)
+  {
+  case SessionState::Idle: return "idle";
+  case SessionState::Activate: return "activate";
+  case SessionState::SetFec: return "set-fec";
+  case SessionState::Info: return "info";
+  case SessionState::Begin: return "erase";
+  case SessionState::Transfer: return "transfer";
+  case SessionState::End: return "end";
+  case SessionState::CheckCrc: return "check";
+  case SessionState::Stats: return "stats";
+  case SessionState::Trace: return "trace";
+  case SessionState::AppRun: return "app-run";
+  case SessionState::Done: return "done";
+  case SessionState::Failed: return "failed";
+  }
+  return "?";
+}
+
+/******************************************************************************/
+
+Session::Session(Transport &transport, std::shared_ptr<const PreparedImage> image,
+                 const SessionOptions &options)
+    : transport_(transport), image_(std::move(image)), opt_(options)
+{
+  if (!image_)
+    throw std::invalid_argument("session: no image");
+  if (opt_.window == 0)
+    opt_.window = 1;
+  if (image_->mode().cobs && (image_->mode().fec != 0))
+    throw std::invalid_argument("session: COBS framing cannot be combined with FEC");
+
+  plain_.address = image_->mode().address;
+  plain_.fec = 0;
+  plain_.cobs = false;
+
+  buildSteps();
+}
+
+void Session::buildSteps()
+{
+  const uint8_t set_fec[2] = {cmd::SetFec, image_->mode().fec};
+  const uint8_t get_info[1] = {cmd::GetInfo};
+  const uint8_t get_stats[1] = {cmd::GetStats};
+  uint8_t activate[1 + sizeof(kActivateSignature) - 1 + 1];
+  size_t activate_len = sizeof(activate) - 1;
+  size_t o_activate, o_activate_cobs, o_set_fec, o_set_fec_fec, o_get_info, o_get_stats;
+
+  // Небольшие запросы до включения FEC кодируются в самой сессии
+  activate[0] = cmd::Activate;
+  memcpy(activate + 1, kActivateSignature, sizeof(kActivateSignature) - 1);
+  if (image_->mode().cobs)
+    activate[activate_len++] = kFramingCobs;
+
+  o_activate = small_.size();
+  EncodeFrame(small_, activate, activate_len, plain_);
+  o_activate_cobs = small_.size();
+  EncodeFrame(small_, activate, activate_len, image_->mode());
+  o_set_fec = small_.size();
+  EncodeFrame(small_, set_fec, sizeof(set_fec), plain_);
+  o_set_fec_fec = small_.size();
+  EncodeFrame(small_, set_fec, sizeof(set_fec), image_->mode());
+  o_get_info = small_.size();
+  EncodeFrame(small_, get_info, sizeof(get_info), image_->mode());
+  o_get_stats = small_.size();
+  EncodeFrame(small_, get_stats, sizeof(get_stats), image_->mode());
+
+  activate_ = {small_.data() + o_activate, (uint32_t)(o_activate_cobs - o_activate)};
+  activate_cobs_ = {small_.data() + o_activate_cobs, (uint32_t)(o_set_fec - o_activate_cobs)};
+  set_fec_ = {small_.data() + o_set_fec, (uint32_t)(o_set_fec_fec - o_set_fec)};
+  set_fec_fec_ = {small_.data() + o_set_fec_fec, (uint32_t)(o_get_info - o_set_fec_fec)};
+  get_info_ = {small_.data() + o_get_info, (uint32_t)(o_get_stats - o_get_info)};
+  get_stats_ = {small_.data() + o_get_stats, (uint32_t)(small_.size() - o_get_stats)};
+
+  steps_.push_back({cmd::Activate, activate_, 0});
+  if (image_->mode().fec != 0)
+    steps_.push_back({cmd::SetFec, set_fec_, 0});
+  if (opt_.read_info)
+    steps_.push_back({cmd::GetInfo, get_info_, 0});
+
+  begin_step_ = steps_.size();
+  if (image_->delta())
+  {
+    // Разностное обновление не продолжается после обрыва:
+    // сектора уже перезаписаны, поток начинается заново
+    steps_.push_back({cmd::DeltaBegin, image_->begin(), 0});
+    for (size_t i = 0; i < image_->numChunks(); i++)
+      steps_.push_back({cmd::DeltaChunk, image_->send(i), i});
+  }
+  else
+  {
+    if (opt_.resume)
+      steps_.push_back({cmd::Resume, image_->resume(), 0});
+    else
+      steps_.push_back({cmd::Begin, image_->begin(), 0});
+    if (image_->sparse())
+      steps_.push_back({cmd::SegmentMap, image_->segmentMap(), 0});
+
+    for (size_t i = 0; i < image_->numChunks(); i++)
+    {
+      steps_.push_back({cmd::Send, image_->send(i), i});
+      steps_.push_back({cmd::Write, image_->write(), i});
+    }
+  }
+
+  steps_.push_back({cmd::End, image_->end(), 0});
+  steps_.push_back({cmd::CheckCrc, image_->checkCrc(), 0});
+  if (opt_.read_stats)
+    steps_.push_back({cmd::GetStats, get_stats_, 0});
+  if (opt_.read_trace)
+    steps_.push_back({cmd::GetTrace, encodeGetTrace(0), 0});
+  if (opt_.run_app)
+    steps_.push_back({cmd::AppRun, image_->appRun(), 0});
+
+  attempts_.assign(steps_.size(), 0);
+  stats_.chunks_total = image_->numChunks();
+}
+
+/*
+  Запрос GET_TRACE кодируется заново для каждой порции записей
+*/
+PreparedImage::Frame Session::encodeGetTrace(uint32_t seq)
+{
+  const uint8_t req[5] = {cmd::GetTrace, (uint8_t)seq, (uint8_t)(seq >> 8),
+                          (uint8_t)(seq >> 16), (uint8_t)(seq >> 24)};
+
+  trace_req_.clear();
+  EncodeFrame(trace_req_, req, sizeof(req), image_->mode());
+  return {trace_req_.data(), (uint32_t)trace_req_.size()};
+}
+
+void Session::start(Clock::time_point now)
+{
+  stats_.started = now;
+  decoder_.setMode(plain_);
+  fill(now);
+}
+
+bool Session::pipelined(size_t step) const
+{
+  uint8_t c = steps_[step].cmd;
+  return (c == cmd::Send) || (c == cmd::Write) || (c == cmd::DeltaChunk);
+}
+
+/*
+  Необязательные запросы: устройство без соответствующей команды
+  не отвечает, и это не ошибка обновления
+*/
+bool Session::optional(size_t step) const
+{
+  uint8_t c = steps_[step].cmd;
+  return (c == cmd::GetInfo) || (c == cmd::GetStats) || (c == cmd::GetTrace);
+}
+
+/*
+  Начать передачу следующего запроса, если позволяет окно
+*/
+void Session::fill(Clock::time_point now)
+{
+  while (!finished() && !backoff_ && (tx_left_ == 0) && (next_ < steps_.size()))
+  {
+    const Step &s = steps_[next_];
+    PreparedImage::Frame frame = s.frame;
+
+    if (!inflight_.empty())
+    {
+      if (!pipelined(next_) || !pipelined(inflight_.back().step))
+        return;
+      if (inflight_.size() >= opt_.window)
+        return;
+      if (inflight_bytes_ + frame.size > opt_.window_bytes)
+        return;
+    }
+
+    if ((s.cmd == cmd::Activate) && image_->mode().cobs)
+    {
+      // Как и для SET_FEC: после потерянного ответа устройство
+      // уже ожидает кадры COBS
+      bool cobs = (attempts_[next_] & 1) != 0;
+      frame = cobs ? activate_cobs_ : activate_;
+      decoder_.setMode(cobs ? image_->mode() : plain_);
+    }
+
+    if (s.cmd == cmd::SetFec)
+    {
+      // Если ответ на SET_FEC потерян, устройство уже перешло в режим
+      // FEC и не примет запрос без FEC: повторы чередуют оба режима
+      bool fec = (attempts_[next_] & 1) != 0;
+      frame = fec ? set_fec_fec_ : set_fec_;
+      decoder_.setMode(fec ? image_->mode() : plain_);
+    }
+
+    setState(state_for(s.cmd));
+
+    tx_ptr_ = frame.data;
+    tx_left_ = frame.size;
+    tx_size_ = frame.size;
+    tx_step_ = next_;
+    tx_discard_ = false;
+    next_++;
+
+    transmit(now);
+  }
+}
+
+void Session::transmit(Clock::time_point now)
+{
+  while (tx_left_ != 0)
+  {
+    ssize_t n = transport_.write(tx_ptr_, tx_left_);
+
+    if (n < 0)
+    {
+      fail("write error", now);
+      return;
+    }
+    if (n == 0)
+      return;
+
+    tx_ptr_ += n;
+    tx_left_ -= n;
+    stats_.bytes_tx += n;
+  }
+
+  if (tx_ptr_ == nullptr)
+    return;
+
+  tx_ptr_ = nullptr;
+  stats_.frames_tx++;
+
+  // Запрос, передача которого началась до повтора, не ожидает ответа
+  if (tx_discard_)
+    return;
+
+  // Тайм-аут первого запроса в очереди - от конца его передачи,
+  // следующих - от ответа на предыдущий
+  if (inflight_.empty())
+    timer_ = now;
+
+  inflight_.push_back({tx_step_, tx_size_, now});
+  inflight_bytes_ += tx_size_;
+}
+
+void Session::onWritable(Clock::time_point now)
+{
+  transport_.onWritable(now);
+  transmit(now);
+  fill(now);
+}
+
+void Session::onReadable(Clock::time_point now)
+{
+  uint8_t buf[512];
+
+  for (;;)
+  {
+    ssize_t n = transport_.read(buf, sizeof(buf));
+
+    if (n < 0)
+    {
+      // После ответа на APP_RUN устройство уходит из Bootloader-а
+      if (!finished())
+        fail("device disconnected", now);
+      return;
+    }
+    if (n == 0)
+      break;
+
+    stats_.bytes_rx += n;
+    decoder_.feed(buf, n, [&](const uint8_t *data, size_t len) {
+      if (!finished())
+        onFrame(data, len, now);
+    });
+  }
+
+  stats_.broken_rx = decoder_.broken();
+  fill(now);
+}
+
+void Session::onFrame(const uint8_t *data, size_t len, Clock::time_point now)
+{
+  stats_.frames_rx++;
+
+  if (backoff_ || (len < 2) || inflight_.empty())
+  {
+    stats_.stale_rx++;
+    return;
+  }
+
+  InFlight front = inflight_.front();
+  const Step &step = steps_[front.step];
+
+  if (data[0] != step.cmd)
+  {
+    stats_.stale_rx++;
+    return;
+  }
+
+  if (data[1] == status::Event)
+  {
+    // Устройство очищает flash, ответ будет позже
+    stats_.events++;
+    timer_ = now;
+    return;
+  }
+
+  inflight_.pop_front();
+  inflight_bytes_ -= front.size;
+  timer_ = now;
+
+  if (data[1] == status::Ok)
+  {
+    onSuccess(front.step, data, len, now);
+    return;
+  }
+
+  stats_.errors++;
+
+  if ((step.cmd == cmd::Resume) && (data[1] == status::NoJournal))
+  {
+    // Продолжать нечего - обычное обновление
+    steps_[front.step] = {cmd::Begin, image_->begin(), 0};
+    next_ = front.step;
+    return;
+  }
+
+  if ((step.cmd == cmd::DeltaBegin || step.cmd == cmd::DeltaChunk) && (data[1] == status::WrongBase))
+  {
+    // Установленная прошивка не та, от которой построен поток
+    base_mismatch_ = true;
+    fail("installed firmware is not the delta base", now);
+    return;
+  }
+
+  if ((step.cmd == cmd::DeltaChunk) && (data[1] == status::Error))
+  {
+    // Ошибка потока не сбрасывается до следующего DELTA_BEGIN
+    fail("delta stream rejected", now);
+    return;
+  }
+
+  if ((step.cmd == cmd::Begin || step.cmd == cmd::Resume || step.cmd == cmd::DeltaBegin) &&
+      (data[1] == status::WrongState))
+  {
+    fail("identity chunk rejected: package is not for this device", now);
+    return;
+  }
+
+  if ((step.cmd == cmd::CheckCrc || step.cmd == cmd::AppRun) && (data[1] == status::Error))
+  {
+    fail("firmware check failed", now);
+    return;
+  }
+
+  retry(front.step, now);
+}
+
+void Session::onSuccess(size_t idx, const uint8_t *data, size_t len, Clock::time_point now)
+{
+  const Step &step = steps_[idx];
+
+  attempts_[idx] = 0;
+
+  switch (step.cmd)
+  {
+  case cmd::Activate:
+    if (image_->mode().cobs)
+    {
+      if ((len < 3) || !(data[2] & kFramingCobs))
+      {
+        fail("device does not support COBS framing", now);
+        return;
+      }
+      decoder_.setMode(image_->mode());
+    }
+    break;
+
+  case cmd::SetFec:
+    decoder_.setMode(image_->mode());
+    break;
+
+  case cmd::Resume:
+    if (len >= 6)
+    {
+      // Пропускаем чанки, записанные в прерванной сессии
+      uint32_t frontier = load_u32(data + 2);
+      size_t i = 0;
+
+      while ((i < image_->numChunks()) && (image_->chunkEnd(i) <= frontier))
+      {
+        stats_.payload_done += image_->chunkLen(i);
+        i++;
+      }
+
+      stats_.chunks_done = i;
+      stats_.chunks_resumed = i;
+
+      // Карту сегментов разреженного образа устройство после сброса
+      // не помнит: сначала SEGMENT_MAP, чанки - после ответа на нее
+      if (image_->sparse())
+        resume_step_ = begin_step_ + 2 + 2 * i;
+      else
+        next_ = begin_step_ + 1 + 2 * i;
+    }
+    break;
+
+  case cmd::SegmentMap:
+    if (resume_step_ != 0)
+    {
+      next_ = resume_step_;
+      resume_step_ = 0;
+    }
+    break;
+
+  case cmd::GetInfo:
+    if (ParseDeviceInfo(data, len, &device_info_))
+    {
+      const DeviceInfo &di = device_info_;
+      bool chunk_ok = di.chunk_sizes.empty();
+
+      for (uint8_t c : di.chunk_sizes)
+        chunk_ok |= (c == image_->chunkSize());
+
+      if (!chunk_ok)
+      {
+        char buf[96];
+        snprintf(buf, sizeof(buf), "package chunk size %u is not supported by the device",
+                 image_->chunkSize());
+        fail(buf, now);
+        return;
+      }
+
+      if (image_->sparse() && (di.features != 0) && !di.has(info::FeatureSparse))
+      {
+        fail("device does not support sparse images", now);
+        return;
+      }
+
+      if (image_->delta() && (di.features != 0) && !di.has(info::FeatureDelta))
+      {
+        fail("device does not support delta updates", now);
+        return;
+      }
+
+      if (di.rx_fifo != 0)
+        opt_.window_bytes = di.rx_fifo;
+    }
+    break;
+
+  case cmd::GetStats:
+    if (len >= 4)
+    {
+      size_t n = data[3];
+
+      if (len >= 4 + 4 * n)
+      {
+        device_stats_.version = data[2];
+        device_stats_.values.resize(n);
+        for (size_t i = 0; i < n; i++)
+          device_stats_.values[i] = load_u32(data + 4 + 4 * i);
+      }
+    }
+    break;
+
+  case cmd::GetTrace:
+    if (len >= 11)
+    {
+      uint32_t first = load_u32(data + 2);
+      uint32_t total = load_u32(data + 6);
+      size_t n = data[10];
+
+      if (len < 11 + kTraceEntrySize * n)
+        break;
+
+      // Читаем записи, сделанные до первого запроса: каждое
+      // чтение само добавляет записи в буфер устройства
+      if (device_trace_.entries.empty() && (device_trace_.total == 0))
+        device_trace_.total = total;
+
+      for (size_t i = 0; i < n; i++)
+      {
+        const uint8_t *p = data + 11 + kTraceEntrySize * i;
+
+        if (first + i >= device_trace_.total)
+          break;
+        device_trace_.entries.push_back({(uint32_t)(first + i), load_u32(p), p[4], p[5],
+                                         (uint16_t)(p[6] | (p[7] << 8))});
+      }
+
+      if ((n != 0) && (first + n < device_trace_.total))
+      {
+        steps_[idx].frame = encodeGetTrace(first + n);
+        next_ = idx;
+        return;
+      }
+    }
+    break;
+
+  case cmd::Write:
+  case cmd::DeltaChunk:
+    stats_.chunks_done++;
+    stats_.payload_done += image_->chunkLen(step.chunk);
+    if (on_progress)
+      on_progress(*this);
+    break;
+  }
+
+  if (idx == steps_.size() - 1)
+  {
+    stats_.finished = now;
+    setState(SessionState::Done);
+  }
+}
+
+/*
+  Повтор начиная с шага step: запросы в линии без ответа отбрасываются.
+  WRITE повторяется вместе со своим SEND - буфер данных устройства
+  мог быть занят следующим чанком из окна
+*/
+void Session::retry(size_t step, Clock::time_point now)
+{
+  std::chrono::milliseconds pause;
+  unsigned n;
+
+  if ((steps_[step].cmd == cmd::Write) && (step > 0) && (steps_[step - 1].cmd == cmd::Send))
+    step--;
+
+  n = ++attempts_[step];
+  stats_.retries++;
+
+  if (optional(step) && (n > 2))
+  {
+    // Команда не поддерживается устройством - шаг пропускается
+    inflight_.clear();
+    inflight_bytes_ = 0;
+    if (tx_left_ != 0)
+      tx_discard_ = true;
+
+    next_ = step + 1;
+    if (next_ == steps_.size())
+    {
+      stats_.finished = now;
+      setState(SessionState::Done);
+      return;
+    }
+    fill(now);
+    return;
+  }
+
+  if (n > opt_.max_retries)
+  {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "no valid reply to 0x%02X after %u retries",
+             steps_[step].cmd, opt_.max_retries);
+    fail(buf, now);
+    return;
+  }
+
+  inflight_.clear();
+  inflight_bytes_ = 0;
+  if (tx_left_ != 0)
+    tx_discard_ = true;
+
+  next_ = step;
+
+  pause = opt_.backoff_min * (1u << (n - 1 < 16 ? n - 1 : 16));
+  if (pause > opt_.backoff_max)
+    pause = opt_.backoff_max;
+
+  backoff_ = true;
+  backoff_until_ = now + pause;
+
+  if (on_progress)
+    on_progress(*this);
+}
+
+void Session::onTimer(Clock::time_point now)
+{
+  if (finished())
+    return;
+
+  transport_.onTimer(now);
+
+  if (backoff_)
+  {
+    if (now < backoff_until_)
+      return;
+
+    // Опоздавшие ответы и обрывки пакетов отброшены
+    backoff_ = false;
+    decoder_.reset();
+    fill(now);
+    return;
+  }
+
+  if (!inflight_.empty() && (now - timer_ >= opt_.timeout))
+  {
+    stats_.timeouts++;
+    retry(inflight_.front().step, now);
+  }
+}
+
+bool Session::wantsWrite() const
+{
+  return (tx_left_ != 0) || transport_.wantsWrite();
+}
+
+Clock::time_point Session::deadline() const
+{
+  Clock::time_point dl = Clock::time_point::max();
+
+  if (finished())
+    return dl;
+  if (backoff_)
+    dl = backoff_until_;
+  else if (!inflight_.empty())
+    dl = timer_ + opt_.timeout;
+  return std::min(dl, transport_.deadline());
+}
+
+void Session::fail(const std::string &reason, Clock::time_point now)
+{
+  error_ = reason;
+  stats_.finished = now;
+  setState(SessionState::Failed);
+}
+
+void Session::setState(SessionState s)
+{
+  if (state_ == s)
+    return;
+
+  state_ = s;
+  if (on_progress)
+    on_progress(*this);
+}
+
+/******************************************************************************/
+
+int RunSession(Session &session)
+{
+  session.start(Clock::now());
+
+  while (!session.finished())
+  {
+    struct pollfd pfd;
+    Clock::time_point dl = session.deadline();
+    int timeout = -1;
+
+    if (dl != Clock::time_point::max())
+    {
+      auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(dl - Clock::now()).count();
+      timeout = (ms < 0) ? 0 : (int)ms + 1;
+    }
+
+    pfd.fd = session.transport().fd();
+    pfd.events = POLLIN | (session.wantsWrite() ? POLLOUT : 0);
+    pfd.revents = 0;
+
+    if ((poll(&pfd, 1, timeout) < 0) && (errno != EINTR))
+      return 1;
+
+    Clock::time_point now = Clock::now();
+
+    if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+      session.onReadable(now);
+    if (pfd.revents & POLLOUT)
+      session.onWritable(now);
+    session.onTimer(now);
+  }
+
+  return (session.state() == SessionState::Done) ? 0 : 1;
+}
+
+} // namespace polyboot
@@ -0,0 +1,119 @@
+#include "polyboot/transport.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <termios.h>
+#include <unistd.h>
+
+namespace polyboot
+{
+
+namespace
+{
+
+void set_nonblock(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+  if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+    throw std::runtime_error(std::string("fcntl: ") + strerror(errno));
+}
+
+speed_t baud_to_speed(unsigned baud)
+{
+  switch (baud)
+  {
+  case 1200: return B1200;
+  case 2400: return B2400;
+  case 4800: return B4800;
+  case 9600: return B9600;
+  case 19200: return B19200;
+  case 38400: return B38400;
+  case 57600: return B57600;
+  case 115200: return B115200;
+  case 230400: return B230400;
+  case 460800: return B460800;
+  case 500000: return B500000;
+  case 921600: return B921600;
+  case 1000000: return B1000000;
+  }
+  throw std::runtime_error("unsupported baud rate " + std::to_string(baud));
+}
+
+} // namespace
+
+FdTransport::FdTransport(int fd, bool own)
+    : fd_(fd), own_(own)
+{
+  set_nonblock(fd_);
+}
+
+FdTransport::~FdTransport()
+{
+  if (own_ && (fd_ >= 0))
+    close(fd_);
+}
+
+ssize_t FdTransport::read(uint8_t *buf, size_t size)
+{
+  ssize_t n = ::read(fd_, buf, size);
+
+  if (n > 0)
+    return n;
+  if ((n < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+    return 0;
+  // Конец потока - устройство отключилось (симулятор завершился)
+  return -1;
+}
+
+ssize_t FdTransport::write(const uint8_t *buf, size_t size)
+{
+  ssize_t n = ::write(fd_, buf, size);
+
+  if (n >= 0)
+    return n;
+  if ((errno == EAGAIN) || (errno == EINTR))
+    return 0;
+  return -1;
+}
+
+SerialTransport::SerialTransport(const std::string &path, unsigned baud)
+{
+  struct termios tio;
+  speed_t speed = baud_to_speed(baud);
+
+  fd_ = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd_ < 0)
+    throw std::runtime_error(path + ": " + strerror(errno));
+  own_ = true;
+
+  if (tcgetattr(fd_, &tio) != 0)
+    throw std::runtime_error(path + ": " + strerror(errno));
+
+  cfmakeraw(&tio);
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+
+  if (tcsetattr(fd_, TCSANOW, &tio) != 0)
+    throw std::runtime_error(path + ": " + strerror(errno));
+
+  tcflush(fd_, TCIOFLUSH);
+}
+
+ssize_t SerialTransport::read(uint8_t *buf, size_t size)
+{
+  ssize_t n = ::read(fd_, buf, size);
+
+  if (n >= 0)
+    return n;
+  if ((errno == EAGAIN) || (errno == EINTR))
+    return 0;
+  return -1;
+}
+
+} // namespace polyboot
@@ -0,0 +1,383 @@
+/*
+  Параллельное обновление нескольких устройств одним процессом:
+  последовательные порты (USB-RS485 адаптеры) либо симуляторы
+  (project/posix-sim), запущенные на псевдотерминалах.
+  Состояние устройств выводится таблицей и/или в файл JSON.
+*/
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "polyboot/fleet.hpp"
+#include "polyboot/package.hpp"
+#include "polyboot/transport.hpp"
+
+using namespace polyboot;
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s --package FILE (--port DEV ... | --sim PATH --sims N) [options]\n"
+          "  --port DEV          serial port, may be repeated\n"
+          "  --baud N            serial port speed (default: 115200)\n"
+          "  --sim PATH          run simulators PATH on pty\n"
+          "  --sims N            number of simulators (default: 1)\n"
+          "  --sim-dir DIR       directory for simulator flash images (default: .)\n"
+          "  --sim-arg ARG       extra simulator argument, may be repeated\n"
+          "  --address N         device address (binex addressing)\n"
+          "  --fec N             enable FEC with N parity bytes\n"
+          "  --cobs              COBS framing instead of escaping (requested at ACTIVATE, not with --fec)\n"
+          "  --window N          requests in flight (default: 2)\n"
+          "  --window-bytes N    device RX FIFO size (default: 128)\n"
+          "  --timeout-ms N      reply timeout (default: 300)\n"
+          "  --retries N         retries per step (default: 10)\n"
+          "  --attempts N        session attempts per device (default: 3)\n"
+          "  --restart-ms N      delay before the second attempt (default: 500)\n"
+          "  --resume            continue interrupted updates\n"
+          "  --info              read device description, tune the window per device\n"
+          "  --no-run            do not start the application\n"
+          "  --status FILE       rewrite device state as JSON every interval\n"
+          "  --interval-ms N     status update interval (default: 1000)\n"
+          "  --quiet             no status table\n",
+          name);
+}
+
+/******************************************************************************/
+
+struct Sim
+{
+  pid_t pid;
+  std::string pty;
+};
+
+// Симулятор печатает имя подчиненного pty в stdout
+static int spawn_sim(const char *sim, const std::string &flash,
+                     const std::vector<const char *> &extra, Sim *s)
+{
+  int pfd[2];
+  char line[256];
+  FILE *f;
+
+  if (pipe(pfd) != 0)
+  {
+    perror("pipe");
+    return -1;
+  }
+
+  s->pid = fork();
+  if (s->pid == 0)
+  {
+    std::vector<const char *> args = {sim, "--pty", "--flash", flash.c_str()};
+
+    args.insert(args.end(), extra.begin(), extra.end());
+    args.push_back(NULL);
+
+    close(pfd[0]);
+    dup2(pfd[1], STDOUT_FILENO);
+    close(pfd[1]);
+    execv(sim, (char *const *)args.data());
+    perror(sim);
+    _exit(127);
+  }
+
+  close(pfd[1]);
+  f = fdopen(pfd[0], "r");
+  if (!f || !fgets(line, sizeof(line), f))
+  {
+    fprintf(stderr, "%s: no pty name\n", sim);
+    if (f)
+      fclose(f);
+    else
+      close(pfd[0]);
+    return -1;
+  }
+  fclose(f);
+
+  line[strcspn(line, "\r\n")] = 0;
+  s->pty = line;
+  return 0;
+}
+
+static void stop_sims(std::vector<Sim> &sims)
+{
+  for (auto &s : sims)
+    kill(s.pid, SIGTERM);
+  for (auto &s : sims)
+    waitpid(s.pid, NULL, 0);
+  sims.clear();
+}
+
+/******************************************************************************/
+
+static std::string json_str(const std::string &s)
+{
+  std::string r = "\"";
+
+  for (char c : s)
+  {
+    if ((c == '"') || (c == '\\'))
+    {
+      r += '\\';
+      r += c;
+    }
+    else if ((unsigned char)c < 0x20)
+    {
+      char b[8];
+      snprintf(b, sizeof(b), "\\u%04x", c);
+      r += b;
+    }
+    else
+      r += c;
+  }
+
+  return r + "\"";
+}
+
+static const char *state_name(const DeviceStatus &d)
+{
+  return d.waiting ? (d.attempt ? "restart" : "queued") : SessionStateName(d.state);
+}
+
+// Файл заменяется целиком (rename), читатель не видит его частично записанным
+static void write_status(const char *path, const Fleet &fleet)
+{
+  std::string tmp = std::string(path) + ".tmp";
+  FILE *f = fopen(tmp.c_str(), "w");
+
+  if (!f)
+  {
+    perror(tmp.c_str());
+    return;
+  }
+
+  fprintf(f, "{\"devices\":[");
+  for (size_t i = 0; i < fleet.size(); i++)
+  {
+    const DeviceStatus &d = fleet.status(i);
+
+    fprintf(f,
+            "%s\n{\"name\":%s,\"state\":\"%s\",\"attempt\":%u,"
+            "\"chunks_done\":%zu,\"chunks_total\":%zu,\"payload\":%llu,"
+            "\"rate\":%.0f,\"bytes_tx\":%llu,\"bytes_rx\":%llu,"
+            "\"retries\":%u,\"timeouts\":%u,\"elapsed\":%.3f,\"error\":%s}",
+            i ? "," : "", json_str(d.name).c_str(), state_name(d), d.attempt,
+            d.chunks_done, d.chunks_total, (unsigned long long)d.payload_done,
+            d.rate, (unsigned long long)d.bytes_tx, (unsigned long long)d.bytes_rx,
+            d.retries, d.timeouts, d.elapsed, json_str(d.error).c_str());
+  }
+  fprintf(f, "\n],\"done\":%zu,\"finished\":%s}\n", fleet.succeeded(),
+          fleet.finished() ? "true" : "false");
+
+  if (fclose(f) != 0 || rename(tmp.c_str(), path) != 0)
+    perror(path);
+}
+
+static void print_row(FILE *f, const DeviceStatus &d)
+{
+  size_t pct = d.chunks_total ? d.chunks_done * 100 / d.chunks_total : 0;
+
+  fprintf(f, "%-24.24s %-9s %3zu%% %8.0f %7u %7.1f %s\n", d.name.c_str(), state_name(d), pct,
+          d.rate, d.retries, d.elapsed, d.error.c_str());
+}
+
+static void print_table(const Fleet &fleet, bool redraw)
+{
+  // На терминале таблица перерисовывается на месте
+  if (redraw)
+    fprintf(stderr, "\033[%zuA\033[J", fleet.size() + 1);
+
+  fprintf(stderr, "%-24s %-9s %4s %8s %7s %7s\n", "device", "state", "done", "B/s", "retries",
+          "time");
+  for (size_t i = 0; i < fleet.size(); i++)
+    print_row(stderr, fleet.status(i));
+}
+
+static void print_line(const Fleet &fleet)
+{
+  size_t failed = 0, active = 0;
+  double rate = 0;
+
+  for (size_t i = 0; i < fleet.size(); i++)
+  {
+    const DeviceStatus &d = fleet.status(i);
+
+    rate += d.rate;
+    failed += (d.state == SessionState::Failed);
+    active += !d.waiting && (d.state != SessionState::Done) && (d.state != SessionState::Failed);
+  }
+
+  fprintf(stderr, "done %zu/%zu, active %zu, failed %zu, %.0f B/s\n", fleet.succeeded(),
+          fleet.size(), active, failed, rate);
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const char *package_path = NULL;
+  const char *sim = NULL;
+  const char *sim_dir = ".";
+  const char *status_path = NULL;
+  std::vector<std::string> ports;
+  std::vector<const char *> sim_args;
+  std::vector<Sim> sims;
+  std::string address_arg;
+  unsigned nsims = 1;
+  unsigned baud = 115200;
+  unsigned interval = 1000;
+  bool quiet = false;
+  LinkMode mode;
+  FleetOptions opt;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--package") && (i + 1 < argc))
+      package_path = argv[++i];
+    else if (!strcmp(argv[i], "--port") && (i + 1 < argc))
+      ports.push_back(argv[++i]);
+    else if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+      baud = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--sim") && (i + 1 < argc))
+      sim = argv[++i];
+    else if (!strcmp(argv[i], "--sims") && (i + 1 < argc))
+      nsims = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--sim-dir") && (i + 1 < argc))
+      sim_dir = argv[++i];
+    else if (!strcmp(argv[i], "--sim-arg") && (i + 1 < argc))
+      sim_args.push_back(argv[++i]);
+    else if (!strcmp(argv[i], "--address") && (i + 1 < argc))
+    {
+      address_arg = argv[++i];
+      mode.address = strtoul(argv[i], NULL, 0);
+    }
+    else if (!strcmp(argv[i], "--fec") && (i + 1 < argc))
+      mode.fec = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--cobs"))
+      mode.cobs = true;
+    else if (!strcmp(argv[i], "--window") && (i + 1 < argc))
+      opt.session.window = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--window-bytes") && (i + 1 < argc))
+      opt.session.window_bytes = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--timeout-ms") && (i + 1 < argc))
+      opt.session.timeout = std::chrono::milliseconds(strtoul(argv[++i], NULL, 0));
+    else if (!strcmp(argv[i], "--retries") && (i + 1 < argc))
+      opt.session.max_retries = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--attempts") && (i + 1 < argc))
+      opt.max_attempts = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--restart-ms") && (i + 1 < argc))
+      opt.restart_delay = std::chrono::milliseconds(strtoul(argv[++i], NULL, 0));
+    else if (!strcmp(argv[i], "--resume"))
+      opt.session.resume = true;
+    else if (!strcmp(argv[i], "--info"))
+      opt.session.read_info = true;
+    else if (!strcmp(argv[i], "--no-run"))
+      opt.session.run_app = false;
+    else if (!strcmp(argv[i], "--status") && (i + 1 < argc))
+      status_path = argv[++i];
+    else if (!strcmp(argv[i], "--interval-ms") && (i + 1 < argc))
+      interval = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--quiet"))
+      quiet = true;
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!package_path || (ports.empty() == !sim) || (sim && nsims == 0) || (interval == 0) ||
+      (mode.cobs && (mode.fec != 0)))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  // Отключенный порт не должен завершать процесс
+  signal(SIGPIPE, SIG_IGN);
+
+  try
+  {
+    Package package = Package::Load(package_path);
+    auto image = std::make_shared<const PreparedImage>(package, mode);
+    Fleet fleet(image, opt);
+    bool tty = !quiet && isatty(STDERR_FILENO);
+    bool drawn = false;
+    size_t failed;
+
+    if (sim)
+    {
+      if (!address_arg.empty())
+      {
+        sim_args.push_back("--address");
+        sim_args.push_back(address_arg.c_str());
+      }
+
+      for (unsigned i = 0; i < nsims; i++)
+      {
+        std::string flash = std::string(sim_dir) + "/sim-" + std::to_string(i) + ".bin";
+        Sim s;
+
+        if (spawn_sim(sim, flash, sim_args, &s) != 0)
+        {
+          stop_sims(sims);
+          return 1;
+        }
+        sims.push_back(s);
+        ports.push_back(s.pty);
+      }
+    }
+
+    for (const std::string &path : ports)
+    {
+      fleet.add(path, [path, baud]() {
+        return std::unique_ptr<Transport>(new SerialTransport(path, baud));
+      });
+    }
+
+    failed = fleet.run(
+        [&](Fleet &f) {
+          if (status_path)
+            write_status(status_path, f);
+          if (tty)
+          {
+            print_table(f, drawn);
+            drawn = true;
+          }
+          else if (!quiet)
+            print_line(f);
+        },
+        std::chrono::milliseconds(interval));
+
+    if (!tty)
+    {
+      printf("%-24s %-9s %4s %8s %7s %7s\n", "device", "state", "done", "B/s", "retries",
+             "time");
+      for (size_t i = 0; i < fleet.size(); i++)
+      {
+        DeviceStatus d = fleet.status(i);
+
+        // Итог - средняя скорость за все время обновления
+        d.rate = d.elapsed > 0 ? d.payload_done / d.elapsed : 0;
+        print_row(stdout, d);
+      }
+    }
+    printf("%zu of %zu devices updated\n", fleet.size() - failed, fleet.size());
+
+    stop_sims(sims);
+    return failed ? 1 : 0;
+  }
+  catch (const std::exception &e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    stop_sims(sims);
+    return 1;
+  }
+}
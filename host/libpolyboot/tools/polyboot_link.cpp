@@ -0,0 +1,595 @@
+/*
+  Проверка канала связи с устройством (команда LINK_TEST Bootloader-а):
+  поток пакетов без ответа (sink) либо запрос-ответ (echo) для каждого
+  заданного размера. По счетчикам устройства вычисляются полезная
+  скорость, доля потерянных и поврежденных пакетов и оценка вероятности
+  ошибки на бит - для выбора скорости, размера чанка и FEC.
+*/
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#include "polyboot/frame.hpp"
+#include "polyboot/protocol.hpp"
+#include "polyboot/transport.hpp"
+
+using namespace polyboot;
+using Clock = std::chrono::steady_clock;
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s (--port DEV | --fd N | --sim PATH) [options]\n"
+          "  --port DEV          serial port\n"
+          "  --baud N            serial port speed (default: 115200)\n"
+          "  --fd N              already opened descriptor (socketpair, pty)\n"
+          "  --sim PATH          run simulator PATH over a socketpair\n"
+          "  --sim-flash FILE    simulator flash image (default: sim-flash.bin)\n"
+          "  --address N         device address (binex addressing)\n"
+          "  --fec N             enable FEC with N parity bytes\n"
+          "  --cobs              COBS framing instead of escaping (requested at ACTIVATE, not with --fec)\n"
+          "  --mode sink|echo    stream without replies or request-reply (default: sink)\n"
+          "  --sizes LIST        comma separated payload sizes (default: 16,64,128,192,240)\n"
+          "  --frames N          frames per size (default: 200)\n"
+          "  --pattern NAME      zero, ones, count, prbs, esc (default: prbs)\n"
+          "  --delay-ms N        echo reply delay on the device (default: 0)\n"
+          "  --timeout-ms N      reply timeout (default: 300)\n"
+          "  --settle-ms N       pause after the stream before REPORT (default: 100)\n"
+          "  --verbose           print all device counters\n",
+          name);
+}
+
+static pid_t spawn_sim(const char *sim, const char *flash, int *fd)
+{
+  int sv[2];
+  pid_t pid;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+  {
+    perror("socketpair");
+    return -1;
+  }
+
+  pid = fork();
+  if (pid == 0)
+  {
+    char fd_str[16];
+
+    close(sv[0]);
+    snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+    execl(sim, sim, "--fd", fd_str, "--flash", flash, (char *)NULL);
+    perror(sim);
+    _exit(127);
+  }
+
+  close(sv[1]);
+  *fd = sv[0];
+  return pid;
+}
+
+/******************************************************************************/
+
+/*
+  Содержимое пакета SINK, совпадает с __link_check_pattern() ядра
+*/
+static void fill_pattern(uint8_t *p, size_t len, uint8_t pattern, uint16_t seq)
+{
+  uint32_t x = seq * 2654435761UL + 1;
+
+  for (size_t i = 0; i < len; i++)
+  {
+    switch (pattern)
+    {
+    case link::PatternZero:
+      p[i] = 0x00;
+      break;
+    case link::PatternOnes:
+      p[i] = 0xFF;
+      break;
+    case link::PatternCount:
+      p[i] = (uint8_t)(seq + i);
+      break;
+    case link::PatternPrbs:
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      p[i] = (uint8_t)(x >> 24);
+      break;
+    default:
+      p[i] = (i & 1) ? 0xF4 : 0xF5;
+      break;
+    }
+  }
+}
+
+static uint32_t load_u32(const uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+  Синхронный обмен с одним устройством поверх неблокирующего Transport
+*/
+class Link
+{
+public:
+  Link(Transport &t, std::chrono::milliseconds timeout) : t_(t), timeout_(timeout) {}
+
+  void setMode(const LinkMode &m)
+  {
+    mode_ = m;
+    decoder_.setMode(m);
+  }
+
+  // Передать пакет целиком, без ожидания ответа.
+  // Возвращает количество символов в линии
+  size_t send(const uint8_t *payload, size_t len)
+  {
+    std::vector<uint8_t> frame;
+
+    EncodeFrame(frame, payload, len, mode_);
+    writeAll(frame.data(), frame.size());
+    return frame.size();
+  }
+
+  // Запрос с ожиданием ответа на ту же команду, пустой ответ - тайм-аут
+  std::vector<uint8_t> request(const uint8_t *payload, size_t len, unsigned retries = 3)
+  {
+    for (unsigned a = 0; a <= retries; a++)
+    {
+      std::vector<uint8_t> reply;
+
+      drain();
+      send(payload, len);
+      if (wait(payload[0], &reply))
+        return reply;
+    }
+    return std::vector<uint8_t>();
+  }
+
+  // Ожидание ответа на команду cmd не дольше тайм-аута
+  bool wait(uint8_t cmd, std::vector<uint8_t> *reply)
+  {
+    Clock::time_point end = Clock::now() + timeout_;
+    bool got = false;
+
+    while (!got)
+    {
+      auto left = std::chrono::duration_cast<std::chrono::milliseconds>(end - Clock::now()).count();
+      if (left < 0)
+        return false;
+
+      if (!poll(POLLIN, (int)left + 1))
+        continue;
+
+      uint8_t buf[512];
+      ssize_t n = t_.read(buf, sizeof(buf));
+      if (n < 0)
+        throw std::runtime_error("device disconnected");
+
+      decoder_.feed(buf, n, [&](const uint8_t *data, size_t l) {
+        if (!got && (l >= 2) && (data[0] == cmd) && (data[1] != status::Event))
+        {
+          reply->assign(data, data + l);
+          got = true;
+        }
+      });
+    }
+    return true;
+  }
+
+  // Отбросить принятые символы
+  void drain()
+  {
+    uint8_t buf[512];
+
+    while (t_.read(buf, sizeof(buf)) > 0)
+      ;
+    decoder_.reset();
+  }
+
+private:
+  bool poll(short events, int timeout)
+  {
+    struct pollfd pfd = {t_.fd(), events, 0};
+    return ::poll(&pfd, 1, timeout) > 0;
+  }
+
+  void writeAll(const uint8_t *p, size_t n)
+  {
+    while (n != 0)
+    {
+      ssize_t w = t_.write(p, n);
+      if (w < 0)
+        throw std::runtime_error("write error");
+      if (w == 0)
+      {
+        poll(POLLOUT, 1000);
+        continue;
+      }
+      p += w;
+      n -= w;
+    }
+  }
+
+  Transport &t_;
+  std::chrono::milliseconds timeout_;
+  LinkMode mode_;
+  FrameDecoder decoder_;
+};
+
+/******************************************************************************/
+
+struct Options
+{
+  std::string mode = "sink";
+  std::vector<size_t> sizes = {16, 64, 128, 192, 240};
+  unsigned frames = 200;
+  uint8_t pattern = link::PatternPrbs;
+  uint8_t delay_ms = 0;
+  unsigned settle_ms = 100;
+  unsigned baud = 115200;
+  bool verbose = false;
+};
+
+// Максимальный размер пакета устройства (BUFFER_EXCH_SIZE)
+// за вычетом заголовка подкоманды SINK
+static const size_t kMaxPayload = 256 - 5;
+
+static std::vector<uint32_t> report(Link &l)
+{
+  const uint8_t req[2] = {cmd::LinkTest, link::Report};
+  std::vector<uint8_t> r = l.request(req, sizeof(req));
+  std::vector<uint32_t> v;
+
+  if ((r.size() < 4) || (r[1] != status::Ok) || (r[2] != link::kVersion))
+    throw std::runtime_error("LINK_TEST REPORT: no valid reply");
+  if (r.size() < 4 + 4 * (size_t)r[3])
+    throw std::runtime_error("LINK_TEST REPORT: short reply");
+
+  for (size_t i = 0; i < r[3]; i++)
+    v.push_back(load_u32(r.data() + 4 + 4 * i));
+  return v;
+}
+
+static void reset(Link &l)
+{
+  const uint8_t req[2] = {cmd::LinkTest, link::Reset};
+  std::vector<uint8_t> r = l.request(req, sizeof(req));
+
+  if ((r.size() < 2) || (r[1] != status::Ok))
+    throw std::runtime_error("LINK_TEST RESET: no valid reply (device not activated or built without BOOTLOADER_USE_LINK_TEST)");
+}
+
+static uint32_t counter(const std::vector<uint32_t> &v, const char *name)
+{
+  const size_t n = sizeof(link::kNames) / sizeof(link::kNames[0]);
+
+  for (size_t i = 0; (i < n) && (i < v.size()); i++)
+    if (!strcmp(link::kNames[i], name))
+      return v[i];
+  return 0;
+}
+
+static void print_counters(const std::vector<uint32_t> &v)
+{
+  const size_t n = sizeof(link::kNames) / sizeof(link::kNames[0]);
+
+  for (size_t i = 0; i < v.size(); i++)
+    printf("    %-18s %u\n", (i < n) ? link::kNames[i] : "?", v[i]);
+}
+
+/*
+  Оценка вероятности ошибки на бит по доле поврежденных пакетов:
+  пакет из bits бит поврежден с вероятностью 1 - (1 - ber)^bits
+*/
+static double ber_estimate(double fer, size_t bits)
+{
+  if ((fer <= 0) || (bits == 0))
+    return 0;
+  if (fer >= 1)
+    return 1;
+  return 1 - std::pow(1 - fer, 1.0 / bits);
+}
+
+static void run_sink(Link &l, const Options &o, size_t size)
+{
+  std::vector<uint8_t> req(5 + size);
+  uint64_t line = 0;
+
+  reset(l);
+
+  Clock::time_point t0 = Clock::now();
+  for (unsigned seq = 0; seq < o.frames; seq++)
+  {
+    req[0] = cmd::LinkTest;
+    req[1] = link::Sink;
+    req[2] = (uint8_t)seq;
+    req[3] = (uint8_t)(seq >> 8);
+    req[4] = o.pattern;
+    fill_pattern(req.data() + 5, size, o.pattern, (uint16_t)seq);
+    line += l.send(req.data(), req.size());
+  }
+  double host_sec = std::chrono::duration<double>(Clock::now() - t0).count();
+
+  usleep(o.settle_ms * 1000);
+  std::vector<uint32_t> v = report(l);
+
+  uint32_t frames = counter(v, "frames");
+  uint32_t bad = counter(v, "pattern_errors");
+  uint32_t good = frames - bad;
+  uint32_t span = counter(v, "last_us") - counter(v, "first_us");
+  double fer = 1.0 - (double)good / o.frames;
+  size_t bits = (size_t)(line / o.frames) * 10; // 8N1
+  double dev_rate = (frames > 1 && span) ? (double)(frames - 1) * size / (span / 1e6) : 0;
+  double line_rate = host_sec > 0 ? line / host_sec : 0;
+
+  printf("%5zu %7u %7u %6u %8.4f %9.2e %10.0f %10.0f %6.1f%% %6u %6u %6u %6u\n",
+         size, o.frames, frames, o.frames - frames, fer, ber_estimate(fer, bits),
+         dev_rate, line_rate, o.baud ? 100.0 * line_rate * 10 / o.baud : 0,
+         counter(v, "rx_err_crc") + counter(v, "rx_err_framing") + counter(v, "rx_err_size") +
+             counter(v, "rx_err_fec"),
+         counter(v, "rx_lost"), counter(v, "usart_framing") + counter(v, "usart_noise"),
+         counter(v, "rx_fec_corrected"));
+
+  if (o.verbose)
+    print_counters(v);
+}
+
+static void run_echo(Link &l, const Options &o, size_t size)
+{
+  std::vector<uint8_t> req(3 + size);
+  std::vector<uint8_t> reply;
+  unsigned ok = 0, bad = 0, lost = 0;
+  double rtt_sum = 0, rtt_min = 1e9, rtt_max = 0;
+  uint64_t line = 0;
+
+  reset(l);
+
+  for (unsigned seq = 0; seq < o.frames; seq++)
+  {
+    req[0] = cmd::LinkTest;
+    req[1] = link::Echo;
+    req[2] = o.delay_ms;
+    fill_pattern(req.data() + 3, size, o.pattern, (uint16_t)seq);
+
+    l.drain();
+    Clock::time_point t0 = Clock::now();
+    line += l.send(req.data(), req.size());
+
+    if (!l.wait(cmd::LinkTest, &reply))
+    {
+      lost++;
+      continue;
+    }
+
+    double rtt = std::chrono::duration<double, std::milli>(Clock::now() - t0).count();
+    rtt_sum += rtt;
+    rtt_min = std::min(rtt_min, rtt);
+    rtt_max = std::max(rtt_max, rtt);
+
+    if ((reply.size() == size + 2) && !memcmp(reply.data() + 2, req.data() + 3, size))
+      ok++;
+    else
+      bad++;
+  }
+
+  std::vector<uint32_t> v = report(l);
+  unsigned replies = ok + bad;
+  double fer = 1.0 - (double)ok / o.frames;
+  size_t bits = (size_t)(line / o.frames) * 10 * 2; // запрос и ответ
+
+  printf("%5zu %7u %7u %6u %6u %8.4f %9.2e %8.2f %8.2f %8.2f %6u %6u\n",
+         size, o.frames, ok, bad, lost, fer, ber_estimate(fer, bits),
+         replies ? rtt_sum / replies : 0, replies ? rtt_min : 0, rtt_max,
+         counter(v, "rx_err_crc") + counter(v, "rx_err_framing") + counter(v, "rx_err_size") +
+             counter(v, "rx_err_fec"),
+         counter(v, "rx_lost"));
+
+  if (o.verbose)
+    print_counters(v);
+}
+
+static void activate(Link &l, const LinkMode &mode)
+{
+  uint8_t req[1 + sizeof(kActivateSignature) - 1 + 1];
+  size_t len = sizeof(req) - 1;
+  LinkMode plain = mode;
+
+  plain.fec = 0;
+  plain.cobs = false;
+  l.setMode(plain);
+
+  req[0] = cmd::Activate;
+  memcpy(req + 1, kActivateSignature, sizeof(kActivateSignature) - 1);
+  if (mode.cobs)
+    req[len++] = kFramingCobs;
+
+  std::vector<uint8_t> r = l.request(req, len, 10);
+  if ((r.size() < 2) || (r[1] != status::Ok))
+    throw std::runtime_error("ACTIVATE: no valid reply");
+
+  if (mode.cobs)
+  {
+    // Ответ на ACTIVATE отправляется еще без COBS
+    if ((r.size() < 3) || !(r[2] & kFramingCobs))
+      throw std::runtime_error("ACTIVATE: COBS framing is not supported by the device");
+    l.setMode(mode);
+  }
+
+  if (mode.fec != 0)
+  {
+    const uint8_t set_fec[2] = {cmd::SetFec, mode.fec};
+
+    // Ответ на SET_FEC отправляется еще без FEC
+    r = l.request(set_fec, sizeof(set_fec));
+    if ((r.size() < 2) || (r[1] != status::Ok))
+      throw std::runtime_error("SET_FEC: no valid reply");
+    l.setMode(mode);
+  }
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const char *port = NULL;
+  const char *sim = NULL;
+  const char *sim_flash = "sim-flash.bin";
+  int fd = -1;
+  unsigned timeout_ms = 300;
+  LinkMode mode;
+  Options o;
+  pid_t sim_pid = -1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--port") && (i + 1 < argc))
+      port = argv[++i];
+    else if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+      o.baud = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--fd") && (i + 1 < argc))
+      fd = strtol(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--sim") && (i + 1 < argc))
+      sim = argv[++i];
+    else if (!strcmp(argv[i], "--sim-flash") && (i + 1 < argc))
+      sim_flash = argv[++i];
+    else if (!strcmp(argv[i], "--address") && (i + 1 < argc))
+      mode.address = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--fec") && (i + 1 < argc))
+      mode.fec = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--cobs"))
+      mode.cobs = true;
+    else if (!strcmp(argv[i], "--mode") && (i + 1 < argc))
+      o.mode = argv[++i];
+    else if (!strcmp(argv[i], "--sizes") && (i + 1 < argc))
+    {
+      char *p = argv[++i];
+
+      o.sizes.clear();
+      while (*p)
+      {
+        o.sizes.push_back(strtoul(p, &p, 0));
+        if (*p == ',')
+          p++;
+        else if (*p)
+          break;
+      }
+    }
+    else if (!strcmp(argv[i], "--frames") && (i + 1 < argc))
+      o.frames = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--pattern") && (i + 1 < argc))
+    {
+      static const char *names[] = {"zero", "ones", "count", "prbs", "esc"};
+      const char *n = argv[++i];
+      size_t k;
+
+      for (k = 0; k < sizeof(names) / sizeof(names[0]); k++)
+        if (!strcmp(n, names[k]))
+          break;
+      if (k == sizeof(names) / sizeof(names[0]))
+      {
+        usage(argv[0]);
+        return 2;
+      }
+      o.pattern = (uint8_t)k;
+    }
+    else if (!strcmp(argv[i], "--delay-ms") && (i + 1 < argc))
+      o.delay_ms = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--timeout-ms") && (i + 1 < argc))
+      timeout_ms = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--settle-ms") && (i + 1 < argc))
+      o.settle_ms = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--verbose"))
+      o.verbose = true;
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (((port != NULL) + (fd >= 0) + (sim != NULL) != 1) ||
+      ((o.mode != "sink") && (o.mode != "echo")) || o.sizes.empty() || (o.frames == 0) ||
+      (mode.cobs && (mode.fec != 0)))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  for (size_t s : o.sizes)
+  {
+    if ((s == 0) || (s > kMaxPayload))
+    {
+      fprintf(stderr, "payload size must be 1..%zu\n", kMaxPayload);
+      return 2;
+    }
+  }
+
+  try
+  {
+    std::unique_ptr<Transport> transport;
+
+    if (sim)
+    {
+      sim_pid = spawn_sim(sim, sim_flash, &fd);
+      if (sim_pid < 0)
+        return 1;
+      transport.reset(new FdTransport(fd, true));
+      o.baud = 0; // скорость линии не моделируется
+    }
+    else if (port)
+      transport.reset(new SerialTransport(port, o.baud));
+    else
+    {
+      transport.reset(new FdTransport(fd));
+      o.baud = 0;
+    }
+
+    Link l(*transport, std::chrono::milliseconds(timeout_ms));
+
+    activate(l, mode);
+
+    if (o.mode == "sink")
+      printf(" size    sent    recv   lost      FER       BER    dev B/s   line B/s   load  broken  rxlost usarterr fec-fix\n");
+    else
+      printf(" size    sent      ok    bad   lost      FER       BER  rtt avg  rtt min  rtt max broken rxlost\n");
+
+    for (size_t s : o.sizes)
+    {
+      if (o.mode == "sink")
+        run_sink(l, o, s);
+      else
+        run_echo(l, o, s);
+    }
+
+    transport.reset();
+    if (sim_pid > 0)
+    {
+      kill(sim_pid, SIGTERM);
+      waitpid(sim_pid, NULL, 0);
+    }
+    return 0;
+  }
+  catch (const std::exception &e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    if (sim_pid > 0)
+    {
+      kill(sim_pid, SIGTERM);
+      waitpid(sim_pid, NULL, 0);
+    }
+    return 1;
+  }
+}
@@ -0,0 +1,454 @@
+/*
+  Обновление одного устройства через libpolyboot:
+  последовательный порт, готовый дескриптор либо симулятор
+  (project/posix-sim), запущенный через socketpair. Устройство за
+  ретранслятором (--relay) обновляется через RELAY_SEND/RELAY_POLL,
+  с симулятором - через второй симулятор на канале ретранслятора.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "polyboot/package.hpp"
+#include "polyboot/protocol.hpp"
+#include "polyboot/relay.hpp"
+#include "polyboot/session.hpp"
+#include "polyboot/transport.hpp"
+
+using namespace polyboot;
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s --package FILE (--port DEV | --fd N | --sim PATH) [options]\n"
+          "  --port DEV          serial port\n"
+          "  --baud N            serial port speed (default: 115200)\n"
+          "  --fd N              already opened descriptor (socketpair, pty)\n"
+          "  --sim PATH          run simulator PATH over a socketpair\n"
+          "  --sim-flash FILE    simulator flash image (default: sim-flash.bin)\n"
+          "  --address N         device address (binex addressing), behind the relay with --relay\n"
+          "  --relay CH          update a device on relay channel CH of the device on the link\n"
+          "  --gateway-address N relay address on the link (with --relay)\n"
+          "  --relay-flash FILE  run a second simulator on relay channel 0 (with --sim and --relay)\n"
+          "  --fec N             enable FEC with N parity bytes\n"
+          "  --cobs              COBS framing instead of escaping (requested at ACTIVATE, not with --fec)\n"
+          "  --window N          requests in flight (default: 2)\n"
+          "  --window-bytes N    device RX FIFO size (default: 128)\n"
+          "  --timeout-ms N      reply timeout (default: 300, with --relay: 2000)\n"
+          "  --retries N         retries per step (default: 10)\n"
+          "  --resume            continue an interrupted update\n"
+          "  --fallback FILE     full package to send if the device rejects the delta base\n"
+          "  --no-run            do not start the application\n"
+          "  --info              read device description (GET_INFO), tune the window\n"
+          "  --stats             read device counters (GET_STATS) before start\n"
+          "  --trace             read device event trace (GET_TRACE) before start\n"
+          "  --quiet             no progress output\n",
+          name);
+}
+
+/*
+  Запуск симулятора на socketpair. relay_fd >= 0 - дескриптор канала
+  ретранслятора симулятора (--relay-fd), close_fd - дескриптор,
+  который симулятору не нужен (второй конец канала ретранслятора)
+*/
+static pid_t spawn_sim(const char *sim, const char *flash, int *fd, int relay_fd = -1,
+                       int close_fd = -1)
+{
+  int sv[2];
+  pid_t pid;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+  {
+    perror("socketpair");
+    return -1;
+  }
+
+  pid = fork();
+  if (pid == 0)
+  {
+    char fd_str[16];
+
+    close(sv[0]);
+    if (close_fd >= 0)
+      close(close_fd);
+    snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+    if (relay_fd >= 0)
+    {
+      char relay_str[16];
+
+      snprintf(relay_str, sizeof(relay_str), "%d", relay_fd);
+      execl(sim, sim, "--fd", fd_str, "--flash", flash, "--relay-fd", relay_str, (char *)NULL);
+    }
+    else
+      execl(sim, sim, "--fd", fd_str, "--flash", flash, (char *)NULL);
+    perror(sim);
+    _exit(127);
+  }
+
+  close(sv[1]);
+  *fd = sv[0];
+  return pid;
+}
+
+/*
+  Симулятор нижестоящего устройства на канале 0 ретранслятора:
+  его последовательный порт - второй конец socketpair, который
+  симулятор ретранслятора получает как --relay-fd
+*/
+static pid_t spawn_relay_sim(const char *sim, const char *flash, int *relay_fd, int *close_fd)
+{
+  int sv[2];
+  pid_t pid;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+  {
+    perror("socketpair");
+    return -1;
+  }
+
+  pid = fork();
+  if (pid == 0)
+  {
+    char fd_str[16];
+
+    close(sv[0]);
+    snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+    execl(sim, sim, "--fd", fd_str, "--flash", flash, (char *)NULL);
+    perror(sim);
+    _exit(127);
+  }
+
+  *relay_fd = sv[0];
+  *close_fd = sv[1];
+  return pid;
+}
+
+static void stop_sim(pid_t pid, bool in_bootloader)
+{
+  if (pid <= 0)
+    return;
+
+  // Симулятор завершается сам только при запуске приложения
+  if (in_bootloader)
+    kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+}
+
+static void print_device_stats(const DeviceStats &ds)
+{
+  const size_t known = sizeof(kStatsNames) / sizeof(kStatsNames[0]);
+
+  if (ds.version == 0)
+  {
+    printf("device stats: not available\n");
+    return;
+  }
+
+  printf("device stats (version %u):\n", ds.version);
+  for (size_t i = 0; i < ds.values.size(); i++)
+  {
+    if ((ds.version == kStatsVersion) && (i < known))
+      printf("  %-18s %u\n", kStatsNames[i], ds.values[i]);
+    else
+      printf("  #%-17zu %u\n", i, ds.values[i]);
+  }
+}
+
+static const char *name_of(const char *const *names, size_t count, size_t i)
+{
+  return (i < count) ? names[i] : "?";
+}
+
+static void print_device_trace(const DeviceTrace &dt)
+{
+  const size_t events = sizeof(kTraceEventNames) / sizeof(kTraceEventNames[0]);
+  const size_t states = sizeof(kTraceStateNames) / sizeof(kTraceStateNames[0]);
+  uint32_t prev_seq = 0, prev_time = 0;
+
+  if (dt.entries.empty())
+  {
+    printf("device trace: not available\n");
+    return;
+  }
+
+  printf("device trace (%zu of %u events), time in ms relative to the first event:\n",
+         dt.entries.size(), dt.total);
+
+  for (size_t i = 0; i < dt.entries.size(); i++)
+  {
+    const TraceEntry &e = dt.entries[i];
+    double t = (uint32_t)(e.time - dt.entries[0].time) / 1000.0;
+    double dtm = i ? (uint32_t)(e.time - prev_time) / 1000.0 : 0;
+
+    if (i && (e.seq != prev_seq + 1))
+      printf("  ... %u events lost\n", e.seq - prev_seq - 1);
+
+    printf("  %6u %10.3f %+9.3f  %-11s", e.seq, t, dtm,
+           name_of(kTraceEventNames, events, e.event));
+
+    switch (e.event)
+    {
+    case 1: // state
+      printf(" %s <- %s", name_of(kTraceStateNames, states, e.arg),
+             name_of(kTraceStateNames, states, e.value));
+      break;
+    case 2: // rx
+      printf(" cmd 0x%02X, %u B", e.arg, e.value);
+      break;
+    case 5: // tx
+      printf(" cmd 0x%02X, status 0x%02X", e.arg, e.value);
+      break;
+    default:
+      printf(" %u %u", e.arg, e.value);
+      break;
+    }
+    printf("\n");
+
+    prev_seq = e.seq;
+    prev_time = e.time;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  const char *package_path = NULL;
+  const char *fallback_path = NULL;
+  const char *port = NULL;
+  const char *sim = NULL;
+  const char *sim_flash = "sim-flash.bin";
+  const char *relay_flash = NULL;
+  unsigned baud = 115200;
+  int fd = -1;
+  int quiet = 0;
+  int relay = -1;
+  bool timeout_set = false;
+  LinkMode mode;
+  SessionOptions opt;
+  RelayOptions relay_opt;
+  pid_t sim_pid = -1, relay_pid = -1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--package") && (i + 1 < argc))
+      package_path = argv[++i];
+    else if (!strcmp(argv[i], "--port") && (i + 1 < argc))
+      port = argv[++i];
+    else if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+      baud = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--fd") && (i + 1 < argc))
+      fd = strtol(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--sim") && (i + 1 < argc))
+      sim = argv[++i];
+    else if (!strcmp(argv[i], "--sim-flash") && (i + 1 < argc))
+      sim_flash = argv[++i];
+    else if (!strcmp(argv[i], "--address") && (i + 1 < argc))
+      mode.address = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--relay") && (i + 1 < argc))
+      relay = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--gateway-address") && (i + 1 < argc))
+      relay_opt.gateway_address = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--relay-flash") && (i + 1 < argc))
+      relay_flash = argv[++i];
+    else if (!strcmp(argv[i], "--fec") && (i + 1 < argc))
+      mode.fec = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--cobs"))
+      mode.cobs = true;
+    else if (!strcmp(argv[i], "--window") && (i + 1 < argc))
+      opt.window = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--window-bytes") && (i + 1 < argc))
+      opt.window_bytes = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--timeout-ms") && (i + 1 < argc))
+    {
+      opt.timeout = std::chrono::milliseconds(strtoul(argv[++i], NULL, 0));
+      timeout_set = true;
+    }
+    else if (!strcmp(argv[i], "--retries") && (i + 1 < argc))
+      opt.max_retries = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--fallback") && (i + 1 < argc))
+      fallback_path = argv[++i];
+    else if (!strcmp(argv[i], "--resume"))
+      opt.resume = true;
+    else if (!strcmp(argv[i], "--no-run"))
+      opt.run_app = false;
+    else if (!strcmp(argv[i], "--info"))
+      opt.read_info = true;
+    else if (!strcmp(argv[i], "--stats"))
+      opt.read_stats = true;
+    else if (!strcmp(argv[i], "--trace"))
+      opt.read_trace = true;
+    else if (!strcmp(argv[i], "--quiet"))
+      quiet = 1;
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!package_path || ((port != NULL) + (fd >= 0) + (sim != NULL) != 1) ||
+      (mode.cobs && (mode.fec != 0)))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (relay >= 0)
+  {
+    // Пакеты к устройству за ретранслятором передаются по одному,
+    // без FEC и COBS: ретранслятор передает их обычным кадром binex
+    if (mode.fec || mode.cobs || (relay_flash && (!sim || (relay != 0))))
+    {
+      usage(argv[0]);
+      return 2;
+    }
+
+    relay_opt.channel = relay;
+    relay_opt.address = mode.address;
+    mode.address = kAddressNone;
+    opt.window = 1;
+    if (!timeout_set)
+      opt.timeout = std::chrono::milliseconds(2000);
+  }
+  else if (relay_flash)
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  try
+  {
+    Package package = Package::Load(package_path);
+    auto image = std::make_shared<const PreparedImage>(package, mode);
+    std::unique_ptr<Transport> transport;
+    std::unique_ptr<RelayTransport> relay_transport;
+    int rc;
+
+    if (sim && relay_flash)
+    {
+      int relay_fd, close_fd;
+
+      relay_pid = spawn_relay_sim(sim, relay_flash, &relay_fd, &close_fd);
+      if (relay_pid < 0)
+        return 1;
+      sim_pid = spawn_sim(sim, sim_flash, &fd, relay_fd, close_fd);
+      close(relay_fd);
+      close(close_fd);
+      if (sim_pid < 0)
+      {
+        stop_sim(relay_pid, true);
+        return 1;
+      }
+      transport.reset(new FdTransport(fd, true));
+    }
+    else if (sim)
+    {
+      sim_pid = spawn_sim(sim, sim_flash, &fd);
+      if (sim_pid < 0)
+        return 1;
+      transport.reset(new FdTransport(fd, true));
+    }
+    else if (port)
+      transport.reset(new SerialTransport(port, baud));
+    else
+      transport.reset(new FdTransport(fd));
+
+    if (relay >= 0)
+      relay_transport.reset(new RelayTransport(*transport, relay_opt));
+
+    Transport &link = relay_transport ? *relay_transport : *transport;
+    std::unique_ptr<Session> session(new Session(link, image, opt));
+
+    auto set_progress = [&](Session &target) {
+      if (quiet)
+        return;
+
+      target.on_progress = [](Session &s) {
+        static SessionState last_state = SessionState::Idle;
+        static size_t last_pct = 0;
+        const SessionStats &st = s.stats();
+        size_t pct = st.chunks_total ? st.chunks_done * 100 / st.chunks_total : 0;
+
+        // Не чаще раза в процент, кроме смены состояния
+        if ((s.state() == last_state) && (pct == last_pct))
+          return;
+        last_state = s.state();
+        last_pct = pct;
+
+        fprintf(stderr, "\r%-9s %5zu/%zu chunks", SessionStateName(s.state()),
+                st.chunks_done, st.chunks_total);
+        if (st.retries)
+          fprintf(stderr, ", %u retries", st.retries);
+      };
+    };
+
+    set_progress(*session);
+    rc = RunSession(*session);
+
+    if ((rc != 0) && session->baseMismatch() && fallback_path)
+    {
+      // Прошивка устройства не та, от которой построен разностный
+      // пакет: полное обновление в том же соединении
+      auto full = std::make_shared<const PreparedImage>(Package::Load(fallback_path), mode);
+
+      if (!quiet)
+        fprintf(stderr, "\n%s, sending %s\n", session->error().c_str(), fallback_path);
+
+      session.reset(new Session(link, full, opt));
+      set_progress(*session);
+      rc = RunSession(*session);
+    }
+
+    const SessionStats &st = session->stats();
+    double sec = std::chrono::duration<double>(st.finished - st.started).count();
+
+    if (!quiet)
+      fprintf(stderr, "\n");
+
+    if (rc != 0)
+      fprintf(stderr, "update failed: %s\n", session->error().c_str());
+    if (relay_transport && !relay_transport->error().empty())
+      fprintf(stderr, "%s\n", relay_transport->error().c_str());
+
+    printf("time %.3f s, payload %llu B (%.0f B/s), tx %llu B, rx %llu B\n",
+           sec, (unsigned long long)st.payload_done, sec > 0 ? st.payload_done / sec : 0,
+           (unsigned long long)st.bytes_tx, (unsigned long long)st.bytes_rx);
+    printf("frames tx %u rx %u, retries %u, timeouts %u, errors %u, broken %u, stale %u\n",
+           st.frames_tx, st.frames_rx, st.retries, st.timeouts, st.errors,
+           st.broken_rx, st.stale_rx);
+    if (st.chunks_resumed)
+      printf("resumed at chunk %zu of %zu\n", st.chunks_resumed, st.chunks_total);
+
+    if (opt.read_info)
+      printf("%s", FormatDeviceInfo(session->deviceInfo()).c_str());
+    if (opt.read_stats)
+      print_device_stats(session->deviceStats());
+    if (opt.read_trace)
+      print_device_trace(session->deviceTrace());
+    if (relay_transport)
+      printf("relay requests %u, retries %u\n", relay_transport->requests(),
+             relay_transport->retries());
+
+    relay_transport.reset();
+    transport.reset();
+
+    // Ретранслятор остается в Bootloader-е в любом случае
+    stop_sim(relay_pid, (rc != 0) || !opt.run_app);
+    stop_sim(sim_pid, (relay_pid > 0) || (rc != 0) || !opt.run_app);
+
+    return rc;
+  }
+  catch (const std::exception &e)
+  {
+    fprintf(stderr, "%s\n", e.what());
+    stop_sim(relay_pid, true);
+    stop_sim(sim_pid, true);
+    return 1;
+  }
+}
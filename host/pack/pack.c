@@ -0,0 +1,827 @@
+/*
+  Подготовка файлов обновления: идентификационный чанк и записи
+  struct fw_chunk_s для всей области приложения, MAC прошивки
+  (Poly1305) в последних 16 байтах области.
+
+  Формат совпадает с PolyBootGen и host/common/src/fw_pack.c,
+  чанки шифруются параллельно в нескольких потоках. Пакетный режим
+  формирует файлы для списка устройств с собственными ключами.
+  Разреженный образ (--sparse) не содержит чанков, целиком состоящих
+  из 0xFF, вместо них - карта сегментов с данными. Разностный образ
+  (--delta-base) - поток восстановления новой прошивки из базовой
+  (host/common/src/fw_delta.c).
+*/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fw_delta.h"
+#include "fw_pack.h"
+#include "monocypher.h"
+
+/******************************************************************************/
+
+// Чанков в одном задании потока (0 - идентификационный)
+#define ITEM_CHUNKS 32
+
+#define NAME_SIZE 64
+#define ID_SIZE PACK_CHUNK_DATA_SIZE
+
+struct device
+{
+  char name[NAME_SIZE];
+  char id[ID_SIZE + 1];
+  uint8_t enc_key[32];
+  uint8_t int_key[32];
+
+  // Заполняются во время работы
+  uint8_t *out;
+  uint32_t left; // невыполненных заданий
+};
+
+static const uint8_t *image;
+static uint32_t image_size;
+static uint32_t app_begin = 0x08003000;
+static uint32_t app_length = 53248;
+static uint32_t num_chunks;
+static uint32_t num_records; // записей в файле устройства
+static uint32_t items_per_device;
+static size_t out_size;
+
+static struct device *devices;
+static uint32_t num_devices;
+static const char *out_path;
+static const char *out_dir;
+
+// Разреженный образ: запись 1 - карта сегментов, далее только чанки
+// сегментов, rec_chunk[rec] - номер чанка области приложения записи rec
+static int sparse;
+static uint32_t *rec_chunk;
+static uint32_t seg_address[PACK_MAX_SEGMENTS];
+static uint32_t seg_size[PACK_MAX_SEGMENTS];
+static uint8_t num_segments;
+
+// Разностный образ: записи 1.. - чанки потока, MAC базовой и новой
+// прошивок подставляются в поток для каждого устройства
+static const uint8_t *base_image;
+static uint32_t base_size;
+static uint32_t sector_size = 1024;
+static uint8_t *delta_stream;
+static size_t delta_size;
+static size_t delta_mac_offset;
+
+static int deterministic;
+static uint8_t nonce_seed[32];
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t next_item;
+static int failed;
+
+/******************************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s --image FILE (--keys FILE --device-id STR --out FILE |\n"
+          "          --devices FILE --out-dir DIR) [options]\n"
+          "  --image FILE        plain application image (mapped, not modified)\n"
+          "  --keys FILE         keys in private_keys.inc format\n"
+          "  --device-id STR     device identity string\n"
+          "  --out FILE          output update file\n"
+          "  --devices FILE      batch: lines \"name enc_key int_key [device_id]\",\n"
+          "                      keys as 64 hex digits\n"
+          "  --out-dir DIR       batch: output directory, files <name>.bin\n"
+          "  --app-begin N       application region address (default: 0x%08X)\n"
+          "  --app-length N      application region length (default: %u)\n"
+          "  --threads N         worker threads (default: online CPUs)\n"
+          "  --sparse            omit chunks that are entirely 0xFF, add a segment map\n"
+          "                      (device needs BOOTLOADER_USE_SPARSE)\n"
+          "  --delta-base FILE   delta update from the installed image FILE\n"
+          "                      (device needs BOOTLOADER_USE_DELTA)\n"
+          "  --sector-size N     flash sector size for --delta-base (default: %u)\n"
+          "  --nonce-seed HEX    derive nonces from a 32-byte seed (reproducible\n"
+          "                      output for tests; never for release images)\n",
+          name, app_begin, app_length, sector_size);
+}
+
+static int parse_hex(const char *s, uint8_t *out, size_t n)
+{
+  for (size_t i = 0; i < n; i++)
+  {
+    unsigned v;
+
+    if (!isxdigit((unsigned char)s[2 * i]) || !isxdigit((unsigned char)s[2 * i + 1]) ||
+        (sscanf(s + 2 * i, "%2x", &v) != 1))
+      return -1;
+    out[i] = (uint8_t)v;
+  }
+
+  return (s[2 * n] == 0) ? 0 : -1;
+}
+
+/*
+  Ключи из private_keys.inc: массивы EncryptionKey и IntegrityKey
+  по 32 значения 0x.. в фигурных скобках
+*/
+static int parse_key_array(const char *text, const char *name, uint8_t key[32])
+{
+  const char *p = strstr(text, name);
+  char *end;
+
+  if (!p || !(p = strchr(p, '{')))
+    return -1;
+
+  p++;
+  for (int i = 0; i < 32; i++)
+  {
+    while (*p && !isxdigit((unsigned char)*p))
+      p++;
+
+    key[i] = (uint8_t)strtoul(p, &end, 0);
+    if (end == p)
+      return -1;
+    p = end;
+  }
+
+  return 0;
+}
+
+static int load_keys(const char *path, struct device *d)
+{
+  static char text[16384];
+  FILE *f = fopen(path, "r");
+  size_t n;
+
+  if (!f)
+  {
+    perror(path);
+    return -1;
+  }
+  n = fread(text, 1, sizeof(text) - 1, f);
+  fclose(f);
+  text[n] = 0;
+
+  if ((parse_key_array(text, "EncryptionKey", d->enc_key) != 0) ||
+      (parse_key_array(text, "IntegrityKey", d->int_key) != 0))
+  {
+    fprintf(stderr, "%s: EncryptionKey/IntegrityKey not found\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int set_id(struct device *d, const char *id)
+{
+  if (strlen(id) > ID_SIZE)
+    return -1;
+  strcpy(d->id, id);
+  return 0;
+}
+
+static int load_devices(const char *path, const char *default_id)
+{
+  FILE *f = fopen(path, "r");
+  char line[512];
+  unsigned lineno = 0;
+  uint32_t cap = 0;
+
+  if (!f)
+  {
+    perror(path);
+    return -1;
+  }
+
+  while (fgets(line, sizeof(line), f))
+  {
+    char name[NAME_SIZE + 1], enc[80], mac[80], id[ID_SIZE + 2];
+    struct device *d;
+    int n;
+
+    lineno++;
+    n = sscanf(line, "%64s %79s %79s %129s", name, enc, mac, id);
+    if ((n <= 0) || (name[0] == '#'))
+      continue;
+
+    if (num_devices == cap)
+    {
+      cap = cap ? cap * 2 : 64;
+      devices = realloc(devices, cap * sizeof(*devices));
+    }
+    d = &devices[num_devices];
+    memset(d, 0, sizeof(*d));
+
+    if ((n < 3) || (strlen(name) >= NAME_SIZE) || strchr(name, '/') ||
+        (parse_hex(enc, d->enc_key, 32) != 0) || (parse_hex(mac, d->int_key, 32) != 0) ||
+        (set_id(d, (n == 4) ? id : (default_id ? default_id : "")) != 0) || (d->id[0] == 0))
+    {
+      fprintf(stderr, "%s:%u: bad device line\n", path, lineno);
+      fclose(f);
+      return -1;
+    }
+
+    strcpy(d->name, name);
+    num_devices++;
+  }
+
+  fclose(f);
+  return 0;
+}
+
+static int map_image(const char *path, const uint8_t **data, uint32_t *size)
+{
+  struct stat st;
+  int fd = open(path, O_RDONLY);
+  void *p;
+
+  if ((fd < 0) || (fstat(fd, &st) != 0))
+  {
+    perror(path);
+    return -1;
+  }
+
+  if ((st.st_size == 0) || (st.st_size > app_length))
+  {
+    fprintf(stderr, "%s: size %lld, expected 1..%u\n", path, (long long)st.st_size, app_length);
+    close(fd);
+    return -1;
+  }
+
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+  {
+    perror("mmap");
+    return -1;
+  }
+
+  *data = p;
+  *size = (uint32_t)st.st_size;
+  return 0;
+}
+
+/*
+  Полный образ области приложения: байты за концом файла - 0xFF
+*/
+static uint8_t *image_region(const uint8_t *data, uint32_t size)
+{
+  uint8_t *region = malloc(app_length);
+
+  if (region)
+  {
+    memset(region, 0xFF, app_length);
+    memcpy(region, data, size);
+  }
+  return region;
+}
+
+static int build_delta(void)
+{
+  uint8_t *base = image_region(base_image, base_size);
+  uint8_t *next = image_region(image, image_size);
+  int err = -1;
+
+  if (base && next)
+    err = PackDelta(&delta_stream, &delta_size, &delta_mac_offset,
+                    base, next, app_length, sector_size);
+
+  free(base);
+  free(next);
+
+  if (err == 0)
+    num_records = 1 + (uint32_t)((delta_size + PACK_CHUNK_DATA_SIZE - 1) / PACK_CHUNK_DATA_SIZE);
+  return err;
+}
+
+/*
+  Чанк потока разностного обновления со смещением off
+  и подставленными MAC базовой и новой прошивок
+*/
+static void pack_delta_record(const struct device *d, uint8_t *out, const uint8_t *nonce,
+                              uint32_t off, uint8_t base_mac[PACK_MAC_SIZE],
+                              uint8_t mac[PACK_MAC_SIZE], int *have_mac)
+{
+  uint8_t data[PACK_CHUNK_DATA_SIZE];
+  uint32_t len = delta_size - off;
+
+  if (len > PACK_CHUNK_DATA_SIZE)
+    len = PACK_CHUNK_DATA_SIZE;
+
+  memcpy(data, delta_stream + off, len);
+
+  if (((off < PACK_DELTA_BASE_MAC_OFFSET + PACK_MAC_SIZE) &&
+       (off + len > PACK_DELTA_BASE_MAC_OFFSET)) ||
+      ((off < delta_mac_offset + PACK_MAC_SIZE) && (off + len > delta_mac_offset)))
+  {
+    if (!*have_mac)
+    {
+      PackImageMacPadded(base_mac, base_image, base_size, app_length, d->int_key);
+      PackImageMacPadded(mac, image, image_size, app_length, d->int_key);
+      *have_mac = 1;
+    }
+
+    for (uint32_t k = 0; k < PACK_MAC_SIZE; k++)
+    {
+      size_t a = PACK_DELTA_BASE_MAC_OFFSET + k;
+      size_t b = delta_mac_offset + k;
+
+      if ((a >= off) && (a < off + len))
+        data[a - off] = base_mac[k];
+      if ((b >= off) && (b < off + len))
+        data[b - off] = mac[k];
+    }
+  }
+
+  PackChunk(out, d->enc_key, nonce, PACK_DELTA_STREAM_BASE + off, data, (uint8_t)len);
+  crypto_wipe(data, sizeof(data));
+}
+
+/******************************************************************************/
+
+/*
+  nonce чанка: случайный, либо при --nonce-seed
+  BLAKE2b(seed; имя устройства || номер записи)
+*/
+static int make_nonces(const struct device *d, uint32_t first, uint32_t count, uint8_t *out)
+{
+  if (!deterministic)
+  {
+    size_t size = (size_t)count * PACK_NONCE_SIZE;
+    size_t pos = 0;
+
+    while (pos < size)
+    {
+      ssize_t n = getrandom(out + pos, size - pos, 0);
+      if (n < 0)
+      {
+        if (errno == EINTR)
+          continue;
+        perror("getrandom");
+        return -1;
+      }
+      pos += n;
+    }
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint8_t msg[NAME_SIZE + 4];
+    size_t len = strlen(d->name);
+    uint32_t rec = first + i;
+
+    memcpy(msg, d->name, len);
+    msg[len + 0] = (uint8_t)(rec >> 0);
+    msg[len + 1] = (uint8_t)(rec >> 8);
+    msg[len + 2] = (uint8_t)(rec >> 16);
+    msg[len + 3] = (uint8_t)(rec >> 24);
+
+    crypto_blake2b_keyed(out + i * PACK_NONCE_SIZE, PACK_NONCE_SIZE,
+                         nonce_seed, sizeof(nonce_seed), msg, len + 4);
+  }
+
+  return 0;
+}
+
+/*
+  Чанк k области приложения целиком стерт (0xFF): байты за концом
+  файла образа считаются стертыми, чанк с MAC прошивки стертым не бывает
+*/
+static int chunk_is_blank(uint32_t k)
+{
+  uint32_t off = k * PACK_CHUNK_DATA_SIZE;
+  uint32_t len = app_length - off;
+
+  if (len > PACK_CHUNK_DATA_SIZE)
+    len = PACK_CHUNK_DATA_SIZE;
+
+  if (off + len > app_length - PACK_MAC_SIZE)
+    return 0;
+
+  for (uint32_t i = off; (i < off + len) && (i < image_size); i++)
+  {
+    if (image[i] != 0xFF)
+      return 0;
+  }
+
+  return 1;
+}
+
+/*
+  Карта сегментов и номера чанков записей разреженного образа.
+  Если сегментов больше, чем помещается в карту, самые короткие
+  пропуски между ними передаются как обычные чанки
+*/
+static int build_sparse(void)
+{
+  uint8_t *used = calloc(num_chunks, 1);
+  uint32_t n = 0;
+
+  rec_chunk = calloc(num_chunks + 2, sizeof(*rec_chunk));
+  if (!used || !rec_chunk)
+  {
+    free(used);
+    return -1;
+  }
+
+  for (uint32_t k = 0; k < num_chunks; k++)
+    used[k] = !chunk_is_blank(k);
+
+  for (;;)
+  {
+    uint32_t runs = 0, best_len = 0, best = 0;
+
+    // Количество сегментов и самый короткий пропуск между ними
+    for (uint32_t k = 0; k < num_chunks; k++)
+    {
+      uint32_t gap = k;
+
+      if (used[k])
+      {
+        if ((k == 0) || !used[k - 1])
+          runs++;
+        continue;
+      }
+
+      while ((k < num_chunks) && !used[k])
+        k++;
+
+      if ((runs != 0) && (k < num_chunks) && ((best_len == 0) || (k - gap < best_len)))
+      {
+        best = gap;
+        best_len = k - gap;
+      }
+      k--;
+    }
+
+    if (runs <= PACK_MAX_SEGMENTS)
+      break;
+
+    memset(used + best, 1, best_len);
+  }
+
+  num_segments = 0;
+  for (uint32_t k = 0; k < num_chunks; k++)
+  {
+    if (!used[k])
+      continue;
+
+    if ((k == 0) || !used[k - 1])
+    {
+      seg_address[num_segments] = app_begin + k * PACK_CHUNK_DATA_SIZE;
+      seg_size[num_segments] = 0;
+      num_segments++;
+    }
+
+    seg_size[num_segments - 1] += (k == num_chunks - 1) ?
+                                      app_length - k * PACK_CHUNK_DATA_SIZE :
+                                      PACK_CHUNK_DATA_SIZE;
+    rec_chunk[2 + n++] = k;
+  }
+
+  num_records = 2 + n;
+  free(used);
+  return 0;
+}
+
+/*
+  Записи first..first+count-1 устройства d: 0 - идентификационный чанк,
+  k - чанк области приложения со смещением (k - 1) * PACK_CHUNK_DATA_SIZE.
+  В разреженном образе 1 - карта сегментов, k - чанк rec_chunk[k],
+  в разностном k - чанк потока со смещением (k - 1) * PACK_CHUNK_DATA_SIZE
+*/
+static int pack_records(const struct device *d, uint32_t first, uint32_t count)
+{
+  uint8_t nonces[ITEM_CHUNKS * PACK_NONCE_SIZE];
+  uint8_t base_mac[PACK_MAC_SIZE];
+  uint8_t mac[PACK_MAC_SIZE];
+  uint8_t data[PACK_CHUNK_DATA_SIZE];
+  int have_mac = 0;
+
+  if (make_nonces(d, first, count, nonces) != 0)
+    return -1;
+
+  for (uint32_t i = 0; i < count; i++)
+  {
+    uint32_t rec = first + i;
+    uint8_t *out = d->out + (size_t)rec * PACK_CHUNK_SIZE;
+    const uint8_t *nonce = nonces + i * PACK_NONCE_SIZE;
+    uint32_t off, len, n;
+
+    if (rec == 0)
+    {
+      PackIdentityChunk(out, d->enc_key, nonce, app_length, d->id);
+      continue;
+    }
+
+    if (delta_stream)
+    {
+      pack_delta_record(d, out, nonce, (rec - 1) * PACK_CHUNK_DATA_SIZE, base_mac, mac, &have_mac);
+      continue;
+    }
+
+    if (sparse && (rec == 1))
+    {
+      PackSegmentMap(out, d->enc_key, nonce, app_length, seg_address, seg_size, num_segments);
+      continue;
+    }
+
+    off = (sparse ? rec_chunk[rec] : rec - 1) * PACK_CHUNK_DATA_SIZE;
+    len = app_length - off;
+    if (len > PACK_CHUNK_DATA_SIZE)
+      len = PACK_CHUNK_DATA_SIZE;
+
+    // Образ читается прямо из отображения, копия нужна только
+    // для чанков за концом файла и чанка с MAC прошивки
+    if ((off + len <= image_size) && (off + len <= app_length - PACK_MAC_SIZE))
+    {
+      PackChunk(out, d->enc_key, nonce, app_begin + off, image + off, (uint8_t)len);
+      continue;
+    }
+
+    memset(data, 0xFF, sizeof(data));
+    if (off < image_size)
+    {
+      n = image_size - off;
+      memcpy(data, image + off, (n < len) ? n : len);
+    }
+
+    if (off + len > app_length - PACK_MAC_SIZE)
+    {
+      if (!have_mac)
+      {
+        PackImageMacPadded(mac, image, image_size, app_length, d->int_key);
+        have_mac = 1;
+      }
+
+      for (uint32_t k = 0; k < PACK_MAC_SIZE; k++)
+      {
+        uint32_t a = app_length - PACK_MAC_SIZE + k;
+        if ((a >= off) && (a < off + len))
+          data[a - off] = mac[k];
+      }
+    }
+
+    PackChunk(out, d->enc_key, nonce, app_begin + off, data, (uint8_t)len);
+  }
+
+  crypto_wipe(data, sizeof(data));
+  return 0;
+}
+
+static int write_output(const struct device *d)
+{
+  char path[4096];
+  FILE *f;
+
+  if (out_dir)
+    snprintf(path, sizeof(path), "%s/%s.bin", out_dir, d->name);
+  else
+    snprintf(path, sizeof(path), "%s", out_path);
+
+  f = fopen(path, "wb");
+  if (!f || (fwrite(d->out, 1, out_size, f) != out_size) || (fclose(f) != 0))
+  {
+    perror(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+  Задания выдаются по порядку устройств, поэтому одновременно
+  в памяти находятся выходные буферы лишь нескольких устройств.
+  Файл записывает поток, выполнивший последнее задание устройства
+*/
+static void *worker(void *arg)
+{
+  uint64_t total = (uint64_t)num_devices * items_per_device;
+
+  (void)arg;
+
+  for (;;)
+  {
+    struct device *d;
+    uint32_t item, first, count;
+    int last, err;
+
+    pthread_mutex_lock(&lock);
+    if (failed || (next_item >= total))
+    {
+      pthread_mutex_unlock(&lock);
+      break;
+    }
+
+    d = &devices[next_item / items_per_device];
+    item = next_item % items_per_device;
+    next_item++;
+
+    if (item == 0)
+    {
+      d->out = malloc(out_size);
+      d->left = items_per_device;
+      if (!d->out)
+      {
+        failed = 1;
+        pthread_mutex_unlock(&lock);
+        break;
+      }
+    }
+    pthread_mutex_unlock(&lock);
+
+    first = item * ITEM_CHUNKS;
+    count = num_records - first;
+    if (count > ITEM_CHUNKS)
+      count = ITEM_CHUNKS;
+
+    err = pack_records(d, first, count);
+
+    pthread_mutex_lock(&lock);
+    last = (--d->left == 0);
+    if (err)
+      failed = 1;
+    pthread_mutex_unlock(&lock);
+
+    if (last)
+    {
+      if (!failed && (write_output(d) != 0))
+      {
+        pthread_mutex_lock(&lock);
+        failed = 1;
+        pthread_mutex_unlock(&lock);
+      }
+
+      crypto_wipe(d->out, out_size);
+      free(d->out);
+      d->out = NULL;
+    }
+  }
+
+  return NULL;
+}
+
+/******************************************************************************/
+
+int main(int argc, char **argv)
+{
+  const char *image_path = NULL;
+  const char *keys_path = NULL;
+  const char *devices_path = NULL;
+  const char *device_id = NULL;
+  const char *base_path = NULL;
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct timespec t0, t1;
+  pthread_t *tid;
+  double sec;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--image") && (i + 1 < argc))
+      image_path = argv[++i];
+    else if (!strcmp(argv[i], "--keys") && (i + 1 < argc))
+      keys_path = argv[++i];
+    else if (!strcmp(argv[i], "--device-id") && (i + 1 < argc))
+      device_id = argv[++i];
+    else if (!strcmp(argv[i], "--out") && (i + 1 < argc))
+      out_path = argv[++i];
+    else if (!strcmp(argv[i], "--devices") && (i + 1 < argc))
+      devices_path = argv[++i];
+    else if (!strcmp(argv[i], "--out-dir") && (i + 1 < argc))
+      out_dir = argv[++i];
+    else if (!strcmp(argv[i], "--app-begin") && (i + 1 < argc))
+      app_begin = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--app-length") && (i + 1 < argc))
+      app_length = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--threads") && (i + 1 < argc))
+      threads = strtol(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--sparse"))
+      sparse = 1;
+    else if (!strcmp(argv[i], "--delta-base") && (i + 1 < argc))
+      base_path = argv[++i];
+    else if (!strcmp(argv[i], "--sector-size") && (i + 1 < argc))
+      sector_size = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--nonce-seed") && (i + 1 < argc))
+    {
+      if (parse_hex(argv[++i], nonce_seed, sizeof(nonce_seed)) != 0)
+      {
+        fprintf(stderr, "--nonce-seed: 64 hex digits expected\n");
+        return 2;
+      }
+      deterministic = 1;
+    }
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (!image_path || (!keys_path == !devices_path) ||
+      (keys_path && (!out_path || !device_id || out_dir)) ||
+      (devices_path && (!out_dir || out_path)) ||
+      (app_length <= PACK_MAC_SIZE) || (threads < 1) || (sparse && base_path))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (keys_path)
+  {
+    devices = calloc(1, sizeof(*devices));
+    num_devices = 1;
+    strcpy(devices[0].name, "device");
+    if ((load_keys(keys_path, &devices[0]) != 0) || (set_id(&devices[0], device_id) != 0))
+    {
+      fprintf(stderr, "bad keys or device id\n");
+      return 1;
+    }
+  }
+  else if (load_devices(devices_path, device_id) != 0)
+    return 1;
+
+  if (num_devices == 0)
+  {
+    fprintf(stderr, "no devices\n");
+    return 1;
+  }
+
+  if ((map_image(image_path, &image, &image_size) != 0) ||
+      (base_path && (map_image(base_path, &base_image, &base_size) != 0)))
+    return 1;
+
+  num_chunks = (app_length + PACK_CHUNK_DATA_SIZE - 1) / PACK_CHUNK_DATA_SIZE;
+  num_records = num_chunks + 1;
+
+  if (sparse)
+  {
+    if (build_sparse() != 0)
+    {
+      fprintf(stderr, "out of memory\n");
+      return 1;
+    }
+    fprintf(stderr, "sparse: %u of %u chunks in %u segment(s)\n",
+            num_records - 2, num_chunks, num_segments);
+  }
+
+  if (base_path)
+  {
+    if (build_delta() != 0)
+    {
+      fprintf(stderr, "delta: sector size %u does not divide the region, or out of memory\n",
+              sector_size);
+      return 1;
+    }
+    fprintf(stderr, "delta: %zu B stream, %u chunks\n", delta_size, num_records - 1);
+  }
+
+  items_per_device = (num_records + ITEM_CHUNKS - 1) / ITEM_CHUNKS;
+  out_size = (size_t)num_records * PACK_CHUNK_SIZE;
+
+  if ((uint64_t)threads > (uint64_t)num_devices * items_per_device)
+    threads = (long)((uint64_t)num_devices * items_per_device);
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  tid = calloc(threads, sizeof(*tid));
+  for (long i = 0; i < threads; i++)
+  {
+    if (pthread_create(&tid[i], NULL, worker, NULL) != 0)
+    {
+      fprintf(stderr, "pthread_create failed\n");
+      return 1;
+    }
+  }
+  for (long i = 0; i < threads; i++)
+    pthread_join(tid[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  sec = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+  for (uint32_t i = 0; i < num_devices; i++)
+  {
+    crypto_wipe(devices[i].enc_key, sizeof(devices[i].enc_key));
+    crypto_wipe(devices[i].int_key, sizeof(devices[i].int_key));
+  }
+
+  if (failed)
+    return 1;
+
+  fprintf(stderr, "%u device(s), %u chunks each, %ld thread(s): %.3f s, %.1f MB/s\n",
+          num_devices, num_records, threads, sec,
+          sec > 0 ? (double)num_devices * out_size / sec / 1e6 : 0);
+
+  return 0;
+}
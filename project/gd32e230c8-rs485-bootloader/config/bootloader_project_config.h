@@ -2,15 +2,95 @@
 #define __BOOTLOADER_PROJECT_CONFIG_H__
 
 #define BOOTLOADER_UART_BAUD 115200
+
+// Размер FIFO приемника (serial_port.c), сообщается хосту
+// командой GET_INFO как окно запросов
+#define BOOTLOADER_RX_FIFO_SIZE 128
 #define BOOTLOADER_RESPONSE_DELAY_MS 20
 
 #define BOOTLOADER_TIMEOUT_MS 5000
 
+// Минимальный интервал между событиями о ходе очистки flash, мс
+// (меньше тайм-аута ответа хоста, 300 мс)
+#define BOOTLOADER_ERASE_EVENT_INTERVAL_MS 50
+
 //#define BOOTLOADER_USE_USER_DATA
 
+// Область кода Bootloader-а: регион IROM1 в GD32E230C8.icf
+// (__ICFEDIT_region_IROM1_end__ = BOOTLOADER_CODE_BEGIN + BOOTLOADER_CODE_LENGTH - 1).
+// Журнал и приложение не должны заходить в эту область.
+// С BOOTLOADER_USE_JOURNAL последний сектор отдается журналу:
+// BOOTLOADER_CODE_LENGTH 0x2C00, IROM1 до 0x08002BFF.
+// Размер образа - в map-файле IAR, переполнение IROM1 - ошибка линковки
+#define BOOTLOADER_CODE_BEGIN  0x08000000UL
+#define BOOTLOADER_CODE_LENGTH 0x3000UL
+
 #define BOOTLOADER_APP_BEGIN   0x08003000UL
 #define BOOTLOADER_APP_LENGTH  53248UL
 
+// Необязательные функции ниже по умолчанию выключены и включаются
+// по потребности объекта; помещается ли образ с ними в область
+// Bootloader-а, показывает линковка проекта IAR
+
+// Журнал сессии обновления (команда RESUME).
+// Занимает последний сектор области Bootloader-а (см. BOOTLOADER_CODE_LENGTH)
+//#define BOOTLOADER_USE_JOURNAL
+#define BOOTLOADER_JOURNAL_BEGIN 0x08002C00UL
+
 #define BOOTLOADER_DEVICE_ID_STRING "gd32e230c8-rs485-bootloader"
 
+// Разреженные образы (команда SEGMENT_MAP): стертые (0xFF)
+// участки образа не передаются и не записываются
+//#define BOOTLOADER_USE_SPARSE
+
+// Разностное обновление (команды DELTA_BEGIN, DELTA_CHUNK):
+// сектор собирается в ОЗУ (BOOTLOADER_FLASH_SECTOR_SIZE байт)
+//#define BOOTLOADER_USE_DELTA
+
+// Кэш записи: чанки собираются в секторе в ОЗУ в любом порядке,
+// сектор записывается во flash целиком (буфер общий с BOOTLOADER_USE_DELTA)
+//#define BOOTLOADER_USE_SECTOR_CACHE
+
+// Широковещательная сессия обновления
+// нескольких устройств на одной шине RS-485
+//#define BOOTLOADER_USE_BROADCAST
+
+// Помехоустойчивое кодирование пакетов binex (команда SET_FEC),
+// код Рида-Соломона rs-fec.c - около 2 КБ flash
+//#define BOOTLOADER_USE_FEC
+
+// Кадрирование binex COBS (согласуется в ACTIVATE)
+//#define BOOTLOADER_USE_COBS
+
+// Адресация пакетов binex на общей шине
+// и поиск устройств (команда DISCOVER)
+//#define BOOTLOADER_USE_ADDRESSING
+
+// Адрес устройства на шине (0x00..0x7E) не задается при сборке:
+// одна прошивка ставится на все устройства шины.
+// Адрес назначается при производстве записью байта DATA0 option bytes
+// (0x1FFFF804, например "ob_data_program(адрес | 0xFF00)" или
+// программатором). Если байт не записан, адрес выводится из 96-битного
+// UID МК (см. __unit_address в bootloader.c), такие адреса могут совпасть
+
+// Счетчики приема, ошибок и времени операций flash
+// (команда GET_STATS)
+//#define BOOTLOADER_USE_STATS
+
+// Буфер событий с отметками времени (команда GET_TRACE),
+// размер - количество записей по 8 байт, степень двойки
+//#define BOOTLOADER_USE_TRACE
+#define BOOTLOADER_TRACE_SIZE 64
+
+// Режим проверки канала (команда LINK_TEST): прием и эхо пакетов
+// заданного размера и содержимого, счетчики ошибок приема
+//#define BOOTLOADER_USE_LINK_TEST
+
+// Режим ретранслятора для обновления нижестоящих устройств
+// через дополнительный канал RS-485 (USART1)
+//#define BOOTLOADER_USE_RELAY
+#define BOOTLOADER_RELAY_CHANNELS 1
+#define BOOTLOADER_RELAY_BAUD 115200
+#define BOOTLOADER_RELAY_TIMEOUT_MS 1000
+
 #endif
@@ -0,0 +1,11 @@
+#ifndef __RELAY_PORT_H__
+#define __RELAY_PORT_H__
+
+#include <stdint.h>
+
+void RelayPortInit(void);
+
+int16_t RelayPortPutc(uint8_t c);
+int16_t RelayPortGetc(void);
+
+#endif
@@ -8,6 +8,8 @@ void SerialPortInit(void);
 int16_t SerialPortPutc(uint8_t c);
 int16_t SerialPortGetc(void);
 int SerialPortTransferCompleted(void);
+uint32_t SerialPortRxLost(void);
+void SerialPortRxErrors(uint32_t *overrun, uint32_t *framing, uint32_t *noise);
 
 
 #endif
\ No newline at end of file
@@ -7,7 +7,9 @@ extern uint32_t SystickCounter_ms;
 
 void SysTick_Init(void);
 void SysTick_Deinit(void);
+uint32_t SysTickGetUs(void);
 
 #define SYSTICK_GET_VALUE()     (SystickCounter_ms)
+#define SYSTICK_GET_US()        (SysTickGetUs())
 
 #endif
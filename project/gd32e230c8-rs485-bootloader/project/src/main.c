@@ -1,8 +1,11 @@
+#include "gd32e23x.h"
 #include "bootloader.h"
 #include "bootloader_port.h"
 #include "port_hardware.h"
 #include "serial_port.h"
+#include "relay_port.h"
 #include "systick.h"
+#include "bootloader_project_config.h"
 
 int16_t port_serial_putc(uint8_t c) 
 { 
@@ -19,6 +22,30 @@ int16_t port_serial_getc(void)
   return SerialPortGetc(); 
 }
 
+uint32_t port_serial_rx_lost(void)
+{
+  return SerialPortRxLost();
+}
+
+void port_serial_rx_errors(uint32_t *overrun, uint32_t *framing, uint32_t *noise)
+{
+  SerialPortRxErrors(overrun, framing, noise);
+}
+
+#ifdef BOOTLOADER_USE_RELAY
+int16_t port_relay_putc(uint8_t ch, uint8_t c)
+{
+  (void)ch; // На плате один канал ретранслятора
+  return RelayPortPutc(c);
+}
+
+int16_t port_relay_getc(uint8_t ch)
+{
+  (void)ch;
+  return RelayPortGetc();
+}
+#endif
+
 void port_deinit_all(void)
 {
   SysTick_Deinit();
@@ -30,12 +57,25 @@ int port_boot_jumper_is_active(void)
   return 0;
 }
 
+uint8_t port_get_unit_address(void)
+{
+  // На плате нет переключателей адреса, адрес назначается
+  // при производстве в байте DATA0 option bytes (OB_DATA_ADDR0).
+  // Байт не записан (0xFF) - адрес выводится ядром из UID МК
+  uint8_t addr = (uint8_t)ob_data_get();
+
+  return (addr < 0x7F) ? addr : 0xFF;
+}
+
 void main(void)
 {
   SysTick_Init();
   hw_init();
 
   SerialPortInit();
+#ifdef BOOTLOADER_USE_RELAY
+  RelayPortInit();
+#endif
 
   InitBootloader();
   
@@ -8,6 +8,11 @@ static void __rcu_deinit(void)
 {
   rcu_periph_clock_disable(RCU_GPIOA);
   rcu_periph_clock_disable(RCU_USART0);
+#ifdef BOOTLOADER_USE_RELAY
+  rcu_periph_clock_disable(RCU_USART1);
+#endif
+  // Блок CRC включается в Crc16Init (port_crc16.c)
+  rcu_periph_clock_disable(RCU_CRC);
 }
 
 static void __gpio_deinit(void)
@@ -15,14 +20,25 @@ static void __gpio_deinit(void)
   gpio_deinit(GPIOA);
 }
 
+static void __crc_deinit(void)
+{
+  crc_deinit();
+}
+
 static void __uart_deinit(void)
 {
   usart_deinit(USART0);
+#ifdef BOOTLOADER_USE_RELAY
+  usart_deinit(USART1);
+#endif
 }
 
 static void __nvic_deinit(void)
 {
   nvic_irq_disable(USART0_IRQn);
+#ifdef BOOTLOADER_USE_RELAY
+  nvic_irq_disable(USART1_IRQn);
+#endif
 }
 
 /*************************************************************************/
@@ -34,6 +50,9 @@ static void __rcu_init(void)
 
   /* enable USART clock */
   rcu_periph_clock_enable(RCU_USART0);
+#ifdef BOOTLOADER_USE_RELAY
+  rcu_periph_clock_enable(RCU_USART1);
+#endif
 }
 
 static void __gpio_init(void)
@@ -58,6 +77,13 @@ static void __gpio_init(void)
   /* configure USART DEx as alternate function push-pull */
   gpio_mode_set(GPIOA, GPIO_MODE_AF, GPIO_PUPD_PULLUP, GPIO_PIN_12);
   gpio_output_options_set(GPIOA, GPIO_OTYPE_PP, GPIO_OSPEED_10MHZ, GPIO_PIN_12);
+
+#ifdef BOOTLOADER_USE_RELAY
+  /* Канал ретранслятора: USART1, PA2 - Tx, PA3 - Rx, PA1 - DE */
+  gpio_af_set(GPIOA, GPIO_AF_1, GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3);
+  gpio_mode_set(GPIOA, GPIO_MODE_AF, GPIO_PUPD_PULLUP, GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3);
+  gpio_output_options_set(GPIOA, GPIO_OTYPE_PP, GPIO_OSPEED_10MHZ, GPIO_PIN_1 | GPIO_PIN_2 | GPIO_PIN_3);
+#endif
 }
 
 static void __uart_init(void)
@@ -88,11 +114,34 @@ static void __uart_init(void)
   usart_transmit_config(USART0, USART_TRANSMIT_ENABLE);
   usart_receive_config(USART0, USART_RECEIVE_ENABLE);
   usart_enable(USART0);
+
+#ifdef BOOTLOADER_USE_RELAY
+  usart_deinit(USART1);
+
+  usart_word_length_set(USART1, USART_WL_8BIT);
+  usart_stop_bit_set(USART1, USART_STB_1BIT);
+  usart_parity_config(USART1, USART_PM_NONE);
+
+  usart_baudrate_set(USART1, BOOTLOADER_RELAY_BAUD);
+
+  usart_rs485_driver_enable(USART1);
+  usart_driver_assertime_config(USART1, 0x01);
+  usart_driver_deassertime_config(USART1, 0x01);
+
+  usart_interrupt_enable(USART1, USART_INT_RBNE);
+
+  usart_transmit_config(USART1, USART_TRANSMIT_ENABLE);
+  usart_receive_config(USART1, USART_RECEIVE_ENABLE);
+  usart_enable(USART1);
+#endif
 }
 
 static void __nvic_init(void)
 {
   nvic_irq_enable(USART0_IRQn, 0);
+#ifdef BOOTLOADER_USE_RELAY
+  nvic_irq_enable(USART1_IRQn, 0);
+#endif
 }
 
 /*************************************************************************/
@@ -110,5 +159,6 @@ void hw_deinit(void)
   __nvic_deinit();
   __uart_deinit();
   __gpio_deinit();
+  __crc_deinit();
   __rcu_deinit();
 }
\ No newline at end of file
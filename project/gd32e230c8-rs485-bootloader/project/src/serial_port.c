@@ -1,6 +1,7 @@
 #include "serial_port.h"
 #include "RingFIFO.h"
 #include "gd32e23x.h"
+#include "bootloader_project_config.h"
 
 /******************************************************************************/
 
@@ -8,7 +9,7 @@
 #define USARTx_IRQn USART0_IRQn
 #define USARTx_IRQHandler USART0_IRQHandler
 
-#define FIFOBUFSIZE_RX 128
+#define FIFOBUFSIZE_RX BOOTLOADER_RX_FIFO_SIZE
 #define FIFOBUFSIZE_TX 128
 
 /******************************************************************************/
@@ -21,6 +22,12 @@ static uint8_t buff_tx[FIFOBUFSIZE_TX];
 
 static uint8_t flag_tx_uart = 0;
 
+// Ошибки приемника
+static volatile uint32_t rx_fifo_lost = 0; // Символы, затертые в заполненном FIFO
+static volatile uint32_t rx_overrun = 0;   // Аппаратное переполнение USART
+static volatile uint32_t rx_framing = 0;   // Ошибка стопового бита
+static volatile uint32_t rx_noise = 0;     // Шум на линии
+
 /******************************************************************************/
 
 void SerialPortInit(void)
@@ -62,6 +69,18 @@ int16_t SerialPortGetc(void)
   return ret;
 }
 
+uint32_t SerialPortRxLost(void)
+{
+  return rx_fifo_lost + rx_overrun;
+}
+
+void SerialPortRxErrors(uint32_t *overrun, uint32_t *framing, uint32_t *noise)
+{
+  *overrun = rx_overrun;
+  *framing = rx_framing;
+  *noise = rx_noise;
+}
+
 int SerialPortTransferCompleted(void)
 {
   return RingBuffNumOfItems(&fifo_tx) == 0;
@@ -71,9 +90,35 @@ int SerialPortTransferCompleted(void)
 
 void USARTx_IRQHandler(void)
 {
+  // Переполнение приемника USART: символ, пришедший
+  // до чтения предыдущего, потерян
+  if (usart_flag_get(USARTx, USART_FLAG_ORERR) == SET)
+  {
+    usart_flag_clear(USARTx, USART_FLAG_ORERR);
+    rx_overrun++;
+  }
+
   // Если что-то получили по uart
   if (usart_flag_get(USARTx, USART_FLAG_RBNE) == SET)
+  {
+    // Флаги ошибок относятся к принятому символу,
+    // символ все равно передается binex, его отбросит CRC
+    if (usart_flag_get(USARTx, USART_FLAG_FERR) == SET)
+    {
+      usart_flag_clear(USARTx, USART_FLAG_FERR);
+      rx_framing++;
+    }
+    if (usart_flag_get(USARTx, USART_FLAG_NERR) == SET)
+    {
+      usart_flag_clear(USARTx, USART_FLAG_NERR);
+      rx_noise++;
+    }
+
+    // При заполненном FIFO самый старый символ затирается
+    if (RingBuffNumOfFreeItems(&fifo_rx) == 0)
+      rx_fifo_lost++;
     RingBuffPut(&fifo_rx, (uint8_t)usart_data_receive(USARTx));
+  }
 
   // Если отправка данных включена, и буфер передатчика пуст
   if (flag_tx_uart && (usart_flag_get(USARTx, USART_FLAG_TBE) == SET))
@@ -20,6 +20,24 @@ void SysTick_Deinit(void)
   SysTick->VAL = 0;
 }
 
+/*
+  Время с момента инициализации в мкс (переполняется через ~71 мин).
+  Доля текущей миллисекунды берется из счетчика SysTick,
+  считающего вниз от 71999 при тактовой частоте 72 МГц
+*/
+uint32_t SysTickGetUs(void)
+{
+  uint32_t ms, val;
+
+  do
+  {
+    ms = SystickCounter_ms;
+    val = SysTick->VAL;
+  } while (ms != SystickCounter_ms); // Счетчик мс обновился между чтениями
+
+  return ms * 1000UL + (71999UL - val) / 72UL;
+}
+
 void SysTick_Handler(void)
 {
   SystickCounter_ms++;
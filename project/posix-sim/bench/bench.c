@@ -0,0 +1,499 @@
+/*
+  Сквозной замер процесса обновления на симуляторе.
+  Запускает симулятор Bootloader-а, соединяясь с ним через socketpair,
+  и выполняет полное обновление зашифрованным образом, так же как
+  утилита обновления: ACTIVATE, BEGIN, SEND/WRITE для каждого чанка,
+  END, CHECK_CRC, APP_RUN.
+  Выводит общее время, объем данных на линии, оценку времени передачи
+  на заданной скорости и задержку ответа для каждой команды.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "binex-lib.h"
+#include "crc16.h"
+#include "fw_pack.h"
+#include "bootloader_project_config.h"
+
+/******************************************************************************/
+
+#include "private_keys.inc"
+
+/******************************************************************************/
+
+#define CMD_ACTIVATE 0x70
+#define CMD_BEGIN 0x71
+#define CMD_SEND 0x72
+#define CMD_WRITE 0x73
+#define CMD_END 0x74
+#define CMD_CHECK_CRC 0x75
+#define CMD_APP_RUN 0x76
+
+#define STATUS_EVENT 0xFF
+
+#define RESP_TIMEOUT_MS 5000
+
+#define BUFFER_SIZE 512
+
+/******************************************************************************/
+
+struct cmd_stat_s
+{
+  const char *name;
+  uint8_t cmd;
+  uint32_t count;
+  uint64_t sum_us;
+  uint64_t min_us;
+  uint64_t max_us;
+};
+
+static struct cmd_stat_s cmd_stat[] =
+{
+  {"ACTIVATE", CMD_ACTIVATE},
+  {"BEGIN", CMD_BEGIN},
+  {"SEND", CMD_SEND},
+  {"WRITE", CMD_WRITE},
+  {"END", CMD_END},
+  {"CHECK_CRC", CMD_CHECK_CRC},
+  {"APP_RUN", CMD_APP_RUN},
+};
+
+#define NUM_CMD_STAT (sizeof(cmd_stat) / sizeof(cmd_stat[0]))
+
+/******************************************************************************/
+
+static int link_fd = -1;
+static pid_t sim_pid = -1;
+
+static Binex_t host_link;
+static uint8_t tx_buff[BUFFER_SIZE * 2 + 16];
+static uint16_t tx_len;
+static uint8_t rx_buff[BUFFER_SIZE];
+
+static uint64_t bytes_tx;
+static uint64_t bytes_rx;
+
+/******************************************************************************/
+
+// Экземпляр binex по умолчанию хостом не используется
+int binex_tx_callback(uint8_t c)
+{
+  (void)c;
+  return 0;
+}
+
+static uint64_t __now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int __link_tx_callback(void *arg, uint8_t c)
+{
+  (void)arg;
+
+  if (tx_len >= sizeof(tx_buff))
+    return 0;
+
+  tx_buff[tx_len++] = c;
+  return 1;
+}
+
+static struct cmd_stat_s *__stat(uint8_t cmd)
+{
+  for (unsigned i = 0; i < NUM_CMD_STAT; i++)
+  {
+    if (cmd_stat[i].cmd == cmd)
+      return &cmd_stat[i];
+  }
+  return NULL;
+}
+
+static void __stat_add(uint8_t cmd, uint64_t us)
+{
+  struct cmd_stat_s *s = __stat(cmd);
+
+  if (s == NULL)
+    return;
+
+  if ((s->count == 0) || (us < s->min_us))
+    s->min_us = us;
+  if (us > s->max_us)
+    s->max_us = us;
+
+  s->sum_us += us;
+  s->count++;
+}
+
+/******************************************************************************/
+
+static int __send(const uint8_t *data, uint16_t len)
+{
+  size_t pos = 0;
+
+  tx_len = 0;
+  binex_tx_init(&host_link, (void *)data, len);
+
+  // binex_tx возвращает управление после каждого esc-символа
+  while (binex_tx(&host_link) != BINEX_PACK_TX)
+  {
+    if (tx_len >= sizeof(tx_buff))
+      return -1;
+  }
+
+  while (pos < tx_len)
+  {
+    ssize_t n = write(link_fd, tx_buff + pos, tx_len - pos);
+
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    pos += n;
+  }
+
+  bytes_tx += tx_len;
+  return 0;
+}
+
+/*
+  Прием пакета
+  Возвращает длину пакета, либо -1 по тайм-ауту
+*/
+static int __receive(int timeout_ms)
+{
+  static uint8_t stream[256];
+  static int stream_pos, stream_len;
+  uint64_t deadline = __now_us() + (uint64_t)timeout_ms * 1000;
+
+  binex_rx_begin(&host_link, rx_buff, sizeof(rx_buff));
+
+  for (;;)
+  {
+    while (stream_pos < stream_len)
+    {
+      if (binex_rx(&host_link, stream[stream_pos++]) == BINEX_PACK_RX)
+        return binex_rx_len(&host_link);
+    }
+
+    uint64_t now = __now_us();
+    if (now >= deadline)
+      return -1;
+
+    struct pollfd pfd = {link_fd, POLLIN, 0};
+    int r = poll(&pfd, 1, (int)((deadline - now + 999) / 1000));
+    if (r < 0 && errno != EINTR)
+      return -1;
+    if (r <= 0)
+      continue;
+
+    ssize_t n = read(link_fd, stream, sizeof(stream));
+    if (n <= 0)
+      return -1; // Симулятор завершился
+
+    bytes_rx += n;
+    stream_pos = 0;
+    stream_len = n;
+  }
+}
+
+/*
+  Запрос - ответ.
+  Промежуточные события (статус STATUS_EVENT) пропускаются.
+  Возвращает статус ответа, либо -1 при ошибке связи
+*/
+static int __transaction(const uint8_t *req, uint16_t len)
+{
+  uint64_t t0 = __now_us();
+  int rlen;
+
+  if (__send(req, len) != 0)
+    return -1;
+
+  for (;;)
+  {
+    rlen = __receive(RESP_TIMEOUT_MS);
+    if (rlen < 2)
+      return -1;
+
+    if (rx_buff[0] != req[0])
+      continue;
+
+    if (rx_buff[1] != STATUS_EVENT)
+      break;
+  }
+
+  __stat_add(req[0], __now_us() - t0);
+  return rx_buff[1];
+}
+
+/******************************************************************************/
+
+static int __spawn_sim(const char *sim, const char *flash,
+                       const char *erase_us, const char *program_us)
+{
+  int sv[2];
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+  {
+    perror("socketpair");
+    return -1;
+  }
+
+  sim_pid = fork();
+  if (sim_pid < 0)
+  {
+    perror("fork");
+    return -1;
+  }
+
+  if (sim_pid == 0)
+  {
+    char fd_str[16];
+
+    close(sv[0]);
+    snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+    execl(sim, sim, "--fd", fd_str, "--flash", flash,
+          "--erase-us", erase_us, "--program-us", program_us, (char *)NULL);
+    perror(sim);
+    _exit(127);
+  }
+
+  close(sv[1]);
+  link_fd = sv[0];
+  return 0;
+}
+
+static int __wait_sim(void)
+{
+  int status;
+
+  if (sim_pid < 0)
+    return -1;
+
+  if (waitpid(sim_pid, &status, 0) != sim_pid)
+    return -1;
+
+  sim_pid = -1;
+  close(link_fd);
+  link_fd = -1;
+
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void __kill_sim(void)
+{
+  if (sim_pid > 0)
+  {
+    kill(sim_pid, SIGTERM);
+    __wait_sim();
+  }
+}
+
+/******************************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --sim PATH        simulator binary (default: build/polyboot-sim)\n"
+          "  --flash PATH      flash image file (default: build/bench-flash.bin)\n"
+          "  --size N          firmware size in bytes, rest is 0xFF (default: whole app area)\n"
+          "  --runs N          number of updates (default: 1)\n"
+          "  --baud N          line speed for wire time estimate (default: %d)\n"
+          "  --erase-us N      emulated sector erase time, us (default: 0)\n"
+          "  --program-us N    emulated word program time, us (default: 0)\n"
+          "  --seed N          firmware content seed (default: 1)\n",
+          name, BOOTLOADER_UART_BAUD);
+}
+
+static int __update(const uint8_t *image, uint32_t fw_size)
+{
+  static uint8_t req[1 + PACK_CHUNK_SIZE];
+  uint8_t nonce[PACK_NONCE_SIZE];
+  int st;
+
+  /* ACTIVATE */
+  req[0] = CMD_ACTIVATE;
+  memcpy(req + 1, "ACTIVATE", 8);
+  if ((st = __transaction(req, 9)) != 0)
+  {
+    fprintf(stderr, "ACTIVATE: %d\n", st);
+    return -1;
+  }
+
+  /* BEGIN */
+  req[0] = CMD_BEGIN;
+  PackRandomNonce(nonce);
+  PackIdentityChunk(req + 1, EncryptionKey, nonce,
+                    BOOTLOADER_APP_LENGTH, BOOTLOADER_DEVICE_ID_STRING);
+  if ((st = __transaction(req, sizeof(req))) != 0)
+  {
+    fprintf(stderr, "BEGIN: %d\n", st);
+    return -1;
+  }
+
+  /* SEND + WRITE */
+  for (uint32_t ofs = 0; ofs < BOOTLOADER_APP_LENGTH; ofs += PACK_CHUNK_DATA_SIZE)
+  {
+    // Пустые чанки в середине образа передавать не нужно,
+    // а конец области с MAC передается всегда
+    if ((ofs < fw_size) || (ofs + PACK_CHUNK_DATA_SIZE >= BOOTLOADER_APP_LENGTH))
+    {
+      req[0] = CMD_SEND;
+      PackRandomNonce(nonce);
+      PackChunk(req + 1, EncryptionKey, nonce, BOOTLOADER_APP_BEGIN + ofs,
+                image + ofs, PACK_CHUNK_DATA_SIZE);
+      if ((st = __transaction(req, sizeof(req))) != 0)
+      {
+        fprintf(stderr, "SEND 0x%08lX: %d\n", (unsigned long)(BOOTLOADER_APP_BEGIN + ofs), st);
+        return -1;
+      }
+
+      req[0] = CMD_WRITE;
+      if ((st = __transaction(req, 1)) != 0)
+      {
+        fprintf(stderr, "WRITE 0x%08lX: %d\n", (unsigned long)(BOOTLOADER_APP_BEGIN + ofs), st);
+        return -1;
+      }
+    }
+  }
+
+  req[0] = CMD_END;
+  if ((st = __transaction(req, 1)) != 0)
+  {
+    fprintf(stderr, "END: %d\n", st);
+    return -1;
+  }
+
+  req[0] = CMD_CHECK_CRC;
+  if ((st = __transaction(req, 1)) != 0)
+  {
+    fprintf(stderr, "CHECK_CRC: %d\n", st);
+    return -1;
+  }
+
+  req[0] = CMD_APP_RUN;
+  if ((st = __transaction(req, 1)) != 0)
+  {
+    fprintf(stderr, "APP_RUN: %d\n", st);
+    return -1;
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv)
+{
+  const char *sim = "build/polyboot-sim";
+  const char *flash = "build/bench-flash.bin";
+  const char *erase_us = "0";
+  const char *program_us = "0";
+  uint32_t fw_size = BOOTLOADER_APP_LENGTH - PACK_MAC_SIZE;
+  uint32_t runs = 1;
+  uint32_t baud = BOOTLOADER_UART_BAUD;
+  uint32_t seed = 1;
+  static uint8_t image[BOOTLOADER_APP_LENGTH];
+  uint64_t total_us = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--sim") && (i + 1 < argc))
+      sim = argv[++i];
+    else if (!strcmp(argv[i], "--flash") && (i + 1 < argc))
+      flash = argv[++i];
+    else if (!strcmp(argv[i], "--size") && (i + 1 < argc))
+      fw_size = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--runs") && (i + 1 < argc))
+      runs = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+      baud = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--erase-us") && (i + 1 < argc))
+      erase_us = argv[++i];
+    else if (!strcmp(argv[i], "--program-us") && (i + 1 < argc))
+      program_us = argv[++i];
+    else if (!strcmp(argv[i], "--seed") && (i + 1 < argc))
+      seed = strtoul(argv[++i], NULL, 0);
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if ((fw_size > BOOTLOADER_APP_LENGTH - PACK_MAC_SIZE) || (runs == 0) || (baud == 0))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  Crc16Init();
+  binex_init(&host_link, __link_tx_callback, NULL);
+
+  /* Образ прошивки: псевдослучайные данные, остаток области стерт */
+  memset(image, 0xFF, sizeof(image));
+  srand(seed);
+  for (uint32_t i = 0; i < fw_size; i++)
+    image[i] = (uint8_t)rand();
+  PackImageMac(image, BOOTLOADER_APP_LENGTH, IntegrityKey);
+
+  for (uint32_t run = 0; run < runs; run++)
+  {
+    if (__spawn_sim(sim, flash, erase_us, program_us) != 0)
+      return 1;
+
+    uint64_t t0 = __now_us();
+
+    if (__update(image, fw_size) != 0)
+    {
+      __kill_sim();
+      return 1;
+    }
+
+    // После ответа на APP_RUN симулятор "запускает приложение" и завершается
+    if (__wait_sim() != 0)
+    {
+      fprintf(stderr, "simulator exited with error\n");
+      return 1;
+    }
+
+    total_us += __now_us() - t0;
+  }
+
+  printf("runs:              %lu\n", (unsigned long)runs);
+  printf("firmware size:     %lu bytes\n", (unsigned long)fw_size);
+  printf("wall time:         %.3f s per update\n", (double)total_us / runs / 1e6);
+  printf("host -> device:    %llu bytes per update\n", (unsigned long long)(bytes_tx / runs));
+  printf("device -> host:    %llu bytes per update\n", (unsigned long long)(bytes_rx / runs));
+  printf("wire time @ %lu:  %.3f s per update (half-duplex, 10 bit/byte)\n",
+         (unsigned long)baud, (double)(bytes_tx + bytes_rx) * 10 / baud / runs);
+  printf("\n%-10s %8s %10s %10s %10s\n", "command", "count", "min, ms", "avg, ms", "max, ms");
+
+  for (unsigned i = 0; i < NUM_CMD_STAT; i++)
+  {
+    struct cmd_stat_s *s = &cmd_stat[i];
+
+    if (s->count == 0)
+      continue;
+
+    printf("%-10s %8lu %10.3f %10.3f %10.3f\n", s->name, (unsigned long)s->count,
+           s->min_us / 1e3, (double)s->sum_us / s->count / 1e3, s->max_us / 1e3);
+  }
+
+  return 0;
+}
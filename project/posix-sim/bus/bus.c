@@ -0,0 +1,444 @@
+/*
+  Поиск устройств на общей шине RS-485 (CMD_DISCOVER).
+  Запускает несколько симуляторов Bootloader-а с одной и той же прошивкой
+  (один исполняемый файл, собранный с BOOTLOADER_USE_ADDRESSING), устройства
+  отличаются только UID МК (--uid симулятора), адрес не назначен.
+  Хост отправляет всем устройствам широковещательный DISCOVER, ответы
+  сводятся на одну линию: ответы, передача которых на скорости --baud
+  перекрывается по времени, сталкиваются и теряются. Раунды повторяются
+  с картой найденных адресов, пока не будут найдены все устройства.
+  Ответы устройств друг другу не передаются (устройства их и так отбрасывают).
+  Код возврата 0 - все устройства найдены не более чем за --rounds раундов
+  и по адресам, выведенным из их UID.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "binex-lib.h"
+#include "utils.h"
+#include "bootloader_port.h"
+#include "bootloader_project_config.h"
+
+/******************************************************************************/
+
+#define CMD_DISCOVER 0x7F
+
+#define MAX_NODES 32
+#define BITMAP_SIZE 16
+
+// Ответ на DISCOVER с запасом на адрес, FEC и экранирование
+#define RX_STREAM_SIZE 256
+
+// Ожидание ответов после окончания окна, мс
+#define ROUND_MARGIN_MS 50
+
+/******************************************************************************/
+
+struct node_s
+{
+  pid_t pid;
+  int fd;
+  uint8_t uid[PORT_UNIQUE_ID_SIZE];
+  uint8_t address; // Адрес, выведенный из UID
+  uint8_t found;
+
+  // Ответ в текущем раунде
+  uint64_t rx_us;  // Время приема первого байта
+  uint8_t rx_stream[RX_STREAM_SIZE];
+  size_t rx_len;
+};
+
+static struct node_s nodes[MAX_NODES];
+static uint32_t num_nodes = 4;
+
+static uint8_t tx_buff[64];
+static size_t tx_len;
+
+/******************************************************************************/
+
+// Экземпляр binex по умолчанию хостом не используется
+int binex_tx_callback(uint8_t c)
+{
+  (void)c;
+  return 0;
+}
+
+static uint64_t __now_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int __tx_callback(void *arg, uint8_t c)
+{
+  (void)arg;
+
+  if (tx_len >= sizeof(tx_buff))
+    return 0;
+
+  tx_buff[tx_len++] = c;
+  return 1;
+}
+
+/*
+  Адрес, который выведет ядро из UID (__unit_address в bootloader.c)
+*/
+static uint8_t __uid_address(const uint8_t *uid)
+{
+  uint32_t h = 2166136261UL;
+
+  for (int i = 0; i < PORT_UNIQUE_ID_SIZE; i++)
+    h = (h ^ uid[i]) * 16777619UL;
+
+  return (uint8_t)(h % BINEX_ADDRESS_BROADCAST);
+}
+
+/******************************************************************************/
+
+static int __spawn_node(struct node_s *n, const char *sim, const char *flash)
+{
+  char uid_str[2 * PORT_UNIQUE_ID_SIZE + 1];
+  int sv[2];
+
+  for (int i = 0; i < PORT_UNIQUE_ID_SIZE; i++)
+    sprintf(uid_str + 2 * i, "%02X", n->uid[i]);
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+  {
+    perror("socketpair");
+    return -1;
+  }
+
+  n->pid = fork();
+  if (n->pid < 0)
+  {
+    perror("fork");
+    return -1;
+  }
+
+  if (n->pid == 0)
+  {
+    char fd_str[16];
+
+    close(sv[0]);
+    snprintf(fd_str, sizeof(fd_str), "%d", sv[1]);
+    execl(sim, sim, "--fd", fd_str, "--flash", flash, "--uid", uid_str, (char *)NULL);
+    perror(sim);
+    _exit(127);
+  }
+
+  close(sv[1]);
+  n->fd = sv[0];
+  return 0;
+}
+
+static void __kill_nodes(void)
+{
+  for (uint32_t i = 0; i < num_nodes; i++)
+  {
+    if (nodes[i].pid > 0)
+    {
+      kill(nodes[i].pid, SIGTERM);
+      waitpid(nodes[i].pid, NULL, 0);
+      nodes[i].pid = -1;
+    }
+    if (nodes[i].fd >= 0)
+    {
+      close(nodes[i].fd);
+      nodes[i].fd = -1;
+    }
+  }
+}
+
+/******************************************************************************/
+
+/*
+  Раунд поиска: запрос всем устройствам и прием ответов в течение окна.
+  Возвращает количество ответивших устройств, -1 - устройство завершилось
+*/
+static int __round(const uint8_t *bitmap, uint16_t window_ms)
+{
+  uint8_t req[3 + BITMAP_SIZE];
+  Binex_t link;
+  uint64_t deadline;
+  int replies = 0;
+
+  req[0] = CMD_DISCOVER;
+  UInt16ToBuff(req + 1, window_ms);
+  memcpy(req + 3, bitmap, BITMAP_SIZE);
+
+  binex_init(&link, __tx_callback, NULL);
+  binex_host_address_set(&link, BINEX_ADDRESS_BROADCAST);
+  tx_len = 0;
+  binex_tx_init(&link, req, sizeof(req));
+  while (binex_tx(&link) != BINEX_PACK_TX)
+    ;
+
+  for (uint32_t i = 0; i < num_nodes; i++)
+  {
+    nodes[i].rx_len = 0;
+    if (write(nodes[i].fd, tx_buff, tx_len) != (ssize_t)tx_len)
+      return -1;
+  }
+
+  deadline = __now_us() + (uint64_t)(BOOTLOADER_RESPONSE_DELAY_MS + window_ms + ROUND_MARGIN_MS) * 1000;
+
+  for (;;)
+  {
+    struct pollfd pfd[MAX_NODES];
+    uint64_t now = __now_us();
+
+    if (now >= deadline)
+      break;
+
+    for (uint32_t i = 0; i < num_nodes; i++)
+    {
+      pfd[i].fd = nodes[i].fd;
+      pfd[i].events = POLLIN;
+      pfd[i].revents = 0;
+    }
+
+    int r = poll(pfd, num_nodes, (int)((deadline - now + 999) / 1000));
+    if (r < 0 && errno != EINTR)
+      return -1;
+    if (r <= 0)
+      continue;
+
+    now = __now_us();
+    for (uint32_t i = 0; i < num_nodes; i++)
+    {
+      struct node_s *n = &nodes[i];
+
+      if (!(pfd[i].revents & (POLLIN | POLLHUP)))
+        continue;
+
+      ssize_t len = read(n->fd, n->rx_stream + n->rx_len, sizeof(n->rx_stream) - n->rx_len);
+      if (len <= 0)
+        return -1;
+
+      if (n->rx_len == 0)
+      {
+        n->rx_us = now;
+        replies++;
+      }
+      n->rx_len += len;
+    }
+  }
+
+  return replies;
+}
+
+/*
+  Ответ устройства, не столкнувшийся с другими на линии.
+  Возвращает адрес из ответа, либо -1
+*/
+static int __reply_address(struct node_s *n)
+{
+  uint8_t resp[RX_STREAM_SIZE];
+  Binex_t link;
+
+  binex_init(&link, __tx_callback, NULL);
+  binex_host_address_set(&link, BINEX_ADDRESS_BROADCAST);
+  binex_rx_begin(&link, resp, sizeof(resp));
+
+  for (size_t i = 0; i < n->rx_len; i++)
+  {
+    if (binex_rx(&link, n->rx_stream[i]) != BINEX_PACK_RX)
+      continue;
+
+    if ((binex_rx_len(&link) == 5) && (resp[0] == CMD_DISCOVER) && (resp[1] == 0x00))
+      return resp[2];
+  }
+
+  return -1;
+}
+
+/******************************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s --sim PATH [options]\n"
+          "  --sim PATH        simulator built with BOOTLOADER_USE_ADDRESSING\n"
+          "  --nodes N         devices on the bus, 2..%d (default: 4)\n"
+          "  --window MS       DISCOVER reply window (default: 50)\n"
+          "  --rounds N        rounds allowed to find all devices (default: 10)\n"
+          "  --baud N          line speed for collision check (default: %d)\n"
+          "  --dir PATH        directory for flash images (default: /tmp/polyboot-bus)\n",
+          name, MAX_NODES, BOOTLOADER_UART_BAUD);
+}
+
+int main(int argc, char **argv)
+{
+  const char *sim = NULL;
+  const char *dir = "/tmp/polyboot-bus";
+  uint32_t window_ms = 50;
+  uint32_t max_rounds = 10;
+  uint32_t baud = BOOTLOADER_UART_BAUD;
+  uint8_t bitmap[BITMAP_SIZE];
+  uint32_t found = 0;
+  uint32_t round;
+  int rc = 1;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--sim") && (i + 1 < argc))
+      sim = argv[++i];
+    else if (!strcmp(argv[i], "--nodes") && (i + 1 < argc))
+      num_nodes = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--window") && (i + 1 < argc))
+      window_ms = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--rounds") && (i + 1 < argc))
+      max_rounds = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+      baud = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--dir") && (i + 1 < argc))
+      dir = argv[++i];
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if ((sim == NULL) || (num_nodes < 2) || (num_nodes > MAX_NODES) ||
+      (window_ms == 0) || (window_ms > 0xFFFF) || (baud == 0))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  mkdir(dir, 0755);
+
+  // UID различаются только последними байтами, как у МК одной партии
+  for (uint32_t i = 0; i < num_nodes; i++)
+  {
+    struct node_s *n = &nodes[i];
+
+    n->pid = -1;
+    n->fd = -1;
+    memset(n->uid, 0, sizeof(n->uid));
+    n->uid[0] = 0x3C;
+    n->uid[1] = 0x57;
+    n->uid[PORT_UNIQUE_ID_SIZE - 2] = (uint8_t)(i >> 8);
+    n->uid[PORT_UNIQUE_ID_SIZE - 1] = (uint8_t)i;
+    n->address = __uid_address(n->uid);
+
+    for (uint32_t j = 0; j < i; j++)
+    {
+      if (nodes[j].address == n->address)
+      {
+        // Такие устройства DISCOVER не различит, им нужен назначенный адрес
+        fprintf(stderr, "nodes %u and %u derive the same address 0x%02X\n", j, i, n->address);
+        return 2;
+      }
+    }
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  for (uint32_t i = 0; i < num_nodes; i++)
+  {
+    char flash[512];
+
+    snprintf(flash, sizeof(flash), "%s/node%u.bin", dir, i);
+    if (__spawn_node(&nodes[i], sim, flash) != 0)
+    {
+      __kill_nodes();
+      return 1;
+    }
+  }
+
+  // Симуляторы включаются одновременно, как устройства на общем питании;
+  // ждем окончания проверки прошивки в InitBootloader
+  usleep(300000);
+
+  memset(bitmap, 0, sizeof(bitmap));
+
+  for (round = 1; (round <= max_rounds) && (found < num_nodes); round++)
+  {
+    uint32_t collided = 0;
+    int replies = __round(bitmap, (uint16_t)window_ms);
+
+    if (replies < 0)
+    {
+      fprintf(stderr, "simulator exited\n");
+      goto out;
+    }
+
+    for (uint32_t i = 0; i < num_nodes; i++)
+    {
+      struct node_s *n = &nodes[i];
+      uint64_t end = n->rx_us + (uint64_t)n->rx_len * 10 * 1000000 / baud;
+      int lost = 0;
+
+      if (n->rx_len == 0)
+        continue;
+
+      // Передача на линии перекрывается с ответом другого устройства
+      for (uint32_t j = 0; j < num_nodes; j++)
+      {
+        const struct node_s *m = &nodes[j];
+        uint64_t m_end = m->rx_us + (uint64_t)m->rx_len * 10 * 1000000 / baud;
+
+        if ((j != i) && (m->rx_len != 0) && (m->rx_us < end) && (n->rx_us < m_end))
+          lost = 1;
+      }
+
+      if (lost)
+      {
+        collided++;
+        continue;
+      }
+
+      int addr = __reply_address(n);
+      if ((addr < 0) || (addr != n->address))
+      {
+        fprintf(stderr, "node %u: bad reply (address %d, expected %u)\n", i, addr, n->address);
+        goto out;
+      }
+
+      if (n->found)
+      {
+        fprintf(stderr, "node %u: replied although already found\n", i);
+        goto out;
+      }
+
+      n->found = 1;
+      found++;
+      bitmap[addr >> 3] |= (uint8_t)(1 << (addr & 0x07));
+    }
+
+    printf("round %2u: replies %2d, collided %2u, found %2u/%u\n",
+           round, replies, collided, found, num_nodes);
+  }
+
+  if (found == num_nodes)
+  {
+    printf("all %u devices found in %u rounds, addresses:", num_nodes, round - 1);
+    for (uint32_t i = 0; i < num_nodes; i++)
+      printf(" 0x%02X", nodes[i].address);
+    printf("\n");
+    rc = 0;
+  }
+  else
+  {
+    printf("found %u of %u devices in %u rounds\n", found, num_nodes, max_rounds);
+  }
+
+out:
+  __kill_nodes();
+  return rc;
+}
@@ -0,0 +1,93 @@
+#ifndef __BOOTLOADER_PROJECT_CONFIG_H__
+#define __BOOTLOADER_PROJECT_CONFIG_H__
+
+/*
+  Конфигурация симулятора повторяет параметры платы
+  gd32e230c8-rs485-bootloader, чтобы результаты замеров
+  переносились на реальное устройство, но включает все
+  необязательные функции ядра для проверки утилит хоста.
+  Параметры, отмеченные #ifndef, можно переопределить при сборке
+  (make CFLAGS_EXTRA=-DBOOTLOADER_RESPONSE_DELAY_MS=0)
+*/
+
+#ifndef BOOTLOADER_UART_BAUD
+#define BOOTLOADER_UART_BAUD 115200
+#endif
+
+#ifndef BOOTLOADER_RESPONSE_DELAY_MS
+#define BOOTLOADER_RESPONSE_DELAY_MS 20
+#endif
+
+// Окно запросов хоста (GET_INFO) - как FIFO приемника платы
+#define BOOTLOADER_RX_FIFO_SIZE 128
+
+#define BOOTLOADER_TIMEOUT_MS 5000
+
+// Минимальный интервал между событиями о ходе очистки flash, мс
+// (меньше тайм-аута ответа хоста, 300 мс)
+#define BOOTLOADER_ERASE_EVENT_INTERVAL_MS 50
+
+// Область кода Bootloader-а платы (регион IROM1 в GD32E230C8.icf),
+// в симуляторе - только для проверки раскладки flash при сборке
+#define BOOTLOADER_CODE_BEGIN  0x08000000UL
+#define BOOTLOADER_CODE_LENGTH 0x2C00UL
+
+#define BOOTLOADER_APP_BEGIN   0x08003000UL
+#define BOOTLOADER_APP_LENGTH  53248UL
+
+// Журнал сессии обновления (команда RESUME).
+// Занимает последний сектор области Bootloader-а
+#define BOOTLOADER_USE_JOURNAL
+#define BOOTLOADER_JOURNAL_BEGIN 0x08002C00UL
+
+#define BOOTLOADER_DEVICE_ID_STRING "posix-sim"
+
+// Разреженные образы (команда SEGMENT_MAP): стертые (0xFF)
+// участки образа не передаются и не записываются
+#define BOOTLOADER_USE_SPARSE
+
+// Разностное обновление (команды DELTA_BEGIN, DELTA_CHUNK):
+// сектор собирается в ОЗУ (BOOTLOADER_FLASH_SECTOR_SIZE байт)
+#define BOOTLOADER_USE_DELTA
+
+// Кэш записи: чанки собираются в секторе в ОЗУ в любом порядке,
+// сектор записывается во flash целиком (буфер общий с BOOTLOADER_USE_DELTA)
+#define BOOTLOADER_USE_SECTOR_CACHE
+
+// Широковещательная сессия обновления
+#define BOOTLOADER_USE_BROADCAST
+
+// Помехоустойчивое кодирование пакетов binex (команда SET_FEC),
+// код Рида-Соломона rs-fec.c - около 2 КБ flash
+#define BOOTLOADER_USE_FEC
+
+// Кадрирование binex COBS (согласуется в ACTIVATE)
+#define BOOTLOADER_USE_COBS
+
+// Адресация пакетов binex на общей шине
+//#define BOOTLOADER_USE_ADDRESSING
+
+// Адрес устройства на шине (0x00..0x7E), как у платы, не задается
+// при сборке: назначенный адрес - параметр --address, без него
+// адрес выводится из UID МК (параметр --uid)
+
+// Счетчики приема, ошибок и времени операций flash
+// (команда GET_STATS)
+#define BOOTLOADER_USE_STATS
+
+// Буфер событий с отметками времени (команда GET_TRACE),
+// размер - количество записей по 8 байт, степень двойки
+#define BOOTLOADER_USE_TRACE
+#define BOOTLOADER_TRACE_SIZE 64
+
+// Режим проверки канала (команда LINK_TEST): прием и эхо пакетов
+// заданного размера и содержимого, счетчики ошибок приема
+#define BOOTLOADER_USE_LINK_TEST
+
+// Режим ретранслятора: канал 0 - дескриптор --relay-fd,
+// к которому подключается симулятор нижестоящего устройства
+#define BOOTLOADER_USE_RELAY
+#define BOOTLOADER_RELAY_CHANNELS 1
+#define BOOTLOADER_RELAY_TIMEOUT_MS 1000
+
+#endif
@@ -0,0 +1,252 @@
+/*
+  Время обработки SEND и WRITE ядром Bootloader-а на хосте.
+  Ядро (bootloader.c либо модуль ядра на C++) работает в одном процессе
+  с моделью хоста без линии связи: запрос передается в приемник целиком,
+  ProcessBootloader вызывается до передачи ответа. Задержка ответа
+  пропускается виртуальным временем SYSTICK, flash - hal/posix.
+  Замеряется время от передачи запроса до получения ответа, в него
+  входят прием и разбор пакета binex, расшифровка (SEND) либо запись
+  (WRITE, с системными вызовами mprotect порта flash) и передача ответа.
+  Образ записывается rounds раз, выводится среднее по чанкам лучшего
+  прохода. Время хоста, а не такты МК: для сравнения вариантов сборки
+  ядра одним компилятором (цель cpp-report)
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bootloader.h"
+#include "bootloader_port.h"
+#include "binex-lib.h"
+#include "flash_sim.h"
+#include "fw_pack.h"
+#include "systick.h"
+#include "bootloader_config.h"
+
+/******************************************************************************/
+
+#include "private_keys.inc"
+
+/******************************************************************************/
+
+#define CMD_ACTIVATE 0x70
+#define CMD_BEGIN 0x71
+#define CMD_SEND 0x72
+#define CMD_WRITE 0x73
+
+#define STATUS_EVENT 0xFF
+
+// Проходов ProcessBootloader на запрос, больше - ядро не ответило
+#define MAX_STEPS 100000
+
+#define QUEUE_SIZE 1024
+
+/******************************************************************************/
+
+static uint32_t now_ms;
+
+static uint8_t rx_queue[QUEUE_SIZE]; // к устройству
+static uint32_t rx_head, rx_tail;
+
+static Binex_t host_link;
+static uint8_t host_rx_buff[BUFFER_EXCH_SIZE];
+static uint16_t host_rx_len;
+
+/******************************************************************************/
+
+uint32_t SysTickGetValue(void)
+{
+  return now_ms;
+}
+
+uint32_t SysTickGetUs(void)
+{
+  return now_ms * 1000UL;
+}
+
+int16_t port_serial_getc(void)
+{
+  if (rx_head == rx_tail)
+    return -1;
+  return rx_queue[rx_tail++ % QUEUE_SIZE];
+}
+
+// Ответ устройства сразу разбирается хостом
+int16_t port_serial_putc(uint8_t c)
+{
+  if (binex_rx(&host_link, c) == BINEX_PACK_RX)
+    host_rx_len = binex_rx_len(&host_link);
+  return c;
+}
+
+int port_serial_transfer_completed(void)
+{
+  return 1;
+}
+
+uint32_t port_serial_rx_lost(void)
+{
+  return 0;
+}
+
+void port_serial_rx_errors(uint32_t *overrun, uint32_t *framing, uint32_t *noise)
+{
+  *overrun = 0;
+  *framing = 0;
+  *noise = 0;
+}
+
+void port_deinit_all(void)
+{
+}
+
+void port_application_run(void)
+{
+  fprintf(stderr, "cpp-bench: unexpected application run\n");
+  exit(1);
+}
+
+/******************************************************************************/
+
+static int __host_tx_callback(void *arg, uint8_t c)
+{
+  (void)arg;
+  rx_queue[rx_head++ % QUEUE_SIZE] = c;
+  return 1;
+}
+
+static uint64_t __ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+  Передать запрос и дождаться ответа (события очистки flash пропускаются)
+  Возвращает статус ответа, -1 - ядро не ответило
+*/
+static int __request(const uint8_t *req, uint16_t len)
+{
+  binex_tx_init(&host_link, (void *)req, len);
+  while (binex_tx(&host_link) != BINEX_PACK_TX)
+    ;
+
+  for (uint32_t i = 0; i < MAX_STEPS; i++)
+  {
+    host_rx_len = 0;
+    ProcessBootloader();
+    now_ms += 1000; // задержка ответа и интервал событий очистки
+
+    if ((host_rx_len >= 2) && (host_rx_buff[1] != STATUS_EVENT))
+    {
+      int status = host_rx_buff[1];
+
+      binex_rx_begin(&host_link, host_rx_buff, sizeof(host_rx_buff));
+      return (host_rx_buff[0] == req[0]) ? status : -1;
+    }
+    if (host_rx_len)
+      binex_rx_begin(&host_link, host_rx_buff, sizeof(host_rx_buff));
+  }
+  return -1;
+}
+
+int main(int argc, char **argv)
+{
+  const char *label = (argc > 1) ? argv[1] : "core";
+  unsigned rounds = (argc > 2) ? strtoul(argv[2], NULL, 0) : 5;
+  const uint32_t chunks = (BOOTLOADER_APP_LENGTH - MAC_SIZE) / CHUNK_DATA_SIZE;
+  static uint8_t image[BOOTLOADER_APP_LENGTH];
+  uint8_t *packed;
+  uint8_t req[1 + PACK_CHUNK_SIZE];
+  uint8_t nonce[PACK_NONCE_SIZE] = {0};
+  uint64_t send_ns, write_ns, t;
+  uint64_t send_min = UINT64_MAX, write_min = UINT64_MAX;
+
+  if (FlashSimOpen(NULL, 0, 0) != 0)
+    return 1;
+
+  packed = malloc((size_t)chunks * PACK_CHUNK_SIZE);
+  if (packed == NULL)
+    return 1;
+
+  srand(1);
+  for (uint32_t i = 0; i < sizeof(image); i++)
+    image[i] = (uint8_t)rand();
+  for (uint32_t k = 0; k < chunks; k++)
+  {
+    memcpy(nonce, &k, sizeof(k));
+    PackChunk(packed + k * PACK_CHUNK_SIZE, EncryptionKey, nonce, BOOTLOADER_APP_BEGIN + k * CHUNK_DATA_SIZE,
+              image + k * CHUNK_DATA_SIZE, CHUNK_DATA_SIZE);
+  }
+
+  binex_init(&host_link, __host_tx_callback, NULL);
+  binex_rx_begin(&host_link, host_rx_buff, sizeof(host_rx_buff));
+  InitBootloader();
+
+  req[0] = CMD_ACTIVATE;
+  memcpy(req + 1, "ACTIVATE", 8);
+  if (__request(req, 9) != 0)
+  {
+    fprintf(stderr, "cpp-bench: ACTIVATE failed\n");
+    return 1;
+  }
+
+  for (unsigned r = 0; r < rounds; r++)
+  {
+    memset(nonce, 0xFF, sizeof(nonce));
+    nonce[0] = (uint8_t)r;
+    req[0] = CMD_BEGIN;
+    PackIdentityChunk(req + 1, EncryptionKey, nonce, BOOTLOADER_APP_LENGTH, BOOTLOADER_DEVICE_ID_STRING);
+    if (__request(req, 1 + PACK_CHUNK_SIZE) != 0)
+    {
+      fprintf(stderr, "cpp-bench: BEGIN failed\n");
+      return 1;
+    }
+
+    send_ns = 0;
+    write_ns = 0;
+    for (uint32_t k = 0; k < chunks; k++)
+    {
+      req[0] = CMD_SEND;
+      memcpy(req + 1, packed + k * PACK_CHUNK_SIZE, PACK_CHUNK_SIZE);
+      t = __ns();
+      if (__request(req, 1 + PACK_CHUNK_SIZE) != 0)
+      {
+        fprintf(stderr, "cpp-bench: SEND %u failed\n", k);
+        return 1;
+      }
+      send_ns += __ns() - t;
+
+      req[0] = CMD_WRITE;
+      t = __ns();
+      if (__request(req, 1) != 0)
+      {
+        fprintf(stderr, "cpp-bench: WRITE %u failed\n", k);
+        return 1;
+      }
+      write_ns += __ns() - t;
+    }
+
+    if (memcmp((const void *)BOOTLOADER_APP_BEGIN, image, (size_t)chunks * CHUNK_DATA_SIZE) != 0)
+    {
+      fprintf(stderr, "cpp-bench: flash does not match the image\n");
+      return 1;
+    }
+
+    if (send_ns < send_min)
+      send_min = send_ns;
+    if (write_ns < write_min)
+      write_min = write_ns;
+  }
+
+  printf("%-10s SEND %6.2f us, WRITE %6.2f us (best of %u x %u chunks)\n", label,
+         send_min / 1000.0 / chunks, write_min / 1000.0 / chunks, rounds, chunks);
+
+  free(packed);
+  return 0;
+}
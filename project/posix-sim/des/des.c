@@ -0,0 +1,922 @@
+/*
+  Симулятор процесса обновления с виртуальным временем (discrete-event).
+  Неизмененный конечный автомат ProcessBootloader работает в одном процессе
+  с моделью хоста. Время не измеряется, а моделируется:
+    - линия RS-485: скорость, 10 бит на символ, время переключения
+      направления передачи, FIFO передатчика МК
+    - задержка ответа BOOTLOADER_RESPONSE_DELAY_MS (по SYSTICK ядра)
+    - стирание сектора и запись слова flash (hal/posix)
+    - расшифровка чанков и проверка MAC прошивки на МК
+      (вызовы monocypher перехватываются через -Wl,--wrap)
+    - задержка хоста (USB-RS485 адаптер, ОС) и тайм-аут ответа
+    - искажение битов на линии и повторные передачи хоста
+  Результат - таблица прогнозируемого времени обновления для
+  сочетаний скорости и вероятности ошибки на бит. Размер чанка
+  задается при сборке (CHUNK_DATA_SIZE), см. цель des-matrix в Makefile.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include "bootloader.h"
+#include "bootloader_port.h"
+#include "binex-lib.h"
+#include "flash_sim.h"
+#include "fw_pack.h"
+#include "monocypher.h"
+#include "systick.h"
+#include "bootloader_project_config.h"
+
+/******************************************************************************/
+
+#include "private_keys.inc"
+
+/******************************************************************************/
+
+#define CMD_ACTIVATE 0x70
+#define CMD_BEGIN 0x71
+#define CMD_SEND 0x72
+#define CMD_WRITE 0x73
+#define CMD_END 0x74
+#define CMD_CHECK_CRC 0x75
+#define CMD_APP_RUN 0x76
+
+#define STATUS_EVENT 0xFF
+
+#define FRAMING_COBS 0x01
+
+#define NUM_CHUNKS ((BOOTLOADER_APP_LENGTH + PACK_CHUNK_DATA_SIZE - 1) / PACK_CHUNK_DATA_SIZE)
+
+// Размеры FIFO приемника и передатчика платы (serial_port.c)
+#define DEV_RX_FIFO_SIZE 128
+#define DEV_TX_FIFO_SIZE 128
+
+#define LINE_QUEUE_SIZE 1024 // степень двойки
+
+#define NS_PER_MS 1000000ULL
+
+/******************************************************************************/
+
+struct des_config_s
+{
+  uint32_t baud;
+  double ber;                // Вероятность искажения бита
+  uint32_t turnaround_us;    // Переключение направления передачи RS-485
+  uint32_t host_latency_us;  // Задержка хоста от приема ответа до отправки запроса
+  uint32_t resp_timeout_ms;  // Тайм-аут ожидания ответа хостом
+  uint32_t max_retries;      // Допустимое число повторов одной команды
+  uint32_t erase_us;         // Стирание сектора
+  uint32_t program_us;       // Запись слова
+  uint32_t mcu_mhz;          // Частота ядра МК
+  uint32_t cpb_chacha;       // Тактов на байт ChaCha20
+  uint32_t cpb_poly;         // Тактов на байт Poly1305
+  uint32_t loop_cycles;      // Тактов на проход ProcessBootloader с работой
+  uint8_t cobs;              // Кадрирование COBS, запрашивается в ACTIVATE
+};
+
+/* Очередь символов в линии: символ и время окончания его передачи */
+struct line_s
+{
+  uint64_t t[LINE_QUEUE_SIZE];
+  uint8_t c[LINE_QUEUE_SIZE];
+  uint32_t head, tail;
+  uint64_t free_ns; // Время окончания передачи последнего символа
+  uint64_t bytes;
+  uint64_t corrupted;
+};
+
+struct des_result_s
+{
+  uint8_t ok;
+  uint64_t time_ns;
+  uint64_t bytes_tx;
+  uint64_t bytes_rx;
+  uint32_t retries;
+};
+
+/* Шаги процесса обновления на стороне хоста */
+enum
+{
+  HOST_IDLE = 0, // Ожидание момента отправки запроса
+  HOST_WAIT,     // Ожидание ответа
+  HOST_DONE,
+  HOST_FAIL
+};
+
+/******************************************************************************/
+
+static struct des_config_s cfg =
+{
+  .baud = BOOTLOADER_UART_BAUD,
+  .turnaround_us = 50,
+  .host_latency_us = 1000,
+  .resp_timeout_ms = 200,
+  .max_retries = 20,
+  .erase_us = 3000,
+  .program_us = 40,
+  .mcu_mhz = 72,
+  .cpb_chacha = 40,
+  .cpb_poly = 35,
+  .loop_cycles = 200,
+};
+
+static uint64_t now_ns;
+static uint64_t byte_ns;
+static uint32_t p_byte_error; // Вероятность искажения символа, доли 2^32
+static uint64_t rnd_state;
+
+static struct line_s host2dev;
+static struct line_s dev2host;
+
+static FILE *capture; // Запись символов линии (--capture)
+
+static uint8_t in_device; // Выполняется код МК
+static uint8_t dev_io;    // МК выполнил работу в текущем проходе
+static uint8_t dev_wait;  // МК ожидает события
+static uint32_t dev_rx_lost; // Символов потеряно при переполнении FIFO приемника МК
+
+static jmp_buf app_run_jmp;
+
+/* Хост */
+static Binex_t host_link;
+static uint8_t host_rx_buff[512];
+static uint8_t host_state;
+static uint32_t host_step;
+static uint32_t host_retries;
+static uint32_t host_step_retries;
+static uint8_t host_cobs; // Текущее кадрирование хоста
+static uint64_t host_wake_ns;
+static uint64_t host_deadline_ns;
+
+static uint8_t image[BOOTLOADER_APP_LENGTH];
+static uint8_t identity[PACK_CHUNK_SIZE];
+static uint8_t chunks[NUM_CHUNKS][PACK_CHUNK_SIZE];
+
+/******************************************************************************/
+
+static uint32_t __rand32(void)
+{
+  // xorshift64*
+  rnd_state ^= rnd_state >> 12;
+  rnd_state ^= rnd_state << 25;
+  rnd_state ^= rnd_state >> 27;
+  return (uint32_t)((rnd_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static void __cycles(uint64_t cycles)
+{
+  now_ns += cycles * 1000 / cfg.mcu_mhz;
+  dev_io = 1;
+}
+
+/******************************************************************************/
+
+static void __line_reset(struct line_s *l)
+{
+  memset(l, 0, sizeof(*l));
+}
+
+static uint32_t __line_count(struct line_s *l)
+{
+  return l->head - l->tail;
+}
+
+/*
+  Передать символ в линию не раньше момента start_ns
+*/
+static void __line_put(struct line_s *l, uint8_t c, uint64_t start_ns)
+{
+  uint32_t i = l->head & (LINE_QUEUE_SIZE - 1);
+
+  // Линия простаивала - передатчику нужно время на переключение
+  if (l->free_ns <= start_ns)
+    l->free_ns = start_ns + (uint64_t)cfg.turnaround_us * 1000;
+
+  l->free_ns += byte_ns;
+
+  if ((p_byte_error != 0) && (__rand32() < p_byte_error))
+  {
+    c ^= (uint8_t)(1 << (__rand32() & 0x07));
+    l->corrupted++;
+  }
+
+  // Время начала символа, как в записи логического анализатора
+  if (capture)
+    fprintf(capture, "%.9f %c %02X\n", (l->free_ns - byte_ns) / 1e9,
+            (l == &host2dev) ? 'H' : 'D', c);
+
+  l->t[i] = l->free_ns;
+  l->c[i] = c;
+  l->head++;
+  l->bytes++;
+}
+
+/*
+  Получить символ, передача которого закончилась к текущему моменту
+*/
+static int16_t __line_get(struct line_s *l)
+{
+  uint32_t i = l->tail & (LINE_QUEUE_SIZE - 1);
+
+  if ((l->head == l->tail) || (l->t[i] > now_ns))
+    return -1;
+
+  l->tail++;
+  return l->c[i];
+}
+
+/*
+  Количество символов, передача которых еще не закончилась
+*/
+static uint32_t __line_pending(struct line_s *l)
+{
+  uint32_t n = 0;
+
+  for (uint32_t i = l->head; i != l->tail; i--)
+  {
+    if (l->t[(i - 1) & (LINE_QUEUE_SIZE - 1)] <= now_ns)
+      break;
+    n++;
+  }
+
+  return n;
+}
+
+/*
+  Переполнение FIFO приемника: символы, принятые, но не прочитанные,
+  сверх размера FIFO теряются (кольцевой буфер затирает самые старые)
+*/
+static uint32_t __line_overflow(struct line_s *l, uint32_t fifo_size)
+{
+  uint32_t n = 0;
+
+  while ((n < __line_count(l)) && (l->t[(l->tail + n) & (LINE_QUEUE_SIZE - 1)] <= now_ns))
+    n++;
+
+  if (n <= fifo_size)
+    return 0;
+
+  l->tail += n - fifo_size;
+  return n - fifo_size;
+}
+
+/*
+  Время окончания передачи ближайшего символа, 0 - очередь пуста
+*/
+static uint64_t __line_next(struct line_s *l)
+{
+  if (l->head == l->tail)
+    return 0;
+  return l->t[l->tail & (LINE_QUEUE_SIZE - 1)];
+}
+
+/******************************************************************************
+  Порт Bootloader-а
+******************************************************************************/
+
+uint32_t SysTickGetValue(void)
+{
+  return (uint32_t)(now_ns / NS_PER_MS);
+}
+
+uint32_t SysTickGetUs(void)
+{
+  return (uint32_t)(now_ns / 1000);
+}
+
+int16_t port_serial_putc(uint8_t c)
+{
+  if ((__line_pending(&dev2host) >= DEV_TX_FIFO_SIZE) ||
+      (__line_count(&dev2host) >= LINE_QUEUE_SIZE))
+  {
+    dev_wait = 1;
+    return -1;
+  }
+
+  __line_put(&dev2host, c, now_ns);
+  dev_io = 1;
+  return c;
+}
+
+int port_serial_transfer_completed(void)
+{
+  if (dev2host.free_ns > now_ns)
+  {
+    dev_wait = 1;
+    return 0;
+  }
+  return 1;
+}
+
+int16_t port_serial_getc(void)
+{
+  int16_t c;
+
+  dev_rx_lost += __line_overflow(&host2dev, DEV_RX_FIFO_SIZE);
+  c = __line_get(&host2dev);
+
+  if (c < 0)
+    dev_wait = 1;
+  else
+    dev_io = 1;
+
+  return c;
+}
+
+uint32_t port_serial_rx_lost(void)
+{
+  return dev_rx_lost;
+}
+
+void port_serial_rx_errors(uint32_t *overrun, uint32_t *framing, uint32_t *noise)
+{
+  // Искажение символа моделируется заменой значения, флаги USART не моделируются
+  *overrun = 0;
+  *framing = 0;
+  *noise = 0;
+}
+
+// Ретранслятор в модели не участвует: каналов нет, RELAY_POLL вернет
+// тайм-аут. Путь ретранслятора проверяется make relay-test
+int16_t port_relay_putc(uint8_t ch, uint8_t c)
+{
+  (void)ch;
+  (void)c;
+  return -1;
+}
+
+int16_t port_relay_getc(uint8_t ch)
+{
+  (void)ch;
+  return -1;
+}
+
+void port_deinit_all(void)
+{
+}
+
+int port_boot_jumper_is_active(void)
+{
+  return 0;
+}
+
+uint8_t port_get_unit_address(void)
+{
+  return 0x01;
+}
+
+void port_get_unique_id(uint8_t *id)
+{
+  memset(id, 0, PORT_UNIQUE_ID_SIZE);
+}
+
+void port_application_run(void)
+{
+  longjmp(app_run_jmp, 1);
+}
+
+static void __flash_delay(uint32_t us)
+{
+  now_ns += (uint64_t)us * 1000;
+  dev_io = 1;
+}
+
+/******************************************************************************
+  Время работы криптографии на МК
+******************************************************************************/
+
+int __real_crypto_aead_unlock(uint8_t *plain_text, const uint8_t mac[16],
+                              const uint8_t key[32], const uint8_t nonce[24],
+                              const uint8_t *ad, size_t ad_size,
+                              const uint8_t *cipher_text, size_t text_size);
+
+void __real_crypto_poly1305(uint8_t mac[16],
+                            const uint8_t *message, size_t message_size,
+                            const uint8_t key[32]);
+
+int __wrap_crypto_aead_unlock(uint8_t *plain_text, const uint8_t mac[16],
+                              const uint8_t key[32], const uint8_t nonce[24],
+                              const uint8_t *ad, size_t ad_size,
+                              const uint8_t *cipher_text, size_t text_size)
+{
+  if (in_device)
+  {
+    // HChaCha20 + блок ключа Poly1305 + поток шифра
+    uint64_t chacha = 64 + 64 + ((text_size + 63) & ~63UL);
+    uint64_t poly = ((ad_size + 15) & ~15UL) + ((text_size + 15) & ~15UL) + 16;
+
+    __cycles(chacha * cfg.cpb_chacha + poly * cfg.cpb_poly);
+  }
+
+  return __real_crypto_aead_unlock(plain_text, mac, key, nonce,
+                                   ad, ad_size, cipher_text, text_size);
+}
+
+void __wrap_crypto_poly1305(uint8_t mac[16],
+                            const uint8_t *message, size_t message_size,
+                            const uint8_t key[32])
+{
+  if (in_device)
+    __cycles(((message_size + 15) & ~15UL) * cfg.cpb_poly);
+
+  __real_crypto_poly1305(mac, message, message_size, key);
+}
+
+/******************************************************************************
+  Модель хоста
+******************************************************************************/
+
+static int __host_tx_callback(void *arg, uint8_t c)
+{
+  uint64_t *start = (uint64_t *)arg;
+
+  // Очередь переполнена, только если МК давно не читает
+  // приемник, такие символы все равно были бы потеряны
+  if (__line_count(&host2dev) < LINE_QUEUE_SIZE)
+    __line_put(&host2dev, c, *start);
+  return 1;
+}
+
+/*
+  Запрос для текущего шага:
+    0 - ACTIVATE, 1 - BEGIN, далее SEND/WRITE для каждого чанка,
+    затем END, CHECK_CRC, APP_RUN
+*/
+static uint16_t __host_request(uint8_t *req)
+{
+  uint32_t step = host_step;
+
+  if (step == 0)
+  {
+    req[0] = CMD_ACTIVATE;
+    memcpy(req + 1, "ACTIVATE", 8);
+    if (cfg.cobs)
+    {
+      req[9] = FRAMING_COBS;
+      return 10;
+    }
+    return 9;
+  }
+
+  if (step == 1)
+  {
+    req[0] = CMD_BEGIN;
+    memcpy(req + 1, identity, PACK_CHUNK_SIZE);
+    return 1 + PACK_CHUNK_SIZE;
+  }
+
+  step -= 2;
+
+  if (step < (NUM_CHUNKS * 2))
+  {
+    if (step & 1)
+    {
+      req[0] = CMD_WRITE;
+      return 1;
+    }
+
+    req[0] = CMD_SEND;
+    memcpy(req + 1, chunks[step / 2], PACK_CHUNK_SIZE);
+    return 1 + PACK_CHUNK_SIZE;
+  }
+
+  step -= NUM_CHUNKS * 2;
+
+  static const uint8_t tail_cmd[] = {CMD_END, CMD_CHECK_CRC, CMD_APP_RUN};
+  req[0] = tail_cmd[step];
+  return 1;
+}
+
+static uint32_t __host_num_steps(void)
+{
+  return 2 + NUM_CHUNKS * 2 + 3;
+}
+
+static void __host_send(void)
+{
+  static uint8_t req[1 + PACK_CHUNK_SIZE];
+  uint16_t len = __host_request(req);
+  uint64_t start = now_ns;
+
+  // Ответ на ACTIVATE мог быть потерян после переключения
+  // устройства на COBS: повторы чередуют оба режима
+  if (cfg.cobs && (host_step == 0))
+    host_cobs = host_step_retries & 1;
+
+  binex_init(&host_link, __host_tx_callback, &start);
+  binex_cobs_set(&host_link, host_cobs);
+  binex_tx_init(&host_link, req, len);
+  while (binex_tx(&host_link) != BINEX_PACK_TX)
+    ;
+
+  binex_rx_begin(&host_link, host_rx_buff, sizeof(host_rx_buff));
+
+  host_state = HOST_WAIT;
+  host_deadline_ns = host2dev.free_ns + (uint64_t)cfg.resp_timeout_ms * NS_PER_MS;
+}
+
+static void __host_retry(uint32_t step)
+{
+  host_retries++;
+  host_step_retries++;
+
+  if (host_step_retries > cfg.max_retries)
+  {
+    host_state = HOST_FAIL;
+    return;
+  }
+
+  host_step = step;
+  host_state = HOST_IDLE;
+  host_wake_ns = now_ns + (uint64_t)cfg.host_latency_us * 1000;
+}
+
+static void __host_response(const uint8_t *resp, uint16_t len)
+{
+  static uint8_t req[1 + PACK_CHUNK_SIZE];
+
+  __host_request(req);
+
+  if ((len < 2) || (resp[0] != req[0]))
+    return; // Запоздавший ответ на предыдущий запрос
+
+  if (resp[1] == STATUS_EVENT)
+  {
+    // Ход очистки flash, продолжаем ждать
+    host_deadline_ns = now_ns + (uint64_t)cfg.resp_timeout_ms * NS_PER_MS;
+    return;
+  }
+
+  if (resp[1] != 0x00)
+  {
+    // WRITE без принятых данных - повторяем SEND этого чанка
+    if ((req[0] == CMD_WRITE) && (resp[1] == 0x02))
+      __host_retry(host_step - 1);
+    else
+      __host_retry(host_step);
+    return;
+  }
+
+  if ((req[0] == CMD_ACTIVATE) && cfg.cobs)
+  {
+    if ((len < 3) || !(resp[2] & FRAMING_COBS))
+    {
+      host_state = HOST_FAIL;
+      return;
+    }
+    host_cobs = 1;
+  }
+
+  host_step++;
+  host_step_retries = 0;
+
+  if (host_step >= __host_num_steps())
+  {
+    host_state = HOST_DONE;
+    return;
+  }
+
+  host_state = HOST_IDLE;
+  host_wake_ns = now_ns + (uint64_t)cfg.host_latency_us * 1000;
+}
+
+static void __host_process(void)
+{
+  int16_t c;
+
+  while ((c = __line_get(&dev2host)) >= 0)
+  {
+    if ((host_state == HOST_WAIT) &&
+        (binex_rx(&host_link, c) == BINEX_PACK_RX))
+    {
+      __host_response(host_rx_buff, binex_rx_len(&host_link));
+
+      if (host_state == HOST_WAIT)
+        binex_rx_begin(&host_link, host_rx_buff, sizeof(host_rx_buff));
+    }
+  }
+
+  if ((host_state == HOST_WAIT) && (now_ns >= host_deadline_ns))
+    __host_retry(host_step);
+
+  if ((host_state == HOST_IDLE) && (now_ns >= host_wake_ns))
+    __host_send();
+}
+
+/******************************************************************************/
+
+static void __min_event(uint64_t *next, uint64_t t)
+{
+  if ((t > now_ns) && (t < *next))
+    *next = t;
+}
+
+/*
+  Следующий момент, в который что-то может измениться
+*/
+static uint64_t __next_event(void)
+{
+  uint64_t next = (now_ns / NS_PER_MS + 1) * NS_PER_MS; // тик SYSTICK
+
+  __min_event(&next, __line_next(&host2dev));
+  __min_event(&next, __line_next(&dev2host));
+  __min_event(&next, dev2host.free_ns);
+
+  if (host_state == HOST_IDLE)
+    __min_event(&next, host_wake_ns);
+  if (host_state == HOST_WAIT)
+    __min_event(&next, host_deadline_ns);
+
+  return next;
+}
+
+static void __prepare_image(uint32_t seed)
+{
+  uint8_t nonce[PACK_NONCE_SIZE];
+
+  rnd_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+  for (uint32_t i = 0; i < BOOTLOADER_APP_LENGTH; i++)
+    image[i] = (uint8_t)__rand32();
+  PackImageMac(image, BOOTLOADER_APP_LENGTH, IntegrityKey);
+
+  for (int i = 0; i < PACK_NONCE_SIZE; i++)
+    nonce[i] = (uint8_t)__rand32();
+  PackIdentityChunk(identity, EncryptionKey, nonce,
+                    BOOTLOADER_APP_LENGTH, BOOTLOADER_DEVICE_ID_STRING);
+
+  for (uint32_t n = 0; n < NUM_CHUNKS; n++)
+  {
+    uint32_t ofs = n * PACK_CHUNK_DATA_SIZE;
+    uint32_t len = BOOTLOADER_APP_LENGTH - ofs;
+
+    if (len > PACK_CHUNK_DATA_SIZE)
+      len = PACK_CHUNK_DATA_SIZE;
+
+    nonce[0]++;
+    PackChunk(chunks[n], EncryptionKey, nonce, BOOTLOADER_APP_BEGIN + ofs,
+              image + ofs, (uint8_t)len);
+  }
+}
+
+/*
+  Одно обновление с текущей конфигурацией
+*/
+static void __run(uint32_t seed, struct des_result_s *res)
+{
+  uint8_t prev_io = 1;
+  volatile uint8_t app_started = 0;
+
+  memset(res, 0, sizeof(*res));
+
+  FlashSimClose();
+  if (FlashSimOpen(NULL, cfg.erase_us, cfg.program_us) != 0)
+    exit(1);
+  FlashSimSetDelayHook(__flash_delay);
+
+  now_ns = 0;
+  dev_rx_lost = 0;
+  rnd_state = seed * 0x9E3779B97F4A7C15ULL + 7;
+  __line_reset(&host2dev);
+  __line_reset(&dev2host);
+
+  host_state = HOST_IDLE;
+  host_step = 0;
+  host_retries = 0;
+  host_step_retries = 0;
+  host_cobs = 0;
+  host_wake_ns = 0;
+
+  in_device = 1;
+  InitBootloader();
+  in_device = 0;
+
+  if (setjmp(app_run_jmp) != 0)
+  {
+    // Приложение запущено раньше, чем хост завершил обновление
+    in_device = 0;
+    app_started = 1;
+  }
+
+  while (!app_started && (host_state != HOST_DONE) && (host_state != HOST_FAIL))
+  {
+    dev_io = 0;
+    dev_wait = 0;
+
+    in_device = 1;
+    ProcessBootloader();
+    in_device = 0;
+
+    __host_process();
+
+    // Проход без работы: МК ждет символ, тик таймера или
+    // освобождения передатчика - переходим к следующему событию
+    if (!dev_io && (dev_wait || !prev_io))
+      now_ns = __next_event();
+    else if (dev_io)
+      now_ns += (uint64_t)cfg.loop_cycles * 1000 / cfg.mcu_mhz;
+
+    prev_io = dev_io;
+  }
+
+  res->ok = (host_state == HOST_DONE);
+  res->time_ns = now_ns;
+  res->bytes_tx = host2dev.bytes;
+  res->bytes_rx = dev2host.bytes;
+  res->retries = host_retries;
+}
+
+/******************************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --baud LIST         comma separated (default: 9600,19200,57600,115200,230400,460800)\n"
+          "  --ber LIST          bit error rates (default: 0,1e-6,1e-5,1e-4)\n"
+          "  --trials N          runs per combination with errors (default: 5)\n"
+          "  --turnaround-us N   RS-485 direction switch time (default: %u)\n"
+          "  --host-latency-us N host reaction time (default: %u)\n"
+          "  --timeout-ms N      host response timeout (default: %u)\n"
+          "  --retries N         max retries per command (default: %u)\n"
+          "  --erase-us N        sector erase time (default: %u)\n"
+          "  --program-us N      word program time (default: %u)\n"
+          "  --mcu-mhz N         MCU core clock (default: %u)\n"
+          "  --cpb-chacha N      ChaCha20 cycles per byte (default: %u)\n"
+          "  --cpb-poly N        Poly1305 cycles per byte (default: %u)\n"
+          "  --cobs              COBS framing requested at ACTIVATE\n"
+          "  --capture FILE      write line symbols of one run (first baud/ber)\n"
+          "                      for host/capture\n"
+          "  --no-header         do not print table header\n",
+          name, cfg.turnaround_us, cfg.host_latency_us, cfg.resp_timeout_ms,
+          cfg.max_retries, cfg.erase_us, cfg.program_us, cfg.mcu_mhz,
+          cfg.cpb_chacha, cfg.cpb_poly);
+}
+
+static int __parse_list(const char *s, double *out, int max)
+{
+  int n = 0;
+  char *end;
+
+  while (*s && (n < max))
+  {
+    out[n++] = strtod(s, &end);
+    if (end == s)
+      return 0;
+    s = (*end == ',') ? end + 1 : end;
+  }
+
+  return n;
+}
+
+int main(int argc, char **argv)
+{
+  double baud_list[16] = {9600, 19200, 57600, 115200, 230400, 460800};
+  double ber_list[16] = {0, 1e-6, 1e-5, 1e-4};
+  int num_baud = 6;
+  int num_ber = 4;
+  uint32_t trials = 5;
+  int header = 1;
+  const char *capture_path = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--baud") && (i + 1 < argc))
+      num_baud = __parse_list(argv[++i], baud_list, 16);
+    else if (!strcmp(argv[i], "--ber") && (i + 1 < argc))
+      num_ber = __parse_list(argv[++i], ber_list, 16);
+    else if (!strcmp(argv[i], "--trials") && (i + 1 < argc))
+      trials = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--turnaround-us") && (i + 1 < argc))
+      cfg.turnaround_us = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--host-latency-us") && (i + 1 < argc))
+      cfg.host_latency_us = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--timeout-ms") && (i + 1 < argc))
+      cfg.resp_timeout_ms = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--retries") && (i + 1 < argc))
+      cfg.max_retries = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--erase-us") && (i + 1 < argc))
+      cfg.erase_us = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--program-us") && (i + 1 < argc))
+      cfg.program_us = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--mcu-mhz") && (i + 1 < argc))
+      cfg.mcu_mhz = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--cpb-chacha") && (i + 1 < argc))
+      cfg.cpb_chacha = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--cpb-poly") && (i + 1 < argc))
+      cfg.cpb_poly = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--cobs"))
+      cfg.cobs = 1;
+    else if (!strcmp(argv[i], "--capture") && (i + 1 < argc))
+      capture_path = argv[++i];
+    else if (!strcmp(argv[i], "--no-header"))
+      header = 0;
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if ((num_baud == 0) || (num_ber == 0) || (trials == 0) || (cfg.mcu_mhz == 0))
+  {
+    usage(argv[0]);
+    return 2;
+  }
+
+  if (header)
+  {
+    printf("# response delay %u ms, turnaround %u us, host latency %u us, timeout %u ms\n",
+           BOOTLOADER_RESPONSE_DELAY_MS, cfg.turnaround_us, cfg.host_latency_us, cfg.resp_timeout_ms);
+    printf("# erase %u us, program %u us, MCU %u MHz, ChaCha20 %u c/B, Poly1305 %u c/B\n",
+           cfg.erase_us, cfg.program_us, cfg.mcu_mhz, cfg.cpb_chacha, cfg.cpb_poly);
+    printf("# framing %s\n", cfg.cobs ? "COBS" : "binex (escape)");
+    printf("%6s %8s %8s %10s %10s %10s %9s %9s %8s %6s\n",
+           "chunk", "baud", "ber", "time_s", "min_s", "max_s",
+           "tx_bytes", "rx_bytes", "retries", "fail");
+  }
+
+  // Запись линии - для одного прогона
+  if (capture_path)
+  {
+    capture = fopen(capture_path, "w");
+    if (!capture)
+    {
+      perror(capture_path);
+      return 1;
+    }
+
+    fprintf(capture, "# polyboot capture: time_s dir(H - host, D - device) byte\n");
+    num_baud = 1;
+    num_ber = 1;
+    trials = 1;
+  }
+
+  __prepare_image(1);
+  binex_init(&host_link, __host_tx_callback, NULL);
+
+  for (int b = 0; b < num_baud; b++)
+  {
+    for (int e = 0; e < num_ber; e++)
+    {
+      uint32_t n = (ber_list[e] > 0) ? trials : 1;
+      double p = 1.0;
+      double sum = 0, min = 0, max = 0;
+      double tx = 0, rx = 0, retries = 0;
+      uint32_t ok = 0;
+
+      cfg.baud = (uint32_t)baud_list[b];
+      cfg.ber = ber_list[e];
+      byte_ns = 10ULL * 1000000000ULL / cfg.baud;
+
+      // Вероятность искажения хотя бы одного из 10 бит символа
+      for (int i = 0; i < 10; i++)
+        p *= 1.0 - cfg.ber;
+      p_byte_error = (uint32_t)((1.0 - p) * 4294967295.0);
+
+      for (uint32_t t = 0; t < n; t++)
+      {
+        struct des_result_s res;
+        double sec;
+
+        __run(t + 1, &res);
+
+        if (!res.ok)
+          continue;
+
+        sec = res.time_ns / 1e9;
+        if ((ok == 0) || (sec < min))
+          min = sec;
+        if (sec > max)
+          max = sec;
+
+        sum += sec;
+        tx += res.bytes_tx;
+        rx += res.bytes_rx;
+        retries += res.retries;
+        ok++;
+      }
+
+      if (ok == 0)
+      {
+        printf("%6u %8u %8.0e %10s %10s %10s %9s %9s %8s %3u/%-2u\n",
+               PACK_CHUNK_DATA_SIZE, cfg.baud, cfg.ber,
+               "-", "-", "-", "-", "-", "-", n, n);
+        continue;
+      }
+
+      printf("%6u %8u %8.0e %10.2f %10.2f %10.2f %9.0f %9.0f %8.1f %3u/%-2u\n",
+             PACK_CHUNK_DATA_SIZE, cfg.baud, cfg.ber,
+             sum / ok, min, max, tx / ok, rx / ok, retries / ok, n - ok, n);
+      fflush(stdout);
+    }
+  }
+
+  if (capture)
+    fclose(capture);
+
+  FlashSimClose();
+  return 0;
+}
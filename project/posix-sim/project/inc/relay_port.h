@@ -0,0 +1,22 @@
+#ifndef __RELAY_PORT_H__
+#define __RELAY_PORT_H__
+
+#include <stdint.h>
+
+/*
+  Канал ретранслятора симулятора поверх файлового дескриптора:
+  обычно конец socketpair, к другому концу которого подключен
+  симулятор нижестоящего устройства (--fd). Дескриптор переводится
+  в неблокирующий режим.
+*/
+
+// Использовать готовый дескриптор
+int RelayPortInit(int fd);
+
+int16_t RelayPortPutc(uint8_t c);
+int16_t RelayPortGetc(void);
+
+// Передать накопленные символы, вызывается в главном цикле
+void RelayPortFlush(void);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef __SERIAL_PORT_H__
+#define __SERIAL_PORT_H__
+
+#include <stdint.h>
+
+/*
+  Последовательный интерфейс симулятора поверх файлового дескриптора
+  (pty, socketpair, pipe). Дескриптор переводится в неблокирующий режим.
+*/
+
+// Использовать готовый дескриптор
+int SerialPortInit(int fd);
+
+// Создать псевдотерминал, имя подчиненного устройства выводится в stdout
+int SerialPortInitPty(void);
+
+void SerialPortDeinit(void);
+
+int16_t SerialPortPutc(uint8_t c);
+int16_t SerialPortGetc(void);
+int SerialPortTransferCompleted(void);
+
+// Передать накопленные символы, вызывается в главном цикле
+void SerialPortFlush(void);
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef __SYSTICK_H__
+#define __SYSTICK_H__
+
+#include <stdint.h>
+
+/*
+  Системное время симулятора, мс, по монотонным часам хоста
+*/
+uint32_t SysTickGetValue(void);
+
+/*
+  То же, мкс
+*/
+uint32_t SysTickGetUs(void);
+
+#define SYSTICK_GET_VALUE()     (SysTickGetValue())
+#define SYSTICK_GET_US()        (SysTickGetUs())
+
+#endif
@@ -0,0 +1,12 @@
+#include "bootloader.hpp"
+
+/*
+  Ядро Bootloader-а на C++ (core/inc/bootloader.hpp) вместо bootloader.c:
+  конфигурация проекта, порт - функции bootloader_port.h из main.c
+  и hal/posix. Собирается только с конфигурацией без BOOTLOADER_USE_xxx
+  (цели cpp-test и cpp-report)
+*/
+
+using SimCore = bootloader::Core<>;
+
+BOOTLOADER_CORE_UNIT(SimCore)
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bootloader.h"
+#include "bootloader_port.h"
+#include "serial_port.h"
+#include "relay_port.h"
+#include "flash_sim.h"
+#include "systick.h"
+#include "bootloader_project_config.h"
+
+/******************************************************************************/
+
+static uint8_t unit_address = 0xFF; // Адрес не назначен, выводится из UID
+static uint8_t unique_id[PORT_UNIQUE_ID_SIZE];
+static int boot_jumper = 0;
+
+/******************************************************************************/
+
+int16_t port_serial_putc(uint8_t c)
+{
+  return SerialPortPutc(c);
+}
+
+int port_serial_transfer_completed(void)
+{
+  return SerialPortTransferCompleted();
+}
+
+int16_t port_serial_getc(void)
+{
+  return SerialPortGetc();
+}
+
+uint32_t port_serial_rx_lost(void)
+{
+  return 0; // Данные буферизует ОС, потерь в симуляторе нет
+}
+
+void port_serial_rx_errors(uint32_t *overrun, uint32_t *framing, uint32_t *noise)
+{
+  // Ошибки символов в симуляторе не возникают
+  *overrun = 0;
+  *framing = 0;
+  *noise = 0;
+}
+
+// Канал ретранслятора 0 - дескриптор --relay-fd, без него
+// канал не подключен: пакеты теряются, ответов нет
+int16_t port_relay_putc(uint8_t ch, uint8_t c)
+{
+  (void)ch; // BOOTLOADER_RELAY_CHANNELS = 1
+  return RelayPortPutc(c);
+}
+
+int16_t port_relay_getc(uint8_t ch)
+{
+  (void)ch;
+  return RelayPortGetc();
+}
+
+void port_deinit_all(void)
+{
+  SerialPortDeinit();
+}
+
+int port_boot_jumper_is_active(void)
+{
+  return boot_jumper;
+}
+
+uint8_t port_get_unit_address(void)
+{
+  return unit_address;
+}
+
+void port_get_unique_id(uint8_t *id)
+{
+  memcpy(id, unique_id, PORT_UNIQUE_ID_SIZE);
+}
+
+/*
+  UID МК из строки шестнадцатеричных цифр, старший байт первый,
+  недостающие старшие байты - нули.
+  Возвращает 0 - OK, -1 - ошибка формата
+*/
+static int parse_uid(const char *s)
+{
+  size_t n = strlen(s);
+  int i;
+
+  if ((n == 0) || (n > 2 * PORT_UNIQUE_ID_SIZE) || (strspn(s, "0123456789abcdefABCDEF") != n))
+    return -1;
+
+  memset(unique_id, 0, sizeof(unique_id));
+  for (i = 0; n > 0; i++)
+  {
+    char hex[3] = {0};
+    hex[0] = (n >= 2) ? s[n - 2] : '0';
+    hex[1] = s[n - 1];
+    unique_id[PORT_UNIQUE_ID_SIZE - 1 - i] = (uint8_t)strtoul(hex, NULL, 16);
+    n = (n >= 2) ? (n - 2) : 0;
+  }
+
+  return 0;
+}
+
+/******************************************************************************/
+
+static void usage(const char *name)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --flash PATH      flash image file (default: flash.bin)\n"
+          "  --fd N            use open descriptor N as serial line\n"
+          "  --pty             create pty, print slave name to stdout (default)\n"
+          "  --address N       unit address on the bus\n"
+          "                    (default: derived from --uid)\n"
+          "  --uid HEX         96-bit MCU unique ID (default: 0)\n"
+          "  --jumper          BOOT jumper is active\n"
+          "  --relay-fd N      use open descriptor N as relay channel 0\n"
+          "  --erase-us N      emulated sector erase time, us\n"
+          "  --program-us N    emulated word program time, us\n",
+          name);
+}
+
+int main(int argc, char **argv)
+{
+  const char *flash_path = "flash.bin";
+  int fd = -1;
+  int relay_fd = -1;
+  uint32_t erase_us = 0;
+  uint32_t program_us = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "--flash") && (i + 1 < argc))
+      flash_path = argv[++i];
+    else if (!strcmp(argv[i], "--fd") && (i + 1 < argc))
+      fd = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--pty"))
+      fd = -1;
+    else if (!strcmp(argv[i], "--address") && (i + 1 < argc))
+      unit_address = (uint8_t)strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--uid") && (i + 1 < argc))
+    {
+      if (parse_uid(argv[++i]) != 0)
+      {
+        usage(argv[0]);
+        return 2;
+      }
+    }
+    else if (!strcmp(argv[i], "--jumper"))
+      boot_jumper = 1;
+    else if (!strcmp(argv[i], "--relay-fd") && (i + 1 < argc))
+      relay_fd = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "--erase-us") && (i + 1 < argc))
+      erase_us = strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "--program-us") && (i + 1 < argc))
+      program_us = strtoul(argv[++i], NULL, 0);
+    else
+    {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (FlashSimOpen(flash_path, erase_us, program_us) != 0)
+    return 1;
+
+  if (((fd >= 0) ? SerialPortInit(fd) : SerialPortInitPty()) != 0)
+    return 1;
+
+  if ((relay_fd >= 0) && (RelayPortInit(relay_fd) != 0))
+    return 1;
+
+  InitBootloader();
+
+  for (;;)
+  {
+    ProcessBootloader();
+
+    // Символы передаются пачкой за один проход главного цикла,
+    // а не системным вызовом на каждый символ
+    SerialPortFlush();
+    RelayPortFlush();
+  }
+}
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "relay_port.h"
+
+/******************************************************************************/
+
+#define FIFOBUFSIZE_RX 256
+#define FIFOBUFSIZE_TX 256
+
+/******************************************************************************/
+
+static int relay_fd = -1;
+
+static uint8_t buff_rx[FIFOBUFSIZE_RX];
+static uint16_t rx_pos, rx_len;
+
+static uint8_t buff_tx[FIFOBUFSIZE_TX];
+static uint16_t tx_len;
+
+/******************************************************************************/
+
+void RelayPortFlush(void)
+{
+  uint16_t pos = 0;
+
+  if (relay_fd < 0)
+    return;
+
+  while (pos < tx_len)
+  {
+    ssize_t n = write(relay_fd, buff_tx + pos, tx_len - pos);
+
+    if (n > 0)
+      pos += n;
+    else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+      break; // Нижестоящее устройство отключено, данные теряются
+  }
+
+  tx_len = 0;
+}
+
+/******************************************************************************/
+
+int RelayPortInit(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+
+  if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+  {
+    perror("relay");
+    return -1;
+  }
+
+  relay_fd = fd;
+  rx_pos = rx_len = tx_len = 0;
+  return 0;
+}
+
+int16_t RelayPortPutc(uint8_t c)
+{
+  if (relay_fd < 0)
+    return -1;
+
+  if (tx_len >= FIFOBUFSIZE_TX)
+    RelayPortFlush();
+
+  buff_tx[tx_len++] = c;
+  return c;
+}
+
+int16_t RelayPortGetc(void)
+{
+  if (relay_fd < 0)
+    return -1;
+
+  if (rx_pos >= rx_len)
+  {
+    ssize_t n = read(relay_fd, buff_rx, sizeof(buff_rx));
+    if (n <= 0)
+      return -1;
+
+    rx_pos = 0;
+    rx_len = n;
+  }
+
+  return buff_rx[rx_pos++];
+}
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <termios.h>
+#include "serial_port.h"
+
+/******************************************************************************/
+
+#define FIFOBUFSIZE_RX 256
+#define FIFOBUFSIZE_TX 256
+
+/******************************************************************************/
+
+static int serial_fd = -1;
+
+static uint8_t buff_rx[FIFOBUFSIZE_RX];
+static uint16_t rx_pos, rx_len;
+
+static uint8_t buff_tx[FIFOBUFSIZE_TX];
+static uint16_t tx_len;
+
+/******************************************************************************/
+
+void SerialPortFlush(void)
+{
+  uint16_t pos = 0;
+
+  while (pos < tx_len)
+  {
+    ssize_t n = write(serial_fd, buff_tx + pos, tx_len - pos);
+
+    if (n > 0)
+      pos += n;
+    else if ((n < 0) && (errno != EAGAIN) && (errno != EINTR))
+      break; // Хост отключился, данные теряются, как и на линии связи
+  }
+
+  tx_len = 0;
+}
+
+/******************************************************************************/
+
+int SerialPortInit(int fd)
+{
+  int flags = fcntl(fd, F_GETFL);
+
+  if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0))
+  {
+    perror("serial");
+    return -1;
+  }
+
+  serial_fd = fd;
+  rx_pos = rx_len = tx_len = 0;
+  return 0;
+}
+
+int SerialPortInitPty(void)
+{
+  struct termios tio;
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+
+  if ((fd < 0) || (grantpt(fd) != 0) || (unlockpt(fd) != 0))
+  {
+    perror("serial: pty");
+    return -1;
+  }
+
+  // Сырой режим, без эха и преобразования символов
+  if (tcgetattr(fd, &tio) == 0)
+  {
+    cfmakeraw(&tio);
+    tcsetattr(fd, TCSANOW, &tio);
+  }
+
+  printf("%s\n", ptsname(fd));
+  fflush(stdout);
+
+  return SerialPortInit(fd);
+}
+
+void SerialPortDeinit(void)
+{
+  if (serial_fd < 0)
+    return;
+
+  SerialPortFlush();
+  close(serial_fd);
+  serial_fd = -1;
+}
+
+int16_t SerialPortPutc(uint8_t c)
+{
+  if (tx_len >= FIFOBUFSIZE_TX)
+    SerialPortFlush();
+
+  buff_tx[tx_len++] = c;
+  return c;
+}
+
+int16_t SerialPortGetc(void)
+{
+  if (rx_pos >= rx_len)
+  {
+    ssize_t n = read(serial_fd, buff_rx, sizeof(buff_rx));
+    if (n <= 0)
+    {
+      // Данных нет: отдаем процессор хосту, иначе на
+      // загруженной машине задержки будут определяться планировщиком
+      sched_yield();
+      return -1;
+    }
+
+    rx_pos = 0;
+    rx_len = n;
+  }
+
+  return buff_rx[rx_pos++];
+}
+
+int SerialPortTransferCompleted(void)
+{
+  SerialPortFlush();
+  return 1;
+}
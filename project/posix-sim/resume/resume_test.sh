@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# Продолжение прерванного обновления разреженным образом (RESUME + SEGMENT_MAP).
+# Образ - три сегмента данных с пропусками 0xFF в несколько секторов между ними.
+# Симулятор дважды завершается (SIGKILL) после того, как во flash записано начало
+# следующего сегмента, и обновление продолжается с --resume. Каждое продолжение
+# должно начаться не раньше сектора, записанного до завершения: без карты сегментов
+# после RESUME граница журнала не переносится через пропуск, и второе продолжение
+# вернулось бы к началу пропуска.
+#
+# resume_test.sh SIM PACK UPDATE DIR APP_OFFSET CHUNK_SIZE
+#
+
+SIM=$1
+PACK=$2
+UPDATE=$3
+DIR=$4
+APP=$5
+CHUNK=$6
+
+SEG=8192
+
+set -e
+
+rm -rf "$DIR"
+mkdir -p "$DIR"
+
+for i in 0 1 2; do
+  head -c $SEG /dev/urandom >> "$DIR/image.bin"
+  [ $i -lt 2 ] && head -c $SEG /dev/zero | tr '\000' '\377' >> "$DIR/image.bin"
+done
+
+$PACK --image "$DIR/image.bin" --keys config/private_keys.inc --device-id posix-sim \
+  --sparse --out "$DIR/image.pkg"
+
+# Обновление, прерванное после записи первых байт по смещению $1 образа
+interrupted()
+{
+  off=$1
+  shift
+
+  $UPDATE --package "$DIR/image.pkg" --sim "$SIM" --sim-flash "$DIR/flash.bin" \
+    --no-run --quiet "$@" > "$DIR/update.log" 2>&1 &
+  pid=$!
+
+  until cmp -s -n 16 -i $((APP + off)):$off "$DIR/flash.bin" "$DIR/image.bin"; do
+    if ! kill -0 $pid 2> /dev/null; then
+      echo "resume-test: update finished before offset $off"
+      exit 1
+    fi
+    sleep 0.05
+  done
+
+  pkill -KILL -P $pid
+  wait $pid || true
+}
+
+# Продолжение с чанка не раньше чанка $1 разреженного образа
+check_resumed()
+{
+  n=$(awk '/^resumed at chunk/ { print $4 }' "$DIR/update.log")
+  if [ -z "$n" ] || [ "$n" -lt "$1" ]; then
+    echo "resume-test: resumed at chunk ${n:-none}, expected $1 or later"
+    exit 1
+  fi
+}
+
+interrupted $((2 * SEG + 1024))
+interrupted $((4 * SEG + 1024)) --resume
+check_resumed $(((SEG + 1024) / CHUNK))
+
+$UPDATE --package "$DIR/image.pkg" --sim "$SIM" --sim-flash "$DIR/flash.bin" --resume --quiet \
+  | tee "$DIR/update.log"
+check_resumed $(((2 * SEG + 1024) / CHUNK))
+
+cmp -n $((5 * SEG)) -i $APP:0 "$DIR/flash.bin" "$DIR/image.bin"
+echo "resume-test: image matches"
@@ -0,0 +1,83 @@
+# Размер кода и данных по модулям по map-файлу GNU ld
+# (сборка с -ffunction-sections -fdata-sections -Wl,--gc-sections).
+# Учитываются только секции, оставшиеся после удаления неиспользуемых:
+# так же линкер IAR отбрасывает неиспользуемые функции.
+# flash = text + rodata + data, ОЗУ = data + bss.
+# dir - каталог объектных файлов сборки
+
+function hex(s,   i, v)
+{
+  v = 0
+  s = tolower(s)
+  sub(/^0x/, "", s)
+  for (i = 1; i <= length(s); i++)
+    v = v * 16 + index("0123456789abcdef", substr(s, i, 1)) - 1
+  return v
+}
+
+function account(sec, size, file,   m, kind)
+{
+  # только модули сборки, без стартового кода и библиотеки C
+  if ((index(file, dir "/") != 1) || (file !~ /\.o$/))
+    return
+  m = substr(file, length(dir) + 2)
+  sub(/\.o$/, "", m)
+
+  if (sec ~ /^\.text/)
+    kind = "text"
+  else if (sec ~ /^\.rodata/)
+    kind = "rodata"
+  else if (sec ~ /^\.data/)
+    kind = "data"
+  else if (sec ~ /^\.bss/)
+    kind = "bss"
+  else
+    return
+
+  if (!(m in seen))
+  {
+    seen[m] = 1
+    modules[++nmod] = m
+  }
+  sz[m, kind] += hex(size)
+}
+
+/^Linker script and memory map/ {
+  in_map = 1
+  next
+}
+
+!in_map {
+  next
+}
+
+# Имя секции и размещение в одной строке
+/^ \.(text|rodata|data|bss)/ && (NF == 4) {
+  account($1, $3, $4)
+  next
+}
+
+# Длинное имя секции - размещение на следующей строке
+/^ \.(text|rodata|data|bss)/ && (NF == 1) {
+  pending = $1
+  next
+}
+
+pending != "" {
+  if (NF == 3)
+    account(pending, $2, $3)
+  pending = ""
+}
+
+END {
+  printf("%-20s %7s %7s %7s %7s %7s\n", "module", "text", "rodata", "data", "bss", "flash")
+  for (i = 1; i <= nmod; i++)
+  {
+    m = modules[i]
+    flash = sz[m, "text"] + sz[m, "rodata"] + sz[m, "data"]
+    printf("%-20s %7d %7d %7d %7d %7d\n", m, sz[m, "text"], sz[m, "rodata"],
+           sz[m, "data"], sz[m, "bss"], flash)
+    total += flash
+  }
+  printf("%-20s %39d\n", "total", total)
+}
@@ -0,0 +1,159 @@
+# Худший расход стека по командам Bootloader-а
+#
+# Вход: core/src/bootloader.c и графы вызовов модулей ядра
+# (*.ci, gcc -fcallgraph-info=su, сборка без встраивания функций).
+# По исходнику вызовы из __parsecmd соотносятся с ветками case CMD_xxx
+# по номеру строки; вызовы до switch выполняются для любой команды.
+#
+# Стек команды = кадр ProcessBootloader + кадр __parsecmd +
+# худшая цепочка вызовов ветки. Функции без кадра в графе (библиотека C,
+# порт) считаются нулевыми, рекурсия не раскрывается
+
+function short_name(t,   n)
+{
+  n = t
+  sub(/^.*:/, "", n)
+  sub(/\..*$/, "", n)
+  return n
+}
+
+function worst(f,   i, w, best, best_to)
+{
+  if (f in memo)
+    return memo[f]
+  if (f in visiting)
+    return 0
+
+  visiting[f] = 1
+  best = 0
+  best_to = ""
+  for (i = 1; i <= nedge[f]; i++)
+  {
+    w = worst(edge_to[f, i])
+    if (w > best)
+    {
+      best = w
+      best_to = edge_to[f, i]
+    }
+  }
+  delete visiting[f]
+
+  via[f] = best_to
+  memo[f] = frame[f] + best
+  return memo[f]
+}
+
+function chain(f,   s)
+{
+  s = short_name(f)
+  while (via[f] != "")
+  {
+    f = via[f]
+    s = s " > " short_name(f)
+  }
+  return s
+}
+
+FNR == 1 {
+  source = (FILENAME ~ /\.c$/)
+}
+
+source {
+  if ($0 ~ /^static void __parsecmd\(void\)/)
+    in_parse = 1
+  else if (in_parse && ($0 ~ /^}/))
+  {
+    in_parse = 0
+    parse_end = FNR
+  }
+  else if (in_parse && match($0, /^  case CMD_[A-Z0-9_]+:/))
+  {
+    ncmd++
+    cmd_name[ncmd] = substr($0, 8, RLENGTH - 8)
+    cmd_line[ncmd] = FNR
+  }
+  next
+}
+
+/^node:/ {
+  match($0, /title: "[^"]*"/)
+  t = substr($0, RSTART + 8, RLENGTH - 9)
+  if (match($0, /\\n[0-9]+ bytes/))
+    frame[t] = substr($0, RSTART + 2, RLENGTH - 8) + 0
+  if (t ~ /:__parsecmd$/)
+    parsecmd = t
+}
+
+/^edge:/ {
+  match($0, /sourcename: "[^"]*"/)
+  s = substr($0, RSTART + 13, RLENGTH - 14)
+  match($0, /targetname: "[^"]*"/)
+  t = substr($0, RSTART + 13, RLENGTH - 14)
+  match($0, /label: "[^"]*"/)
+  n = split(substr($0, RSTART + 8, RLENGTH - 9), pos, ":")
+
+  nedge[s]++
+  edge_to[s, nedge[s]] = t
+  edge_line[s, nedge[s]] = pos[n - 1] + 0
+}
+
+END {
+  if ((parsecmd == "") || (ncmd == 0))
+  {
+    print "stack_report: __parsecmd not found (inlined?)" > "/dev/stderr"
+    exit 1
+  }
+
+  base = frame["ProcessBootloader"] + frame[parsecmd]
+  cmd_line[ncmd + 1] = parse_end
+
+  # вызовы до switch
+  common = 0
+  common_to = ""
+  for (i = 1; i <= nedge[parsecmd]; i++)
+  {
+    if (edge_line[parsecmd, i] >= cmd_line[1])
+      continue
+    w = worst(edge_to[parsecmd, i])
+    if (w > common)
+    {
+      common = w
+      common_to = edge_to[parsecmd, i]
+    }
+  }
+
+  printf("# frames: ProcessBootloader %d B, __parsecmd %d B\n",
+         frame["ProcessBootloader"], frame[parsecmd])
+  printf("%-22s %6s  %s\n", "command", "stack", "worst call chain")
+
+  for (k = 1; k <= ncmd; k++)
+  {
+    calls = 0
+    best = common
+    best_to = common_to
+
+    for (i = 1; i <= nedge[parsecmd]; i++)
+    {
+      l = edge_line[parsecmd, i]
+      if ((l < cmd_line[k]) || (l >= cmd_line[k + 1]))
+        continue
+      calls++
+      w = worst(edge_to[parsecmd, i])
+      if (w > best)
+      {
+        best = w
+        best_to = edge_to[parsecmd, i]
+      }
+    }
+
+    # ветка без вызовов - команда отключена в конфигурации
+    if (calls == 0)
+      continue
+
+    printf("%-22s %6d  %s\n", cmd_name[k], base + best,
+           (best_to != "") ? chain(best_to) : "-")
+  }
+
+  printf("%-22s %6d  %s\n", "InitBootloader", worst("InitBootloader"), chain("InitBootloader"))
+  printf("%-22s %6d  %s\n", "ProcessBootloader", worst("ProcessBootloader"), chain("ProcessBootloader"))
+}